@@ -56,6 +56,7 @@ extern const char *AuthResult_getFieldName(void);
 extern AuthResult *AuthResult_new(void);
 extern bool AuthResult_appendAuthServId(AuthResult *self, const char *authserv_id);
 extern bool AuthResult_appendMethodSpec(AuthResult *self, const char *method, const char *result);
+extern bool AuthResult_appendReason(AuthResult *self, const char *reason);
 extern bool AuthResult_appendPropSpecWithToken(AuthResult *self, const char *ptype,
                                                const char *property, const char *value);
 extern bool AuthResult_appendPropSpecWithAddrSpec(AuthResult *self, const char *ptype,
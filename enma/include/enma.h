@@ -15,11 +15,13 @@
 #include "enma_config.h"
 #include "sidf.h"
 #include "dkim.h"
+#include "enma_dkimsign.h"
 
 #define ENMA_MILTER_NAME "enma"
 
 extern EnmaConfig *g_enma_config;
 extern SidfPolicy *g_sidf_policy;
 extern DkimVerificationPolicy *g_dkim_vpolicy;
+extern EnmaDkimSign *g_dkim_sign;
 
 #endif
@@ -39,13 +39,35 @@ typedef struct EnmaConfig {
     // sender authentication
     int spf_auth;               //boolean
     int spf_explog;             //boolean
+    int spf_early_evaluation;   //boolean
+    int spf_early_evaluation_workers;
+    int spf_early_evaluation_queue;
+    int spf_max_void_lookups;
+    int spf_max_dns_queries;
+    int spf_eval_timeout;
     int sidf_auth;              //boolean
     int sidf_explog;            //boolean
     int dkim_auth;              //boolean
     int dkim_signheader_limit;
     int dkim_accept_expired_signature;  //boolean
+    int dkim_prefer_ed25519;    //boolean
+    int dkim_stop_at_author_signature;  //boolean
+    int dkim_early_lookup;      //boolean
+    int dkim_early_lookup_workers;
+    int dkim_early_lookup_limit;
     int dkim_rfc4871_compatible;    //boolean
+    int dkim_keycache_size;
+    int dkim_keycache_max_ttl;
+    int dkim_keycache_negative_ttl;
+    int dkim_verdictcache_size;
+    int dkim_verdictcache_ttl;
+    int dkim_crypto_workers;
     int dkimadsp_auth;          //boolean
+    // dkim signing
+    const char *dkimsign_keytable;
+    IPAddressRangeList *dkimsign_clients;
+    const char *dkimsign_headers;
+    const char *dkimsign_canonicalization;
     // authentication-results
     const char *authresult_identifier;
 } EnmaConfig;
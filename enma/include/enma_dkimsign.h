@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __ENMA_DKIMSIGN_H__
+#define __ENMA_DKIMSIGN_H__
+
+#include <stdbool.h>
+
+#include "mailheaders.h"
+#include "dkim.h"
+#include "enma_config.h"
+
+typedef struct EnmaDkimSign EnmaDkimSign;
+typedef struct EnmaDkimSignKey EnmaDkimSignKey;
+
+extern EnmaDkimSign *EnmaDkimSign_new(const EnmaConfig *enma_config);
+extern void EnmaDkimSign_free(EnmaDkimSign *self);
+extern bool EnmaDkimSign_setup(const EnmaDkimSign *self, const MailHeaders *headers,
+                               DkimSigner **signer, const EnmaDkimSignKey **key);
+extern bool EnmaDkimSign_sign(DkimSigner *signer, const EnmaDkimSignKey *key,
+                              const char **headerf, const char **headerv);
+
+#endif /* __ENMA_DKIMSIGN_H__ */
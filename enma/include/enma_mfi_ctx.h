@@ -23,6 +23,8 @@
 #include "sidf.h"
 #include "dkim.h"
 #include "authresult.h"
+#include "enma_sidf.h"
+#include "enma_dkimsign.h"
 
 typedef struct EnmaMfiCtx {
     // for connections
@@ -31,12 +33,17 @@ typedef struct EnmaMfiCtx {
     char *ipaddr;
     _SOCK_ADDR *hostaddr;
     DnsResolver *resolver;
+    bool excluded;              // connected from common.exclusion_addresses, only signed with DKIM
+    bool dkimsign;              // connected from dkimsign.clients
     // for message
     char *raw_envfrom;
     char *qid;
     InetMailbox *envfrom;
+    EnmaSpfFuture *spf_future;  // SPF evaluation started at MAIL FROM, if any
     MailHeaders *headers;
     DkimVerifier *dkimverifier;
+    DkimSigner *dkimsigner;
+    const EnmaDkimSignKey *dkimsignkey;
     AuthResult *authresult;
     // for Authentication-Results headers
     int authhdr_count;          // the number of existing Authentication-Results headers
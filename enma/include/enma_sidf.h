@@ -25,6 +25,16 @@ extern bool EnmaSpf_evaluate(SidfPolicy *policy, DnsResolver *resolver, AuthResu
                              const struct sockaddr *hostaddr, const char *ipaddr,
                              const char *helohost, const char *raw_envfrom,
                              const InetMailbox *envfrom, bool explog);
+typedef struct EnmaSpfFuture EnmaSpfFuture;
+
+extern bool EnmaSpf_initWorkers(unsigned int thread_num, unsigned int queue_limit);
+extern EnmaSpfFuture *EnmaSpf_start(SidfPolicy *policy, const struct sockaddr *hostaddr,
+                                    const char *helohost, const InetMailbox *envfrom);
+extern bool EnmaSpf_collect(EnmaSpfFuture *future, AuthResult *authresult, const char *ipaddr,
+                            const char *helohost, const char *raw_envfrom,
+                            const InetMailbox *envfrom, bool explog);
+extern void EnmaSpf_cancel(EnmaSpfFuture *future);
+extern void EnmaSpf_waitForWorkers(void);
 extern bool EnmaSidf_evaluate(SidfPolicy *policy, DnsResolver *resolver, AuthResult *authresult,
                               const struct sockaddr *hostaddr, const char *ipaddr,
                               const char *helohost, const MailHeaders *headers, bool explog);
@@ -89,6 +89,13 @@ AuthResult_appendMethodSpec(AuthResult *self, const char *method, const char *re
     return EOK == FoldString_status(self) ? true : false;
 }   // end function : AuthResult_appendMethodSpec
 
+bool
+AuthResult_appendReason(AuthResult *self, const char *reason)
+{
+    // reasonspec, must follow methodspec
+    return 0 == FoldString_appendFormatBlock(self, true, " reason=\"%s\"", reason) ? true : false;
+}   // end function : AuthResult_appendReason
+
 bool
 AuthResult_appendPropSpecWithToken(AuthResult *self, const char *ptype, const char *property,
                                    const char *value)
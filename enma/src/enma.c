@@ -31,6 +31,8 @@ RCSID("$Id: enma.c 1371 2011-11-07 03:18:02Z takahiko $");
 #include "consolehandler.h"
 #include "enma_config.h"
 #include "enma_mfi.h"
+#include "enma_sidf.h"
+#include "enma_dkimsign.h"
 #include "daemonize.h"
 #include "enma.h"
 
@@ -38,6 +40,7 @@ RCSID("$Id: enma.c 1371 2011-11-07 03:18:02Z takahiko $");
 /* definition of global variable */
 SidfPolicy *g_sidf_policy = NULL;   // sidf policy variable
 DkimVerificationPolicy *g_dkim_vpolicy = NULL;  // dkim verify policy variable
+EnmaDkimSign *g_dkim_sign = NULL;   // dkim signing keys, NULL if signing is disabled
 EnmaConfig *g_enma_config = NULL;   // configuration variable of ENMA
 
 
@@ -96,6 +99,9 @@ sidf_init(const EnmaConfig *enma_config)
     SidfPolicy_setSpfRRLookup(sidf_policy, false);
     SidfPolicy_setExplanationLookup(sidf_policy, false);
     SidfPolicy_setLogger(sidf_policy, LogHandler_syslogWithPrefix);
+    SidfPolicy_setMaxVoidLookup(sidf_policy, enma_config->spf_max_void_lookups);
+    SidfPolicy_setMaxDnsQuery(sidf_policy, enma_config->spf_max_dns_queries);
+    SidfPolicy_setEvalTimeout(sidf_policy, enma_config->spf_eval_timeout);
 
     if (SIDF_STAT_OK !=
         SidfPolicy_setCheckingDomain(sidf_policy, enma_config->authresult_identifier)) {
@@ -129,7 +135,48 @@ dkim_init(const EnmaConfig *enma_config)
     DkimVerificationPolicy_setSignHeaderLimit(dkim_vpolicy, enma_config->dkim_signheader_limit);
     DkimVerificationPolicy_acceptExpiredSignature(dkim_vpolicy,
                                                   enma_config->dkim_accept_expired_signature);
+    DkimVerificationPolicy_preferEd25519(dkim_vpolicy, enma_config->dkim_prefer_ed25519);
+    DkimVerificationPolicy_stopAtAuthorSignature(dkim_vpolicy,
+                                                 enma_config->dkim_stop_at_author_signature);
     DkimVerificationPolicy_getRfc4871Compatible(dkim_vpolicy, enma_config->dkim_rfc4871_compatible);
+    if (0 < enma_config->dkim_keycache_size) {
+        set_stat =
+            DkimVerificationPolicy_setPublicKeyCache(dkim_vpolicy, enma_config->dkim_keycache_size,
+                                                     enma_config->dkim_keycache_max_ttl,
+                                                     enma_config->dkim_keycache_negative_ttl);
+        if (DSTAT_OK != set_stat) {
+            DkimVerificationPolicy_free(dkim_vpolicy);
+            return NULL;
+        }   // end if
+    }   // end if
+    if (0 < enma_config->dkim_verdictcache_size) {
+        set_stat =
+            DkimVerificationPolicy_setVerdictCache(dkim_vpolicy,
+                                                   enma_config->dkim_verdictcache_size,
+                                                   enma_config->dkim_verdictcache_ttl);
+        if (DSTAT_OK != set_stat) {
+            DkimVerificationPolicy_free(dkim_vpolicy);
+            return NULL;
+        }   // end if
+    }   // end if
+    if (0 < enma_config->dkim_crypto_workers) {
+        set_stat =
+            DkimVerificationPolicy_setCryptoWorkers(dkim_vpolicy, enma_config->dkim_crypto_workers);
+        if (DSTAT_OK != set_stat) {
+            DkimVerificationPolicy_free(dkim_vpolicy);
+            return NULL;
+        }   // end if
+    }   // end if
+    if (enma_config->dkim_early_lookup && 0 < enma_config->dkim_early_lookup_workers) {
+        set_stat =
+            DkimVerificationPolicy_setLookupWorkers(dkim_vpolicy,
+                                                    enma_config->dkim_early_lookup_workers,
+                                                    enma_config->dkim_early_lookup_limit);
+        if (DSTAT_OK != set_stat) {
+            DkimVerificationPolicy_free(dkim_vpolicy);
+            return NULL;
+        }   // end if
+    }   // end if
     DkimVerificationPolicy_supposeLeadingHeaderValueSpace(dkim_vpolicy,
                                                           enma_config->milter_sendmail813);
     DkimVerificationPolicy_setLogger(dkim_vpolicy, LogHandler_syslogWithPrefix);
@@ -167,11 +214,26 @@ main(int argc, char **argv)
         ConsoleError("enma starting up failed: error=sidf_init failed");
         exit(EX_OSERR);
     }
+    // initialize the worker threads of SPF evaluation started at MAIL FROM
+    if (g_enma_config->spf_auth && g_enma_config->spf_early_evaluation
+        && 0 < g_enma_config->spf_early_evaluation_workers
+        && !EnmaSpf_initWorkers(g_enma_config->spf_early_evaluation_workers,
+                                0 < g_enma_config->spf_early_evaluation_queue
+                                ? g_enma_config->spf_early_evaluation_queue : 0)) {
+        ConsoleError("enma starting up failed: error=EnmaSpf_initWorkers failed");
+        exit(EX_OSERR);
+    }
     // initialize DKIM Policy
     if (NULL == (g_dkim_vpolicy = dkim_init(g_enma_config))) {
         ConsoleError("enma starting up failed: error=dkim_init failed");
         exit(EX_OSERR);
     }
+    // initialize DKIM signing (private keys are read before dropping privileges)
+    if (NULL != g_enma_config->dkimsign_keytable
+        && NULL == (g_dkim_sign = EnmaDkimSign_new(g_enma_config))) {
+        ConsoleError("enma starting up failed: error=EnmaDkimSign_new failed");
+        exit(EX_OSERR);
+    }
     // initialize milter
     if (!EnmaMfi_init
         (g_enma_config->milter_socket, g_enma_config->milter_timeout,
@@ -196,8 +258,11 @@ main(int argc, char **argv)
         exit(EX_OSERR);
     }
 
+    // SPF evaluations abandoned by aborted transactions may still be referring to g_sidf_policy
+    EnmaSpf_waitForWorkers();
     SidfPolicy_free(g_sidf_policy);
     DkimVerificationPolicy_free(g_dkim_vpolicy);
+    EnmaDkimSign_free(g_dkim_sign);
     EnmaConfig_free(g_enma_config);
 
     // OpenSSL cleanup
@@ -67,6 +67,18 @@ static ConfigEntry ConfigEntry_table[] = {
         "enable SPF authentication (boolean)"},
     {"spf.explog", CONFIGTYPE_BOOLEAN, "true", offsetof(EnmaConfig, spf_explog),
         "record explanation of SPF (boolean)"},
+    {"spf.early_evaluation", CONFIGTYPE_BOOLEAN, "false", offsetof(EnmaConfig, spf_early_evaluation),
+        "start SPF evaluation in background at MAIL FROM (boolean)"},
+    {"spf.early_evaluation_workers", CONFIGTYPE_INTEGER, "16", offsetof(EnmaConfig, spf_early_evaluation_workers),
+        "number of threads dedicated to the SPF evaluations started at MAIL FROM"},
+    {"spf.early_evaluation_queue", CONFIGTYPE_INTEGER, "128", offsetof(EnmaConfig, spf_early_evaluation_queue),
+        "maximum number of the SPF evaluations waiting for the threads, the rest are evaluated at end of message"},
+    {"spf.max_void_lookups", CONFIGTYPE_INTEGER, "2", offsetof(EnmaConfig, spf_max_void_lookups),
+        "maximum number of DNS lookups with no answers per SPF/SIDF evaluation, 0 for unlimited (integer)"},
+    {"spf.max_dns_queries", CONFIGTYPE_INTEGER, "0", offsetof(EnmaConfig, spf_max_dns_queries),
+        "maximum number of DNS queries per SPF/SIDF evaluation, 0 for unlimited (integer)"},
+    {"spf.eval_timeout", CONFIGTYPE_INTEGER, "0", offsetof(EnmaConfig, spf_eval_timeout),
+        "time limit of an SPF/SIDF evaluation, 0 for unlimited (milliseconds)"},
     // sidf
     {"sidf.auth", CONFIGTYPE_BOOLEAN, "true", offsetof(EnmaConfig, sidf_auth),
         "enable SIDF authentication (boolean)"},
@@ -79,11 +91,42 @@ static ConfigEntry ConfigEntry_table[] = {
         "maximum number of DKIM signature headers to be verified (rests are ignored)"},
     {"dkim.accept_expired_signature", CONFIGTYPE_BOOLEAN, "false", offsetof(EnmaConfig, dkim_accept_expired_signature),
         "accept expired dkim signature (boolean)"},
+    {"dkim.prefer_ed25519", CONFIGTYPE_BOOLEAN, "false", offsetof(EnmaConfig, dkim_prefer_ed25519),
+        "skip RSA signatures if an Ed25519 signature of the same domain is present (boolean)"},
+    {"dkim.stop_at_author_signature", CONFIGTYPE_BOOLEAN, "false", offsetof(EnmaConfig, dkim_stop_at_author_signature),
+        "skip the other signatures once an author domain signature is verified (boolean)"},
+    {"dkim.early_lookup", CONFIGTYPE_BOOLEAN, "false", offsetof(EnmaConfig, dkim_early_lookup),
+        "start DNS lookups for DKIM as soon as each header arrives (boolean)"},
+    {"dkim.early_lookup_workers", CONFIGTYPE_INTEGER, "16", offsetof(EnmaConfig, dkim_early_lookup_workers),
+        "number of threads dedicated to the DNS lookups started by dkim.early_lookup"},
+    {"dkim.early_lookup_limit", CONFIGTYPE_INTEGER, "128", offsetof(EnmaConfig, dkim_early_lookup_limit),
+        "maximum number of the DNS lookups started by dkim.early_lookup in flight"},
     {"dkim.rfc4871_compatible", CONFIGTYPE_BOOLEAN, "false", offsetof(EnmaConfig, dkim_rfc4871_compatible),
         "RFC4871 compatible mode (boolean)"},
+    {"dkim.keycache_size", CONFIGTYPE_INTEGER, "1024", offsetof(EnmaConfig, dkim_keycache_size),
+        "maximum number of DKIM public key records to be cached, 0 to disable the cache"},
+    {"dkim.keycache_max_ttl", CONFIGTYPE_INTEGER, "86400", offsetof(EnmaConfig, dkim_keycache_max_ttl),
+        "upper limit of the time to cache DKIM public key records (seconds)"},
+    {"dkim.keycache_negative_ttl", CONFIGTYPE_INTEGER, "300", offsetof(EnmaConfig, dkim_keycache_negative_ttl),
+        "time to cache the absence of DKIM public key records (seconds)"},
+    {"dkim.verdictcache_size", CONFIGTYPE_INTEGER, "0", offsetof(EnmaConfig, dkim_verdictcache_size),
+        "maximum number of DKIM signature verification results to be cached, 0 (default) disables the cache"},
+    {"dkim.verdictcache_ttl", CONFIGTYPE_INTEGER, "3600", offsetof(EnmaConfig, dkim_verdictcache_ttl),
+        "time to cache DKIM signature verification results (seconds)"},
+    {"dkim.crypto_workers", CONFIGTYPE_INTEGER, "0", offsetof(EnmaConfig, dkim_crypto_workers),
+        "number of threads dedicated to DKIM signature verification, 0 to verify on each connection thread"},
     // dkim adsp
     {"dkimadsp.auth", CONFIGTYPE_BOOLEAN, "true", offsetof(EnmaConfig, dkimadsp_auth),
         "enable DKIM ADSP authentication (boolean)"},
+    // dkim signing
+    {"dkimsign.keytable", CONFIGTYPE_STRING, NULL, offsetof(EnmaConfig, dkimsign_keytable),
+        "file listing \"domain selector keyfile\" per line, DKIM signing is disabled if not specified (filename)"},
+    {"dkimsign.clients", CONFIGTYPE_IP_ADDRESS_LIST, "127.0.0.1,::1", offsetof(EnmaConfig, dkimsign_clients),
+        "source address list whose messages are signed with DKIM"},
+    {"dkimsign.headers", CONFIGTYPE_STRING, "From:To:Cc:Subject:Date:Message-ID:Reply-To:In-Reply-To:References:MIME-Version:Content-Type:Content-Transfer-Encoding", offsetof(EnmaConfig, dkimsign_headers),
+        "colon-separated list of header fields to be signed with DKIM"},
+    {"dkimsign.canonicalization", CONFIGTYPE_STRING, "relaxed/relaxed", offsetof(EnmaConfig, dkimsign_canonicalization),
+        "canonicalization algorithm of DKIM signature (header/body)"},
     // authresult
     {"authresult.identifier", CONFIGTYPE_STRING, "localhost", offsetof(EnmaConfig, authresult_identifier),
         "identifier of Authentication-Results header"},
@@ -37,6 +37,9 @@ EnmaDkim_evaluate(DkimVerifier *dkimverifier, AuthResult *authresult)
             DkimBaseScore score = DkimVerifier_getFrameResult(dkimverifier, sigidx, &identity);
             const char *scoreexp = DkimEnum_lookupScoreByValue(score);
             (void) AuthResult_appendMethodSpec(authresult, AUTHRES_METHOD_DKIM, scoreexp);
+            if (!DkimVerifier_isFrameEvaluated(dkimverifier, sigidx)) {
+                (void) AuthResult_appendReason(authresult, "not evaluated");
+            }
             if (NULL != identity) {
                 (void) AuthResult_appendPropSpecWithAddrSpec(authresult, AUTHRES_PTYPE_HEADER,
                                                              AUTHRES_PROPERTY_I, identity);
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "ptrop.h"
+#include "loghandler.h"
+#include "ptrarray.h"
+#include "strarray.h"
+#include "inetmailbox.h"
+#include "mailheaders.h"
+#include "dkim.h"
+
+#include "enma_config.h"
+#include "enma_dkimsign.h"
+
+#define ENMA_DKIMSIGN_ED25519_SEED_LEN 32
+#define ENMA_DKIMSIGN_KEYTABLE_LINE_MAX 1024
+
+/*
+ * PKCS#8 PrivateKeyInfo of an Ed25519 private key (RFC 8410) consists of this fixed prefix
+ * followed by the 32-byte seed.
+ * Ed25519 keys are recognized by hand as OpenSSL in use may not support Ed25519.
+ */
+static const unsigned char EnmaDkimSign_ed25519_pkcs8_prefix[] = {
+    0x30, 0x2e, 0x02, 0x01, 0x00, 0x30, 0x05, 0x06, 0x03, 0x2b, 0x65, 0x70, 0x04, 0x22, 0x04, 0x20,
+};
+
+struct EnmaDkimSignKey {
+    char *domain;
+    char *selector;
+    EVP_PKEY *pkey;             // RSA private key, or NULL for Ed25519
+    unsigned char seed[ENMA_DKIMSIGN_ED25519_SEED_LEN]; // Ed25519 private key
+};
+
+struct EnmaDkimSign {
+    DkimSignPolicy *rsa_policy;
+    DkimSignPolicy *ed25519_policy;
+    StrArray *headers;          // names of the header fields to be signed
+    PtrArray *keys;             // array of EnmaDkimSignKey, looked up by the author domain
+};
+
+
+static void
+EnmaDkimSignKey_free(EnmaDkimSignKey *self)
+{
+    if (NULL == self) {
+        return;
+    }
+    free(self->domain);
+    free(self->selector);
+    if (NULL != self->pkey) {
+        EVP_PKEY_free(self->pkey);
+    }
+    OPENSSL_cleanse(self->seed, sizeof(self->seed));
+    free(self);
+}
+
+
+/**
+ * read a private key in PEM format.
+ * PKCS#8 Ed25519 keys are taken as a 32-byte seed, the others are read through OpenSSL
+ * and must be RSA keys.
+ *
+ * @param self
+ * @param keyfile
+ * @return true on success, false otherwise.
+ */
+static bool
+EnmaDkimSignKey_load(EnmaDkimSignKey *self, const char *keyfile)
+{
+    FILE *fp = fopen(keyfile, "r");
+    if (NULL == fp) {
+        LogError("failed to open private key: file=%s, error=%s", keyfile, strerror(errno));
+        return false;
+    }
+
+    char *name = NULL;
+    char *header = NULL;
+    unsigned char *data = NULL;
+    long datalen = 0;
+    bool loaded = false;
+    if (1 == PEM_read(fp, &name, &header, &data, &datalen) && 0 == strcmp(name, "PRIVATE KEY")
+        && (long) (sizeof(EnmaDkimSign_ed25519_pkcs8_prefix) + sizeof(self->seed)) == datalen
+        && 0 == memcmp(data, EnmaDkimSign_ed25519_pkcs8_prefix,
+                       sizeof(EnmaDkimSign_ed25519_pkcs8_prefix))) {
+        memcpy(self->seed, data + sizeof(EnmaDkimSign_ed25519_pkcs8_prefix), sizeof(self->seed));
+        loaded = true;
+    } else {
+        rewind(fp);
+        self->pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+        if (NULL == self->pkey) {
+            LogError("failed to read private key: file=%s", keyfile);
+        } else if (EVP_PKEY_RSA != EVP_PKEY_base_id(self->pkey)) {
+            LogError("unsupported private key type: file=%s", keyfile);
+        } else {
+            loaded = true;
+        }
+    }
+
+    if (NULL != data) {
+        OPENSSL_cleanse(data, (size_t) datalen);
+    }
+    OPENSSL_free(data);
+    OPENSSL_free(header);
+    OPENSSL_free(name);
+    fclose(fp);
+    return loaded;
+}
+
+
+/**
+ * load the key table.
+ * each line consists of "domain selector keyfile" separated by white spaces.
+ * empty lines and lines beginning with '#' are ignored.
+ *
+ * @param self
+ * @param keytable
+ * @return true on success, false otherwise.
+ */
+static bool
+EnmaDkimSign_loadKeyTable(EnmaDkimSign *self, const char *keytable)
+{
+    FILE *fp = fopen(keytable, "r");
+    if (NULL == fp) {
+        LogError("failed to open DKIM key table: file=%s, error=%s", keytable, strerror(errno));
+        return false;
+    }
+
+    char line[ENMA_DKIMSIGN_KEYTABLE_LINE_MAX];
+    unsigned int lineno = 0;
+    while (NULL != fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        char *saveptr = NULL;
+        char *domain = strtok_r(line, " \t\r\n", &saveptr);
+        if (NULL == domain || '#' == *domain) {
+            continue;
+        }
+        char *selector = strtok_r(NULL, " \t\r\n", &saveptr);
+        char *keyfile = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (NULL == selector || NULL == keyfile || NULL != strtok_r(NULL, " \t\r\n", &saveptr)) {
+            LogError("invalid DKIM key table entry: file=%s, line=%u", keytable, lineno);
+            goto error;
+        }
+
+        EnmaDkimSignKey *key = (EnmaDkimSignKey *) malloc(sizeof(EnmaDkimSignKey));
+        if (NULL == key) {
+            LogError("memory allocation failed: error=%s", strerror(errno));
+            goto error;
+        }
+        memset(key, 0, sizeof(EnmaDkimSignKey));
+        if (0 > PtrArray_append(self->keys, key)) {
+            LogError("memory allocation failed: error=%s", strerror(errno));
+            EnmaDkimSignKey_free(key);
+            goto error;
+        }
+        key->domain = strdup(domain);
+        key->selector = strdup(selector);
+        if (NULL == key->domain || NULL == key->selector) {
+            LogError("memory allocation failed: error=%s", strerror(errno));
+            goto error;
+        }
+        if (!EnmaDkimSignKey_load(key, keyfile)) {
+            goto error;
+        }
+        LogDebug("DKIM signing key loaded: domain=%s, selector=%s, keytype=%s", key->domain,
+                 key->selector, NULL != key->pkey ? "rsa" : "ed25519");
+    }
+    fclose(fp);
+    return true;
+
+  error:
+    fclose(fp);
+    return false;
+}
+
+
+/**
+ * create a DkimSignPolicy object for the key type.
+ *
+ * @param enma_config
+ * @param keytype
+ * @return
+ */
+static DkimSignPolicy *
+EnmaDkimSign_newPolicy(const EnmaConfig *enma_config, const char *keytype)
+{
+    DkimSignPolicy *policy = DkimSignPolicy_new();
+    if (NULL == policy) {
+        return NULL;
+    }
+    DkimSignPolicy_setLogger(policy, LogHandler_syslogWithPrefix);
+    DkimSignPolicy_supposeLeadingHeaderValueSpace(policy, enma_config->milter_sendmail813);
+
+    // "header/body" form as in sig-c-tag, the body canonicalization defaults to "simple"
+    char headercanon[32];
+    const char *canon = enma_config->dkimsign_canonicalization;
+    const char *bodycanon = strchr(canon, '/');
+    size_t headercanon_len = NULL != bodycanon ? (size_t) (bodycanon - canon) : strlen(canon);
+    if (sizeof(headercanon) <= headercanon_len) {
+        LogError("invalid canonicalization: canonicalization=%s", canon);
+        goto error;
+    }
+    memcpy(headercanon, canon, headercanon_len);
+    headercanon[headercanon_len] = '\0';
+    bodycanon = NULL != bodycanon ? bodycanon + 1 : "simple";
+
+    if (DSTAT_OK != DkimSignPolicy_setCanonAlgorithm(policy, headercanon, bodycanon)
+        || DSTAT_OK != DkimSignPolicy_setHashAlgorithm(policy, "sha256")
+        || DSTAT_OK != DkimSignPolicy_setKeyType(policy, keytype)
+        || DSTAT_OK != DkimSignPolicy_setAuthorPriority(policy, "From", ":")) {
+        goto error;
+    }
+    return policy;
+
+  error:
+    DkimSignPolicy_free(policy);
+    return NULL;
+}
+
+
+/**
+ * create an EnmaDkimSign object.
+ * private keys listed in the key table are read at once,
+ * and shared read-only among the connections afterward.
+ *
+ * @param enma_config
+ * @return EnmaDkimSign object, or NULL on failure.
+ */
+EnmaDkimSign *
+EnmaDkimSign_new(const EnmaConfig *enma_config)
+{
+    assert(NULL != enma_config);
+    assert(NULL != enma_config->dkimsign_keytable);
+
+    EnmaDkimSign *self = (EnmaDkimSign *) malloc(sizeof(EnmaDkimSign));
+    if (NULL == self) {
+        LogError("memory allocation failed: error=%s", strerror(errno));
+        return NULL;
+    }
+    memset(self, 0, sizeof(EnmaDkimSign));
+
+    self->rsa_policy = EnmaDkimSign_newPolicy(enma_config, "rsa");
+    self->ed25519_policy = EnmaDkimSign_newPolicy(enma_config, "ed25519");
+    if (NULL == self->rsa_policy || NULL == self->ed25519_policy) {
+        LogError("failed to configure DKIM signing policy");
+        goto error;
+    }
+    self->headers = StrArray_split(NNSTR(enma_config->dkimsign_headers), ":", true);
+    self->keys = PtrArray_new(0, (void (*)(void *)) EnmaDkimSignKey_free);
+    if (NULL == self->headers || NULL == self->keys) {
+        LogError("memory allocation failed: error=%s", strerror(errno));
+        goto error;
+    }
+    if (0 > StrArray_linearSearchIgnoreCase(self->headers, "From")) {
+        // RFC6376 5.4. the From header field MUST be signed
+        if (0 > StrArray_append(self->headers, "From")) {
+            LogError("memory allocation failed: error=%s", strerror(errno));
+            goto error;
+        }
+    }
+    if (!EnmaDkimSign_loadKeyTable(self, enma_config->dkimsign_keytable)) {
+        goto error;
+    }
+
+    return self;
+
+  error:
+    EnmaDkimSign_free(self);
+    return NULL;
+}
+
+
+void
+EnmaDkimSign_free(EnmaDkimSign *self)
+{
+    if (NULL == self) {
+        return;
+    }
+    if (NULL != self->rsa_policy) {
+        DkimSignPolicy_free(self->rsa_policy);
+    }
+    if (NULL != self->ed25519_policy) {
+        DkimSignPolicy_free(self->ed25519_policy);
+    }
+    if (NULL != self->headers) {
+        StrArray_free(self->headers);
+    }
+    if (NULL != self->keys) {
+        PtrArray_free(self->keys);
+    }
+    free(self);
+}
+
+
+static const EnmaDkimSignKey *
+EnmaDkimSign_lookupKey(const EnmaDkimSign *self, const char *domain)
+{
+    size_t keynum = PtrArray_getCount(self->keys);
+    for (size_t i = 0; i < keynum; ++i) {
+        const EnmaDkimSignKey *key = (const EnmaDkimSignKey *) PtrArray_get(self->keys, i);
+        if (0 == strcasecmp(key->domain, domain)) {
+            return key;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * prepare to sign a message with the key of the author domain.
+ * each occurrence of the configured header fields in "headers" is signed.
+ *
+ * @param self
+ * @param headers
+ * @param signer a pointer to a variable to receive the DkimSigner object,
+ *               which is set to NULL if the message is not to be signed.
+ * @param key a pointer to a variable to receive the key to be passed to EnmaDkimSign_sign()
+ * @return true on success (including the case the message is not to be signed),
+ *         false on system errors.
+ */
+bool
+EnmaDkimSign_setup(const EnmaDkimSign *self, const MailHeaders *headers, DkimSigner **signer,
+                   const EnmaDkimSignKey **key)
+{
+    assert(NULL != self);
+    assert(NULL != headers);
+    assert(NULL != signer);
+    assert(NULL != key);
+
+    *signer = NULL;
+    *key = NULL;
+
+    size_t author_index;
+    const char *author_field, *author_value;
+    InetMailbox *author = NULL;
+    DkimStatus author_stat =
+        DkimAuthor_extract((const DkimPolicyBase *) self->rsa_policy, headers, &author_index,
+                           &author_field, &author_value, &author);
+    if (DSTAT_ISCRITERR(author_stat)) {
+        LogError("DkimAuthor_extract failed: err=%s", DKIM_strerror(author_stat));
+        return false;
+    } else if (DSTAT_OK != author_stat) {
+        LogInfo("[DKIM-sign] no valid author found and signing is skipped: err=%s",
+                DKIM_strerror(author_stat));
+        return true;
+    }
+    const EnmaDkimSignKey *signkey = EnmaDkimSign_lookupKey(self, InetMailbox_getDomain(author));
+    InetMailbox_free(author);
+    if (NULL == signkey) {
+        LogDebug("[DKIM-sign] no signing key for the author domain");
+        return true;
+    }
+
+    StrArray *signed_header_fields = StrArray_new(0);
+    if (NULL == signed_header_fields) {
+        LogError("memory allocation failed: error=%s", strerror(errno));
+        return false;
+    }
+    size_t headernum = MailHeaders_getCount(headers);
+    for (size_t i = 0; i < headernum; ++i) {
+        const char *headerf, *headerv;
+        MailHeaders_get(headers, i, &headerf, &headerv);
+        if (NULL != headerf && 0 <= StrArray_linearSearchIgnoreCase(self->headers, headerf)
+            && 0 > StrArray_append(signed_header_fields, headerf)) {
+            LogError("memory allocation failed: error=%s", strerror(errno));
+            StrArray_free(signed_header_fields);
+            return false;
+        }
+    }
+
+    DkimSigner *newsigner =
+        DkimSigner_new(NULL != signkey->pkey ? self->rsa_policy : self->ed25519_policy);
+    if (NULL == newsigner) {
+        LogError("DkimSigner_new failed: error=%s", strerror(errno));
+        StrArray_free(signed_header_fields);
+        return false;
+    }
+    DkimStatus setup_stat =
+        DkimSigner_setup(newsigner, NULL, signkey->domain, headers, signed_header_fields);
+    StrArray_free(signed_header_fields);
+    if (DSTAT_OK != setup_stat) {
+        LogError("DkimSigner_setup failed: domain=%s, err=%s", signkey->domain,
+                 DKIM_strerror(setup_stat));
+        DkimSigner_free(newsigner);
+        return false;
+    }
+
+    *signer = newsigner;
+    *key = signkey;
+    return true;
+}
+
+
+/**
+ * sign the message and build DKIM-Signature header.
+ *
+ * @param signer
+ * @param key
+ * @param headerf a pointer to a variable to receive the header field name
+ * @param headerv a pointer to a variable to receive the header field value
+ * @return true on success, false otherwise.
+ */
+bool
+EnmaDkimSign_sign(DkimSigner *signer, const EnmaDkimSignKey *key, const char **headerf,
+                  const char **headerv)
+{
+    assert(NULL != signer);
+    assert(NULL != key);
+
+    DkimStatus sign_stat;
+    if (NULL != key->pkey) {
+        sign_stat = DkimSigner_sign(signer, key->selector, key->pkey, headerf, headerv);
+    } else {
+        sign_stat = DkimSigner_signWithEd25519Key(signer, key->selector, key->seed, headerf,
+                                                  headerv);
+    }
+    if (DSTAT_OK != sign_stat) {
+        LogError("DkimSigner_sign failed: domain=%s, selector=%s, err=%s", key->domain,
+                 key->selector, DKIM_strerror(sign_stat));
+        return false;
+    }
+    LogEvent("DKIM-sign", "d=%s, s=%s", key->domain, key->selector);
+    return true;
+}
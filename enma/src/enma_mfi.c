@@ -40,6 +40,7 @@ RCSID("$Id: enma_mfi.c 1193 2009-09-07 00:32:32Z takahiko $");
 #include "enma_config.h"
 #include "enma_sidf.h"
 #include "enma_dkim.h"
+#include "enma_dkimsign.h"
 #include "enma_mfi_ctx.h"
 #include "ipaddressrange.h"
 #include "addr_util.h"
@@ -119,10 +120,22 @@ EnmaMfi_init(char *socket, int timeout, int loglevel)
  * @return 正常終了の場合は true, エラーが発生した場合は false.
  */
 static bool
-EnmaMfi_sidf_eom(const EnmaMfiCtx *enma_mfi_ctx, const SidfRecordScope scope)
+EnmaMfi_sidf_eom(EnmaMfiCtx *enma_mfi_ctx, const SidfRecordScope scope)
 {
     switch (scope) {
     case SIDF_RECORD_SCOPE_SPF1:
+        if (NULL != enma_mfi_ctx->spf_future) {
+            // mfi_envfrom で開始した評価の結果を受け取る
+            EnmaSpfFuture *spf_future = enma_mfi_ctx->spf_future;
+            enma_mfi_ctx->spf_future = NULL;
+            if (!EnmaSpf_collect
+                (spf_future, enma_mfi_ctx->authresult, enma_mfi_ctx->ipaddr,
+                 enma_mfi_ctx->helohost, enma_mfi_ctx->raw_envfrom, enma_mfi_ctx->envfrom,
+                 g_enma_config->spf_explog)) {
+                return false;
+            }
+            break;
+        }
         if (!EnmaSpf_evaluate
             (g_sidf_policy, enma_mfi_ctx->resolver, enma_mfi_ctx->authresult,
              enma_mfi_ctx->hostaddr, enma_mfi_ctx->ipaddr, enma_mfi_ctx->helohost,
@@ -146,6 +159,31 @@ EnmaMfi_sidf_eom(const EnmaMfiCtx *enma_mfi_ctx, const SidfRecordScope scope)
 }
 
 
+/**
+ * DKIM 署名をおこない, DKIM-Signature ヘッダをメッセージの先頭に挿入する.
+ * 署名の対象でない場合は何もしない.
+ * @return 正常終了の場合は true, エラーが発生した場合は false.
+ */
+static bool
+EnmaMfi_dkimsign_eom(SMFICTX *ctx, EnmaMfiCtx *enma_mfi_ctx)
+{
+    if (NULL == enma_mfi_ctx->dkimsigner) {
+        return true;
+    }
+
+    const char *headerf, *headerv;
+    if (!EnmaDkimSign_sign
+        (enma_mfi_ctx->dkimsigner, enma_mfi_ctx->dkimsignkey, &headerf, &headerv)) {
+        return false;
+    }
+    if (MI_FAILURE == smfi_insheader(ctx, 0, (char *) headerf, (char *) headerv)) {
+        LogError("smfi_insheader failed: %s", headerf);
+        return false;
+    }
+    return true;
+}
+
+
 /**
  * SMFI_TEMPFAIL時の処理
  */
@@ -352,10 +390,21 @@ mfi_connect(SMFICTX *ctx, char *hostname, _SOCK_ADDR *hostaddr)
         return EnmaMfi_tempfail(enma_mfi_ctx);
     }
 
+    // DKIM 署名の対象となる接続元か
+    if (NULL != g_dkim_sign && NULL != g_enma_config->dkimsign_clients
+        && IPAddressRangeList_matchToSocket(g_enma_config->dkimsign_clients,
+                                            (struct sockaddr *) enma_mfi_ctx->hostaddr)) {
+        enma_mfi_ctx->dkimsign = true;
+    }
+
     if (NULL != g_enma_config->common_exclusion_addresses
         && EnmaMfi_match_exclusion_address_ranges(enma_mfi_ctx)) {
-        // 以降の処理をスキップ
-        return SMFIS_ACCEPT;
+        if (!enma_mfi_ctx->dkimsign) {
+            // 以降の処理をスキップ
+            return SMFIS_ACCEPT;
+        }
+        // 送信ドメイン認証はおこなわず, DKIM 署名のみおこなう
+        enma_mfi_ctx->excluded = true;
     }
 
     return SMFIS_CONTINUE;
@@ -448,6 +497,15 @@ mfi_envfrom(SMFICTX *ctx, char **argv)
         }
     }
 
+    // SPF の評価に必要な情報は揃っているので, DATA の受信と並行して評価を進める.
+    // 開始できなかった場合は mfi_eom で評価する.
+    if (g_enma_config->spf_auth && g_enma_config->spf_early_evaluation
+        && !enma_mfi_ctx->excluded && NULL != enma_mfi_ctx->hostaddr && NULL != enma_mfi_ctx->helohost) {
+        enma_mfi_ctx->spf_future =
+            EnmaSpf_start(g_sidf_policy, enma_mfi_ctx->hostaddr, enma_mfi_ctx->helohost,
+                          enma_mfi_ctx->envfrom);
+    }
+
     return SMFIS_CONTINUE;
 }
 
@@ -482,8 +540,9 @@ mfi_header(SMFICTX *ctx, char *headerf, char *headerv)
             LogDebug("fraud AuthResultHeader: [No.%d] %s", enma_mfi_ctx->authhdr_count, headerv);
         }
     }
-    // SIDF/DKIM が有効の場合ヘッダを格納する
-    if (g_enma_config->sidf_auth || g_enma_config->dkim_auth) {
+    // SIDF/DKIM の検証, または DKIM 署名をおこなう場合ヘッダを格納する
+    if (((g_enma_config->sidf_auth || g_enma_config->dkim_auth) && !enma_mfi_ctx->excluded)
+        || enma_mfi_ctx->dkimsign) {
         int pos = MailHeaders_append(enma_mfi_ctx->headers, headerf, headerv);
         if (pos < 0) {
             LogError("MailHeaders_append failed: headerf=%s, headerv=%s", NNSTR(headerf),
@@ -491,6 +550,25 @@ mfi_header(SMFICTX *ctx, char *headerf, char *headerv)
             return EnmaMfi_tempfail(enma_mfi_ctx);
         }
     }
+    // DKIM の公開鍵と ADSP レコードの取得を残りのヘッダの受信と並行して進める
+    if (g_enma_config->dkim_auth && g_enma_config->dkim_early_lookup && !enma_mfi_ctx->excluded) {
+        if (NULL == enma_mfi_ctx->dkimverifier) {
+            enma_mfi_ctx->dkimverifier = DkimVerifier_new(g_dkim_vpolicy, enma_mfi_ctx->resolver);
+            if (NULL == enma_mfi_ctx->dkimverifier) {
+                LogError("DkimVerifier_new failed: err=%s", strerror(errno));
+                return EnmaMfi_tempfail(enma_mfi_ctx);
+            }
+        }
+        DkimStatus prefetch_stat =
+            DkimVerifier_prefetchPublicKey(enma_mfi_ctx->dkimverifier, headerf, headerv);
+        if (DSTAT_OK == prefetch_stat && g_enma_config->dkimadsp_auth) {
+            prefetch_stat = DkimVerifier_prefetchAdsp(enma_mfi_ctx->dkimverifier, headerf, headerv);
+        }
+        if (DSTAT_ISCRITERR(prefetch_stat)) {
+            LogError("DkimVerifier_prefetch failed: err=%s", DKIM_strerror(prefetch_stat));
+            return EnmaMfi_tempfail(enma_mfi_ctx);
+        }
+    }
 
     return SMFIS_CONTINUE;
 }
@@ -507,12 +585,14 @@ mfi_eoh(SMFICTX *ctx)
         return SMFIS_TEMPFAIL;
     }
 
-    if (g_enma_config->dkim_auth) {
-        // DkimVerifier オブジェクトの初期化
-        enma_mfi_ctx->dkimverifier = DkimVerifier_new(g_dkim_vpolicy, enma_mfi_ctx->resolver);
+    if (g_enma_config->dkim_auth && !enma_mfi_ctx->excluded) {
+        // DkimVerifier オブジェクトの初期化 (mfi_header で初期化済みの場合を除く)
         if (NULL == enma_mfi_ctx->dkimverifier) {
-            LogError("DkimVerifier_new failed: err=%s", strerror(errno));
-            return EnmaMfi_tempfail(enma_mfi_ctx);
+            enma_mfi_ctx->dkimverifier = DkimVerifier_new(g_dkim_vpolicy, enma_mfi_ctx->resolver);
+            if (NULL == enma_mfi_ctx->dkimverifier) {
+                LogError("DkimVerifier_new failed: err=%s", strerror(errno));
+                return EnmaMfi_tempfail(enma_mfi_ctx);
+            }   // end if
         }   // end if
         DkimStatus eoh_stat = DkimVerifier_setup(enma_mfi_ctx->dkimverifier, enma_mfi_ctx->headers);
         if (DSTAT_INFO_NO_SIGNHEADER == eoh_stat) {
@@ -524,6 +604,17 @@ mfi_eoh(SMFICTX *ctx)
             return EnmaMfi_tempfail(enma_mfi_ctx);
         }   // end if
     }
+    if (enma_mfi_ctx->dkimsign) {
+        if (!EnmaDkimSign_setup(g_dkim_sign, enma_mfi_ctx->headers, &enma_mfi_ctx->dkimsigner,
+                                &enma_mfi_ctx->dkimsignkey)) {
+            return EnmaMfi_tempfail(enma_mfi_ctx);
+        }
+        // 検証と同じ本文ハッシュで署名できる場合は, 本文の正規化とダイジェスト計算を1回で済ませる
+        if (NULL != enma_mfi_ctx->dkimsigner && NULL != enma_mfi_ctx->dkimverifier
+            && DkimSigner_shareBodyDigest(enma_mfi_ctx->dkimsigner, enma_mfi_ctx->dkimverifier)) {
+            LogDebug("[DKIM-sign] body hash is shared with verification");
+        }
+    }
 
     return SMFIS_CONTINUE;
 }
@@ -540,7 +631,7 @@ mfi_body(SMFICTX *ctx, unsigned char *bodyp, size_t bodylen)
         return SMFIS_TEMPFAIL;
     }
 
-    if (g_enma_config->dkim_auth) {
+    if (g_enma_config->dkim_auth && !enma_mfi_ctx->excluded) {
         DkimStatus body_stat = DkimVerifier_updateBody(enma_mfi_ctx->dkimverifier, bodyp, bodylen);
         if (DSTAT_ISCRITERR(body_stat)) {
             // エラーが発生した場合
@@ -548,6 +639,14 @@ mfi_body(SMFICTX *ctx, unsigned char *bodyp, size_t bodylen)
             return EnmaMfi_tempfail(enma_mfi_ctx);
         }   // end if
     }   // end if
+    // 本文ハッシュを検証と共有している場合は何もしない
+    if (NULL != enma_mfi_ctx->dkimsigner) {
+        DkimStatus body_stat = DkimSigner_updateBody(enma_mfi_ctx->dkimsigner, bodyp, bodylen);
+        if (DSTAT_ISCRITERR(body_stat)) {
+            LogError("DkimSigner_updateBody failed: err=%s", DKIM_strerror(body_stat));
+            return EnmaMfi_tempfail(enma_mfi_ctx);
+        }
+    }
 
     return SMFIS_CONTINUE;
 }
@@ -574,6 +673,16 @@ mfi_eom(SMFICTX *ctx)
             return EnmaMfi_tempfail(enma_mfi_ctx);
         }
     }
+    if (enma_mfi_ctx->excluded) {
+        // DKIM 署名のみおこなう
+        if (!EnmaMfi_dkimsign_eom(ctx, enma_mfi_ctx)) {
+            return EnmaMfi_tempfail(enma_mfi_ctx);
+        }
+        EnmaMfiCtx_reset(enma_mfi_ctx);
+        ERR_remove_state(0);
+        (void) LogHandler_setPrefix(NULL);
+        return SMFIS_CONTINUE;
+    }
     // Authentication-result ヘッダの削除
     size_t authhdr_num = IntArray_getCount(enma_mfi_ctx->delauthhdr);
     for (size_t n = 0; n < authhdr_num; ++n) {
@@ -609,6 +718,10 @@ mfi_eom(SMFICTX *ctx)
         && !EnmaDkimAdsp_evaluate(enma_mfi_ctx->dkimverifier, enma_mfi_ctx->authresult)) {
         return EnmaMfi_tempfail(enma_mfi_ctx);
     }
+    // DKIM 署名 (Authentication-Results ヘッダより下に挿入する)
+    if (!EnmaMfi_dkimsign_eom(ctx, enma_mfi_ctx)) {
+        return EnmaMfi_tempfail(enma_mfi_ctx);
+    }
     // Authentication-Results ヘッダをメッセージの先頭に挿入
     if (0 != AuthResult_status(enma_mfi_ctx->authresult)) {
         LogError("AuthResult_status failed");
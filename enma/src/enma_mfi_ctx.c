@@ -22,6 +22,8 @@ RCSID("$Id: enma_mfi_ctx.c 1098 2009-08-03 02:20:19Z takahiko $");
 #include "authresult.h"
 #include "sidf.h"
 #include "dkim.h"
+#include "enma_sidf.h"
+#include "enma_dkimsign.h"
 
 #include "enma_mfi_ctx.h"
 
@@ -45,15 +47,20 @@ EnmaMfiCtx_new(void)
     if (NULL == self->resolver) {
         goto error_free;
     }
+    self->excluded = false;
+    self->dkimsign = false;
 
     self->raw_envfrom = NULL;
     self->qid = NULL;
     self->envfrom = NULL;
+    self->spf_future = NULL;
     self->headers = MailHeaders_new(0);
     if (NULL == self->headers) {
         goto error_free;
     }
     self->dkimverifier = NULL;
+    self->dkimsigner = NULL;
+    self->dkimsignkey = NULL;
     self->authresult = AuthResult_new();
     if (NULL == self->authresult) {
         goto error_free;
@@ -89,9 +96,20 @@ EnmaMfiCtx_reset(EnmaMfiCtx *self)
         InetMailbox_free(self->envfrom);
         self->envfrom = NULL;
     }
+    // RSET や abort で結果が不要になった SPF の評価を破棄する
+    if (NULL != self->spf_future) {
+        EnmaSpf_cancel(self->spf_future);
+        self->spf_future = NULL;
+    }
     if (NULL != self->headers) {
         MailHeaders_reset(self->headers);
     }
+    // 署名が検証用の DkimVerifier オブジェクトの本文ダイジェストを参照している場合があるので先に解放する
+    if (NULL != self->dkimsigner) {
+        DkimSigner_free(self->dkimsigner);
+        self->dkimsigner = NULL;
+    }
+    self->dkimsignkey = NULL;
     if (NULL != self->dkimverifier) {
         DkimVerifier_free(self->dkimverifier);
         self->dkimverifier = NULL;
@@ -130,9 +148,15 @@ EnmaMfiCtx_free(EnmaMfiCtx *self)
     if (NULL != self->envfrom) {
         InetMailbox_free(self->envfrom);
     }
+    if (NULL != self->spf_future) {
+        EnmaSpf_cancel(self->spf_future);
+    }
     if (NULL != self->headers) {
         MailHeaders_free(self->headers);
     }
+    if (NULL != self->dkimsigner) {
+        DkimSigner_free(self->dkimsigner);
+    }
     if (NULL != self->dkimverifier) {
         DkimVerifier_free(self->dkimverifier);
     }
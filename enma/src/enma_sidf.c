@@ -16,6 +16,7 @@ RCSID("$Id: enma_sidf.c 1460 2011-12-21 11:47:15Z takahiko $");
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "loghandler.h"
 #include "authresult.h"
@@ -161,6 +162,7 @@ EnmaSidf_prepare(SidfRequest *request, const struct sockaddr *hostaddr, const ch
  * SPF append score
  *
  * @param request
+ * @param score result of SidfRequest_eval() with request
  * @param authresult
  * @param ipaddr
  * @param helohost
@@ -170,9 +172,9 @@ EnmaSidf_prepare(SidfRequest *request, const struct sockaddr *hostaddr, const ch
  * @return
  */
 static bool
-EnmaSpf_appendScore(SidfRequest *request, AuthResult *authresult, const char *ipaddr,
-                    const char *helohost, const char *raw_envfrom, const InetMailbox *envfrom,
-                    bool explog)
+EnmaSpf_appendScore(SidfRequest *request, SidfScore score, AuthResult *authresult,
+                    const char *ipaddr, const char *helohost, const char *raw_envfrom,
+                    const InetMailbox *envfrom, bool explog)
 {
     assert(NULL != request);
     assert(NULL != authresult);
@@ -180,7 +182,6 @@ EnmaSpf_appendScore(SidfRequest *request, AuthResult *authresult, const char *ip
     assert(NULL != helohost);
     assert(NULL != raw_envfrom);
 
-    SidfScore score = SidfRequest_eval(request, SIDF_RECORD_SCOPE_SPF1);
     if (SIDF_SCORE_SYSERROR == score || SIDF_SCORE_NULL == score) {
         LogWarning("SidfRequest_eval failed: score=0x%x", score);
         return false;
@@ -204,6 +205,10 @@ EnmaSpf_appendScore(SidfRequest *request, AuthResult *authresult, const char *ip
              ipaddr,
              SidfRequest_isSenderContext(request) ? AUTHRES_PROPERTY_MAILFROM :
              AUTHRES_PROPERTY_HELO, helohost, raw_envfrom, resultexp);
+    LogEvent("SPF-cost", "domain=%s, dns_mech=%u, void_lookup=%u, dns_query=%u, elapsed=%ums",
+             SidfRequest_isSenderContext(request) ? InetMailbox_getDomain(envfrom) : helohost,
+             SidfRequest_getDnsMechCount(request), SidfRequest_getVoidLookupCount(request),
+             SidfRequest_getDnsQueryCount(request), SidfRequest_getEvalTime(request));
 
     // 設定により explanation をログに残す
     if (explog && NULL != SidfRequest_getExplanation(request)) {
@@ -253,6 +258,10 @@ EnmaSidf_appendScore(SidfRequest *request, AuthResult *authresult, const char *i
     LogEvent("SIDF-auth", "ipaddr=%s, header.%s=%s@%s, score=%s",
              ipaddr, pra_header,
              InetMailbox_getLocalPart(pra_mailbox), InetMailbox_getDomain(pra_mailbox), resultexp);
+    LogEvent("SIDF-cost", "domain=%s, dns_mech=%u, void_lookup=%u, dns_query=%u, elapsed=%ums",
+             InetMailbox_getDomain(pra_mailbox), SidfRequest_getDnsMechCount(request),
+             SidfRequest_getVoidLookupCount(request), SidfRequest_getDnsQueryCount(request),
+             SidfRequest_getEvalTime(request));
 
     // 設定により explanation をログに残す
     if (explog && NULL != SidfRequest_getExplanation(request)) {
@@ -307,7 +316,9 @@ EnmaSpf_evaluate(SidfPolicy *policy, DnsResolver *resolver, AuthResult *authresu
         goto cleanup;
     }
     // evaluation
-    if (!EnmaSpf_appendScore(request, authresult, ipaddr, helohost, raw_envfrom, envfrom, explog)) {
+    SidfScore score = SidfRequest_eval(request, SIDF_RECORD_SCOPE_SPF1);
+    if (!EnmaSpf_appendScore(request, score, authresult, ipaddr, helohost, raw_envfrom, envfrom,
+                             explog)) {
         goto cleanup;
     }
 
@@ -320,6 +331,340 @@ EnmaSpf_evaluate(SidfPolicy *policy, DnsResolver *resolver, AuthResult *authresu
 }
 
 
+/*
+ * SPF evaluation running on the worker threads.
+ * The evaluations started by EnmaSpf_start() wait in the queue for one of the fixed number of
+ * worker threads, each of which has its own DnsResolver.
+ * EnmaSpfFuture object is shared between the milter thread and the worker thread,
+ * and is released by whichever finishes with it later.
+ */
+typedef struct EnmaSpfWorker {
+    pthread_t thread;
+    DnsResolver *resolver;
+} EnmaSpfWorker;
+
+// the worker threads and the queue of the evaluations waiting for them
+static pthread_mutex_t EnmaSpf_worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t EnmaSpf_worker_cond = PTHREAD_COND_INITIALIZER;
+static EnmaSpfWorker *EnmaSpf_worker = NULL;
+static unsigned int EnmaSpf_worker_max = 0;
+static unsigned int EnmaSpf_worker_num = 0;
+static bool EnmaSpf_worker_shutdown = false;
+static struct EnmaSpfFuture *EnmaSpf_queue_head = NULL;
+static struct EnmaSpfFuture *EnmaSpf_queue_tail = NULL;
+static unsigned int EnmaSpf_queue_num = 0;
+static unsigned int EnmaSpf_queue_limit = 0;
+
+struct EnmaSpfFuture {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;                  // true once the worker has stored the score
+    bool abandoned;             // true if the milter thread is no longer interested in the result
+    SidfRequest *request;
+    SidfScore score;
+    char *logprefix;
+    struct EnmaSpfFuture *queue_next;
+};
+
+
+static void
+EnmaSpfFuture_free(EnmaSpfFuture *self)
+{
+    assert(NULL != self);
+
+    if (NULL != self->request) {
+        SidfRequest_free(self->request);
+    }
+    free(self->logprefix);
+    (void) pthread_cond_destroy(&self->cond);
+    (void) pthread_mutex_destroy(&self->lock);
+    free(self);
+}
+
+
+static void
+EnmaSpfFuture_run(EnmaSpfFuture *self, DnsResolver *resolver)
+{
+    (void) pthread_mutex_lock(&self->lock);
+    bool abandoned = self->abandoned;
+    (void) pthread_mutex_unlock(&self->lock);
+    if (abandoned) {
+        // キャンセル済みの評価は開始しない
+        EnmaSpfFuture_free(self);
+        return;
+    }
+
+    // 起動元のスレッドと同じ prefix でログを出力する
+    (void) LogHandler_setPrefix(self->logprefix);
+
+    SidfRequest_setResolver(self->request, resolver);
+    SidfScore score = SidfRequest_eval(self->request, SIDF_RECORD_SCOPE_SPF1);
+
+    (void) pthread_mutex_lock(&self->lock);
+    self->score = score;
+    self->done = true;
+    abandoned = self->abandoned;
+    (void) pthread_cond_signal(&self->cond);
+    (void) pthread_mutex_unlock(&self->lock);
+
+    if (abandoned) {
+        LogDebug("SPF evaluation finished after cancellation: score=%s",
+                 SidfEnum_lookupScoreByValue(score));
+        EnmaSpfFuture_free(self);
+    }
+    (void) LogHandler_setPrefix(NULL);
+}
+
+
+static void *
+EnmaSpf_worker_main(void *arg)
+{
+    EnmaSpfWorker *worker = (EnmaSpfWorker *) arg;
+
+    (void) pthread_mutex_lock(&EnmaSpf_worker_lock);
+    while (true) {
+        while (NULL == EnmaSpf_queue_head && !EnmaSpf_worker_shutdown) {
+            (void) pthread_cond_wait(&EnmaSpf_worker_cond, &EnmaSpf_worker_lock);
+        }
+        if (NULL == EnmaSpf_queue_head) {
+            // shutting down
+            break;
+        }
+        EnmaSpfFuture *future = EnmaSpf_queue_head;
+        EnmaSpf_queue_head = future->queue_next;
+        if (NULL == EnmaSpf_queue_head) {
+            EnmaSpf_queue_tail = NULL;
+        }
+        --EnmaSpf_queue_num;
+        (void) pthread_mutex_unlock(&EnmaSpf_worker_lock);
+
+        EnmaSpfFuture_run(future, worker->resolver);
+
+        (void) pthread_mutex_lock(&EnmaSpf_worker_lock);
+    }
+    (void) pthread_mutex_unlock(&EnmaSpf_worker_lock);
+    return NULL;
+}
+
+
+/**
+ * start the worker threads not running yet.
+ * EnmaSpf_worker_lock must be held by the caller.
+ *
+ * @return true if at least one worker thread is running, false otherwise.
+ */
+static bool
+EnmaSpf_startWorkers(void)
+{
+    while (EnmaSpf_worker_num < EnmaSpf_worker_max) {
+        EnmaSpfWorker *worker = &EnmaSpf_worker[EnmaSpf_worker_num];
+        worker->resolver = DnsResolver_new();
+        if (NULL == worker->resolver) {
+            LogNoResource();
+            break;
+        }
+        int create_stat = pthread_create(&worker->thread, NULL, EnmaSpf_worker_main, worker);
+        if (0 != create_stat) {
+            LogWarning("pthread_create failed: error=%s", strerror(create_stat));
+            DnsResolver_free(worker->resolver);
+            worker->resolver = NULL;
+            break;
+        }
+        ++EnmaSpf_worker_num;
+    }
+    return 0 < EnmaSpf_worker_num;
+}
+
+
+/**
+ * configure the worker threads for EnmaSpf_start().
+ * the threads are started on the first EnmaSpf_start() call, that is, after daemonizing.
+ *
+ * @param thread_num the number of the worker threads
+ * @param queue_limit the maximum number of the evaluations waiting for the worker threads
+ * @return true on success, false if memory allocation failed.
+ */
+bool
+EnmaSpf_initWorkers(unsigned int thread_num, unsigned int queue_limit)
+{
+    assert(NULL == EnmaSpf_worker);
+
+    if (0 == thread_num) {
+        return true;
+    }
+    EnmaSpf_worker = (EnmaSpfWorker *) calloc(thread_num, sizeof(EnmaSpfWorker));
+    if (NULL == EnmaSpf_worker) {
+        return false;
+    }
+    EnmaSpf_worker_max = thread_num;
+    EnmaSpf_queue_limit = queue_limit;
+    return true;
+}
+
+
+/**
+ * start SPF evaluation on a worker thread.
+ * the result is collected with EnmaSpf_collect(), or discarded with EnmaSpf_cancel().
+ *
+ * @param policy
+ * @param hostaddr
+ * @param helohost
+ * @param envfrom (maybe NULL)
+ * @return EnmaSpfFuture object, or NULL if the evaluation could not be started,
+ *         including the case that the queue of the worker threads is full.
+ *         In that case the caller should fall back on EnmaSpf_evaluate().
+ */
+EnmaSpfFuture *
+EnmaSpf_start(SidfPolicy *policy, const struct sockaddr *hostaddr, const char *helohost,
+              const InetMailbox *envfrom)
+{
+    assert(NULL != policy);
+    assert(NULL != hostaddr);
+    assert(NULL != helohost);
+
+    if (0 == EnmaSpf_worker_max) {
+        return NULL;
+    }
+
+    EnmaSpfFuture *self = (EnmaSpfFuture *) malloc(sizeof(EnmaSpfFuture));
+    if (NULL == self) {
+        LogNoResource();
+        return NULL;
+    }
+    memset(self, 0, sizeof(EnmaSpfFuture));
+    if (0 != pthread_mutex_init(&self->lock, NULL)) {
+        free(self);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&self->cond, NULL)) {
+        (void) pthread_mutex_destroy(&self->lock);
+        free(self);
+        return NULL;
+    }
+    self->score = SIDF_SCORE_NULL;
+
+    const char *logprefix = LogHandler_getPrefix();
+    if (NULL != logprefix && NULL == (self->logprefix = strdup(logprefix))) {
+        LogNoResource();
+        goto cleanup;
+    }
+    // DnsResolver は評価を担当するワーカースレッドのものを使う
+    self->request = SidfRequest_new(policy, NULL);
+    if (NULL == self->request) {
+        LogNoResource();
+        goto cleanup;
+    }
+    if (!EnmaSpf_prepare(self->request, hostaddr, helohost, envfrom)) {
+        goto cleanup;
+    }
+
+    (void) pthread_mutex_lock(&EnmaSpf_worker_lock);
+    if (EnmaSpf_queue_limit <= EnmaSpf_queue_num) {
+        (void) pthread_mutex_unlock(&EnmaSpf_worker_lock);
+        LogDebug("SPF worker queue is full, evaluating at end of message");
+        goto cleanup;
+    }
+    if (EnmaSpf_worker_shutdown || !EnmaSpf_startWorkers()) {
+        (void) pthread_mutex_unlock(&EnmaSpf_worker_lock);
+        goto cleanup;
+    }
+    if (NULL != EnmaSpf_queue_tail) {
+        EnmaSpf_queue_tail->queue_next = self;
+    } else {
+        EnmaSpf_queue_head = self;
+    }
+    EnmaSpf_queue_tail = self;
+    ++EnmaSpf_queue_num;
+    (void) pthread_cond_signal(&EnmaSpf_worker_cond);
+    (void) pthread_mutex_unlock(&EnmaSpf_worker_lock);
+
+    return self;
+
+  cleanup:
+    EnmaSpfFuture_free(self);
+    return NULL;
+}
+
+
+/**
+ * wait for the SPF evaluation started with EnmaSpf_start() and append its result.
+ * future is released regardless of the result.
+ *
+ * @param future
+ * @param authresult
+ * @param ipaddr
+ * @param helohost
+ * @param raw_envfrom
+ * @param envfrom
+ * @param explog
+ * @return
+ */
+bool
+EnmaSpf_collect(EnmaSpfFuture *future, AuthResult *authresult, const char *ipaddr,
+                const char *helohost, const char *raw_envfrom, const InetMailbox *envfrom,
+                bool explog)
+{
+    assert(NULL != future);
+
+    (void) pthread_mutex_lock(&future->lock);
+    while (!future->done) {
+        (void) pthread_cond_wait(&future->cond, &future->lock);
+    }
+    (void) pthread_mutex_unlock(&future->lock);
+
+    bool append_stat = EnmaSpf_appendScore(future->request, future->score, authresult, ipaddr,
+                                           helohost, raw_envfrom, envfrom, explog);
+    EnmaSpfFuture_free(future);
+    return append_stat;
+}
+
+
+/**
+ * discard the SPF evaluation started with EnmaSpf_start().
+ * the evaluation still in the queue is not started.
+ * the evaluation in progress is not interrupted, but its result is thrown away
+ * and the worker thread releases future when it finishes.
+ *
+ * @param future
+ */
+void
+EnmaSpf_cancel(EnmaSpfFuture *future)
+{
+    assert(NULL != future);
+
+    (void) pthread_mutex_lock(&future->lock);
+    bool done = future->done;
+    future->abandoned = true;
+    (void) pthread_mutex_unlock(&future->lock);
+
+    if (done) {
+        EnmaSpfFuture_free(future);
+    }
+}
+
+
+/**
+ * stop the worker threads after the evaluations in the queue are finished.
+ * must be called before the SidfPolicy passed to EnmaSpf_start() is released.
+ */
+void
+EnmaSpf_waitForWorkers(void)
+{
+    (void) pthread_mutex_lock(&EnmaSpf_worker_lock);
+    EnmaSpf_worker_shutdown = true;
+    (void) pthread_cond_broadcast(&EnmaSpf_worker_cond);
+    (void) pthread_mutex_unlock(&EnmaSpf_worker_lock);
+    for (unsigned int i = 0; i < EnmaSpf_worker_num; ++i) {
+        (void) pthread_join(EnmaSpf_worker[i].thread, NULL);
+        DnsResolver_free(EnmaSpf_worker[i].resolver);
+    }
+    free(EnmaSpf_worker);
+    EnmaSpf_worker = NULL;
+    EnmaSpf_worker_max = 0;
+    EnmaSpf_worker_num = 0;
+}
+
+
 /**
  * SIDF evalute
  *
@@ -21,26 +21,81 @@ RCSID("$Id: sidfquery.c 1426 2011-12-03 17:14:40Z takahiko $");
 #include <sysexits.h>
 #include <limits.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <syslog.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include "stdaux.h"
 #include "ptrop.h"
 #include "dnsresolv.h"
 #include "sidf.h"
 
+#define BATCH_LINE_MAXLEN 1024
+#define BATCH_THREAD_MAXNUM 1024
+// deep enough for the recursion limits of SidfPolicy
+#define EXPLAIN_DEPTH_MAXNUM 64
+
 bool g_verbose_mode = false;
+bool g_batch_mode = false;
+
+/*
+ * state of the explain mode, built from the trace events of a single evaluation.
+ * the critical path is the longest chain of DNS queries each of which depends on the answer of the previous one,
+ * that is, the evaluation time if every independent query were issued in parallel.
+ */
+typedef struct ExplainContext {
+    unsigned long serial_latency;   // sum of the latency of all the queries
+    unsigned long critical_latency;
+    unsigned long record_ready[EXPLAIN_DEPTH_MAXNUM];   // when the record of each depth became available on the critical path
+    unsigned long name_ready;   // when the names of the MX/PTR answer became available
+    bool fetching[EXPLAIN_DEPTH_MAXNUM];    // true until the record of each depth is selected
+    bool dynamic[EXPLAIN_DEPTH_MAXNUM]; // true if the subtree of each depth depends on the request
+    bool child_dynamic;         // "dynamic" of check_host() which returned last
+    bool child_reused;          // true if check_host() of the current "include:" was skipped
+    unsigned int mech_base[EXPLAIN_DEPTH_MAXNUM];   // DNS mechanism counter at the beginning of the current term
+    unsigned int record_num;
+    unsigned int query_num;
+    unsigned int reused_num;
+    unsigned int flattenable_num;
+    unsigned int prefetchable_num;
+} ExplainContext;
+
+// state shared among the batch worker threads
+typedef struct BatchContext {
+    const SidfPolicy *policy;
+    SidfRecordScope scope;
+    FILE *input;
+    pthread_mutex_t input_lock;
+    pthread_mutex_t output_lock;
+} BatchContext;
+
+typedef struct BatchWorker {
+    pthread_t thread;
+    BatchContext *context;
+    unsigned long evaluated;
+    unsigned long malformed;    // the number of input lines skipped
+    unsigned long dns_query;
+    unsigned long score_count[SIDF_SCORE_MAX];
+    unsigned int *latency;      // wall-clock time of each evaluation in microseconds
+    size_t latency_num;
+    size_t latency_capacity;
+    bool failed;
+} BatchWorker;
 
 static void
 usage(FILE *fp)
 {
-    fprintf(fp, "\nUsage: sidfquery [-46mpsv] username@domain IP-address1 IP-address2 ...\n\n");
+    fprintf(fp, "\nUsage: sidfquery [-46empsv] username@domain IP-address1 IP-address2 ...\n");
+    fprintf(fp, "       sidfquery [-mpsv] [-t threads] -b file\n\n");
     fprintf(fp, "handling of IP address:\n");
     fprintf(fp, "  -4    handle \"IP-address\" as IPv4 address\n");
     fprintf(fp, "  -6    handle \"IP-address\" as IPv6 address\n\n");
@@ -48,6 +103,11 @@ usage(FILE *fp)
     fprintf(fp, "  -s  SPF mode (default)\n");
     fprintf(fp, "  -m  Sender ID (mfrom) mode\n");
     fprintf(fp, "  -p  Sender ID (pra) mode\n");
+    fprintf(fp, "  -e  explain mode, show each record, mechanism and DNS query on the way to the result\n");
+    fprintf(fp, "batch mode:\n");
+    fprintf(fp, "  -b file     evaluate \"IP-address sender [HELO]\" tuples read from each line of file\n");
+    fprintf(fp, "              (\"-\" for stdin), \"<>\" as sender for the null reverse-path\n");
+    fprintf(fp, "  -t threads  the number of evaluating threads (default: 1)\n");
     fprintf(fp, "features:\n");
     fprintf(fp, "  -v  verbose mode\n");
     exit(EX_USAGE);
@@ -56,26 +116,535 @@ usage(FILE *fp)
 static void
 stdout_logger(int priority, const char *message, ...)
 {
-    if (!g_verbose_mode && LOG_DEBUG == priority) {
+    // in batch mode, informational messages per request would bury the warnings
+    if (!g_verbose_mode && (LOG_DEBUG == priority || (g_batch_mode && LOG_WARNING < priority))) {
         return;
     }
 
+    // keep the result records on stdout parsable in batch mode
+    FILE *fp = g_batch_mode ? stderr : stdout;
     va_list args;
     va_start(args, message);
-    vfprintf(stdout, message, args);
-    putc('\n', stdout);
+    vfprintf(fp, message, args);
+    putc('\n', fp);
     va_end(args);
 }   // end functiion : stdout_logger
 
+static unsigned long
+elapsed_usec(const struct timeval *start)
+{
+    struct timeval now;
+    (void) gettimeofday(&now, NULL);
+    long usec = (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_usec - start->tv_usec);
+    return 0 < usec ? (unsigned long) usec : 0;
+}   // end function : elapsed_usec
+
+static void
+batch_record_latency(BatchWorker *worker, unsigned long usec)
+{
+    if (worker->latency_capacity <= worker->latency_num) {
+        size_t newcapacity = 0 < worker->latency_capacity ? worker->latency_capacity * 2 : 4096;
+        unsigned int *newbuf =
+            (unsigned int *) realloc(worker->latency, newcapacity * sizeof(unsigned int));
+        if (NULL == newbuf) {
+            worker->failed = true;
+            return;
+        }   // end if
+        worker->latency = newbuf;
+        worker->latency_capacity = newcapacity;
+    }   // end if
+    worker->latency[worker->latency_num++] = (unsigned int) MIN(usec, UINT_MAX);
+}   // end function : batch_record_latency
+
+/*
+ * evaluates a line of "IP-address sender [HELO]".
+ * @return true on success, false if the line is malformed.
+ */
+static bool
+batch_eval_line(BatchWorker *worker, SidfRequest *request, char *line)
+{
+    char *saveptr = NULL;
+    const char *ipaddr = strtok_r(line, " \t\r\n", &saveptr);
+    if (NULL == ipaddr || '#' == *ipaddr) {
+        // blank or comment line
+        return true;
+    }   // end if
+    const char *sender = strtok_r(NULL, " \t\r\n", &saveptr);
+    const char *helo = strtok_r(NULL, " \t\r\n", &saveptr);
+    if (NULL == sender) {
+        return false;
+    }   // end if
+
+    SidfRequest_reset(request);
+    if (!SidfRequest_setIpAddrString(request, NULL != strchr(ipaddr, ':') ? AF_INET6 : AF_INET,
+                                     ipaddr)) {
+        return false;
+    }   // end if
+    if (0 != strcmp(sender, "<>")) {
+        const char *dummy;
+        InetMailbox *envfrom = InetMailbox_build2822Mailbox(sender, STRTAIL(sender), &dummy, NULL);
+        if (NULL == envfrom) {
+            return false;
+        }   // end if
+        bool set_stat = SidfRequest_setSender(request, envfrom)
+            && SidfRequest_setHeloDomain(request, PTROR(helo, InetMailbox_getDomain(envfrom)));
+        InetMailbox_free(envfrom);
+        if (!set_stat) {
+            worker->failed = true;
+            return false;
+        }   // end if
+    } else if (NULL == helo || !SidfRequest_setHeloDomain(request, helo)) {
+        // HELO is mandatory for the null reverse-path
+        return false;
+    }   // end if
+
+    struct timeval start;
+    (void) gettimeofday(&start, NULL);
+    SidfScore score = SidfRequest_eval(request, worker->context->scope);
+    unsigned long usec = elapsed_usec(&start);
+
+    ++(worker->evaluated);
+    ++(worker->score_count[score]);
+    worker->dns_query += SidfRequest_getDnsQueryCount(request);
+    batch_record_latency(worker, usec);
+
+    pthread_mutex_lock(&(worker->context->output_lock));
+    fprintf(stdout, "%s %s %s dns_mech=%u void_lookup=%u dns_query=%u usec=%lu\n", sender,
+            ipaddr, NNSTR(SidfEnum_lookupScoreByValue(score)), SidfRequest_getDnsMechCount(request),
+            SidfRequest_getVoidLookupCount(request), SidfRequest_getDnsQueryCount(request), usec);
+    pthread_mutex_unlock(&(worker->context->output_lock));
+    return true;
+}   // end function : batch_eval_line
+
+/*
+ * reads a line like fgets(3).
+ * the rest of a line longer than the buffer is discarded and "overlong" is set,
+ * so that it is not taken for the next line.
+ */
+static char *
+batch_read_line(FILE *fp, char *buf, size_t buflen, bool *overlong)
+{
+    *overlong = false;
+    if (NULL == fgets(buf, buflen, fp)) {
+        return NULL;
+    }   // end if
+    if (NULL != strchr(buf, '\n')) {
+        return buf;
+    }   // end if
+    int c = getc(fp);
+    if (EOF == c || '\n' == c) {
+        // the last line without newline, or the line just fits the buffer
+        return buf;
+    }   // end if
+    *overlong = true;
+    do {
+        c = getc(fp);
+    } while (EOF != c && '\n' != c);
+    return buf;
+}   // end function : batch_read_line
+
+static void *
+batch_worker_main(void *arg)
+{
+    BatchWorker *worker = (BatchWorker *) arg;
+    BatchContext *context = worker->context;
+
+    // DnsResolver is not thread-safe, so each thread has its own one. SidfPolicy is shared.
+    DnsResolver *resolver = DnsResolver_new();
+    SidfRequest *request = NULL;
+    if (NULL == resolver || NULL == (request = SidfRequest_new(context->policy, resolver))) {
+        // neither of them reports the cause through errno
+        fprintf(stderr, "[Error] worker initialization failed: error=%s failed\n",
+                NULL == resolver ? "DnsResolver_new" : "SidfRequest_new");
+        worker->failed = true;
+        goto cleanup;
+    }   // end if
+
+    char line[BATCH_LINE_MAXLEN];
+    while (true) {
+        bool overlong = false;
+        pthread_mutex_lock(&(context->input_lock));
+        char *p = batch_read_line(context->input, line, sizeof(line), &overlong);
+        pthread_mutex_unlock(&(context->input_lock));
+        if (NULL == p) {
+            break;
+        }   // end if
+        if (overlong || !batch_eval_line(worker, request, line)) {
+            ++(worker->malformed);
+        }   // end if
+    }   // end while
+
+  cleanup:
+    if (NULL != request) {
+        SidfRequest_free(request);
+    }   // end if
+    if (NULL != resolver) {
+        DnsResolver_free(resolver);
+    }   // end if
+    return NULL;
+}   // end function : batch_worker_main
+
+static int
+latency_compare(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}   // end function : latency_compare
+
+/*
+ * @return the q-quantile of the sorted latencies in milliseconds (nearest-rank method).
+ */
+static double
+latency_percentile(const unsigned int *latency, size_t num, double q)
+{
+    if (0 == num) {
+        return 0.0;
+    }   // end if
+    size_t rank = (size_t) (q * num + 0.999999);
+    return latency[0 < rank ? MIN(rank, num) - 1 : 0] / 1000.0;
+}   // end function : latency_percentile
+
+static void
+batch_report(BatchWorker *workers, unsigned int thread_num, unsigned long elapsed)
+{
+    unsigned long evaluated = 0, malformed = 0, dns_query = 0;
+    unsigned long score_count[SIDF_SCORE_MAX];
+    size_t latency_num = 0;
+    memset(score_count, 0, sizeof(score_count));
+    for (unsigned int i = 0; i < thread_num; ++i) {
+        evaluated += workers[i].evaluated;
+        malformed += workers[i].malformed;
+        dns_query += workers[i].dns_query;
+        latency_num += workers[i].latency_num;
+        for (int j = 0; j < SIDF_SCORE_MAX; ++j) {
+            score_count[j] += workers[i].score_count[j];
+        }   // end for
+    }   // end for
+
+    unsigned int *latency = (unsigned int *) malloc(MAX(latency_num, 1) * sizeof(unsigned int));
+    if (NULL != latency) {
+        size_t n = 0;
+        for (unsigned int i = 0; i < thread_num; ++i) {
+            if (0 < workers[i].latency_num) {
+                memcpy(latency + n, workers[i].latency,
+                       workers[i].latency_num * sizeof(unsigned int));
+                n += workers[i].latency_num;
+            }   // end if
+        }   // end for
+        qsort(latency, latency_num, sizeof(unsigned int), latency_compare);
+    } else {
+        latency_num = 0;
+    }   // end if
+
+    double seconds = elapsed / 1000000.0;
+    fprintf(stderr, "[Summary] evaluated=%lu, malformed=%lu, threads=%u, elapsed=%.3fs, throughput=%.1f/s\n",
+            evaluated, malformed, thread_num, seconds, 0.0 < seconds ? evaluated / seconds : 0.0);
+    fprintf(stderr, "[Summary] latency(ms): p50=%.3f, p90=%.3f, p99=%.3f, p99.9=%.3f, max=%.3f\n",
+            latency_percentile(latency, latency_num, 0.5),
+            latency_percentile(latency, latency_num, 0.9),
+            latency_percentile(latency, latency_num, 0.99),
+            latency_percentile(latency, latency_num, 0.999),
+            latency_percentile(latency, latency_num, 1.0));
+    fprintf(stderr, "[Summary] dns queries: total=%lu, per-evaluation=%.2f\n", dns_query,
+            0 < evaluated ? (double) dns_query / evaluated : 0.0);
+    fprintf(stderr, "[Summary] results:");
+    for (int j = SIDF_SCORE_NULL + 1; j < SIDF_SCORE_MAX; ++j) {
+        if (0 < score_count[j]) {
+            fprintf(stderr, " %s=%lu", NNSTR(SidfEnum_lookupScoreByValue((SidfScore) j)),
+                    score_count[j]);
+        }   // end if
+    }   // end for
+    fprintf(stderr, "\n");
+    free(latency);
+}   // end function : batch_report
+
+/*
+ * evaluates the tuples read from the file on multiple threads
+ * and reports throughput, latency percentiles and the number of DNS queries.
+ */
+static int
+batch_run(const SidfPolicy *policy, SidfRecordScope scope, const char *filename,
+          unsigned int thread_num)
+{
+    BatchContext context;
+    context.policy = policy;
+    context.scope = scope;
+    context.input = (0 == strcmp(filename, "-")) ? stdin : fopen(filename, "r");
+    if (NULL == context.input) {
+        fprintf(stderr, "[Error] cannot open file: file=%s, error=%s\n", filename, strerror(errno));
+        return EX_NOINPUT;
+    }   // end if
+    pthread_mutex_init(&(context.input_lock), NULL);
+    pthread_mutex_init(&(context.output_lock), NULL);
+
+    BatchWorker *workers = (BatchWorker *) calloc(thread_num, sizeof(BatchWorker));
+    if (NULL == workers) {
+        fprintf(stderr, "[Error] memory allocation failed: error=%s\n", strerror(errno));
+        pthread_mutex_destroy(&(context.output_lock));
+        pthread_mutex_destroy(&(context.input_lock));
+        if (stdin != context.input) {
+            fclose(context.input);
+        }   // end if
+        return EX_OSERR;
+    }   // end if
+
+    struct timeval start;
+    (void) gettimeofday(&start, NULL);
+    unsigned int started = 0;
+    for (; started < thread_num; ++started) {
+        workers[started].context = &context;
+        int create_stat = pthread_create(&(workers[started].thread), NULL, batch_worker_main,
+                                         &(workers[started]));
+        if (0 != create_stat) {
+            fprintf(stderr, "[Error] pthread_create failed: error=%s\n", strerror(create_stat));
+            break;
+        }   // end if
+    }   // end for
+    bool failed = (started < thread_num);
+    for (unsigned int i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        failed |= workers[i].failed;
+    }   // end for
+    unsigned long elapsed = elapsed_usec(&start);
+    fflush(stdout);
+
+    batch_report(workers, started, elapsed);
+
+    for (unsigned int i = 0; i < started; ++i) {
+        free(workers[i].latency);
+    }   // end for
+    free(workers);
+    pthread_mutex_destroy(&(context.output_lock));
+    pthread_mutex_destroy(&(context.input_lock));
+    if (stdin != context.input) {
+        fclose(context.input);
+    }   // end if
+    return failed ? EX_SOFTWARE : EX_OK;
+}   // end function : batch_run
+
+static const char *
+explain_query_type(SidfQueryType type)
+{
+    switch (type) {
+    case SIDF_QUERY_A:
+        return "A";
+    case SIDF_QUERY_AAAA:
+        return "AAAA";
+    case SIDF_QUERY_MX:
+        return "MX";
+    case SIDF_QUERY_TXT:
+        return "TXT";
+    case SIDF_QUERY_SPF:
+        return "SPF";
+    case SIDF_QUERY_PTR:
+        return "PTR";
+    default:
+        return "(unknown)";
+    }   // end switch
+}   // end function : explain_query_type
+
+static const char *
+explain_dns_stat(dns_stat_t stat)
+{
+    switch (stat) {
+    case DNS_STAT_NOERROR:
+        return "NOERROR";
+    case DNS_STAT_NXDOMAIN:
+        return "NXDOMAIN";
+    case DNS_STAT_NODATA:
+        return "NODATA";
+    case DNS_STAT_SERVFAIL:
+        return "SERVFAIL";
+    case DNS_STAT_REFUSED:
+        return "REFUSED";
+    case DNS_STAT_NOMEMORY:
+        return "NOMEMORY";
+    default:
+        return "ERROR";
+    }   // end switch
+}   // end function : explain_dns_stat
+
+/*
+ * @return true if any directive in the record depends on the request,
+ *         that is, contains macros or is "ptr" or "exists:" mechanism.
+ */
+static bool
+explain_is_dynamic_record(const char *record)
+{
+    const char *p = record;
+    while ('\0' != *p) {
+        size_t len = strcspn(p, " ");
+        const char *term = p;
+        if (0 < len && NULL != strchr("+-~?", *term)) {
+            ++term;
+        }   // end if
+        // the explanation is irrelevant to the result
+        if (0 != strncasecmp(term, "exp=", 4)) {
+            if (NULL != memchr(term, '%', p + len - term)
+                || 0 == strncasecmp(term, "exists:", 7)
+                || (0 == strncasecmp(term, "ptr", 3) && NULL != strchr(" :/", term[3]))) {
+                return true;
+            }   // end if
+        }   // end if
+        p += len;
+        p += strspn(p, " ");
+    }   // end while
+    return false;
+}   // end function : explain_is_dynamic_record
+
+static void
+explain_indent(unsigned int depth)
+{
+    fprintf(stdout, "%*s", (int) (depth + 1) * 2, "");
+}   // end function : explain_indent
+
+static void
+explain_answer(ExplainContext *context, const SidfTrace *trace, unsigned int depth)
+{
+    const SidfQuery *query = trace->query;
+    unsigned long finish;
+    if (context->fetching[depth]) {
+        // SPF RR and the fallback to TXT RR are fetched one after another
+        context->record_ready[depth] += trace->latency;
+        finish = context->record_ready[depth];
+    } else if ((SIDF_QUERY_A == query->type || SIDF_QUERY_AAAA == query->type)
+               && 0 < context->name_ready) {
+        // addresses of the MX/PTR names can be looked up in parallel once the names are known
+        finish = context->name_ready + trace->latency;
+    } else {
+        finish = context->record_ready[depth] + trace->latency;
+        if (SIDF_QUERY_MX == query->type || SIDF_QUERY_PTR == query->type) {
+            context->name_ready = finish;
+        }   // end if
+    }   // end if
+    context->critical_latency = MAX(context->critical_latency, finish);
+    context->serial_latency += trace->latency;
+    ++(context->query_num);
+
+    explain_indent(depth);
+    fprintf(stdout, "query: %s %s -> %s, answers=%zu, latency=%.3fms, cache=miss\n",
+            explain_query_type(query->type), PTROR(query->domain, "(ip-address)"),
+            explain_dns_stat(trace->answer->stat), trace->answer->num, trace->latency / 1000.0);
+}   // end function : explain_answer
+
+static void
+explain_term(ExplainContext *context, const SidfTrace *trace, unsigned int depth)
+{
+    bool is_include = (0 == strcmp(trace->term, "include") || 0 == strcmp(trace->term, "redirect"));
+    bool dynamic = trace->macro || 0 == strcmp(trace->term, "ptr")
+        || 0 == strcmp(trace->term, "exists") || (is_include && context->child_dynamic);
+    unsigned int mech_cost = trace->dns_mech_count - context->mech_base[depth];
+    context->mech_base[depth] = trace->dns_mech_count;
+    context->name_ready = 0;
+    if (dynamic) {
+        context->dynamic[depth] = true;
+    }   // end if
+
+    explain_indent(depth);
+    fprintf(stdout, "term: %s -> %s, dns_mech=%u, dns_query=%u", trace->term,
+            PTROR(SidfEnum_lookupScoreByValue(trace->score), "not-match"),
+            trace->dns_mech_count, trace->dns_query_count);
+    if (is_include && context->child_reused) {
+        fprintf(stdout, ", cache=hit");
+    } else if (0 < mech_cost && !dynamic
+               && (is_include || 0 == strcmp(trace->term, "a") || 0 == strcmp(trace->term, "mx"))) {
+        // the result depends only on the client IP address, so the term can be replaced with ip4:/ip6:
+        fprintf(stdout, "  <= flattenable, saves %u DNS mechanism(s)", mech_cost);
+        ++(context->flattenable_num);
+    } else if (0 < mech_cost && !trace->macro && 0 != strcmp(trace->term, "ptr")) {
+        // the target is known as soon as the record is parsed
+        fprintf(stdout, "  <= prefetchable, static target");
+        ++(context->prefetchable_num);
+    }   // end if
+    fprintf(stdout, "\n");
+    context->child_dynamic = false;
+    context->child_reused = false;
+}   // end function : explain_term
+
+/*
+ * trace handler of the explain mode. prints the evaluation tree as it goes.
+ */
+static void
+explain_handler(const SidfTrace *trace, void *arg)
+{
+    ExplainContext *context = (ExplainContext *) arg;
+    unsigned int depth = MIN(trace->depth, EXPLAIN_DEPTH_MAXNUM - 1);
+    switch (trace->event) {
+    case SIDF_TRACE_CHECK_HOST:
+        context->record_ready[depth] = 0 < depth ? context->record_ready[depth - 1] : 0;
+        context->fetching[depth] = true;
+        context->dynamic[depth] = false;
+        context->mech_base[depth] = trace->dns_mech_count;
+        explain_indent(depth);
+        fprintf(stdout, "check_host: domain=%s\n", trace->domain);
+        break;
+    case SIDF_TRACE_RECORD:
+        context->fetching[depth] = false;
+        // judged by the whole record since the evaluation may not reach every directive
+        if (explain_is_dynamic_record(trace->record)) {
+            context->dynamic[depth] = true;
+        }   // end if
+        ++(context->record_num);
+        explain_indent(depth);
+        fprintf(stdout, "record: %s\n", trace->record);
+        break;
+    case SIDF_TRACE_DNS_QUERY:
+        break;
+    case SIDF_TRACE_DNS_ANSWER:
+        explain_answer(context, trace, depth);
+        break;
+    case SIDF_TRACE_TERM_RESULT:
+        explain_term(context, trace, depth);
+        break;
+    case SIDF_TRACE_INCLUDE_REUSED:
+        context->child_reused = true;
+        ++(context->reused_num);
+        explain_indent(depth);
+        fprintf(stdout, "check_host: domain=%s, result=%s reused\n", trace->domain,
+                NNSTR(SidfEnum_lookupScoreByValue(trace->score)));
+        break;
+    case SIDF_TRACE_CHECK_HOST_RESULT:
+        context->fetching[depth] = false;
+        context->child_dynamic = context->dynamic[depth];
+        if (0 < depth && context->dynamic[depth]) {
+            context->dynamic[depth - 1] = true;
+        }   // end if
+        explain_indent(depth);
+        fprintf(stdout, "=> %s (domain=%s)\n", NNSTR(SidfEnum_lookupScoreByValue(trace->score)),
+                trace->domain);
+        break;
+    default:
+        break;
+    }   // end switch
+}   // end function : explain_handler
+
+static void
+explain_report(const ExplainContext *context, const SidfRequest *request)
+{
+    fprintf(stdout, "[Explain] records=%u, dns_mech=%u, void_lookup=%u, dns_query=%u, include_reused=%u\n",
+            context->record_num, SidfRequest_getDnsMechCount(request),
+            SidfRequest_getVoidLookupCount(request), context->query_num, context->reused_num);
+    fprintf(stdout, "[Explain] dns latency: serial=%.3fms, critical-path=%.3fms, eval_time=%ums\n",
+            context->serial_latency / 1000.0, context->critical_latency / 1000.0,
+            SidfRequest_getEvalTime(request));
+    fprintf(stdout, "[Explain] flattenable=%u, prefetchable=%u\n", context->flattenable_num,
+            context->prefetchable_num);
+}   // end function : explain_report
+
 int
 main(int argc, char **argv)
 {
     int af = AF_UNSPEC;
     int ai_flags = 0;
     SidfRecordScope scope = SIDF_RECORD_SCOPE_SPF1;
+    const char *batch_file = NULL;
+    unsigned int thread_num = 1;
+    bool explain_mode = false;
 
     int c;
-    while (-1 != (c = getopt(argc, argv, "46mnpshv"))) {
+    char *endptr;
+    while (-1 != (c = getopt(argc, argv, "46b:emnpst:hv"))) {
         switch (c) {
         case '4':  // IPv4
             af = AF_INET;
@@ -101,6 +670,22 @@ main(int argc, char **argv)
         case 'v':
             g_verbose_mode = true;
             break;
+        case 'e':  // explain mode
+            explain_mode = true;
+            break;
+        case 'b':  // batch mode
+            batch_file = optarg;
+            g_batch_mode = true;
+            break;
+        case 't':  // the number of threads in batch mode
+            errno = 0;
+            thread_num = (unsigned int) strtoul(optarg, &endptr, 10);
+            if (0 != errno || '\0' != *endptr || 0 == thread_num
+                || BATCH_THREAD_MAXNUM < thread_num) {
+                fprintf(stdout, "[Error] invalid number of threads: threads=%s\n", optarg);
+                usage(stdout);
+            }   // end if
+            break;
         default:
             fprintf(stdout, "[Error] illegal option: -%c\n", c);
             usage(stdout);
@@ -111,6 +696,24 @@ main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
+    if (NULL != batch_file && explain_mode) {
+        fprintf(stdout, "[Error] explain mode is not available in batch mode\n");
+        usage(stdout);
+    }   // end if
+
+    if (NULL != batch_file) {
+        SidfPolicy *policy = SidfPolicy_new();
+        if (NULL == policy) {
+            fprintf(stderr, "[Error] SidfPolicy_new failed: error=%s\n", strerror(errno));
+            exit(EX_OSERR);
+        }   // end if
+        SidfPolicy_setSpfRRLookup(policy, true);
+        SidfPolicy_setLogger(policy, stdout_logger);
+        int batch_stat = batch_run(policy, scope, batch_file, thread_num);
+        SidfPolicy_free(policy);
+        exit(batch_stat);
+    }   // end if
+
     if (argc < 2) {
         usage(stdout);
     }   // end if
@@ -193,7 +796,15 @@ main(int argc, char **argv)
             SidfRequest_setHeloDomain(request, InetMailbox_getDomain(envfrom));
 
             // SPF/Sender ID evaluation
+            ExplainContext explain;
+            if (explain_mode) {
+                memset(&explain, 0, sizeof(explain));
+                SidfRequest_setTraceHandler(request, explain_handler, &explain);
+            }   // end if
             SidfScore score = SidfRequest_eval(request, scope);
+            if (explain_mode) {
+                explain_report(&explain, request);
+            }   // end if
             const char *spfresultexp = SidfEnum_lookupScoreByValue(score);
             fprintf(stdout, "%s %s %s\n", mailbox, addr_string, spfresultexp);
         }   //end for
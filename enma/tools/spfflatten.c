@@ -0,0 +1,748 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <syslog.h>
+#include <inttypes.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "stdaux.h"
+#include "ptrop.h"
+#include "strarray.h"
+#include "xbuffer.h"
+#include "memarena.h"
+#include "dnsresolv.h"
+#include "sidf.h"
+#include "sidfenum.h"
+#include "sidfrecord.h"
+#include "sidfrequest.h"
+
+// the same limits as check_host() itself
+#define FLATTEN_DEPTH_MAXNUM 10
+#define FLATTEN_MX_MAXNUM 10
+#define FLATTEN_DNS_MECH_MAXNUM 10
+#define FLATTEN_IP4_MAX_CIDR_LENGTH 32
+#define FLATTEN_IP6_MAX_CIDR_LENGTH 128
+// the maximum length of a <character-string> in TXT RDATA
+#define TXT_STRING_MAXLEN 255
+
+typedef enum FlattenStat {
+    FLATTEN_OK,     // the subtree is replaced with the flattened directives
+    FLATTEN_KEEP,   // the subtree depends on the request, the term must be kept as is
+    FLATTEN_ERROR,  // the SPF tree is broken or DNS lookup failed
+} FlattenStat;
+
+typedef struct Flattener {
+    SidfRequest *request;
+    DnsResolver *resolver;
+    SidfRecordScope scope;
+    StrArray *cidrs;            // CIDR blocks already flattened, later ones are unreachable
+    StrArray *unflattenable;    // terms kept as is, with the reason and the domain they appear in
+    const char *version;        // version of the top-level record
+    const char *exp;            // "exp=" modifier of the top-level record
+    const char *redirect;       // "redirect=" modifier of the top-level record kept as is
+    unsigned int dns_query_count;
+    unsigned int remaining_mech_count;  // DNS mechanisms left in the flattened record
+    uint32_t ttl_min;           // 0 if no TTL is known
+} Flattener;
+
+bool g_verbose_mode = false;
+
+static void
+usage(FILE *fp)
+{
+    fprintf(fp, "\nUsage: spfflatten [-mpsv] domain\n\n");
+    fprintf(fp, "evaluation mode:\n");
+    fprintf(fp, "  -s  SPF mode (default)\n");
+    fprintf(fp, "  -m  Sender ID (mfrom) mode\n");
+    fprintf(fp, "  -p  Sender ID (pra) mode\n");
+    fprintf(fp, "features:\n");
+    fprintf(fp, "  -v  verbose mode\n\n");
+    fprintf(fp, "The flattened record is written to stdout as a zone file fragment.\n");
+    exit(EX_USAGE);
+}   // end functiion : usage
+
+static void
+stderr_logger(int priority, const char *message, ...)
+{
+    if (!g_verbose_mode && LOG_DEBUG == priority) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, message);
+    vfprintf(stderr, message, args);
+    putc('\n', stderr);
+    va_end(args);
+}   // end functiion : stderr_logger
+
+static const char *
+flatten_qualifier(SidfQualifier qualifier)
+{
+    switch (qualifier) {
+    case SIDF_QUALIFIER_MINUS:
+        return "-";
+    case SIDF_QUALIFIER_TILDE:
+        return "~";
+    case SIDF_QUALIFIER_QUESTION:
+        return "?";
+    default:
+        // "+" is the default qualifier
+        return "";
+    }   // end switch
+}   // end function : flatten_qualifier
+
+static void
+flatten_updateTtl(Flattener *self)
+{
+    uint32_t ttl = DnsResolver_getTtl(self->resolver);
+    if (0 < ttl && (0 == self->ttl_min || ttl < self->ttl_min)) {
+        self->ttl_min = ttl;
+    }   // end if
+}   // end function : flatten_updateTtl
+
+static bool
+flatten_isTempError(dns_stat_t stat)
+{
+    return DNS_STAT_NOERROR != stat && DNS_STAT_NXDOMAIN != stat && DNS_STAT_NODATA != stat;
+}   // end function : flatten_isTempError
+
+static bool
+flatten_note(Flattener *self, const char *reason, const char *text, const char *domain)
+{
+    char buf[BUFSIZ];
+    snprintf(buf, sizeof(buf), "%s: %s (in %s)", reason, text, domain);
+    return 0 <= StrArray_append(self->unflattenable, buf);
+}   // end function : flatten_note
+
+/*
+ * appends a CIDR block unless the same block is already flattened.
+ */
+static bool
+flatten_appendCidr(Flattener *self, StrArray *out, const char *qualifier, sa_family_t sa_family,
+                   const void *addr, unsigned short cidr)
+{
+    char addrbuf[INET6_ADDRSTRLEN];
+    char cidrbuf[INET6_ADDRSTRLEN + 16];
+    (void) inet_ntop(sa_family, addr, addrbuf, sizeof(addrbuf));
+    if ((AF_INET == sa_family && FLATTEN_IP4_MAX_CIDR_LENGTH == cidr)
+        || (AF_INET6 == sa_family && FLATTEN_IP6_MAX_CIDR_LENGTH == cidr)) {
+        snprintf(cidrbuf, sizeof(cidrbuf), "%s:%s", AF_INET == sa_family ? "ip4" : "ip6",
+                 addrbuf);
+    } else {
+        snprintf(cidrbuf, sizeof(cidrbuf), "%s:%s/%u", AF_INET == sa_family ? "ip4" : "ip6",
+                 addrbuf, cidr);
+    }   // end if
+    // the first occurrence decides the result regardless of the qualifiers of the rest
+    if (0 <= StrArray_linearSearchIgnoreCase(self->cidrs, cidrbuf)) {
+        return true;
+    }   // end if
+    char directive[sizeof(cidrbuf) + 1];
+    snprintf(directive, sizeof(directive), "%s%s", qualifier, cidrbuf);
+    return 0 <= StrArray_append(self->cidrs, cidrbuf) && 0 <= StrArray_append(out, directive);
+}   // end function : flatten_appendCidr
+
+static bool
+flatten_appendIp4Cidr(Flattener *self, StrArray *out, const char *qualifier,
+                      const struct in_addr *addr, unsigned short cidr)
+{
+    // mask host bits so that equivalent blocks are recognized as the same
+    struct in_addr network = *addr;
+    if (cidr < FLATTEN_IP4_MAX_CIDR_LENGTH) {
+        network.s_addr &= htonl(0 == cidr ? 0 : ~((1UL << (32 - cidr)) - 1));
+    }   // end if
+    return flatten_appendCidr(self, out, qualifier, AF_INET, &network, cidr);
+}   // end function : flatten_appendIp4Cidr
+
+static bool
+flatten_appendIp6Cidr(Flattener *self, StrArray *out, const char *qualifier,
+                      const struct in6_addr *addr, unsigned short cidr)
+{
+    struct in6_addr network = *addr;
+    for (unsigned int n = 0; n < sizeof(network.s6_addr); ++n) {
+        unsigned int bits = (cidr <= n * 8) ? 0 : MIN(cidr - n * 8, 8);
+        network.s6_addr[n] &= (unsigned char) (0xff << (8 - bits));
+    }   // end for
+    return flatten_appendCidr(self, out, qualifier, AF_INET6, &network, cidr);
+}   // end function : flatten_appendIp6Cidr
+
+/*
+ * looks up both A and AAAA records of the domain and appends them as CIDR blocks,
+ * since the flattened record must cover clients of either address family.
+ */
+static FlattenStat
+flatten_appendHost(Flattener *self, StrArray *out, const char *qualifier, const char *domain,
+                   const SidfTerm *term)
+{
+    DnsAResponse *resp4;
+    ++(self->dns_query_count);
+    dns_stat_t stat4 = DnsResolver_lookupA(self->resolver, domain, &resp4);
+    if (DNS_STAT_NOERROR == stat4) {
+        flatten_updateTtl(self);
+        bool append_stat = true;
+        for (size_t n = 0; append_stat && n < DnsAResponse_size(resp4); ++n) {
+            append_stat = flatten_appendIp4Cidr(self, out, qualifier,
+                                                DnsAResponse_addr(resp4, n), term->ip4cidr);
+        }   // end for
+        DnsAResponse_free(resp4);
+        if (!append_stat) {
+            fprintf(stderr, "[Error] memory allocation failed\n");
+            return FLATTEN_ERROR;
+        }   // end if
+    } else if (flatten_isTempError(stat4)) {
+        fprintf(stderr, "[Error] DNS lookup failure: rrtype=A, domain=%s, err=%s\n", domain,
+                DnsResolver_getErrorString(self->resolver));
+        return FLATTEN_ERROR;
+    }   // end if
+
+    DnsAaaaResponse *resp6;
+    ++(self->dns_query_count);
+    dns_stat_t stat6 = DnsResolver_lookupAaaa(self->resolver, domain, &resp6);
+    if (DNS_STAT_NOERROR == stat6) {
+        flatten_updateTtl(self);
+        bool append_stat = true;
+        for (size_t n = 0; append_stat && n < DnsAaaaResponse_size(resp6); ++n) {
+            append_stat = flatten_appendIp6Cidr(self, out, qualifier,
+                                                DnsAaaaResponse_addr(resp6, n), term->ip6cidr);
+        }   // end for
+        DnsAaaaResponse_free(resp6);
+        if (!append_stat) {
+            fprintf(stderr, "[Error] memory allocation failed\n");
+            return FLATTEN_ERROR;
+        }   // end if
+    } else if (flatten_isTempError(stat6)) {
+        fprintf(stderr, "[Error] DNS lookup failure: rrtype=AAAA, domain=%s, err=%s\n", domain,
+                DnsResolver_getErrorString(self->resolver));
+        return FLATTEN_ERROR;
+    }   // end if
+    return FLATTEN_OK;
+}   // end function : flatten_appendHost
+
+static FlattenStat
+flatten_appendMx(Flattener *self, StrArray *out, const char *qualifier, const char *domain,
+                 const SidfTerm *term)
+{
+    DnsMxResponse *resp;
+    ++(self->dns_query_count);
+    dns_stat_t stat = DnsResolver_lookupMx(self->resolver, domain, &resp);
+    if (DNS_STAT_NOERROR != stat) {
+        if (flatten_isTempError(stat)) {
+            fprintf(stderr, "[Error] DNS lookup failure: rrtype=MX, domain=%s, err=%s\n", domain,
+                    DnsResolver_getErrorString(self->resolver));
+            return FLATTEN_ERROR;
+        }   // end if
+        return FLATTEN_OK;
+    }   // end if
+    flatten_updateTtl(self);
+    FlattenStat flatten_stat = FLATTEN_OK;
+    for (size_t n = 0; FLATTEN_OK == flatten_stat && n < MIN(DnsMxResponse_size(resp),
+                                                               FLATTEN_MX_MAXNUM); ++n) {
+        flatten_stat =
+            flatten_appendHost(self, out, qualifier, DnsMxResponse_domain(resp, n), term);
+    }   // end for
+    DnsMxResponse_free(resp);
+    return flatten_stat;
+}   // end function : flatten_appendMx
+
+static bool
+flatten_isModifier(const char *token)
+{
+    if (!isalpha(*token)) {
+        return false;
+    }   // end if
+    const char *p = token + 1;
+    while (isalnum(*p) || '-' == *p || '_' == *p || '.' == *p) {
+        ++p;
+    }   // end while
+    return '=' == *p;
+}   // end function : flatten_isModifier
+
+/*
+ * fetches the SPF/SIDF record of the domain in the scope.
+ * @return FLATTEN_OK and the record on success, FLATTEN_ERROR otherwise.
+ */
+static FlattenStat
+flatten_fetchRecord(Flattener *self, const char *domain, char **record)
+{
+    DnsTxtResponse *resp;
+    ++(self->dns_query_count);
+    dns_stat_t stat = DnsResolver_lookupTxt(self->resolver, domain, &resp);
+    if (DNS_STAT_NOERROR != stat) {
+        fprintf(stderr, "[Error] %s: rrtype=TXT, domain=%s, err=%s\n",
+                flatten_isTempError(stat) ? "DNS lookup failure" : "no SPF record found",
+                domain, DnsResolver_getErrorString(self->resolver));
+        return FLATTEN_ERROR;
+    }   // end if
+    flatten_updateTtl(self);
+
+    // SIDF records take precedence over SPF records in SIDF scopes as check_host() does
+    const char *selected = NULL;
+    for (int pass = 0; NULL == selected && pass < 2; ++pass) {
+        SidfRecordScope wanted = (0 == pass) ? self->scope : SIDF_RECORD_SCOPE_SPF1;
+        for (size_t n = 0; n < DnsTxtResponse_size(resp); ++n) {
+            const char *data = DnsTxtResponse_data(resp, n);
+            SidfRecordScope scope;
+            const char *scope_tail;
+            if (SIDF_STAT_OK != SidfRecord_getSidfScope(self->request, data, STRTAIL(data),
+                                                        &scope, &scope_tail)
+                || !(scope & wanted)) {
+                continue;
+            }   // end if
+            if (NULL != selected) {
+                fprintf(stderr, "[Error] multiple SPF records found: domain=%s\n", domain);
+                DnsTxtResponse_free(resp);
+                return FLATTEN_ERROR;
+            }   // end if
+            selected = data;
+        }   // end for
+    }   // end for
+    if (NULL == selected) {
+        fprintf(stderr, "[Error] no SPF record found: domain=%s\n", domain);
+        DnsTxtResponse_free(resp);
+        return FLATTEN_ERROR;
+    }   // end if
+    *record = MemArena_strdup(self->request->arena, selected);
+    DnsTxtResponse_free(resp);
+    if (NULL == *record) {
+        fprintf(stderr, "[Error] memory allocation failed\n");
+        return FLATTEN_ERROR;
+    }   // end if
+    return FLATTEN_OK;
+}   // end function : flatten_fetchRecord
+
+static FlattenStat flatten_record(Flattener *self, const char *domain,
+                                  const SidfTerm *include_term, bool strict, unsigned int depth,
+                                  StrArray *out, unsigned int *dns_mech_count, bool *terminated);
+
+/*
+ * flattens the record "include:" or "redirect=" refers to into a separate list,
+ * so that it is discarded if the subtree turns out to depend on the request.
+ */
+static FlattenStat
+flatten_subtree(Flattener *self, const char *domain, const SidfTerm *include_term,
+                unsigned int depth, StrArray *out, unsigned int *dns_mech_count,
+                bool *terminated)
+{
+    StrArray *sub = StrArray_new(0);
+    // CIDR blocks of a discarded subtree must not suppress the same blocks found later
+    size_t cidr_num = StrArray_getCount(self->cidrs);
+    if (NULL == sub) {
+        fprintf(stderr, "[Error] memory allocation failed\n");
+        return FLATTEN_ERROR;
+    }   // end if
+    FlattenStat flatten_stat =
+        flatten_record(self, domain, include_term, true, depth, sub, dns_mech_count, terminated);
+    if (FLATTEN_OK == flatten_stat) {
+        for (size_t n = 0; n < StrArray_getCount(sub); ++n) {
+            if (0 > StrArray_append(out, StrArray_get(sub, n))) {
+                fprintf(stderr, "[Error] memory allocation failed\n");
+                flatten_stat = FLATTEN_ERROR;
+                break;
+            }   // end if
+        }   // end for
+    } else {
+        while (cidr_num < StrArray_getCount(self->cidrs)) {
+            StrArray_unappend(self->cidrs);
+        }   // end while
+    }   // end if
+    StrArray_free(sub);
+    return flatten_stat;
+}   // end function : flatten_subtree
+
+/*
+ * flattens the directives of the record of the domain into "out".
+ * @param include_term "include:" the record is evaluated for, NULL at the top level.
+ *                     only "pass" results are reachable through "include:",
+ *                     and they are given the qualifier of "include:".
+ * @param strict true if the record is reached through "include:" or "redirect=",
+ *               where terms depending on the request cannot be moved to the top-level record
+ *               since %{d} would be expanded differently.
+ * @param dns_mech_count receives the number of DNS mechanisms in the subtree.
+ * @param terminated receives true if "all" is reached and the rest is unreachable.
+ */
+static FlattenStat
+flatten_record(Flattener *self, const char *domain, const SidfTerm *include_term, bool strict,
+               unsigned int depth, StrArray *out, unsigned int *dns_mech_count, bool *terminated)
+{
+    *dns_mech_count = 0;
+    *terminated = false;
+    if (FLATTEN_DEPTH_MAXNUM < depth) {
+        fprintf(stderr, "[Error] include/redirect nested too deeply: domain=%s\n", domain);
+        return FLATTEN_ERROR;
+    }   // end if
+    if (0 <= StrArray_linearSearchIgnoreCase(self->request->domain, domain)) {
+        fprintf(stderr, "[Error] include/redirect loop detected: domain=%s\n", domain);
+        return FLATTEN_ERROR;
+    }   // end if
+
+    char *rawrecord;
+    if (FLATTEN_OK != flatten_fetchRecord(self, domain, &rawrecord)) {
+        return FLATTEN_ERROR;
+    }   // end if
+    SidfRecordScope scope;
+    const char *scope_tail;
+    (void) SidfRecord_getSidfScope(self->request, rawrecord, STRTAIL(rawrecord), &scope,
+                                   &scope_tail);
+    if (NULL == self->version) {
+        self->version = MemArena_strpdup(self->request->arena, rawrecord,
+                                         rawrecord + strcspn(rawrecord, " "));
+    }   // end if
+
+    // the directives are kept as they are written when they cannot be flattened
+    StrArray *tokens = StrArray_split(scope_tail, " ", true);
+    char *domain_copy = MemArena_strdup(self->request->arena, domain);
+    if (NULL == tokens || NULL == domain_copy
+        || 0 > PtrArray_append(self->request->domain, domain_copy)) {
+        fprintf(stderr, "[Error] memory allocation failed\n");
+        if (NULL != tokens) {
+            StrArray_free(tokens);
+        }   // end if
+        return FLATTEN_ERROR;
+    }   // end if
+    SidfRecord *record;
+    FlattenStat flatten_stat = FLATTEN_OK;
+    if (SIDF_STAT_OK !=
+        SidfRecord_build(self->request, scope, scope_tail, STRTAIL(scope_tail), &record)) {
+        fprintf(stderr, "[Error] SPF record syntax error: domain=%s, record=%s\n", domain,
+                rawrecord);
+        flatten_stat = FLATTEN_ERROR;
+        goto cleanup;
+    }   // end if
+
+    size_t token_index = 0;
+    for (unsigned int i = 0; i < record->directive_num; ++i) {
+        const SidfTerm *term = record->directives[i];
+        while (token_index < StrArray_getCount(tokens)
+               && ('\0' == *StrArray_get(tokens, token_index)
+                   || flatten_isModifier(StrArray_get(tokens, token_index)))) {
+            ++token_index;
+        }   // end while
+        const char *text = (token_index < StrArray_getCount(tokens))
+            ? StrArray_get(tokens, token_index++) : term->attr->name;
+        const char *target = PTROR(term->querydomain, domain);
+        const char *qualifier = flatten_qualifier(NULL != include_term
+                                                  ? include_term->qualifier : term->qualifier);
+        if (term->attr->involve_dnslookup) {
+            ++(*dns_mech_count);
+        }   // end if
+
+        if (NULL != include_term && SIDF_QUALIFIER_PLUS != term->qualifier) {
+            if (SIDF_TERM_MECH_ALL == term->attr->type) {
+                // check_host() ends here without "pass", so "include:" doesn't match
+                goto cleanup;
+            }   // end if
+            // blocks excluded here cannot be subtracted from the "pass" ones that follow
+            (void) flatten_note(self, "order-dependent", text, domain);
+            flatten_stat = FLATTEN_KEEP;
+            goto cleanup;
+        }   // end if
+
+        unsigned int sub_mech_count = 0;
+        bool sub_terminated = false;
+        switch (term->attr->type) {
+        case SIDF_TERM_MECH_ALL:;
+            // "+all" through "include:" makes the "include:" itself match everything
+            char all[sizeof("+all")];
+            snprintf(all, sizeof(all), "%sall", qualifier);
+            if (0 > StrArray_append(out, all)) {
+                flatten_stat = FLATTEN_ERROR;
+            }   // end if
+            *terminated = true;
+            goto cleanup;
+        case SIDF_TERM_MECH_IP4:
+            if (!flatten_appendIp4Cidr(self, out, qualifier, &(term->param.addr4), term->ip4cidr)) {
+                flatten_stat = FLATTEN_ERROR;
+                goto cleanup;
+            }   // end if
+            continue;
+        case SIDF_TERM_MECH_IP6:
+            if (!flatten_appendIp6Cidr(self, out, qualifier, &(term->param.addr6), term->ip6cidr)) {
+                flatten_stat = FLATTEN_ERROR;
+                goto cleanup;
+            }   // end if
+            continue;
+        case SIDF_TERM_MECH_A:
+            if (NULL != term->macro) {
+                break;
+            }   // end if
+            flatten_stat = flatten_appendHost(self, out, qualifier, target, term);
+            if (FLATTEN_OK != flatten_stat) {
+                goto cleanup;
+            }   // end if
+            continue;
+        case SIDF_TERM_MECH_MX:
+            if (NULL != term->macro) {
+                break;
+            }   // end if
+            flatten_stat = flatten_appendMx(self, out, qualifier, target, term);
+            if (FLATTEN_OK != flatten_stat) {
+                goto cleanup;
+            }   // end if
+            continue;
+        case SIDF_TERM_MECH_INCLUDE:
+            if (NULL != term->macro) {
+                break;
+            }   // end if
+            flatten_stat = flatten_subtree(self, target, NULL != include_term ? include_term : term,
+                                           depth + 1, out, &sub_mech_count, &sub_terminated);
+            *dns_mech_count += sub_mech_count;
+            if (FLATTEN_OK == flatten_stat) {
+                if (sub_terminated) {
+                    *terminated = true;
+                    goto cleanup;
+                }   // end if
+                continue;
+            }   // end if
+            if (FLATTEN_KEEP == flatten_stat && !strict) {
+                // keep "include:" itself, the reason is already noted
+                flatten_stat = FLATTEN_OK;
+                self->remaining_mech_count += 1 + sub_mech_count;
+                if (0 > StrArray_append(out, text)) {
+                    flatten_stat = FLATTEN_ERROR;
+                    goto cleanup;
+                }   // end if
+                continue;
+            }   // end if
+            goto cleanup;
+        case SIDF_TERM_MECH_PTR:
+        case SIDF_TERM_MECH_EXISTS:
+            break;
+        default:
+            abort();
+        }   // end switch
+
+        // the term depends on the request
+        (void) flatten_note(self, NULL != term->macro ? "macro-dependent" : "request-dependent",
+                            text, domain);
+        if (strict) {
+            flatten_stat = FLATTEN_KEEP;
+            goto cleanup;
+        }   // end if
+        ++(self->remaining_mech_count);
+        if (0 > StrArray_append(out, text)) {
+            flatten_stat = FLATTEN_ERROR;
+            goto cleanup;
+        }   // end if
+    }   // end for
+
+    if (0 == depth) {
+        for (size_t n = 0; n < StrArray_getCount(tokens); ++n) {
+            if (0 == strncasecmp(StrArray_get(tokens, n), "exp=", 4)) {
+                self->exp = MemArena_strdup(self->request->arena, StrArray_get(tokens, n));
+            }   // end if
+        }   // end for
+    }   // end if
+
+    const SidfTerm *redirect = record->modifiers.rediect;
+    if (NULL != redirect) {
+        const char *text = "redirect";
+        for (size_t n = 0; n < StrArray_getCount(tokens); ++n) {
+            if (0 == strncasecmp(StrArray_get(tokens, n), "redirect=", 9)) {
+                text = StrArray_get(tokens, n);
+            }   // end if
+        }   // end for
+        ++(*dns_mech_count);
+        unsigned int sub_mech_count = 0;
+        if (NULL == redirect->macro) {
+            flatten_stat = flatten_subtree(self, redirect->querydomain, include_term, depth + 1,
+                                           out, &sub_mech_count, terminated);
+            *dns_mech_count += sub_mech_count;
+        } else {
+            (void) flatten_note(self, "macro-dependent", text, domain);
+            flatten_stat = FLATTEN_KEEP;
+        }   // end if
+        if (FLATTEN_KEEP == flatten_stat && !strict) {
+            self->remaining_mech_count += 1 + sub_mech_count;
+            self->redirect = MemArena_strdup(self->request->arena, text);
+            flatten_stat = FLATTEN_OK;
+        }   // end if
+    }   // end if
+
+  cleanup:
+    StrArray_unappend(self->request->domain);
+    StrArray_free(tokens);
+    return flatten_stat;
+}   // end function : flatten_record
+
+/*
+ * writes the record as a TXT RR in the zone file format,
+ * splitting it into <character-string>s of 255 bytes at most.
+ */
+static void
+flatten_writeTxtRR(FILE *fp, const char *domain, uint32_t ttl, const char *record)
+{
+    fprintf(fp, "%s%s", domain, '.' == *(STRTAIL(domain) - 1) ? "" : ".");
+    if (0 < ttl) {
+        fprintf(fp, " %" PRIu32, ttl);
+    }   // end if
+    fprintf(fp, " IN TXT");
+    const char *p = record;
+    do {
+        size_t len = MIN(strlen(p), TXT_STRING_MAXLEN);
+        fprintf(fp, " \"");
+        for (size_t n = 0; n < len; ++n) {
+            if ('"' == p[n] || '\\' == p[n]) {
+                putc('\\', fp);
+            }   // end if
+            putc(p[n], fp);
+        }   // end for
+        putc('"', fp);
+        p += len;
+    } while ('\0' != *p);
+    putc('\n', fp);
+}   // end function : flatten_writeTxtRR
+
+int
+main(int argc, char **argv)
+{
+    SidfRecordScope scope = SIDF_RECORD_SCOPE_SPF1;
+
+    int c;
+    while (-1 != (c = getopt(argc, argv, "mpshv"))) {
+        switch (c) {
+        case 'm':  // mfrom
+            scope = SIDF_RECORD_SCOPE_SPF2_MFROM;
+            break;
+        case 'p':  // pra
+            scope = SIDF_RECORD_SCOPE_SPF2_PRA;
+            break;
+        case 's':  // SPF
+            scope = SIDF_RECORD_SCOPE_SPF1;
+            break;
+        case 'h':
+            usage(stdout);
+            break;
+        case 'v':
+            g_verbose_mode = true;
+            break;
+        default:
+            fprintf(stderr, "[Error] illegal option: -%c\n", c);
+            usage(stderr);
+            break;
+        }   // end switch
+    }   // end while
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1) {
+        usage(stderr);
+    }   // end if
+    const char *domain = argv[0];
+
+    DnsResolver *resolver = DnsResolver_new();
+    if (NULL == resolver) {
+        fprintf(stderr, "[Error] resolver initialization failed: error=%s\n", strerror(errno));
+        exit(EX_OSERR);
+    }   // end if
+
+    SidfPolicy *policy = SidfPolicy_new();
+    if (NULL == policy) {
+        fprintf(stderr, "[Error] SidfPolicy_new failed: error=%s\n", strerror(errno));
+        exit(EX_OSERR);
+    }   // end if
+    SidfPolicy_setLogger(policy, stderr_logger);
+
+    // the request only serves as the parser context, it is never evaluated
+    SidfRequest *request = SidfRequest_new(policy, resolver);
+    if (NULL == request) {
+        fprintf(stderr, "[Error] SidfRequest_new failed: error=%s\n", strerror(errno));
+        exit(EX_OSERR);
+    }   // end if
+
+    Flattener flattener;
+    memset(&flattener, 0, sizeof(Flattener));
+    flattener.request = request;
+    flattener.resolver = resolver;
+    flattener.scope = scope;
+    flattener.cidrs = StrArray_new(0);
+    flattener.unflattenable = StrArray_new(0);
+    StrArray *directives = StrArray_new(0);
+    if (NULL == flattener.cidrs || NULL == flattener.unflattenable || NULL == directives) {
+        fprintf(stderr, "[Error] memory allocation failed\n");
+        exit(EX_OSERR);
+    }   // end if
+
+    unsigned int dns_mech_count;
+    bool terminated;
+    if (FLATTEN_OK != flatten_record(&flattener, domain, NULL, false, 0, directives,
+                                     &dns_mech_count, &terminated)) {
+        exit(EX_DATAERR);
+    }   // end if
+
+    XBuffer *xbuf = XBuffer_new(0);
+    if (NULL == xbuf) {
+        fprintf(stderr, "[Error] memory allocation failed\n");
+        exit(EX_OSERR);
+    }   // end if
+    XBuffer_appendString(xbuf, flattener.version);
+    for (size_t n = 0; n < StrArray_getCount(directives); ++n) {
+        XBuffer_appendChar(xbuf, ' ');
+        XBuffer_appendString(xbuf, StrArray_get(directives, n));
+    }   // end for
+    if (!terminated && NULL != flattener.redirect) {
+        XBuffer_appendChar(xbuf, ' ');
+        XBuffer_appendString(xbuf, flattener.redirect);
+    }   // end if
+    if (NULL != flattener.exp) {
+        XBuffer_appendChar(xbuf, ' ');
+        XBuffer_appendString(xbuf, flattener.exp);
+    }   // end if
+    if (0 != XBuffer_status(xbuf)) {
+        fprintf(stderr, "[Error] memory allocation failed\n");
+        exit(EX_OSERR);
+    }   // end if
+
+    // the report is written as comments so that the whole output can be loaded as is
+    fprintf(stdout, "; flattened SPF record of %s\n", domain);
+    fprintf(stdout, "; dns_mech: original=%u, flattened=%u%s\n", dns_mech_count,
+            flattener.remaining_mech_count,
+            FLATTEN_DNS_MECH_MAXNUM < flattener.remaining_mech_count ? " (still over the limit)" : "");
+    fprintf(stdout, "; dns_query: %u\n", flattener.dns_query_count);
+    if (0 < flattener.ttl_min) {
+        fprintf(stdout, "; ttl_min: %" PRIu32 "\n", flattener.ttl_min);
+    } else {
+        fprintf(stdout, "; ttl_min: unknown\n");
+    }   // end if
+    for (size_t n = 0; n < StrArray_getCount(flattener.unflattenable); ++n) {
+        fprintf(stdout, "; kept as is, %s\n", StrArray_get(flattener.unflattenable, n));
+    }   // end for
+    flatten_writeTxtRR(stdout, domain, flattener.ttl_min, XBuffer_getString(xbuf));
+
+    // clean up
+    XBuffer_free(xbuf);
+    StrArray_free(directives);
+    StrArray_free(flattener.unflattenable);
+    StrArray_free(flattener.cidrs);
+    SidfRequest_free(request);
+    SidfPolicy_free(policy);
+    DnsResolver_free(resolver);
+
+    exit(EX_OK);
+}   // end function : main
@@ -76,6 +76,8 @@ typedef enum DkimStatus {
     DSTAT_INFO_ADSP_NOT_EXIST,  // ADSP record have not found
     DSTAT_INFO_ADSP_NXDOMAIN,   // Author Domain does not exist (NXDOMAIN)
     DSTAT_INFO_NO_SIGNHEADER,   // No DKIM-Signature headers are found
+    DSTAT_INFO_SIGNATURE_SUPERSEDED,    // verification skipped in favor of an Ed25519 signature of the same domain
+    DSTAT_INFO_SIGNATURE_NOT_EVALUATED, // verification skipped since an author domain signature is verified
     // [System Errors]
     DSTAT_SYSERR_DIGEST_UPDATE_FAILURE = DSTATCAT_SYSERR,   // error on digest update (returned by OpenSSL EVP_DigestUpdate())
     DSTAT_SYSERR_DIGEST_VERIFICATION_FAILURE,   // error on digital signature verification (returned by OpenSSL EVP_VerifyFinal())
@@ -148,6 +150,19 @@ extern void DkimVerificationPolicy_setSignHeaderLimit(DkimVerificationPolicy *se
                                                       size_t header_limit);
 extern void DkimVerificationPolicy_acceptExpiredSignature(DkimVerificationPolicy *self,
                                                           bool accept);
+extern void DkimVerificationPolicy_preferEd25519(DkimVerificationPolicy *self, bool prefer);
+extern void DkimVerificationPolicy_stopAtAuthorSignature(DkimVerificationPolicy *self, bool stop);
+extern DkimStatus DkimVerificationPolicy_setPublicKeyCache(DkimVerificationPolicy *self,
+                                                           size_t max_entries,
+                                                           unsigned int max_ttl,
+                                                           unsigned int negative_ttl);
+extern DkimStatus DkimVerificationPolicy_setVerdictCache(DkimVerificationPolicy *self,
+                                                         size_t max_entries, unsigned int ttl);
+extern DkimStatus DkimVerificationPolicy_setCryptoWorkers(DkimVerificationPolicy *self,
+                                                          size_t thread_num);
+extern DkimStatus DkimVerificationPolicy_setLookupWorkers(DkimVerificationPolicy *self,
+                                                          size_t thread_num,
+                                                          size_t inflight_limit);
 #define DkimVerificationPolicy_setLogger(__self, __logger) \
     DkimPolicyBase_setLogger((DkimPolicyBase *)(__self), __logger)
 #define DkimVerificationPolicy_supposeLeadingHeaderValueSpace(__self, __flag) \
@@ -160,6 +175,10 @@ extern void DkimVerificationPolicy_acceptExpiredSignature(DkimVerificationPolicy
 // DkimVerifier
 extern DkimVerifier *DkimVerifier_new(const DkimVerificationPolicy *vpolicy, DnsResolver *resolver);
 extern void DkimVerifier_free(DkimVerifier *self);
+extern DkimStatus DkimVerifier_prefetchPublicKey(DkimVerifier *self, const char *headerf,
+                                                 const char *headerv);
+extern DkimStatus DkimVerifier_prefetchAdsp(DkimVerifier *self, const char *headerf,
+                                            const char *headerv);
 extern DkimStatus DkimVerifier_setup(DkimVerifier *self, const MailHeaders *headers);
 extern DkimStatus DkimVerifier_updateBody(DkimVerifier *self,
                                           const unsigned char *bodyp, size_t len);
@@ -172,6 +191,7 @@ extern size_t DkimVerifier_getFrameCount(const DkimVerifier *self);
 extern DkimBaseScore DkimVerifier_getSessionResult(const DkimVerifier *self);
 extern DkimBaseScore DkimVerifier_getFrameResult(const DkimVerifier *self,
                                                  size_t signo, const InetMailbox **auid);
+extern bool DkimVerifier_isFrameEvaluated(const DkimVerifier *self, size_t signo);
 extern DkimAdspScore DkimVerifier_checkAdsp(DkimVerifier *self);
 
 // DkimSignPolicy
@@ -183,6 +203,7 @@ extern DkimStatus DkimSignPolicy_setHashAlgorithm(DkimSignPolicy *self, const ch
 extern DkimStatus DkimSignPolicy_setKeyType(DkimSignPolicy *self, const char *pubkeyalg);
 extern void DkimSignPolicy_setSignatureTTL(DkimSignPolicy *self, long long signature_ttl);
 extern void DkimSignPolicy_setNewlineCharOfSignature(DkimSignPolicy *self, bool crlf);
+extern DkimStatus DkimSignPolicy_setCryptoWorkers(DkimSignPolicy *self, size_t thread_num);
 #define DkimSignPolicy_setLogger(__self, __logger) \
     DkimPolicyBase_setLogger((DkimPolicyBase *)(__self), __logger)
 #define DkimSignPolicy_supposeLeadingHeaderValueSpace(__self, __flag) \
@@ -198,9 +219,22 @@ extern void DkimSigner_free(DkimSigner *self);
 extern DkimStatus DkimSigner_setup(DkimSigner *self, const InetMailbox *auid, const char *sdid,
                                    const MailHeaders *headers,
                                    const StrArray *signed_header_fields);
+extern bool DkimSigner_shareBodyDigest(DkimSigner *self, const DkimVerifier *verifier);
+extern bool DkimSigner_reuseBodyDigest(DkimSigner *self, DkimSigner *source);
 extern DkimStatus DkimSigner_updateBody(DkimSigner *self, const unsigned char *bodyp, size_t len);
 extern DkimStatus DkimSigner_sign(DkimSigner *self, const char *selector, EVP_PKEY *pkey,
                                   const char **headerf, const char **headerv);
+extern DkimStatus DkimSigner_signWithEd25519Key(DkimSigner *self, const char *selector,
+                                                const unsigned char *privatekey,
+                                                const char **headerf, const char **headerv);
+extern DkimStatus DkimSigner_signBatch(DkimSigner *const *signers, size_t signernum,
+                                       const char *selector, EVP_PKEY *pkey,
+                                       const char **headerf, const char **headerv);
+extern DkimStatus DkimSigner_signBatchWithEd25519Key(DkimSigner *const *signers,
+                                                     size_t signernum, const char *selector,
+                                                     const unsigned char *privatekey,
+                                                     const char **headerf,
+                                                     const char **headerv);
 extern DkimStatus DkimSigner_enableC14nDump(DkimSigner *self, const char *basedir,
                                           const char *prefix);
 
@@ -17,6 +17,7 @@
 #include "dkimpolicybase.h"
 
 typedef struct DkimCanonicalizer DkimCanonicalizer;
+typedef DkimStatus (*DkimCanonicalizerSink) (void *arg, const unsigned char *buf, size_t len);
 
 extern DkimCanonicalizer *DkimCanonicalizer_new(const DkimPolicyBase *policy,
                                                 DkimC14nAlgorithm headeralg,
@@ -27,6 +28,7 @@ extern DkimStatus DkimCanonicalizer_header(DkimCanonicalizer *self, const char *
                                            const char *headerv, bool crlf,
                                            bool suppose_leadeing_header_space,
                                            const unsigned char **canonbuf, size_t *canonsize);
+extern DkimC14nAlgorithm DkimCanonicalizer_getHeaderAlgorithm(const DkimCanonicalizer *self);
 extern DkimStatus DkimCanonicalizer_signheader(DkimCanonicalizer *self, const char *headerf,
                                                const char *headerv,
                                                bool suppose_leadeing_header_space,
@@ -36,6 +38,9 @@ extern DkimStatus DkimCanonicalizer_signheader(DkimCanonicalizer *self, const ch
 extern DkimStatus DkimCanonicalizer_body(DkimCanonicalizer *self, const unsigned char *bodyp,
                                          size_t bodylen, const unsigned char **canonbuf,
                                          size_t *canonsize);
+extern DkimStatus DkimCanonicalizer_bodyToSink(DkimCanonicalizer *self, const unsigned char *bodyp,
+                                               size_t bodylen, DkimCanonicalizerSink sink,
+                                               void *arg);
 extern DkimStatus DkimCanonicalizer_finalizeBody(DkimCanonicalizer *self,
                                                  const unsigned char **canonbuf, size_t *canonsize);
 
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_CRYPTOPOOL_H__
+#define __DKIM_CRYPTOPOOL_H__
+
+#include <sys/types.h>
+
+#include "dkim.h"
+
+typedef struct DkimCryptoPool DkimCryptoPool;
+typedef void (*DkimCryptoJob) (void *arg, size_t jobidx);
+
+extern DkimCryptoPool *DkimCryptoPool_new(size_t thread_num);
+extern void DkimCryptoPool_free(DkimCryptoPool *self);
+extern DkimStatus DkimCryptoPool_execute(DkimCryptoPool *self, DkimCryptoJob job, void *arg,
+                                         size_t jobnum);
+
+#endif /* __DKIM_CRYPTOPOOL_H__ */
@@ -12,6 +12,7 @@
 #ifndef __DKIM_DIGESTER_H__
 #define __DKIM_DIGESTER_H__
 
+#include <stdbool.h>
 #include <openssl/evp.h>
 
 #include "strarray.h"
@@ -19,6 +20,9 @@
 #include "dkim.h"
 #include "dkimpolicybase.h"
 #include "dkimsignature.h"
+#include "dkimpublickey.h"
+#include "dkimheaderindex.h"
+#include "dkimverdictcache.h"
 
 typedef struct DkimDigester DkimDigester;
 
@@ -31,10 +35,27 @@ extern DkimDigester *DkimDigester_newWithSignature(const DkimPolicyBase *policy,
                                                    DkimStatus *dstat);
 extern void DkimDigester_free(DkimDigester *self);
 extern DkimStatus DkimDigester_updateBody(DkimDigester *self, const unsigned char *buf, size_t len);
-extern DkimStatus DkimDigester_verifyMessage(DkimDigester *self, const MailHeaders *headers,
-                                             const DkimSignature *signature, EVP_PKEY *pkey);
-extern DkimStatus DkimDigester_signMessage(DkimDigester *self, const MailHeaders *headers,
+extern bool DkimDigester_isBodyDigestShareable(const DkimDigester *self, const DkimDigester *other);
+extern void DkimDigester_shareBodyDigest(DkimDigester *self, DkimDigester *source);
+extern DkimStatus DkimDigester_finalizeBodyDigest(DkimDigester *self);
+extern DkimStatus DkimDigester_verifyBody(DkimDigester *self, const DkimSignature *signature);
+extern DkimStatus DkimDigester_verifyHeader(DkimDigester *self,
+                                            const DkimHeaderIndex *header_index,
+                                            const DkimSignature *signature,
+                                            const DkimPublicKey *publickey,
+                                            DkimVerdictCache *verdict_cache);
+extern DkimStatus DkimDigester_verifyMessage(DkimDigester *self,
+                                             const DkimHeaderIndex *header_index,
+                                             const DkimSignature *signature,
+                                             const DkimPublicKey *publickey,
+                                             DkimVerdictCache *verdict_cache);
+extern DkimStatus DkimDigester_signMessage(DkimDigester *self,
+                                           const DkimHeaderIndex *header_index,
                                            DkimSignature *signature, EVP_PKEY *pkey);
+extern DkimStatus DkimDigester_signMessageWithEd25519(DkimDigester *self,
+                                                      const DkimHeaderIndex *header_index,
+                                                      DkimSignature *signature,
+                                                      const unsigned char *privatekey);
 extern DkimStatus DkimDigester_enableC14nDump(DkimDigester *self, const char *fnHeaderDump,
                                               const char *fnBodyDump);
 
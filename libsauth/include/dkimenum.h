@@ -23,6 +23,7 @@ typedef enum DkimC14nAlgorithm {
 typedef enum DkimKeyType {
     DKIM_KEY_TYPE_NULL = 0,
     DKIM_KEY_TYPE_RSA,
+    DKIM_KEY_TYPE_ED25519,      // [RFC8463]
     DKIM_KEY_TYPE_ANY = 0xffffffff,
 } DkimKeyType;
 
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_HEADERINDEX_H__
+#define __DKIM_HEADERINDEX_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "dkim.h"
+#include "mailheaders.h"
+#include "dkimenum.h"
+#include "dkimcanonicalizer.h"
+
+typedef struct DkimHeaderIndex DkimHeaderIndex;
+
+extern DkimHeaderIndex *DkimHeaderIndex_new(const MailHeaders *headers);
+extern void DkimHeaderIndex_free(DkimHeaderIndex *self);
+extern const MailHeaders *DkimHeaderIndex_getHeaders(const DkimHeaderIndex *self);
+extern size_t DkimHeaderIndex_getNameCount(const DkimHeaderIndex *self);
+extern bool DkimHeaderIndex_pickBottomMost(const DkimHeaderIndex *self, const char *fieldname,
+                                           size_t *cursor, const char **headerf,
+                                           const char **headerv, size_t *headeridx);
+extern DkimStatus DkimHeaderIndex_canonicalize(const DkimHeaderIndex *self, size_t headeridx,
+                                               DkimCanonicalizer *canon,
+                                               bool suppose_leading_header_space,
+                                               const unsigned char **canonbuf, size_t *canonsize);
+
+#endif /* __DKIM_HEADERINDEX_H__ */
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_LOOKUPPOOL_H__
+#define __DKIM_LOOKUPPOOL_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#include "dnsresolv.h"
+
+typedef struct DkimLookupPool DkimLookupPool;
+typedef struct DkimLookupTask DkimLookupTask;
+typedef void (*DkimLookupJob) (void *arg, DnsResolver *resolver);
+
+extern DkimLookupPool *DkimLookupPool_new(size_t thread_num, size_t inflight_limit);
+extern void DkimLookupPool_free(DkimLookupPool *self);
+extern DkimLookupTask *DkimLookupPool_submit(DkimLookupPool *self, DkimLookupJob job, void *arg);
+extern bool DkimLookupPool_wait(DkimLookupPool *self, DkimLookupTask *task);
+
+#endif /* __DKIM_LOOKUPPOOL_H__ */
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_LRUCACHE_H__
+#define __DKIM_LRUCACHE_H__
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * links of the cache entry.
+ * each cache embeds it as the first member of its own entry structure.
+ */
+typedef struct DkimLruCacheEntry {
+    unsigned int hash;
+    time_t expire;
+    struct DkimLruCacheEntry *chain;    // next entry in the same hash bucket
+    struct DkimLruCacheEntry *lru_prev; // more recently used entry
+    struct DkimLruCacheEntry *lru_next; // less recently used entry
+} DkimLruCacheEntry;
+
+typedef struct DkimLruCache DkimLruCache;
+typedef bool (*DkimLruCacheMatcher) (const DkimLruCacheEntry *entry, const void *key);
+typedef bool (*DkimLruCacheReader) (const DkimLruCacheEntry *entry, void *arg);
+typedef void (*DkimLruCacheReleaser) (DkimLruCacheEntry *entry);
+
+extern DkimLruCache *DkimLruCache_new(size_t max_entries, DkimLruCacheMatcher matcher,
+                                      DkimLruCacheReleaser releaser);
+extern void DkimLruCache_free(DkimLruCache *self);
+extern bool DkimLruCache_lookup(DkimLruCache *self, const void *key, unsigned int hash,
+                                DkimLruCacheReader reader, void *arg);
+extern void DkimLruCache_insert(DkimLruCache *self, DkimLruCacheEntry *entry, const void *key,
+                                unsigned int hash, unsigned int ttl);
+
+#endif /* __DKIM_LRUCACHE_H__ */
@@ -20,16 +20,23 @@
 #include "dkimpolicybase.h"
 #include "dkimtaglistobject.h"
 #include "dkimsignature.h"
+#include "dkimpublickeycache.h"
+
+// length of the fingerprint of the public key, the size of SHA-256 digest
+#define DKIM_PUBLICKEY_FINGERPRINT_LEN 32
 
 typedef struct DkimPublicKey DkimPublicKey;
 
 extern DkimPublicKey *DkimPublicKey_build(const DkimPolicyBase *policy, const char *keyval,
                                           const char *domain, DkimStatus *dstat);
+extern DkimPublicKey *DkimPublicKey_ref(DkimPublicKey *self);
 extern void DkimPublicKey_free(DkimPublicKey *self);
 extern DkimPublicKey *DkimPublicKey_lookup(const DkimPolicyBase *policy,
                                            const DkimSignature *signature, DnsResolver *resolver,
-                                           DkimStatus *dstat);
+                                           DkimPublicKeyCache *cache, DkimStatus *dstat);
 extern EVP_PKEY *DkimPublicKey_getPublicKey(const DkimPublicKey *self);
+extern const unsigned char *DkimPublicKey_getEd25519Key(const DkimPublicKey *self);
+extern const unsigned char *DkimPublicKey_getFingerprint(const DkimPublicKey *self);
 extern bool DkimPublicKey_isTesting(const DkimPublicKey *self);
 extern bool DkimPublicKey_isSubdomainProhibited(const DkimPublicKey *self);
 extern bool DkimPublicKey_isEMailServiceUsable(const DkimPublicKey *self);
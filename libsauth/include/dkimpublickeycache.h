@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_PUBLICKEYCACHE_H__
+#define __DKIM_PUBLICKEYCACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ptrarray.h"
+#include "dkim.h"
+
+typedef struct DkimPublicKeyCache DkimPublicKeyCache;
+
+extern DkimPublicKeyCache *DkimPublicKeyCache_new(size_t max_entries, unsigned int max_ttl,
+                                                  unsigned int negative_ttl);
+extern void DkimPublicKeyCache_free(DkimPublicKeyCache *self);
+extern bool DkimPublicKeyCache_lookup(DkimPublicKeyCache *self, const char *name, PtrArray *keys,
+                                      DkimStatus *status);
+extern DkimStatus DkimPublicKeyCache_store(DkimPublicKeyCache *self, const char *name,
+                                           const PtrArray *keys, DkimStatus status, uint32_t ttl);
+
+#endif /* __DKIM_PUBLICKEYCACHE_H__ */
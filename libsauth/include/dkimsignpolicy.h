@@ -16,6 +16,7 @@
 
 #include "dkimenum.h"
 #include "dkimpolicybase.h"
+#include "dkimcryptopool.h"
 
 struct DkimSignPolicy {
     DkimPolicyBase_MEMBER;
@@ -32,6 +33,8 @@ struct DkimSignPolicy {
     DkimC14nAlgorithm canon_method_body;
     // use CRLF as end-on-line character for DKIM-Signature headers to be generated
     bool sign_header_with_crlf;
+    // worker threads to sign the messages of a batch, NULL to sign on the caller's thread
+    DkimCryptoPool *crypto_pool;
 };
 
 #endif /* __DKIM_SIGNPOLICY_H__ */
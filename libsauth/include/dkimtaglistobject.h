@@ -38,8 +38,34 @@ typedef const struct DkimTagListObjectFieldMap {
     uint32_t parsed_mask;
 } DkimTagListObjectFieldMap;
 
+// the maximum number of the entries of a field map, limited by the width of parsed_mask
+#define DKIM_TAGLISTOBJECT_FIELD_MAX 32
+// tag-name begins with ALPHA, which is within US-ASCII
+#define DKIM_TAGLISTOBJECT_DISPATCH_SIZE 128
+
+/*
+ * field map compiled for dispatching, built from DkimTagListObjectFieldMap on the first use.
+ * define each instance with DKIM_TAGLISTOBJECT_FIELD_TABLE() statically.
+ */
+typedef struct DkimTagListObjectFieldTable {
+    DkimTagListObjectFieldMap *fieldmap;
+    bool compiled;
+    // parsed_mask of all the required tags
+    uint32_t required_mask;
+    // parsed_mask of all the tags with default values
+    uint32_t default_mask;
+    // the first character of tag-name -> (index of the first candidate in "fieldmap" + 1), 0 if none
+    uint8_t dispatch[DKIM_TAGLISTOBJECT_DISPATCH_SIZE];
+    // index in "fieldmap" -> (index of the next candidate with the same first character + 1), 0 if none
+    uint8_t collision[DKIM_TAGLISTOBJECT_FIELD_MAX];
+    // bit position of parsed_mask -> index in "fieldmap"
+    uint8_t bitindex[DKIM_TAGLISTOBJECT_FIELD_MAX];
+} DkimTagListObjectFieldTable;
+
+#define DKIM_TAGLISTOBJECT_FIELD_TABLE(__fieldmap) {(__fieldmap), false, 0, 0, {0}, {0}, {0}}
+
 #define DkimTagListObject_MEMBER        \
-    DkimTagListObjectFieldMap *ftbl;    \
+    DkimTagListObjectFieldTable *ftbl;  \
     const DkimPolicyBase *policy;       \
     uint32_t parsed_flag
 
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_VERDICTCACHE_H__
+#define __DKIM_VERDICTCACHE_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "dkim.h"
+
+// length of the key of DkimVerdictCache, the size of SHA-256 digest
+#define DKIM_VERDICTCACHE_KEY_LEN 32
+
+typedef struct DkimVerdictCache DkimVerdictCache;
+
+extern DkimVerdictCache *DkimVerdictCache_new(size_t max_entries, unsigned int ttl);
+extern void DkimVerdictCache_free(DkimVerdictCache *self);
+extern bool DkimVerdictCache_lookup(DkimVerdictCache *self, const unsigned char *key,
+                                    DkimStatus *verdict);
+extern DkimStatus DkimVerdictCache_store(DkimVerdictCache *self, const unsigned char *key,
+                                         DkimStatus verdict);
+
+#endif /* __DKIM_VERDICTCACHE_H__ */
@@ -15,6 +15,10 @@
 #include <sys/types.h>
 #include <stdbool.h>
 #include "dkimpolicybase.h"
+#include "dkimpublickeycache.h"
+#include "dkimverdictcache.h"
+#include "dkimcryptopool.h"
+#include "dkimlookuppool.h"
 
 struct DkimVerificationPolicy {
     DkimPolicyBase_MEMBER;
@@ -25,6 +29,18 @@ struct DkimVerificationPolicy {
     size_t sign_header_limit;
     // whether or not to treat expired DKIM signatures as valid
     bool accept_expired_signature;
+    // whether or not to skip RSA signatures if an Ed25519 signature of the same domain is valid
+    bool prefer_ed25519;
+    // whether or not to leave the rest of the signatures unevaluated once an author domain signature is verified
+    bool stop_at_author_signature;
+    // cache of public key records shared among verifications, NULL if disabled
+    DkimPublicKeyCache *pubkey_cache;
+    // cache of the results of signature verification shared among verifications, NULL if disabled
+    DkimVerdictCache *verdict_cache;
+    // worker threads to verify the signatures, NULL to verify on the caller's thread
+    DkimCryptoPool *crypto_pool;
+    // worker threads to run the DNS lookups started ahead, NULL to disable the lookups ahead
+    DkimLookupPool *lookup_pool;
 };
 
 #endif /* __DKIM_VERIFICATIONPOLICY_H__ */
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __DKIM_VERIFIER_H__
+#define __DKIM_VERIFIER_H__
+
+#include "dkim.h"
+#include "dkimdigester.h"
+
+extern DkimDigester *DkimVerifier_findBodyDigester(const DkimVerifier *self,
+                                                   const DkimDigester *digester);
+
+#endif /* __DKIM_VERIFIER_H__ */
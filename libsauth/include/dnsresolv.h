@@ -96,6 +96,7 @@ extern dns_stat_t DnsResolver_lookupPtr(DnsResolver *self, sa_family_t af, const
                                         DnsPtrResponse **resp);
 
 extern const char *DnsResolver_getErrorString(const DnsResolver *self);
+extern uint32_t DnsResolver_getTtl(const DnsResolver *self);
 
 #ifndef _PATH_RESCONF
 #define _PATH_RESCONF  "/etc/resolv.conf"
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __ED25519_H__
+#define __ED25519_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define ED25519_PUBLICKEY_LEN 32
+#define ED25519_PRIVATEKEY_LEN 32
+#define ED25519_SIGNATURE_LEN 64
+
+extern void Ed25519_derivePublicKey(unsigned char *publickey, const unsigned char *privatekey);
+extern void Ed25519_sign(unsigned char *signature, const unsigned char *msg, size_t msglen,
+                         const unsigned char *privatekey, const unsigned char *publickey);
+extern bool Ed25519_verify(const unsigned char *signature, const unsigned char *msg,
+                           size_t msglen, const unsigned char *publickey);
+
+#endif /* __ED25519_H__ */
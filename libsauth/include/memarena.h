@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#ifndef __MEMARENA_H__
+#define __MEMARENA_H__
+
+#include <sys/types.h>
+
+struct MemArena;
+typedef struct MemArena MemArena;
+
+extern MemArena *MemArena_new(size_t blocksize);
+extern void MemArena_free(MemArena *self);
+extern void MemArena_reset(MemArena *self);
+extern void *MemArena_alloc(MemArena *self, size_t size);
+extern void *MemArena_calloc(MemArena *self, size_t size);
+extern char *MemArena_strdup(MemArena *self, const char *s);
+extern char *MemArena_strpdup(MemArena *self, const char *head, const char *tail);
+extern size_t MemArena_getUsage(const MemArena *self);
+
+#endif /* __MEMARENA_H__ */
@@ -81,6 +81,62 @@ typedef enum SidfCustomAction {
 typedef struct SidfPolicy SidfPolicy;
 typedef struct SidfRequest SidfRequest;
 
+typedef enum SidfQueryType {
+    SIDF_QUERY_A = 1,
+    SIDF_QUERY_AAAA,
+    SIDF_QUERY_MX,
+    SIDF_QUERY_TXT,
+    SIDF_QUERY_SPF,
+    SIDF_QUERY_PTR,
+} SidfQueryType;
+
+// DNS query a suspended evaluation is waiting for
+typedef struct SidfQuery {
+    SidfQueryType type;
+    const char *domain;         // NULL for SIDF_QUERY_PTR
+    sa_family_t sa_family;      // SIDF_QUERY_PTR only
+    const void *addr;           // SIDF_QUERY_PTR only, struct in_addr or struct in6_addr
+} SidfQuery;
+
+// answer to SidfQuery to resume the evaluation with, referred to only during SidfRequest_resume()
+typedef struct SidfAnswer {
+    dns_stat_t stat;
+    size_t num;                 // the number of records, 0 unless stat is DNS_STAT_NOERROR
+    union {
+        const struct in_addr *addr4;    // SIDF_QUERY_A
+        const struct in6_addr *addr6;   // SIDF_QUERY_AAAA
+        const char *const *str; // data of SIDF_QUERY_TXT/SPF, domain names of SIDF_QUERY_MX/PTR
+    } rr;
+    const char *error;          // error message for logging, may be NULL
+} SidfAnswer;
+
+typedef enum SidfTraceEvent {
+    SIDF_TRACE_CHECK_HOST = 1,  // check_host() is called with "domain"
+    SIDF_TRACE_CHECK_HOST_RESULT,   // check_host() with "domain" returned "score"
+    SIDF_TRACE_TERM_RESULT,     // "term" in the record of "domain" was evaluated to "score"
+    SIDF_TRACE_RECORD,          // "record" was selected as the SPF/SIDF record of "domain"
+    SIDF_TRACE_DNS_QUERY,       // "query" was issued while evaluating the record of "domain"
+    SIDF_TRACE_DNS_ANSWER,      // "answer" to "query" was given "latency" microseconds after the query
+    SIDF_TRACE_INCLUDE_REUSED,  // check_host() with "domain" was not performed but its earlier "score" was reused
+} SidfTraceEvent;
+
+typedef struct SidfTrace {
+    SidfTraceEvent event;
+    unsigned int depth;         // the depth of "include:" and "redirect=" recursion
+    const char *domain;         // <domain> argument of the current check_host()
+    const char *term;           // name of the mechanism or modifier, SIDF_TRACE_TERM_RESULT only
+    bool macro;                 // true if <domain-spec> of "term" contains macros
+    SidfScore score;            // SIDF_SCORE_NULL if the mechanism didn't match
+    unsigned int dns_mech_count;    // counters at the time of the event
+    unsigned int dns_query_count;
+    const char *record;         // SIDF_TRACE_RECORD only
+    const SidfQuery *query;     // SIDF_TRACE_DNS_QUERY and SIDF_TRACE_DNS_ANSWER only
+    const SidfAnswer *answer;   // SIDF_TRACE_DNS_ANSWER only
+    unsigned int latency;       // SIDF_TRACE_DNS_ANSWER only, in microseconds
+} SidfTrace;
+
+typedef void (*SidfTraceHandler) (const SidfTrace *trace, void *arg);
+
 // SidfPolicy
 extern SidfPolicy *SidfPolicy_new(void);
 extern void SidfPolicy_free(SidfPolicy *self);
@@ -91,6 +147,9 @@ extern SidfStat SidfPolicy_setLocalPolicyExplanation(SidfPolicy *self, const cha
 extern void SidfPolicy_setLogger(SidfPolicy *self,
                                  void (*logger) (int priority, const char *message, ...));
 extern void SidfPolicy_setExplanationLookup(SidfPolicy *self, bool flag);
+extern void SidfPolicy_setMaxVoidLookup(SidfPolicy *self, unsigned int limit);
+extern void SidfPolicy_setMaxDnsQuery(SidfPolicy *self, unsigned int limit);
+extern void SidfPolicy_setEvalTimeout(SidfPolicy *self, unsigned int msec);
 
 // SidfRequest
 extern SidfRequest *SidfRequest_new(const SidfPolicy *policy, DnsResolver *resolver);
@@ -99,8 +158,17 @@ extern void SidfRequest_free(SidfRequest *self);
 extern bool SidfRequest_isSenderContext(const SidfRequest *self);
 extern const char *SidfRequest_getExplanation(const SidfRequest *self);
 extern SidfScore SidfRequest_eval(SidfRequest *self, SidfRecordScope scope);
+extern bool SidfRequest_start(SidfRequest *self, SidfRecordScope scope, SidfScore *score);
+extern const SidfQuery *SidfRequest_getQuery(const SidfRequest *self);
+extern bool SidfRequest_resume(SidfRequest *self, const SidfAnswer *answer, SidfScore *score);
+extern void SidfRequest_setTraceHandler(SidfRequest *self, SidfTraceHandler handler, void *arg);
+extern unsigned int SidfRequest_getDnsMechCount(const SidfRequest *self);
+extern unsigned int SidfRequest_getVoidLookupCount(const SidfRequest *self);
+extern unsigned int SidfRequest_getDnsQueryCount(const SidfRequest *self);
+extern unsigned int SidfRequest_getEvalTime(const SidfRequest *self);
 extern bool SidfRequest_setSender(SidfRequest *self, const InetMailbox *sender);
 extern bool SidfRequest_setHeloDomain(SidfRequest *self, const char *domain);
+extern void SidfRequest_setResolver(SidfRequest *self, DnsResolver *resolver);
 extern bool SidfRequest_setIpAddr(SidfRequest *self, sa_family_t sa_family,
                                   const struct sockaddr *addr);
 extern bool SidfRequest_setIpAddrString(SidfRequest *self, sa_family_t sa_family,
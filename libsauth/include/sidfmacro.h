@@ -12,13 +12,22 @@
 #ifndef __SIDFMACRO_H__
 #define __SIDFMACRO_H__
 
+#include <stdbool.h>
 #include "xbuffer.h"
 #include "sidf.h"
 #include "sidfrecord.h"
 
-extern SidfStat SidfMacro_parseDomainSpec(const SidfRequest *request, const char *head,
-                                          const char *tail, const char **nextp, XBuffer *xbuf);
-extern SidfStat SidfMacro_parseExplainString(const SidfRequest *request, const char *head,
-                                             const char *tail, const char **nextp, XBuffer *xbuf);
+typedef struct SidfMacroProgram SidfMacroProgram;
+
+extern SidfStat SidfMacro_compileDomainSpec(const SidfRequest *request, const char *head,
+                                            const char *tail, const char **nextp,
+                                            SidfMacroProgram **program);
+extern SidfStat SidfMacro_compileExplainString(const SidfRequest *request, const char *head,
+                                               const char *tail, const char **nextp,
+                                               SidfMacroProgram **program);
+extern SidfStat SidfMacro_expand(SidfRequest *request, const SidfMacroProgram *program,
+                                 XBuffer *xbuf);
+extern bool SidfMacro_hasMacroExpand(const SidfMacroProgram *program);
+extern bool SidfMacro_needsValidatedDomain(const SidfMacroProgram *program);
 
 #endif /* __SIDFMACRO_H__ */
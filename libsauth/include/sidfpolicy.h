@@ -32,6 +32,14 @@ struct SidfPolicy {
     // the maximum limit of mechanisms which involves DNS lookups per an evaluation.
     // RFC4408 defines this as 10. DO NOT TOUCH NORMALLY.
     unsigned int max_dns_mech;
+    // the maximum limit of DNS lookups of terms which return no answers (NXDOMAIN or NODATA)
+    // per an evaluation. RFC7208 (4.6.4.) recommends 2. 0 for unlimited.
+    unsigned int max_void_lookup;
+    // the maximum limit of DNS queries issued per an evaluation,
+    // including record lookups and address lookups of "mx" and "ptr". 0 for unlimited.
+    unsigned int max_dns_query;
+    // 1回の評価に費やす時間の上限 (ミリ秒), 越えた場合は TempError. 0 for unlimited.
+    unsigned int eval_timeout;
     // check_host() 関数の <domain> 引数に含まれる label の最大長, RFC4408 defines this as 63.
     unsigned int max_label_len;
     // mx メカニズム評価中に1回のMXレコードのルックアップに対するレスポンスとして受け取るRRの最大数
@@ -54,14 +54,19 @@ typedef struct SidfTerm {
     // param.domain 内のどこかへの参照を保持し, 通常は先頭を指す.
     // RFC4408 (8.1.) defines this as 253. DO NOT TOUCH NORMALLY.
     const char *querydomain;
+    // domain-spec which contains macro-expand, compiled at parse time and expanded on evaluation.
+    // param.domain and querydomain are left NULL in that case. use SidfTerm_getTargetName().
+    const struct SidfMacroProgram *macro;
 } SidfTerm;
 
 typedef struct SidfRecord {
     // マクロを展開してから保持する選択をしたので, リクエストに依存するのは避けられない
-    const SidfRequest *request;
+    SidfRequest *request;
     SidfRecordScope scope;
     const char *domain;
-    PtrArray *directives;
+    // directives in the order of appearance, allocated from the arena of the request
+    SidfTerm **directives;
+    unsigned int directive_num;
     struct spf_modifiers {
         SidfTerm *rediect;
         SidfTerm *exp;
@@ -69,10 +74,11 @@ typedef struct SidfRecord {
     // PtrArray *modifiers;
 } SidfRecord;
 
-extern SidfStat SidfRecord_build(const SidfRequest *request, SidfRecordScope scope,
+extern SidfStat SidfRecord_build(SidfRequest *request, SidfRecordScope scope,
                                  const char *record_head, const char *record_tail,
                                  SidfRecord **recordobj);
-extern void SidfRecord_free(SidfRecord *self);
+extern SidfStat SidfTerm_getTargetName(const SidfTerm *self, SidfRequest *request,
+                                       const char **target);
 extern SidfStat SidfRecord_getSidfScope(const SidfRequest *request, const char *record_head,
                                         const char *record_tail, SidfRecordScope *scope,
                                         const char **scope_tail);
@@ -14,6 +14,7 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -21,11 +22,15 @@
 
 #include "xbuffer.h"
 #include "strarray.h"
+#include "memarena.h"
 #include "inetmailbox.h"
 #include "dnsresolv.h"
 #include "sidf.h"
 #include "sidfpolicy.h"
 
+struct SidfIncludeMemo;
+struct SidfFrame;
+
 struct SidfRequest {
     const SidfPolicy *policy;
     SidfRecordScope scope;      // evaluation scope: SPF1, SPF2_MFROM or SPF2_PRA
@@ -39,19 +44,36 @@ struct SidfRequest {
      * false if "HELO" identity is chosen (SPF-scope only)
      */
     bool is_sender_context;
-    StrArray *domain;
+    StrArray *domain;           // stack of <domain> arguments of check_host(), elements are allocated from "arena"
     char *helo_domain;
     InetMailbox *sender;
     unsigned int dns_mech_count;    // the number of mechanisms which involves DNS lookups, encountered during evaluation
+    unsigned int void_lookup_count; // the number of DNS lookups of terms which returned no answers (RFC7208 4.6.4.)
+    unsigned int dns_query_count;   // the number of DNS queries issued during evaluation
+    struct timeval eval_start;  // the time the evaluation started
+    unsigned int eval_time;     // wall-clock time the last evaluation took (milliseconds)
+    SidfScore budget_score;     // non-NULL once the evaluation exceeded max_dns_query or eval_timeout
     unsigned int redirect_depth;    // the depth of "redirect=" modifier
     unsigned int include_depth; // the depth of "include:" mechanism
     bool local_policy_mode;     // true while evaluating local-policy, to prevent infinite loop
     XBuffer *xbuf;
+    MemArena *arena;            // records, terms and macro expansions live here until the next evaluation
+    struct SidfIncludeMemo *include_memo;   // results of "include:" evaluated so far, allocated from "arena"
     DnsResolver *resolver;      // reference to the DnsResolver object
     char *explanation;          // explanation string provided by "exp=" modifier at "hardfail" result
+    SidfTraceHandler trace_handler; // called on each step of evaluation if set
+    void *trace_arg;
+    // state of the evaluation suspended on a DNS query, frames are allocated from "arena"
+    struct SidfFrame *frame;    // the innermost frame being evaluated, NULL if not evaluating
+    struct SidfFrame *free_frame;   // frames returned, to be reused
+    bool query_pending;         // true while waiting for the answer to "query"
+    SidfQuery query;
+    struct timeval query_start; // the time "query" was issued, only recorded while tracing
+    const SidfAnswer *answer;   // the answer to "query" given to SidfRequest_resume()
+    const char *validated_domain;   // value of "p" macro, resolved just before the expansion
+    SidfScore result;           // the result of the evaluation once all the frames returned
 };
 
 extern const char *SidfRequest_getDomain(const SidfRequest *self);
-extern int SidfRequest_isValidatedDomainName(const SidfRequest *request, const char *revdomain);
 
 #endif /* __SIDFREQUEST_H__ */
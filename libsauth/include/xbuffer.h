@@ -25,6 +25,7 @@ typedef size_t xbuffer_savepoint_t;
 
 extern int XBuffer_appendByte(XBuffer *self, unsigned char b);
 extern int XBuffer_appendBytes(XBuffer *self, const void *b, size_t size);
+extern void *XBuffer_appendSpace(XBuffer *self, size_t size);
 extern int XBuffer_appendXBuffer(XBuffer *self, const XBuffer *xbuf);
 extern int XBuffer_appendChar(XBuffer *self, char c);
 extern int XBuffer_appendFormatString(XBuffer *self, const char *format, ...)
@@ -41,6 +41,7 @@ struct DnsResolver {
     struct __res_state resolver;
     ns_msg msghanlde;
     dns_stat_t status;
+    uint32_t ttl;   // the minimum TTL of the answer section of the last response
     int msglen;
     unsigned char msgbuf[NS_MAXMSG];
 };
@@ -303,6 +304,7 @@ static void
 DnsResolver_resetErrorState(DnsResolver *self)
 {
     self->status = DNS_STAT_NOERROR;
+    self->ttl = 0;
 }   // end function: DnsResolver_resetErrorState
 
 static const char *
@@ -342,6 +344,32 @@ DnsResolver_getErrorString(const DnsResolver *self)
     return DnsResolver_statcode2string(self->status);
 }   // end function: DnsResolver_getErrorString
 
+/**
+ * @return the minimum TTL of the answer records of the last lookup,
+ *         0 if the last lookup didn't succeed.
+ */
+uint32_t
+DnsResolver_getTtl(const DnsResolver *self)
+{
+    return DNS_STAT_NOERROR == self->status ? self->ttl : 0;
+}   // end function: DnsResolver_getTtl
+
+static void
+DnsResolver_setTtl(DnsResolver *self)
+{
+    size_t msg_count = ns_msg_count(self->msghanlde, ns_s_an);
+    for (size_t n = 0; n < msg_count; ++n) {
+        ns_rr rr;
+        if (0 != ns_parserr(&self->msghanlde, ns_s_an, n, &rr)) {
+            // reported by the caller parsing the same section
+            break;
+        }   // end if
+        if (0 == n || ns_rr_ttl(rr) < self->ttl) {
+            self->ttl = ns_rr_ttl(rr);
+        }   // end if
+    }   // end for
+}   // end function: DnsResolver_setTtl
+
 /*
  * throw a DNS query and receive a response of it
  * @return
@@ -361,6 +389,7 @@ DnsResolver_query(DnsResolver *self, const char *domain, uint16_t rrtype)
     if (ns_r_noerror != rcode_flag) {
         return DnsResolver_setRcode(self, rcode_flag);
     }   // end if
+    DnsResolver_setTtl(self);
     return DNS_STAT_NOERROR;
 }   // end function: DnsResolver_query
 
@@ -48,6 +48,9 @@ static const DkimTagListObjectFieldMap dkim_adsp_field_table[] = {
     {NULL, NULL, false, NULL, 0},   // sentinel
 };
 
+static DkimTagListObjectFieldTable dkim_adsp_tag_table =
+    DKIM_TAGLISTOBJECT_FIELD_TABLE(dkim_adsp_field_table);
+
 /*
  * [RFC5617] 4.2.1.
  * adsp-dkim-tag = %x64.6b.69.6d *WSP "=" *WSP
@@ -120,7 +123,7 @@ DkimAdsp_build(const DkimPolicyBase *policy, const char *keyval, DkimStatus *dst
     }   // end if
     memset(self, 0, sizeof(DkimAdsp));
     self->policy = policy;
-    self->ftbl = dkim_adsp_field_table;
+    self->ftbl = &dkim_adsp_tag_table;
 
     /*
      * [RFC5617] 4.1.
@@ -19,7 +19,13 @@ RCSID("$Id: dkimcanonicalizer.c 1476 2012-01-30 07:50:28Z takahiko $");
 #include <strings.h>
 #include <assert.h>
 #include <stdbool.h>
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
+#include "stdaux.h"
 #include "dkimlogger.h"
 #include "xskip.h"
 #include "strtokarray.h"
@@ -165,6 +171,57 @@ DkimCanonicalizer_headerWithSimple(DkimCanonicalizer *self, const char *headerf,
     return DSTAT_OK;
 }   // end function: DkimCanonicalizer_headerWithSimple
 
+/**
+ * find the first CR, LF or WSP in the header field value.
+ * scans 32 (with AVX2) or 16 (with SSE2) octets at a time, and the rest octet by octet.
+ * @return a pointer to the first CR, LF, SP or HTAB in [head, tail), or "tail" if not found.
+ */
+static inline const char *
+DkimCanonicalizer_findCrLfWsp(const char *head, const char *tail)
+{
+    const char *p = head;
+#if defined(__AVX2__)
+    const __m256i cr32 = _mm256_set1_epi8('\r');
+    const __m256i lf32 = _mm256_set1_epi8('\n');
+    const __m256i sp32 = _mm256_set1_epi8(' ');
+    const __m256i ht32 = _mm256_set1_epi8('\t');
+    for (; 32 <= tail - p; p += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, cr32),
+                                                      _mm256_cmpeq_epi8(block, lf32)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(block, sp32),
+                                                      _mm256_cmpeq_epi8(block, ht32)));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+        if (0 != mask) {
+            return p + __builtin_ctz(mask);
+        }   // end if
+    }   // end for
+#endif
+#if defined(__SSE2__)
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    const __m128i lf16 = _mm_set1_epi8('\n');
+    const __m128i sp16 = _mm_set1_epi8(' ');
+    const __m128i ht16 = _mm_set1_epi8('\t');
+    for (; 16 <= tail - p; p += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, cr16),
+                                                _mm_cmpeq_epi8(block, lf16)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(block, sp16),
+                                                _mm_cmpeq_epi8(block, ht16)));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(hit);
+        if (0 != mask) {
+            return p + __builtin_ctz(mask);
+        }   // end if
+    }   // end for
+#endif
+    for (; p < tail; ++p) {
+        if (IS_CR(*p) || IS_LF(*p) || IS_WSP(*p)) {
+            break;
+        }   // end if
+    }   // end for
+    return p;
+}   // end function: DkimCanonicalizer_findCrLfWsp
+
 /**
  * canonicalize a header with "relaxed" algorithm.
  * @param headerf header field name
@@ -210,7 +267,8 @@ DkimCanonicalizer_headerWithRelaxed(DkimCanonicalizer *self, const char *headerf
 
     // memory allocation
     // 4 bytes for ":", trailing CRLF and NULL terminator.
-    size_t buflen = strlen(headerf) + strlen(headerv) + 4;
+    size_t headervlen = strlen(headerv);
+    size_t buflen = strlen(headerf) + headervlen + 4;
     DkimStatus assure_stat = DkimCanonicalizer_assureBuffer(self, buflen);
     if (DSTAT_OK != assure_stat) {
         self->canonlen = 0;
@@ -242,21 +300,31 @@ DkimCanonicalizer_headerWithRelaxed(DkimCanonicalizer *self, const char *headerf
     for (p = headerv; IS_WSP(*p); ++p);
 
     // write out header field value.
+    // the runs of the characters other than CR, LF and WSP are copied at once.
+    const char *headerv_tail = headerv + headervlen;
     store_wsp = false;
-    for (; *p != '\0'; ++p) {
-        if (*p == '\r' || *p == '\n') {
-            // header の場合 folding 以外の CR/LF は存在しないはずなので読み飛ばす
-        } else if (IS_WSP(*p)) {
-            store_wsp = true;
-        } else {
+    while (p < headerv_tail) {
+        const char *run_tail = DkimCanonicalizer_findCrLfWsp(p, headerv_tail);
+        if (p < run_tail) {
             if (store_wsp) {
                 // replace a sequence of WSP with single SP
                 *(q++) = 0x20;  // skip this line for "nowsp" canonicalization
                 store_wsp = false;
             }   // end if
-            *(q++) = *p;
+            memcpy(q, p, run_tail - p);
+            q += run_tail - p;
+            p = run_tail;
+            if (headerv_tail <= p) {
+                break;
+            }   // end if
         }   // end if
-    }   // end for
+        if (*p == '\r' || *p == '\n') {
+            // header の場合 folding 以外の CR/LF は存在しないはずなので読み飛ばす
+        } else {
+            store_wsp = true;
+        }   // end if
+        ++p;
+    }   // end while
 
     if (append_crlf) {
         *(q++) = '\r';
@@ -303,6 +371,15 @@ DkimCanonicalizer_header(DkimCanonicalizer *self, const char *headerf, const cha
     return canon_stat;
 }   // end function: DkimCanonicalizer_header
 
+/**
+ * @return the header canonicalization algorithm of the DkimCanonicalizer object
+ */
+DkimC14nAlgorithm
+DkimCanonicalizer_getHeaderAlgorithm(const DkimCanonicalizer *self)
+{
+    return self->headeralg;
+}   // end function: DkimCanonicalizer_getHeaderAlgorithm
+
 /**
  * canonicalize a DKIM-Signature header
  * @param headerf header field name
@@ -377,6 +454,65 @@ DkimCanonicalizer_signheader(DkimCanonicalizer *self, const char *headerf, const
     return canon_stat;
 }   // end function: DkimCanonicalizer_signheader
 
+/**
+ * find the first CR in the message body chunk.
+ * memchr() of the C library is expected to be vectorized.
+ * @return a pointer to the first CR in [head, tail), or "tail" if not found.
+ */
+static inline const unsigned char *
+DkimCanonicalizer_findCr(const unsigned char *head, const unsigned char *tail)
+{
+    const unsigned char *p = (const unsigned char *) memchr(head, '\r', tail - head);
+    return PTROR(p, tail);
+}   // end function: DkimCanonicalizer_findCr
+
+/**
+ * find the first CR or WSP in the message body chunk.
+ * scans 32 (with AVX2) or 16 (with SSE2) octets at a time, and the rest octet by octet.
+ * @return a pointer to the first CR, SP or HTAB in [head, tail), or "tail" if not found.
+ */
+static inline const unsigned char *
+DkimCanonicalizer_findCrWsp(const unsigned char *head, const unsigned char *tail)
+{
+    const unsigned char *p = head;
+#if defined(__AVX2__)
+    const __m256i cr32 = _mm256_set1_epi8('\r');
+    const __m256i sp32 = _mm256_set1_epi8(' ');
+    const __m256i ht32 = _mm256_set1_epi8('\t');
+    for (; 32 <= tail - p; p += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, cr32),
+                                                      _mm256_cmpeq_epi8(block, sp32)),
+                                      _mm256_cmpeq_epi8(block, ht32));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+        if (0 != mask) {
+            return p + __builtin_ctz(mask);
+        }   // end if
+    }   // end for
+#endif
+#if defined(__SSE2__)
+    const __m128i cr16 = _mm_set1_epi8('\r');
+    const __m128i sp16 = _mm_set1_epi8(' ');
+    const __m128i ht16 = _mm_set1_epi8('\t');
+    for (; 16 <= tail - p; p += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, cr16),
+                                                _mm_cmpeq_epi8(block, sp16)),
+                                   _mm_cmpeq_epi8(block, ht16));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(hit);
+        if (0 != mask) {
+            return p + __builtin_ctz(mask);
+        }   // end if
+    }   // end for
+#endif
+    for (; p < tail; ++p) {
+        if (IS_CR(*p) || IS_WSP(*p)) {
+            break;
+        }   // end if
+    }   // end for
+    return p;
+}   // end function: DkimCanonicalizer_findCrWsp
+
 /// flushes saved CRLF(s)
 #define FLUSH_CRLF(__writep, __crlfnum) \
     do { \
@@ -444,17 +580,22 @@ DkimCanonicalizer_bodyWithSimple(DkimCanonicalizer *self, const unsigned char *b
         CATCH_CRLF(*p, p, q, self->body_crlf_count);
     }   // end if
 
-    for (; p < tail; ++p) {
+    while (p < tail) {
         if (*p == '\r') {
             if (tail <= p + 1) {
                 break;
             }   // end if
             CATCH_CRLF(*(p + 1), p, q, self->body_crlf_count);
+            ++p;
         } else {
+            // copy the run of octets other than CR at once
+            const unsigned char *runtail = DkimCanonicalizer_findCr(p + 1, tail);
             FLUSH_CRLF(q, self->body_crlf_count);
-            *(q++) = *p;
+            memcpy(q, p, runtail - p);
+            q += runtail - p;
+            p = runtail;
         }   // end if
-    }   // end for
+    }   // end while
     *q = '\0';
 
     assert(q <= self->buf + buflen);
@@ -545,19 +686,25 @@ DkimCanonicalizer_bodyWithRelaxed(DkimCanonicalizer *self, const unsigned char *
         CATCH_CRLFWSP(*p, p, q, self->body_crlf_count, self->body_wsp_count);
     }   // end if
 
-    for (; p < tail; ++p) {
+    while (p < tail) {
         if (IS_WSP(*p)) {
             self->body_wsp_count = 1;
+            ++p;
         } else if (*p == '\r') {
             if (tail <= p + 1) {
                 break;
             }   // end if
             CATCH_CRLFWSP(*(p + 1), p, q, self->body_crlf_count, self->body_wsp_count);
+            ++p;
         } else {
+            // copy the run of octets other than CR and WSP at once
+            const unsigned char *runtail = DkimCanonicalizer_findCrWsp(p + 1, tail);
             FLUSH_CRLFWSP(q, self->body_crlf_count, self->body_wsp_count);
-            *(q++) = *p;
+            memcpy(q, p, runtail - p);
+            q += runtail - p;
+            p = runtail;
         }   // end if
-    }   // end for
+    }   // end while
     *q = '\0';
 
     assert(q <= self->buf + buflen);
@@ -606,6 +753,122 @@ DkimCanonicalizer_body(DkimCanonicalizer *self, const unsigned char *bodyp, size
     return canon_stat;
 }   // end function: DkimCanonicalizer_body
 
+/**
+ * passes the saved CRLF(s) to "sink".
+ * @return DSTAT_OK for success, otherwise status code returned by "sink".
+ */
+static DkimStatus
+DkimCanonicalizer_flushCrlfToSink(DkimCanonicalizer *self, DkimCanonicalizerSink sink, void *arg)
+{
+    static const unsigned char crlfs[] = "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n";
+    while (0 < self->body_crlf_count) {
+        unsigned int crlfnum = MIN(self->body_crlf_count, (sizeof(crlfs) - 1) / 2);
+        DkimStatus sink_stat = sink(arg, crlfs, crlfnum * 2);
+        if (DSTAT_OK != sink_stat) {
+            return sink_stat;
+        }   // end if
+        self->body_crlf_count -= crlfnum;
+        self->total_body_canonicalized_output_len += crlfnum * 2;
+    }   // end while
+    return DSTAT_OK;
+}   // end function: DkimCanonicalizer_flushCrlfToSink
+
+/**
+ * canonicalize message body chunk with "simple" algorithm without copying.
+ * "simple" algorithm changes nothing but the trailing CRLFs of the message body,
+ * so the chunk is passed to "sink" as is except the CRLFs (and a CR) at its end,
+ * which are saved until it turns out whether they are at the end of the message body.
+ * @return DSTAT_OK for success, otherwise status code returned by "sink".
+ */
+static DkimStatus
+DkimCanonicalizer_bodyWithSimpleToSink(DkimCanonicalizer *self, const unsigned char *bodyp,
+                                       size_t bodylen, DkimCanonicalizerSink sink, void *arg)
+{
+    const unsigned char *p = bodyp;
+    const unsigned char *tail = bodyp + bodylen;
+    DkimStatus sink_stat;
+
+    // 前回の body の最後の文字が CR だった場合
+    if (self->body_last_char == '\r') {
+        if (*p == '\n') {
+            ++(self->body_crlf_count);
+            ++p;
+        } else {
+            sink_stat = DkimCanonicalizer_flushCrlfToSink(self, sink, arg);
+            if (DSTAT_OK != sink_stat) {
+                return sink_stat;
+            }   // end if
+            sink_stat = sink(arg, (const unsigned char *) "\r", 1);
+            if (DSTAT_OK != sink_stat) {
+                return sink_stat;
+            }   // end if
+            ++(self->total_body_canonicalized_output_len);
+        }   // end if
+    }   // end if
+
+    // save the CR and CRLFs at the end of the chunk
+    const unsigned char *span_tail = tail;
+    if (p < span_tail && *(span_tail - 1) == '\r') {
+        --span_tail;
+    }   // end if
+    unsigned int tail_crlf_count = 0;
+    while (p + 2 <= span_tail && *(span_tail - 2) == '\r' && *(span_tail - 1) == '\n') {
+        span_tail -= 2;
+        ++tail_crlf_count;
+    }   // end while
+
+    if (p < span_tail) {
+        // CRLFs saved so far are followed by the span, so they are not at the end of the body
+        sink_stat = DkimCanonicalizer_flushCrlfToSink(self, sink, arg);
+        if (DSTAT_OK != sink_stat) {
+            return sink_stat;
+        }   // end if
+        sink_stat = sink(arg, p, span_tail - p);
+        if (DSTAT_OK != sink_stat) {
+            return sink_stat;
+        }   // end if
+        self->total_body_canonicalized_output_len += span_tail - p;
+    }   // end if
+
+    self->body_crlf_count += tail_crlf_count;
+    self->body_last_char = *(tail - 1); // bodylen が 1 以上であることを確認しているので問題ない
+    self->total_body_input_len += bodylen;
+
+    return DSTAT_OK;
+}   // end function: DkimCanonicalizer_bodyWithSimpleToSink
+
+/**
+ * canonicalize message body chunk and pass the result to "sink".
+ * with "simple" body canonicalization, the chunk is passed to "sink" without copying it
+ * into the internal buffer, so "sink" may be called more than once for each chunk.
+ * @param bodyp message body chunk to canonicalize
+ * @param bodylen length of "bodyp"
+ * @param sink function to receive the canonicalized message body.
+ *             the data passed to "sink" is available only during the call.
+ * @param arg argument passed to "sink" as is
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error other errors returned by "sink"
+ */
+DkimStatus
+DkimCanonicalizer_bodyToSink(DkimCanonicalizer *self, const unsigned char *bodyp, size_t bodylen,
+                             DkimCanonicalizerSink sink, void *arg)
+{
+    if (bodylen == 0) {
+        return DSTAT_OK;
+    }   // end if
+
+    if (DKIM_C14N_ALGORITHM_SIMPLE == self->bodyalg) {
+        return DkimCanonicalizer_bodyWithSimpleToSink(self, bodyp, bodylen, sink, arg);
+    }   // end if
+
+    DkimStatus canon_stat = self->canonBody(self, bodyp, bodylen);
+    if (DSTAT_OK != canon_stat) {
+        return canon_stat;
+    }   // end if
+    return 0 < self->canonlen ? sink(arg, self->buf, self->canonlen) : DSTAT_OK;
+}   // end function: DkimCanonicalizer_bodyToSink
+
 /**
  * メッセージ本文に対する canonicalization を終了する.
  * 溜め込んでいた空白や改行を必要に応じてはき出す.
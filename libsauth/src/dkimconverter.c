@@ -17,6 +17,12 @@ RCSID("$Id: dkimconverter.c 1365 2011-10-16 08:08:36Z takahiko $");
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdbool.h>
+#if defined(__SSSE3__)
+# include <tmmintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 #include "dkimlogger.h"
 #include "ptrop.h"
@@ -28,12 +34,131 @@ RCSID("$Id: dkimconverter.c 1365 2011-10-16 08:08:36Z takahiko $");
 #include "dkimenum.h"
 #include "dkimconverter.h"
 
+// *INDENT-OFF*
+
+static const unsigned char b64decmap[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// *INDENT-ON*
+
+/**
+ * skip BASE64 characters (ALPHADIGITPS).
+ * scans 16 octets at a time with SSE2, and the rest octet by octet.
+ * @return a pointer to the first non-BASE64 character in [head, tail), or "tail" if not found.
+ */
+static inline const char *
+DkimConverter_skipBase64Chars(const char *head, const char *tail)
+{
+    const char *p = head;
+#if defined(__SSE2__)
+    const __m128i upper_lo = _mm_set1_epi8('A' - 1), upper_hi = _mm_set1_epi8('Z' + 1);
+    const __m128i lower_lo = _mm_set1_epi8('a' - 1), lower_hi = _mm_set1_epi8('z' + 1);
+    const __m128i digit_lo = _mm_set1_epi8('0' - 1), digit_hi = _mm_set1_epi8('9' + 1);
+    const __m128i plus = _mm_set1_epi8('+'), slash = _mm_set1_epi8('/');
+    for (; 16 <= tail - p; p += 16) {
+        // octets over 0x7f are negative as signed char, and fall out of all the ranges
+        __m128i block = _mm_loadu_si128((const __m128i *) p);
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, upper_lo),
+                                      _mm_cmpgt_epi8(upper_hi, block));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(block, lower_lo),
+                                      _mm_cmpgt_epi8(lower_hi, block));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(block, digit_lo),
+                                      _mm_cmpgt_epi8(digit_hi, block));
+        __m128i sign = _mm_or_si128(_mm_cmpeq_epi8(block, plus), _mm_cmpeq_epi8(block, slash));
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, sign));
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(valid);
+        if (0xffff != mask) {
+            return p + __builtin_ctz(~mask);
+        }   // end if
+    }   // end for
+#endif
+    for (; p < tail; ++p) {
+        if (0xff == b64decmap[(unsigned char) *p]) {
+            break;
+        }   // end if
+    }   // end for
+    return p;
+}   // end function: DkimConverter_skipBase64Chars
+
+/**
+ * decode BASE64 characters by 4 characters (24 bits).
+ * 16 characters are decoded at a time with SSSE3, into 12 octets followed by 4 octets of garbage.
+ * "dst" may be the same as "src" since each block is read before written.
+ * @param src BASE64 characters, which must be checked in advance
+ * @param quantum_num the number of 4-character groups to decode
+ * @param dst buffer to store the decoded octets, which must have 4 octets of room after (quantum_num * 3) octets
+ * @return the number of the decoded octets
+ */
+static size_t
+DkimConverter_decodeBase64Quanta(const unsigned char *src, size_t quantum_num, unsigned char *dst)
+{
+    const unsigned char *readp = src;
+    unsigned char *writep = dst;
+    const unsigned char *read_tail = src + quantum_num * 4;
+#if defined(__SSSE3__)
+    const __m128i lower_lo = _mm_set1_epi8('a' - 1);
+    const __m128i plus = _mm_set1_epi8('+'), slash = _mm_set1_epi8('/');
+    const __m128i upper_lo = _mm_set1_epi8('A' - 1);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    for (; 16 <= read_tail - readp; readp += 16, writep += 12) {
+        __m128i block = _mm_loadu_si128((const __m128i *) readp);
+        // translate characters into 6-bit values by adding the offset for each range:
+        // '0'-'9': +4, 'A'-'Z': -65, 'a'-'z': -71, '+': +19, '/': +16
+        __m128i offset = _mm_set1_epi8(4);
+        offset = _mm_add_epi8(offset, _mm_and_si128(_mm_cmpgt_epi8(block, upper_lo),
+                                                    _mm_set1_epi8(-65 - 4)));
+        offset = _mm_add_epi8(offset, _mm_and_si128(_mm_cmpgt_epi8(block, lower_lo),
+                                                    _mm_set1_epi8(-71 + 65)));
+        offset = _mm_add_epi8(offset, _mm_and_si128(_mm_cmpeq_epi8(block, plus),
+                                                    _mm_set1_epi8(19 - 4)));
+        offset = _mm_add_epi8(offset, _mm_and_si128(_mm_cmpeq_epi8(block, slash),
+                                                    _mm_set1_epi8(16 - 4)));
+        __m128i value = _mm_add_epi8(block, offset);
+        // merge 6-bit values into 12-bit, then 24-bit values in each 32-bit lane
+        value = _mm_maddubs_epi16(value, _mm_set1_epi32(0x01400140));
+        value = _mm_madd_epi16(value, _mm_set1_epi32(0x00011000));
+        // gather 3 octets of each lane in big-endian order
+        _mm_storeu_si128((__m128i *) writep, _mm_shuffle_epi8(value, pack));
+    }   // end for
+#endif
+    for (; readp < read_tail; readp += 4, writep += 3) {
+        unsigned long bits = ((unsigned long) b64decmap[readp[0]] << 18)
+            | ((unsigned long) b64decmap[readp[1]] << 12)
+            | ((unsigned long) b64decmap[readp[2]] << 6)
+            | (unsigned long) b64decmap[readp[3]];
+        writep[0] = (unsigned char) (bits >> 16);
+        writep[1] = (unsigned char) (bits >> 8);
+        writep[2] = (unsigned char) bits;
+    }   // end for
+    return writep - dst;
+}   // end function: DkimConverter_decodeBase64Quanta
+
 /**
  * [RFC6376]
  * ALPHADIGITPS    =  (ALPHA / DIGIT / "+" / "/")
  * base64string    =  ALPHADIGITPS *([FWS] ALPHADIGITPS)
  *                    [ [FWS] "=" [ [FWS] "=" ] ]
  *
+ * BASE64 characters are decoded directly into the returned XBuffer.
+ * If the BASE64 string contains FWS, the BASE64 characters are compacted
+ * into the XBuffer first, and decoded in place.
  * @param dstat a pointer to a variable to receive the status code if an error occurred.
  *              possible value of status codes are listed with error tags below.
  * @error DSTAT_SYSERR_NORESOURCE memory allocation error
@@ -42,108 +167,83 @@ XBuffer *
 DkimConverter_decodeBase64(const DkimPolicyBase *policy, const char *head, const char *tail,
                            const char **nextp, DkimStatus *dstat)
 {
-
-// *INDENT-OFF*
-
-    static const unsigned char b64decmap[] = {
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
-        0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-        0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
-        0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
-
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    };
-
-// *INDENT-ON*
-
-    XBuffer *xbuf;
-    const char *p = head;
-    unsigned char stock_octet[3];
-    size_t stock_b64len = 0;    // 読み込み済みだが，xbuf に格納していない base64 文字列の長さ
-
-    // 必要に応じて拡張されるので，最初に確保する領域のサイズはざっくりでよい
-    xbuf = XBuffer_new((tail - head) / 4 * 3);
+    // nextp に設定する位置 (4文字のまとまりを読み終えた直後, または FWS の直後)
+    const char *boundary = NULL;
+
+    // BASE64 文字の連続を探す
+    const char *p = DkimConverter_skipBase64Chars(head, tail);
+    const char *fws_tail;
+    bool fws_follows = (0 < XSkip_fws(p, tail, &fws_tail));
+
+    // 復号結果の格納先. FWS を含む場合は BASE64 文字を詰めて格納するための作業領域も兼ねる.
+    // SIMD による書き込みのはみ出し分として 16 バイトの余裕を持たせる.
+    size_t spacelen = (fws_follows ? (size_t) (tail - head) : (size_t) (p - head)) + 16;
+    XBuffer *xbuf = XBuffer_new(spacelen);
     if (NULL == xbuf) {
         DkimLogNoResource(policy);
         SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
         return NULL;
     }   // end if
+    unsigned char *space = (unsigned char *) XBuffer_appendSpace(xbuf, spacelen);
+    if (NULL == space) {
+        DkimLogNoResource(policy);
+        SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
+        XBuffer_free(xbuf);
+        SETDEREF(nextp, head);
+        return NULL;
+    }   // end if
 
-    while (p < tail && *p != '\0') {
-        unsigned char octet = b64decmap[(const unsigned char) *p];
-        if (0xff == octet) {
-            // BASE64 文字ではない場合
-            if (0 < XSkip_fws(p, tail, &p)) {
-                // FWS なら FWS 部分をスキップししてループの先頭に戻る
-                SETDEREF(nextp, p);
-                continue;
-            } else {
-                // FWS でもない場合は BASE64 列の終了なのでループを抜ける
-                break;
-            }   // end if
+    const unsigned char *b64src;
+    size_t b64len;
+    if (!fws_follows) {
+        // FWS を含まない場合は入力を直接復号する
+        b64src = (const unsigned char *) head;
+        b64len = p - head;
+        if (4 <= b64len) {
+            boundary = head + b64len / 4 * 4;
         }   // end if
-
-        // *p は BASE64 文字として読み込んだので, p を1バイト進める.
-        ++p;
-
-        switch (stock_b64len) {
-        case 0:
-            stock_octet[0] = octet << 2;
-            stock_b64len = 1;
-            break;
-
-        case 1:
-            stock_octet[0] |= (octet & 0x30) >> 4;
-            stock_octet[1] = (octet & 0x0f) << 4;
-            stock_b64len = 2;
-            break;
-
-        case 2:
-            stock_octet[1] |= (octet & 0x3c) >> 2;
-            stock_octet[2] = (octet & 0x03) << 6;
-            stock_b64len = 3;
-            break;
-
-        case 3:
-            stock_octet[2] |= octet & 0x3f;
-            if (0 > XBuffer_appendBytes(xbuf, stock_octet, 3)) {
-                DkimLogNoResource(policy);
-                SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
-                goto cleanup;
+    } else {
+        // FWS を取り除いて BASE64 文字を作業領域に詰める
+        const char *run_head = head;
+        b64len = 0;
+        while (true) {
+            size_t runlen = p - run_head;
+            memcpy(space + b64len, run_head, runlen);
+            if (b64len / 4 < (b64len + runlen) / 4) {
+                boundary = run_head + ((b64len + runlen) / 4 * 4 - b64len);
             }   // end if
-            SETDEREF(nextp, p);
-            stock_b64len = 0;
-            break;
+            b64len += runlen;
+            if (0 >= XSkip_fws(p, tail, &p)) {
+                // FWS でもない場合は BASE64 列の終了
+                break;
+            }   // end if
+            boundary = p;
+            run_head = p;
+            p = DkimConverter_skipBase64Chars(run_head, tail);
+        }   // end while
+        b64src = space;
+    }   // end if
 
-        default:
-            abort();
-        }   // end switch
-    }   // end while
+    size_t quantum_num = b64len / 4;
+    // 端数の文字は復号結果で上書きされる前に読んでおく
+    unsigned char rest_octet[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < b64len % 4; ++i) {
+        rest_octet[i] = b64decmap[b64src[quantum_num * 4 + i]];
+    }   // end for
+    size_t decodedlen = DkimConverter_decodeBase64Quanta(b64src, quantum_num, space);
 
-    switch (stock_b64len) {
+    switch (b64len % 4) {
     case 0:
     case 1:
         // 1バイトもストックがないので，何もしない
+        if (NULL != boundary) {
+            SETDEREF(nextp, boundary);
+        }   // end if
         break;
 
     case 2:
         // "==" が続くか否かに依らず，ストックを吐き出す
-        if (0 > XBuffer_appendByte(xbuf, *stock_octet)) {
-            DkimLogNoResource(policy);
-            SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
-            goto cleanup;
-        }   // end if
+        space[decodedlen++] = (rest_octet[0] << 2) | ((rest_octet[1] & 0x30) >> 4);
         // '=' が2個続くはず
         if (0 >= XSkip_char(p, tail, '=', &p)) {
             // 本当は '=' で残りを埋める必要があるんだよ警告
@@ -160,11 +260,8 @@ DkimConverter_decodeBase64(const DkimPolicyBase *policy, const char *head, const
 
     case 3:
         // '=' が続くか否かに依らず，ストックを吐き出す
-        if (0 > XBuffer_appendBytes(xbuf, stock_octet, 2)) {
-            DkimLogNoResource(policy);
-            SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
-            goto cleanup;
-        }   // end if
+        space[decodedlen++] = (rest_octet[0] << 2) | ((rest_octet[1] & 0x30) >> 4);
+        space[decodedlen++] = ((rest_octet[1] & 0x0f) << 4) | ((rest_octet[2] & 0x3c) >> 2);
         // '=' が1個続くはず
         if (0 >= XSkip_char(p, tail, '=', &p)) {
             // 本当は '=' で残りを埋める必要があるんだよ警告
@@ -178,13 +275,10 @@ DkimConverter_decodeBase64(const DkimPolicyBase *policy, const char *head, const
         abort();
     }   // end switch
 
+    // 作業領域の余りを切り詰める
+    XBuffer_rollback(xbuf, decodedlen);
     SETDEREF(dstat, DSTAT_OK);
     return xbuf;
-
-  cleanup:
-    XBuffer_free(xbuf);
-    SETDEREF(nextp, head);
-    return NULL;
 }   // end function: DkimConverter_decodeBase64
 
 /**
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "dkim.h"
+#include "dkimcryptopool.h"
+
+/*
+ * Fixed-size thread pool to run CPU-bound DKIM jobs, such as digest and signature verification,
+ * apart from the (possibly numerous) threads handling I/O.
+ * Each DkimCryptoPool_execute() call enqueues a batch of jobs, which are picked up one by one
+ * by the worker threads, and waits for all of them to complete.
+ * The worker threads are started on the first use, so that the pool can be created
+ * before the process forks (daemonizes).
+ */
+
+typedef struct DkimCryptoBatch {
+    DkimCryptoJob job;
+    void *arg;
+    size_t jobnum;
+    size_t next;                // index of the next job to be picked up
+    size_t remaining;           // number of the jobs not completed yet
+    pthread_cond_t done;
+    struct DkimCryptoBatch *queue_next;
+} DkimCryptoBatch;
+
+struct DkimCryptoPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    DkimCryptoBatch *queue_head;
+    DkimCryptoBatch *queue_tail;
+    bool shutdown;
+    size_t thread_max;
+    size_t thread_num;          // number of the worker threads running
+    pthread_t *thread;
+};
+
+static void *
+DkimCryptoPool_worker(void *arg)
+{
+    DkimCryptoPool *self = (DkimCryptoPool *) arg;
+
+    (void) pthread_mutex_lock(&self->lock);
+    while (true) {
+        while (NULL == self->queue_head && !self->shutdown) {
+            (void) pthread_cond_wait(&self->work, &self->lock);
+        }   // end while
+        if (NULL == self->queue_head) {
+            // shutting down
+            break;
+        }   // end if
+
+        // pick up a job from the head of the queue
+        DkimCryptoBatch *batch = self->queue_head;
+        size_t jobidx = batch->next++;
+        if (batch->jobnum <= batch->next) {
+            self->queue_head = batch->queue_next;
+            if (NULL == self->queue_head) {
+                self->queue_tail = NULL;
+            }   // end if
+        }   // end if
+        (void) pthread_mutex_unlock(&self->lock);
+
+        batch->job(batch->arg, jobidx);
+
+        (void) pthread_mutex_lock(&self->lock);
+        if (0 == --(batch->remaining)) {
+            (void) pthread_cond_signal(&batch->done);
+        }   // end if
+    }   // end while
+    (void) pthread_mutex_unlock(&self->lock);
+    return NULL;
+}   // end function: DkimCryptoPool_worker
+
+/**
+ * bind the worker thread to a CPU core, if the platform supports it.
+ * failure is not an error since the binding is merely an optimization.
+ */
+static void
+DkimCryptoPool_bindCpu(pthread_t thread, size_t thread_idx)
+{
+#if defined(__linux__) && defined(CPU_SET)
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (0 < cpu_num) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(thread_idx % cpu_num, &cpuset);
+        (void) pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset);
+    }   // end if
+#else
+    (void) thread;
+    (void) thread_idx;
+#endif
+}   // end function: DkimCryptoPool_bindCpu
+
+/**
+ * start the worker threads not running yet.
+ * the lock must be held by the caller.
+ * @return true if at least one worker thread is running, false otherwise.
+ */
+static bool
+DkimCryptoPool_start(DkimCryptoPool *self)
+{
+    while (self->thread_num < self->thread_max) {
+        if (0 != pthread_create(&self->thread[self->thread_num], NULL, DkimCryptoPool_worker, self)) {
+            break;
+        }   // end if
+        DkimCryptoPool_bindCpu(self->thread[self->thread_num], self->thread_num);
+        ++(self->thread_num);
+    }   // end while
+    return 0 < self->thread_num;
+}   // end function: DkimCryptoPool_start
+
+/**
+ * create DkimCryptoPool object.
+ * the worker threads are not started until DkimCryptoPool_execute() is called first.
+ * @param thread_num the number of the worker threads,
+ *                   typically the number of the CPU cores dedicated to the crypto jobs.
+ * @return initialized DkimCryptoPool object, or NULL if memory allocation failed.
+ */
+DkimCryptoPool *
+DkimCryptoPool_new(size_t thread_num)
+{
+    assert(0 < thread_num);
+
+    DkimCryptoPool *self = (DkimCryptoPool *) malloc(sizeof(DkimCryptoPool));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(DkimCryptoPool));
+    self->thread = (pthread_t *) malloc(sizeof(pthread_t) * thread_num);
+    if (NULL == self->thread) {
+        goto cleanup;
+    }   // end if
+    if (0 != pthread_mutex_init(&self->lock, NULL)) {
+        goto cleanup;
+    }   // end if
+    if (0 != pthread_cond_init(&self->work, NULL)) {
+        (void) pthread_mutex_destroy(&self->lock);
+        goto cleanup;
+    }   // end if
+    self->thread_max = thread_num;
+    return self;
+
+  cleanup:
+    free(self->thread);
+    free(self);
+    return NULL;
+}   // end function: DkimCryptoPool_new
+
+/**
+ * stop the worker threads and release DkimCryptoPool object.
+ * must not be called while DkimCryptoPool_execute() is in progress.
+ * @param self DkimCryptoPool object to release
+ */
+void
+DkimCryptoPool_free(DkimCryptoPool *self)
+{
+    assert(NULL != self);
+
+    (void) pthread_mutex_lock(&self->lock);
+    self->shutdown = true;
+    (void) pthread_cond_broadcast(&self->work);
+    (void) pthread_mutex_unlock(&self->lock);
+    for (size_t i = 0; i < self->thread_num; ++i) {
+        (void) pthread_join(self->thread[i], NULL);
+    }   // end for
+
+    (void) pthread_cond_destroy(&self->work);
+    (void) pthread_mutex_destroy(&self->lock);
+    free(self->thread);
+    free(self);
+}   // end function: DkimCryptoPool_free
+
+/**
+ * run "job" for each job index in [0, jobnum) on the worker threads,
+ * and wait for all of them to complete.
+ * the jobs of a batch may run in parallel and in any order.
+ * @param job function to run, called as job(arg, jobidx)
+ * @param arg the first argument passed to "job"
+ * @param jobnum the number of the jobs
+ * @return DSTAT_OK if all the jobs are completed,
+ *         otherwise status code that indicates error and none of the jobs are run.
+ * @error DSTAT_SYSERR_NORESOURCE no worker thread could be started
+ */
+DkimStatus
+DkimCryptoPool_execute(DkimCryptoPool *self, DkimCryptoJob job, void *arg, size_t jobnum)
+{
+    assert(NULL != self);
+    assert(NULL != job);
+
+    if (0 == jobnum) {
+        return DSTAT_OK;
+    }   // end if
+
+    DkimCryptoBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.job = job;
+    batch.arg = arg;
+    batch.jobnum = jobnum;
+    batch.remaining = jobnum;
+    if (0 != pthread_cond_init(&batch.done, NULL)) {
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+
+    (void) pthread_mutex_lock(&self->lock);
+    if (!DkimCryptoPool_start(self)) {
+        (void) pthread_mutex_unlock(&self->lock);
+        (void) pthread_cond_destroy(&batch.done);
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+    if (NULL != self->queue_tail) {
+        self->queue_tail->queue_next = &batch;
+    } else {
+        self->queue_head = &batch;
+    }   // end if
+    self->queue_tail = &batch;
+    if (1 < jobnum) {
+        (void) pthread_cond_broadcast(&self->work);
+    } else {
+        (void) pthread_cond_signal(&self->work);
+    }   // end if
+    while (0 < batch.remaining) {
+        (void) pthread_cond_wait(&batch.done, &self->lock);
+    }   // end while
+    (void) pthread_mutex_unlock(&self->lock);
+
+    (void) pthread_cond_destroy(&batch.done);
+    return DSTAT_OK;
+}   // end function: DkimCryptoPool_execute
@@ -18,6 +18,7 @@ RCSID("$Id: dkimdigester.c 1365 2011-10-16 08:08:36Z takahiko $");
 #include <strings.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdlib.h>
 
 #include <openssl/err.h>
 #include <openssl/evp.h>
@@ -26,23 +27,40 @@ RCSID("$Id: dkimdigester.c 1365 2011-10-16 08:08:36Z takahiko $");
 #include "dkimlogger.h"
 #include "xbuffer.h"
 #include "strtokarray.h"
-#include "strpairlist.h"
 #include "dkimsignature.h"
+#include "dkimpublickey.h"
+#include "dkimheaderindex.h"
+#include "dkimverdictcache.h"
+#include "ed25519.h"
 #include "dkimcanonicalizer.h"
 #include "dkimpolicybase.h"
 #include "dkimdigester.h"
 
+// the number of the header field names whose cursors are kept on the stack
+// while choosing the header fields to sign or verify
+#define DKIM_HEADER_CURSOR_STACK_NUM 64
+
 struct DkimDigester {
     const DkimPolicyBase *policy;
     const EVP_MD *digest_alg;
-    int pubkey_alg;
+    DkimKeyType pubkey_alg;
     EVP_MD_CTX header_digest;
     EVP_MD_CTX body_digest;
     DkimCanonicalizer *canon;
+    DkimC14nAlgorithm body_canon_alg;
     /// body length limit. sig-l-tag itself. -1 for unlimited.
     long long body_length_limit;
     /// the number of octets included in the hash value at the time.
     long long current_body_length;
+    /// DkimDigester object which computes the body hash on behalf of this object,
+    /// NULL if this object computes the body hash by itself. this holds the reference.
+    DkimDigester *body_source;
+    /// status of the body hash computation, kept once an error occurred
+    DkimStatus body_stat;
+    /// true once the body hash is finalized and stored in "body_hash"
+    bool body_finalized;
+    unsigned char body_hash[EVP_MAX_MD_SIZE];
+    unsigned int body_hash_len;
 
     FILE *fp_c14n_header;
     FILE *fp_c14n_body;
@@ -197,7 +215,20 @@ DkimDigester_new(const DkimPolicyBase *policy, DkimHashAlgorithm digest_alg,
 
     switch (pubkey_alg) {
     case DKIM_KEY_TYPE_RSA:
-        self->pubkey_alg = EVP_PKEY_RSA;
+        break;
+    case DKIM_KEY_TYPE_ED25519:
+        /*
+         * [RFC8463] 3.
+         * The Ed25519-SHA256 signing algorithm computes a message hash as
+         * defined in Section 3 of [RFC6376] using SHA-256 as the hash-alg.
+         * It signs the hash with the PureEdDSA variant Ed25519
+         */
+        if (DKIM_HASH_ALGORITHM_SHA256 != digest_alg) {
+            DkimLogPermFail(policy, "unsupported digest algorithm for ed25519: digestalg=0x%x",
+                            digest_alg);
+            SETDEREF(dstat, DSTAT_PERMFAIL_UNSUPPORTED_HASH_ALGORITHM);
+            goto cleanup;
+        }   // end if
         break;
     default:
         DkimLogPermFail(policy, "unsupported public key algorithm specified: pubkeyalg=0x%x",
@@ -205,6 +236,7 @@ DkimDigester_new(const DkimPolicyBase *policy, DkimHashAlgorithm digest_alg,
         SETDEREF(dstat, DSTAT_PERMFAIL_UNSUPPORTED_KEY_ALGORITHM);
         goto cleanup;
     }   // end switch
+    self->pubkey_alg = pubkey_alg;
 
     self->canon = DkimCanonicalizer_new(policy, header_canon_alg, body_canon_alg, dstat);
     if (NULL == self->canon) {
@@ -224,7 +256,9 @@ DkimDigester_new(const DkimPolicyBase *policy, DkimHashAlgorithm digest_alg,
     }   // end if
 
     self->policy = policy;
+    self->body_canon_alg = body_canon_alg;
     self->body_length_limit = body_length_limit;
+    self->body_stat = DSTAT_OK;
 
     SETDEREF(dstat, DSTAT_OK);
     return self;
@@ -249,7 +283,7 @@ DkimDigester_free(DkimDigester *self)
     (void) EVP_MD_CTX_cleanup(&(self->header_digest));
     (void) EVP_MD_CTX_cleanup(&(self->body_digest));
 
-    // No need to clean up "self->digest_alg"
+    // No need to clean up "self->digest_alg" and "self->body_source"
 
     free(self);
 }   // end function: DkimDigester_free
@@ -303,6 +337,16 @@ DkimDigester_updateBodyChunk(DkimDigester *self, const unsigned char *buf, size_
     return DSTAT_OK;
 }   // end function: DkimDigester_updateBodyChunk
 
+/**
+ * DkimCanonicalizerSink to update digest value of message body
+ * @param arg DkimDigester object
+ */
+static DkimStatus
+DkimDigester_bodySink(void *arg, const unsigned char *buf, size_t len)
+{
+    return DkimDigester_updateBodyChunk((DkimDigester *) arg, buf, len);
+}   // end function: DkimDigester_bodySink
+
 /**
  * update digest value of message body
  * @param self DkimDigester object
@@ -310,6 +354,8 @@ DkimDigester_updateBodyChunk(DkimDigester *self, const unsigned char *buf, size_
  * @param len length of buf
  * @return DSTAT_OK for success, otherwise status code that indicates error.
  * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @attention does nothing if the body hash is shared with another DkimDigester object
+ *            by DkimDigester_shareBodyDigest(). the message body should be given to that object instead.
  */
 DkimStatus
 DkimDigester_updateBody(DkimDigester *self, const unsigned char *buf, size_t len)
@@ -317,20 +363,146 @@ DkimDigester_updateBody(DkimDigester *self, const unsigned char *buf, size_t len
     assert(NULL != self);
     assert(NULL != buf);
 
+    if (NULL != self->body_source) {
+        // the message body is digested by "body_source"
+        return DSTAT_OK;
+    }   // end if
+    if (DSTAT_OK != self->body_stat) {
+        return self->body_stat;
+    }   // end if
     if (0 <= self->body_length_limit && self->body_length_limit <= self->current_body_length) {
         // return if the body length limit is already exceeded.
         return DSTAT_OK;
     }   // end if
 
+    // update digest with the canonicalized message body.
+    // "simple" canonicalized message body is fed to the digest without being copied.
+    self->body_stat =
+        DkimCanonicalizer_bodyToSink(self->canon, buf, len, DkimDigester_bodySink, self);
+    return self->body_stat;
+}   // end function: DkimDigester_updateBody
+
+/**
+ * flush the canonicalization buffer and finalize the body hash.
+ * the body hash is computed only once and kept in "body_hash",
+ * so that the DkimDigester objects sharing this object can refer to it.
+ * @param self DkimDigester object
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+static DkimStatus
+DkimDigester_finalizeBody(DkimDigester *self)
+{
+    if (DSTAT_OK != self->body_stat || self->body_finalized) {
+        return self->body_stat;
+    }   // end if
+
+    // Flush the canonicalization buffer and finalize canonicalization.
     const unsigned char *canonbuf;
     size_t canonsize;
-    DkimStatus canon_stat = DkimCanonicalizer_body(self->canon, buf, len, &canonbuf, &canonsize);
-    if (DSTAT_OK != canon_stat) {
-        return canon_stat;
+    DkimStatus ret = DkimCanonicalizer_finalizeBody(self->canon, &canonbuf, &canonsize);
+    if (DSTAT_OK != ret) {
+        self->body_stat = ret;
+        return ret;
     }   // end if
-    // update digest after canonicalization
-    return DkimDigester_updateBodyChunk(self, canonbuf, canonsize);
-}   // end function: DkimDigester_updateBody
+    // Add the final chunk of the message body into the digest.
+    ret = DkimDigester_updateBodyChunk(self, canonbuf, canonsize);
+    if (DSTAT_OK != ret) {
+        self->body_stat = ret;
+        return ret;
+    }   // end if
+    if (0 == EVP_DigestFinal(&self->body_digest, self->body_hash, &self->body_hash_len)) {
+        DkimLogSysError(self->policy, "Digest finish (of body) failed");
+        DkimDigester_logOpenSSLErrors(self);
+        self->body_stat = DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
+        return self->body_stat;
+    }   // end if
+    self->body_finalized = true;
+    return DSTAT_OK;
+}   // end function: DkimDigester_finalizeBody
+
+/**
+ * finalize the body hash this object refers to,
+ * which may be computed by another DkimDigester object sharing the body digest.
+ * DkimDigester_verifyMessage() calls this implicitly, but it must be called in advance
+ * when DkimDigester objects sharing the body digest verify the messages concurrently.
+ * @param self DkimDigester object
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+DkimStatus
+DkimDigester_finalizeBodyDigest(DkimDigester *self)
+{
+    assert(NULL != self);
+    return DkimDigester_finalizeBody(PTROR(self->body_source, self));
+}   // end function: DkimDigester_finalizeBodyDigest
+
+/**
+ * check if the body hash of the two DkimDigester objects can be computed at once.
+ * that is, they have the same body canonicalization algorithm, digest algorithm and body length limit.
+ * @param self DkimDigester object
+ * @param other DkimDigester object to compare with
+ * @return true if the body hash can be shared, false otherwise.
+ */
+bool
+DkimDigester_isBodyDigestShareable(const DkimDigester *self, const DkimDigester *other)
+{
+    assert(NULL != self);
+    assert(NULL != other);
+
+    return self->digest_alg == other->digest_alg && self->body_canon_alg == other->body_canon_alg
+        && self->body_length_limit == other->body_length_limit;
+}   // end function: DkimDigester_isBodyDigestShareable
+
+/**
+ * let "self" use the body hash computed by "source" instead of computing it by itself.
+ * DkimDigester_updateBody() on "self" does nothing after this call,
+ * and the message body should be given to "source" only.
+ * canonicalized message body is dumped only by "source" if DkimDigester_enableC14nDump() is enabled.
+ * @param self DkimDigester object
+ * @param source DkimDigester object which computes the body hash.
+ *               "source" must outlive "self", and must not share the body hash with another object.
+ */
+void
+DkimDigester_shareBodyDigest(DkimDigester *self, DkimDigester *source)
+{
+    assert(NULL != self);
+    assert(NULL != source);
+    assert(self != source);
+    assert(NULL == source->body_source);
+    assert(DkimDigester_isBodyDigestShareable(self, source));
+    assert(0 == self->current_body_length);
+
+    self->body_source = source;
+}   // end function: DkimDigester_shareBodyDigest
+
+/**
+ * update digest value of message header with the header field already canonicalized
+ * @param self DkimDigester object
+ * @param canonbuf canonicalized header field
+ * @param canonsize length of "canonbuf"
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+static DkimStatus
+DkimDigester_updateCanonicalizedHeader(DkimDigester *self, const unsigned char *canonbuf,
+                                       size_t canonsize)
+{
+    // discard errors occurred in functions for debugging
+    (void) DkimDigester_dumpCanonicalizedHeader(self, canonbuf, canonsize);
+
+    if (0 == EVP_DigestUpdate(&self->header_digest, canonbuf, canonsize)) {
+        DkimLogSysError(self->policy, "Digest update (of header) failed");
+        DkimDigester_logOpenSSLErrors(self);
+        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
+    }   // end if
+
+    return DSTAT_OK;
+}   // end function: DkimDigester_updateCanonicalizedHeader
 
 /**
  * update digest value of message header
@@ -356,23 +528,13 @@ DkimDigester_updateHeader(DkimDigester *self, const char *headerf, const char *h
     if (DSTAT_OK != canon_stat) {
         return canon_stat;
     }   // end if
-
-    // discard errors occurred in functions for debugging
-    (void) DkimDigester_dumpCanonicalizedHeader(self, canonbuf, canonsize);
-
-    if (0 == EVP_DigestUpdate(&self->header_digest, canonbuf, canonsize)) {
-        DkimLogSysError(self->policy, "Digest update (of header) failed");
-        DkimDigester_logOpenSSLErrors(self);
-        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
-    }   // end if
-
-    return DSTAT_OK;
+    return DkimDigester_updateCanonicalizedHeader(self, canonbuf, canonsize);
 }   // end function: DkimDigester_updateHeader
 
 /**
  * update digest value of message headers
  * @param self DkimDigester object
- * @param headers MailHeaders object that stores all headers.
+ * @param header_index DkimHeaderIndex object built from all headers of the message.
  * @param signed_headers The names of the header fields included in the digest of the signature.
  *                       The parsed sig-h-tag itself.
  * @return DSTAT_OK for success, otherwise status code that indicates error.
@@ -381,36 +543,31 @@ DkimDigester_updateHeader(DkimDigester *self, const char *headerf, const char *h
  * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
  */
 static DkimStatus
-DkimDigester_updateSignedHeaders(DkimDigester *self, const MailHeaders *headers,
+DkimDigester_updateSignedHeaders(DkimDigester *self, const DkimHeaderIndex *header_index,
                                  const StrArray *signed_headers)
 {
-    size_t n;
     DkimStatus final_stat;
 
-    StrPairList *kvl = StrPairList_new();
-    if (NULL == kvl) {
-        DkimLogNoResource(self->policy);
-        return DSTAT_SYSERR_NORESOURCE;
-    }   // end if
-
-    // make a shallow copy of "headers"
-    StrPairListItem *cur = StrPairList_tail(kvl);
-    size_t headernum = MailHeaders_getCount(headers);
-    for (n = 0; n < headernum; ++n) {
-        const char *key, *val;
-        MailHeaders_get(headers, n, &key, &val);
-        cur = StrPairList_insertShallowly(kvl, cur, key, val);
-        if (NULL == cur) {
+    // a cursor for each header field name to track the instances already picked.
+    // the stack is sufficient for most messages.
+    size_t cursor_buf[DKIM_HEADER_CURSOR_STACK_NUM];
+    size_t namenum = DkimHeaderIndex_getNameCount(header_index);
+    size_t *cursor = cursor_buf;
+    if (DKIM_HEADER_CURSOR_STACK_NUM < namenum) {
+        cursor = (size_t *) malloc(sizeof(size_t) * namenum);
+        if (NULL == cursor) {
             DkimLogNoResource(self->policy);
-            final_stat = DSTAT_SYSERR_NORESOURCE;
-            goto finally;
+            return DSTAT_SYSERR_NORESOURCE;
         }   // end if
     }   // end if
+    memset(cursor, 0, sizeof(size_t) * namenum);
 
     // choose header fields according to "signed_headers"
     size_t signed_header_num = StrArray_getCount(signed_headers);
-    for (n = 0; n < signed_header_num; ++n) {
+    for (size_t n = 0; n < signed_header_num; ++n) {
         const char *headerf = StrArray_get(signed_headers, n);
+        const char *key, *val;
+        size_t headeridx;
         /*
          * [RFC6376] 5.4.2.
          * Signers choosing to sign an existing header field that occurs more
@@ -421,17 +578,21 @@ DkimDigester_updateSignedHeaders(DkimDigester *self, const MailHeaders *headers,
          * DKIM-Signature header field and MUST sign such header fields in order
          * from the bottom of the header field block to the top.
          */
-        cur = StrPairList_rfindIgnoreCaseByKey(kvl, headerf, NULL);
-        if (NULL != cur) {
-            DkimStatus update_stat = DkimDigester_updateHeader(self, StrPairListItem_key(cur),
-                                                               StrPairListItem_value(cur), true,
-                                                               self->
-                                                               policy->suppose_leadeing_header_space);
+        if (DkimHeaderIndex_pickBottomMost(header_index, headerf, cursor, &key, &val, &headeridx)) {
+            // the canonicalized header field is shared with the other signatures of the message
+            const unsigned char *canonbuf;
+            size_t canonsize;
+            DkimStatus update_stat =
+                DkimHeaderIndex_canonicalize(header_index, headeridx, self->canon,
+                                             self->policy->suppose_leadeing_header_space,
+                                             &canonbuf, &canonsize);
+            if (DSTAT_OK == update_stat) {
+                update_stat = DkimDigester_updateCanonicalizedHeader(self, canonbuf, canonsize);
+            }   // end if
             if (DSTAT_OK != update_stat) {
                 final_stat = update_stat;
                 goto finally;
             }   // end if
-            StrPairList_deleteShallowly(kvl, cur);
         } else {
             /*
              * treat as the null string if the header field specified by the sig-h-tag does not exist.
@@ -446,13 +607,15 @@ DkimDigester_updateSignedHeaders(DkimDigester *self, const MailHeaders *headers,
              * value, all punctuation, and the trailing CRLF).
              */
         }   // end if
-    }   // end if
+    }   // end for
     final_stat = DSTAT_OK;
 
   finally:
-    StrPairList_freeShallowly(kvl);
+    if (cursor_buf != cursor) {
+        free(cursor);
+    }   // end if
     return final_stat;
-}   // end function: DkimDigester_digestHeaders
+}   // end function: DkimDigester_updateSignedHeaders
 
 /**
  * update the digest with the DKIM-Signature header
@@ -497,66 +660,186 @@ DkimDigester_updateSignatureHeader(DkimDigester *self, const DkimSignature *sign
 }   // end function: DkimDigester_updateSignatureHeader
 
 /**
- * compare the digests of the message headers and body to the digest value included in the DKIM-Signature headers
- * @param headers MailHeaders object that stores all headers.
+ * compute the key of DkimVerdictCache, the SHA-256 digest over what determines
+ * the result of the signature verification;
+ * sig-d-tag, sig-s-tag, the public key, sig-b-tag, sig-bh-tag and the header hash.
+ * @param md the header hash
+ * @param key buffer to receive the key of DKIM_VERDICTCACHE_KEY_LEN octets
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+static DkimStatus
+DkimDigester_computeVerdictKey(const DkimDigester *self, const DkimSignature *signature,
+                               const DkimPublicKey *publickey, const unsigned char *md,
+                               unsigned int mdlen, unsigned char *key)
+{
+    const char *sdid = DkimSignature_getSdid(signature);
+    const char *selector = DkimSignature_getSelector(signature);
+    const XBuffer *signvalue = DkimSignature_getSignatureValue(signature);
+    const XBuffer *bodyhash = DkimSignature_getBodyHash(signature);
+    unsigned int keylen;
+    EVP_MD_CTX keyctx;
+    EVP_MD_CTX_init(&keyctx);
+    // each variable-length field is followed by NUL to separate it from the next one
+    int ok = EVP_DigestInit_ex(&keyctx, EVP_sha256(), NULL)
+        && EVP_DigestUpdate(&keyctx, sdid, strlen(sdid) + 1)
+        && EVP_DigestUpdate(&keyctx, selector, strlen(selector) + 1)
+        && EVP_DigestUpdate(&keyctx, DkimPublicKey_getFingerprint(publickey),
+                            DKIM_PUBLICKEY_FINGERPRINT_LEN)
+        && EVP_DigestUpdate(&keyctx, XBuffer_getBytes(signvalue), XBuffer_getSize(signvalue))
+        && EVP_DigestUpdate(&keyctx, "", 1)
+        && EVP_DigestUpdate(&keyctx, XBuffer_getBytes(bodyhash), XBuffer_getSize(bodyhash))
+        && EVP_DigestUpdate(&keyctx, "", 1)
+        && EVP_DigestUpdate(&keyctx, md, mdlen)
+        && EVP_DigestFinal_ex(&keyctx, key, &keylen);
+    (void) EVP_MD_CTX_cleanup(&keyctx);
+    if (!ok || DKIM_VERDICTCACHE_KEY_LEN != keylen) {
+        DkimLogSysError(self->policy, "Digest of verification result key failed");
+        DkimDigester_logOpenSSLErrors(self);
+        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
+    }   // end if
+    return DSTAT_OK;
+}   // end function: DkimDigester_computeVerdictKey
+
+/**
+ * verify the RSA signature over the hash of the message headers.
+ * @return DSTAT_INFO_DIGEST_MATCH if the signature is correct, otherwise status code that indicates error.
+ * @error DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY the signature is broken
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_DIGEST_VERIFICATION_FAILURE error on digital signature verification (returned by OpenSSL EVP_PKEY_verify())
+ */
+static DkimStatus
+DkimDigester_verifyRsa(DkimDigester *self, const unsigned char *signbuf, size_t signlen,
+                       const unsigned char *md, unsigned int mdlen, EVP_PKEY *pkey)
+{
+    // equivalent to EVP_VerifyFinal(), which takes the digest context instead of the hash
+    EVP_PKEY_CTX *pkctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (NULL == pkctx) {
+        DkimLogNoResource(self->policy);
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+    int vret = -1;
+    if (0 < EVP_PKEY_verify_init(pkctx)
+        && 0 < EVP_PKEY_CTX_set_signature_md(pkctx, self->digest_alg)) {
+        vret = EVP_PKEY_verify(pkctx, signbuf, signlen, md, mdlen);
+    }   // end if
+    EVP_PKEY_CTX_free(pkctx);
+    // EVP_PKEY_verify() returns 1 for a correct signature, 0 for failure and negative value if some other error occurred.
+    if (1 == vret) {
+        // the signature is correct
+        return DSTAT_INFO_DIGEST_MATCH;
+    } else if (0 == vret) {
+        // the signature is broken
+        DkimLogPermFail(self->policy, "Digest of message header mismatch");
+        return DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY;
+    } else {
+        // some other error occurred
+        DkimLogSysError(self->policy, "Digest verification error");
+        DkimDigester_logOpenSSLErrors(self);
+        return DSTAT_SYSERR_DIGEST_VERIFICATION_FAILURE;
+    }   // end if
+}   // end function: DkimDigester_verifyRsa
+
+/**
+ * verify the Ed25519 signature over the SHA-256 hash of the message headers [RFC8463].
+ * @return DSTAT_INFO_DIGEST_MATCH if the signature is correct, otherwise status code that indicates error.
+ * @error DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY the signature is broken
+ */
+static DkimStatus
+DkimDigester_verifyEd25519(DkimDigester *self, const unsigned char *signbuf, size_t signlen,
+                           const unsigned char *md, unsigned int mdlen,
+                           const unsigned char *publickey)
+{
+    if (ED25519_SIGNATURE_LEN != signlen || !Ed25519_verify(signbuf, md, mdlen, publickey)) {
+        DkimLogPermFail(self->policy, "Digest of message header mismatch");
+        return DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY;
+    }   // end if
+    return DSTAT_INFO_DIGEST_MATCH;
+}   // end function: DkimDigester_verifyEd25519
+
+/**
+ * check if the type of the public key is suitable for the algorithm
+ * specified by sig-a-tag of the DKIM-Signature header.
+ * @return DSTAT_OK if suitable, otherwise DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH.
+ */
+static DkimStatus
+DkimDigester_checkKeyType(const DkimDigester *self, const DkimPublicKey *publickey)
+{
+    if (DkimPublicKey_getKeyType(publickey) != self->pubkey_alg) {
+        DkimLogPermFail(self->policy, "Public key algorithm mismatch: signature=0x%x, pubkey=0x%x",
+                        self->pubkey_alg, DkimPublicKey_getKeyType(publickey));
+        return DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH;
+    }   // end if
+    return DSTAT_OK;
+}   // end function: DkimDigester_checkKeyType
+
+/**
+ * compare the digest of the message body to the digest value (sig-bh-tag) included in the DKIM-Signature header.
+ * must be called after the whole message body is passed to DkimDigester_updateBody().
  * @param signature DkimSignature object to verify
- * @param pkey public key
- * @return DSTAT_INFO_DIGEST_MATCH if the digest value of message header fields and body matches,
+ * @return DSTAT_INFO_DIGEST_MATCH if the digest value of the message body matches,
  *         otherwise status code that indicates error.
- * @error DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY the digest value of the message header fields does not match
  * @error DSTAT_PERMFAIL_BODY_HASH_DID_NOT_VERIFY the digest value of the message body does not match
  * @error other errors
  */
 DkimStatus
-DkimDigester_verifyMessage(DkimDigester *self, const MailHeaders *headers,
-                           const DkimSignature *signature, EVP_PKEY *publickey)
+DkimDigester_verifyBody(DkimDigester *self, const DkimSignature *signature)
 {
     assert(NULL != self);
-    assert(NULL != headers);
     assert(NULL != signature);
-    assert(NULL != publickey);
-
-    const unsigned char *canonbuf;
-    const unsigned char *signbuf;
-    size_t canonsize, signlen;
-    unsigned char md[EVP_MD_size(self->digest_alg)];    // EVP_MAX_MD_SIZE instead of EVP_MD_size() is safer(?)
-    unsigned int mdlen;
-
-    // check if the type of the public key is suitable for the algorithm
-    // specified by sig-a-tag of the DKIM-Signature header.
-    if (publickey->type != self->pubkey_alg) {
-        DkimLogPermFail(self->policy, "Public key algorithm mismatch: signature=0x%x, pubkey=0x%x",
-                        publickey->type, self->pubkey_alg);
-        return DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH;
-    }   // end if
 
     // Calculation and verification of the message body hash.
-    // Flush the canonicalization buffer and finalize canonicalization.
-    DkimStatus ret = DkimCanonicalizer_finalizeBody(self->canon, &canonbuf, &canonsize);
-    if (DSTAT_OK != ret) {
-        return ret;
-    }   // end if
-    // Add the final chunk of the message body into the digest.
-    ret = DkimDigester_updateBodyChunk(self, canonbuf, canonsize);
+    // The body hash may be computed by another DkimDigester object with the same parameters.
+    DkimDigester *body_digester = PTROR(self->body_source, self);
+    DkimStatus ret = DkimDigester_finalizeBody(body_digester);
     if (DSTAT_OK != ret) {
         return ret;
     }   // end if
-    if (0 == EVP_DigestFinal(&self->body_digest, md, &mdlen)) {
-        DkimLogSysError(self->policy, "Digest finish (of body) failed");
-        DkimDigester_logOpenSSLErrors(self);
-        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
-    }   // end if
 
-    // Comparing the digest of the message body prior to the verification of the signature
     const XBuffer *bodyhash = DkimSignature_getBodyHash(signature);
-    if (!XBuffer_compareToBytes(bodyhash, md, mdlen)) {
+    if (!XBuffer_compareToBytes(bodyhash, body_digester->body_hash, body_digester->body_hash_len)) {
         DkimLogPermFail(self->policy, "Digest of message body mismatch");
         return DSTAT_PERMFAIL_BODY_HASH_DID_NOT_VERIFY;
     }   // end if
+    return DSTAT_INFO_DIGEST_MATCH;
+}   // end function: DkimDigester_verifyBody
+
+/**
+ * verify the signature (sig-b-tag) over the message headers, without the message body.
+ * the signature covers sig-bh-tag, so DkimDigester_verifyBody() must also succeed
+ * for the message to be verified.
+ * The header digest is finalized, so this function can be called only once for each object.
+ * @param header_index DkimHeaderIndex object built from all headers of the message.
+ * @param signature DkimSignature object to verify
+ * @param pkey public key
+ * @param verdict_cache DkimVerdictCache object to look up and store the result of the signature verification,
+ *                      NULL to verify the signature always.
+ * @return DSTAT_INFO_DIGEST_MATCH if the signature over the message header fields is correct,
+ *         otherwise status code that indicates error.
+ * @error DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY the digest value of the message header fields does not match
+ * @error other errors
+ */
+DkimStatus
+DkimDigester_verifyHeader(DkimDigester *self, const DkimHeaderIndex *header_index,
+                          const DkimSignature *signature, const DkimPublicKey *publickey,
+                          DkimVerdictCache *verdict_cache)
+{
+    assert(NULL != self);
+    assert(NULL != header_index);
+    assert(NULL != signature);
+    assert(NULL != publickey);
+
+    const unsigned char *signbuf;
+    size_t signlen;
+
+    DkimStatus ret = DkimDigester_checkKeyType(self, publickey);
+    if (DSTAT_OK != ret) {
+        return ret;
+    }   // end if
 
     // Add the headers specified by sig-h-tag into the digest.
     ret =
-        DkimDigester_updateSignedHeaders(self, headers,
+        DkimDigester_updateSignedHeaders(self, header_index,
                                          DkimSignature_getSignedHeaderFields(signature));
     if (DSTAT_OK != ret) {
         return ret;
@@ -570,85 +853,106 @@ DkimDigester_verifyMessage(DkimDigester *self, const MailHeaders *headers,
     // discard errors occurred in functions for debugging
     (void) DkimDigester_closeC14nDump(self);
 
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen;
+    if (0 == EVP_DigestFinal(&self->header_digest, md, &mdlen)) {
+        DkimLogSysError(self->policy, "Digest finish (of header) failed");
+        DkimDigester_logOpenSSLErrors(self);
+        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
+    }   // end if
+
+    // the same signature over the same message may have been verified already
+    unsigned char verdict_key[DKIM_VERDICTCACHE_KEY_LEN];
+    if (NULL != verdict_cache) {
+        ret = DkimDigester_computeVerdictKey(self, signature, publickey, md, mdlen, verdict_key);
+        if (DSTAT_OK != ret) {
+            return ret;
+        }   // end if
+        DkimStatus verdict;
+        if (DkimVerdictCache_lookup(verdict_cache, verdict_key, &verdict)) {
+            if (DSTAT_INFO_DIGEST_MATCH != verdict) {
+                DkimLogPermFail(self->policy, "Digest of message header mismatch (cached)");
+            }   // end if
+            return verdict;
+        }   // end if
+    }   // end if
+
     const XBuffer *headerhash = DkimSignature_getSignatureValue(signature);
     signbuf = (const unsigned char *) XBuffer_getBytes(headerhash);
     signlen = XBuffer_getSize(headerhash);
-    int vret = EVP_VerifyFinal(&self->header_digest, signbuf, signlen, publickey);
-    // EVP_VerifyFinal() returns 1 for a correct signature, 0 for failure and -1 if some other error occurred.
-    switch (vret) {
-    case 1:    // the signature is correct
-        return DSTAT_INFO_DIGEST_MATCH;
-    case 0:    // the signature is broken
-        DkimLogPermFail(self->policy, "Digest of message header mismatch");
-        return DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY;
-    case -1:   // some other error occurred
-        DkimLogSysError(self->policy, "Digest verification error");
-        DkimDigester_logOpenSSLErrors(self);
-        return DSTAT_SYSERR_DIGEST_VERIFICATION_FAILURE;
-    default:
-        DkimLogImplError(self->policy, "EVP_VerifyFinal returns unexpected value: ret=0x%x", vret);
-        DkimDigester_logOpenSSLErrors(self);
-        return DSTAT_SYSERR_IMPLERROR;
-    }   // end switch
-}   // end function: DkimDigester_verifyMessage
+    if (DKIM_KEY_TYPE_ED25519 == self->pubkey_alg) {
+        ret = DkimDigester_verifyEd25519(self, signbuf, signlen, md, mdlen,
+                                         DkimPublicKey_getEd25519Key(publickey));
+    } else {
+        ret = DkimDigester_verifyRsa(self, signbuf, signlen, md, mdlen,
+                                     DkimPublicKey_getPublicKey(publickey));
+    }   // end if
+
+    // failure to store the result is not an error since the cache is merely an optimization
+    if (NULL != verdict_cache) {
+        (void) DkimVerdictCache_store(verdict_cache, verdict_key, ret);
+    }   // end if
+    return ret;
+}   // end function: DkimDigester_verifyHeader
 
 /**
- * generate the digital signature based on the digests of the message headers and body
- * @param headers MailHeaders object that stores all headers.
- * @param signature DkimSignature object that stores the digest value calculated in this function.
- *                  "signature_value", "bodyhash", "rawname" and "rawvalue" field of this object are updated in this function.
- *                  "signed_header_fields" field of this object is referred to determine which header fields to be signed.
- * @param pkey private key
- * @return DSTAT_OK for success, otherwise status code that indicates error.
- * @error DSTAT_SYSERR_NORESOURCE memory allocation error
- * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
- * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ * compare the digests of the message headers and body to the digest value included in the DKIM-Signature headers
+ * @param header_index DkimHeaderIndex object built from all headers of the message.
+ * @param signature DkimSignature object to verify
+ * @param pkey public key
+ * @param verdict_cache DkimVerdictCache object to look up and store the result of the signature verification,
+ *                      NULL to verify the signature always.
+ * @return DSTAT_INFO_DIGEST_MATCH if the digest value of message header fields and body matches,
+ *         otherwise status code that indicates error.
+ * @error DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY the digest value of the message header fields does not match
+ * @error DSTAT_PERMFAIL_BODY_HASH_DID_NOT_VERIFY the digest value of the message body does not match
+ * @error other errors
  */
 DkimStatus
-DkimDigester_signMessage(DkimDigester *self, const MailHeaders *headers, DkimSignature *signature,
-                         EVP_PKEY *privatekey)
+DkimDigester_verifyMessage(DkimDigester *self, const DkimHeaderIndex *header_index,
+                           const DkimSignature *signature, const DkimPublicKey *publickey,
+                           DkimVerdictCache *verdict_cache)
 {
     assert(NULL != self);
-    assert(NULL != headers);
-    assert(NULL != signature);
-    assert(NULL != privatekey);
-
-    // XXX signature と self の署名/ダイジェストアルゴリズムが一致しているか確認した方がいい
-    if (privatekey->type != self->pubkey_alg) {
-        DkimLogPermFail(self->policy,
-                        "Public key algorithm mismatch: signature=0x%x, privatekey=0x%x",
-                        privatekey->type, self->pubkey_alg);
-        return DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH;
-    }   // end if
+    assert(NULL != publickey);
 
-    // calculation of the message body hash
-    const unsigned char *canonbuf;
-    size_t canonsize;
-    DkimStatus ret = DkimCanonicalizer_finalizeBody(self->canon, &canonbuf, &canonsize);
+    DkimStatus ret = DkimDigester_checkKeyType(self, publickey);
     if (DSTAT_OK != ret) {
         return ret;
     }   // end if
-    ret = DkimDigester_updateBodyChunk(self, canonbuf, canonsize);
-    if (DSTAT_OK != ret) {
+
+    // Comparing the digest of the message body prior to the verification of the signature
+    ret = DkimDigester_verifyBody(self, signature);
+    if (DSTAT_INFO_DIGEST_MATCH != ret) {
         return ret;
     }   // end if
+    return DkimDigester_verifyHeader(self, header_index, signature, publickey, verdict_cache);
+}   // end function: DkimDigester_verifyMessage
 
-    unsigned char bodyhashbuf[EVP_MD_size(self->digest_alg)];   // EVP_MAX_MD_SIZE instead of EVP_MD_size() is safer(?)
-    unsigned int bodyhashlen;
-    bodyhashlen = EVP_MD_size(self->digest_alg);
-    if (0 == EVP_DigestFinal(&self->body_digest, bodyhashbuf, &bodyhashlen)) {
-        DkimLogSysError(self->policy, "DigestFinal (of body) failed");
-        DkimDigester_logOpenSSLErrors(self);
-        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
+/**
+ * set the body hash to the signature, and add the message headers to be signed
+ * and DKIM-Signature header without sig-b-tag into the header digest.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ */
+static DkimStatus
+DkimDigester_digestMessageToSign(DkimDigester *self, const DkimHeaderIndex *header_index,
+                                 DkimSignature *signature)
+{
+    // calculation of the message body hash
+    DkimDigester *body_digester = PTROR(self->body_source, self);
+    DkimStatus ret = DkimDigester_finalizeBody(body_digester);
+    if (DSTAT_OK != ret) {
+        return ret;
     }   // end if
-    ret = DkimSignature_setBodyHash(signature, bodyhashbuf, bodyhashlen);
+    ret = DkimSignature_setBodyHash(signature, body_digester->body_hash,
+                                    body_digester->body_hash_len);
     if (DSTAT_OK != ret) {
         return ret;
     }   // end if
 
     // calculation of the message headers hash
     ret =
-        DkimDigester_updateSignedHeaders(self, headers,
+        DkimDigester_updateSignedHeaders(self, header_index,
                                          DkimSignature_getSignedHeaderFields(signature));
     if (DSTAT_OK != ret) {
         return ret;
@@ -673,6 +977,42 @@ DkimDigester_signMessage(DkimDigester *self, const MailHeaders *headers, DkimSig
 
     // discard errors occurred in functions for debugging
     (void) DkimDigester_closeC14nDump(self);
+    return DSTAT_OK;
+}   // end function: DkimDigester_digestMessageToSign
+
+/**
+ * generate the digital signature based on the digests of the message headers and body
+ * @param header_index DkimHeaderIndex object built from all headers of the message.
+ * @param signature DkimSignature object that stores the digest value calculated in this function.
+ *                  "signature_value", "bodyhash", "rawname" and "rawvalue" field of this object are updated in this function.
+ *                  "signed_header_fields" field of this object is referred to determine which header fields to be signed.
+ * @param pkey private key
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+DkimStatus
+DkimDigester_signMessage(DkimDigester *self, const DkimHeaderIndex *header_index,
+                         DkimSignature *signature, EVP_PKEY *privatekey)
+{
+    assert(NULL != self);
+    assert(NULL != header_index);
+    assert(NULL != signature);
+    assert(NULL != privatekey);
+
+    // XXX signature と self の署名/ダイジェストアルゴリズムが一致しているか確認した方がいい
+    if (DKIM_KEY_TYPE_RSA != self->pubkey_alg || EVP_PKEY_RSA != privatekey->type) {
+        DkimLogPermFail(self->policy,
+                        "Public key algorithm mismatch: signature=0x%x, privatekey=0x%x",
+                        self->pubkey_alg, privatekey->type);
+        return DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH;
+    }   // end if
+
+    DkimStatus ret = DkimDigester_digestMessageToSign(self, header_index, signature);
+    if (DSTAT_OK != ret) {
+        return ret;
+    }   // end if
 
     unsigned char signbuf[EVP_PKEY_size(privatekey)];
     unsigned int signlen;
@@ -688,3 +1028,46 @@ DkimDigester_signMessage(DkimDigester *self, const MailHeaders *headers, DkimSig
 
     return DSTAT_OK;
 }   // end function: DkimDigester_signMessage
+
+/**
+ * generate the Ed25519 signature over the SHA-256 hash of the message headers [RFC8463].
+ * @param privatekey Ed25519 private key of ED25519_PRIVATEKEY_LEN octets
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+DkimStatus
+DkimDigester_signMessageWithEd25519(DkimDigester *self, const DkimHeaderIndex *header_index,
+                                    DkimSignature *signature, const unsigned char *privatekey)
+{
+    assert(NULL != self);
+    assert(NULL != header_index);
+    assert(NULL != signature);
+    assert(NULL != privatekey);
+
+    if (DKIM_KEY_TYPE_ED25519 != self->pubkey_alg) {
+        DkimLogPermFail(self->policy,
+                        "Public key algorithm mismatch: signature=0x%x, privatekey=ed25519",
+                        self->pubkey_alg);
+        return DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH;
+    }   // end if
+
+    DkimStatus ret = DkimDigester_digestMessageToSign(self, header_index, signature);
+    if (DSTAT_OK != ret) {
+        return ret;
+    }   // end if
+
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int mdlen;
+    if (0 == EVP_DigestFinal(&self->header_digest, md, &mdlen)) {
+        DkimLogSysError(self->policy, "Digest finish (of header) failed");
+        DkimDigester_logOpenSSLErrors(self);
+        return DSTAT_SYSERR_DIGEST_UPDATE_FAILURE;
+    }   // end if
+    unsigned char publickey[ED25519_PUBLICKEY_LEN];
+    unsigned char signbuf[ED25519_SIGNATURE_LEN];
+    Ed25519_derivePublicKey(publickey, privatekey);
+    Ed25519_sign(signbuf, md, mdlen, privatekey, publickey);
+    return DkimSignature_setSignatureValue(signature, signbuf, sizeof(signbuf));
+}   // end function: DkimDigester_signMessageWithEd25519
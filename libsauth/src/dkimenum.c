@@ -30,6 +30,7 @@ static const KeywordMap dkim_c14n_algorithm_table[] = {
 
 static const KeywordMap dkim_key_type_table[] = {
     {"rsa", DKIM_KEY_TYPE_RSA},
+    {"ed25519", DKIM_KEY_TYPE_ED25519},
     {NULL, DKIM_KEY_TYPE_NULL},
 };
 
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "dkim.h"
+#include "mailheaders.h"
+#include "dkimenum.h"
+#include "dkimcanonicalizer.h"
+#include "dkimheaderindex.h"
+
+/*
+ * Index of the header fields of a message, built once per message and shared by
+ * all the signatures to sign or verify.
+ * The header fields are grouped by the field name (case-insensitive),
+ * and the positions of each group are chained from the bottom to the top of the header block,
+ * which is the order to pick the header fields listed in sig-h-tag [RFC6376] 5.4.2.
+ * The index is immutable once built, so that it can be used by multiple threads at a time.
+ * The state of the selection is held by the caller as an array of cursors, one for each field name.
+ * The only exception is the memo of the canonicalized header fields, which is filled lazily
+ * and shared by all the signatures, whatever canonicalization algorithms they use.
+ * Each slot of the memo is published by compare-and-swap, so no lock is required.
+ */
+
+#define DKIM_HEADER_INDEX_NONE SIZE_MAX
+
+// the number of the memo slots for each header field:
+// {simple, relaxed} x {without, with} the leading space of the header field value
+#define DKIM_HEADER_INDEX_CANON_VARIANT_NUM 4
+
+typedef struct DkimHeaderIndexCanon {
+    size_t len;
+    unsigned char buf[];        // canonicalized header field including trailing CRLF
+} DkimHeaderIndexCanon;
+
+typedef struct DkimHeaderIndexName {
+    unsigned int hash;
+    const char *fieldname;      // field name of the bottom-most instance
+    size_t bottom;              // position of the bottom-most instance
+    size_t top;                 // position of the top-most instance
+} DkimHeaderIndexName;
+
+struct DkimHeaderIndex {
+    const MailHeaders *headers;
+    size_t namenum;
+    DkimHeaderIndexName *name;  // array of the distinct field names
+    size_t *upper;              // upper[pos]: position of the next instance above "pos" of the same name
+    size_t bucket_num;          // power of 2
+    size_t *bucket;             // (index of "name" + 1), 0 for empty bucket (open addressing)
+    size_t headernum;
+    DkimHeaderIndexCanon **canon;   // memo of the canonicalized header fields, filled lazily
+};
+
+/**
+ * FNV-1a hash of the header field name, case-insensitive
+ */
+static unsigned int
+DkimHeaderIndex_hash(const char *fieldname)
+{
+    unsigned int hash = 2166136261U;
+    for (const unsigned char *p = (const unsigned char *) fieldname; '\0' != *p; ++p) {
+        hash ^= (unsigned int) tolower(*p);
+        hash *= 16777619U;
+    }   // end for
+    return hash;
+}   // end function: DkimHeaderIndex_hash
+
+/**
+ * @return the bucket which holds "fieldname", or the empty bucket where "fieldname" is to be stored.
+ */
+static size_t *
+DkimHeaderIndex_findBucket(const DkimHeaderIndex *self, const char *fieldname, unsigned int hash)
+{
+    size_t mask = self->bucket_num - 1;
+    for (size_t idx = hash & mask;; idx = (idx + 1) & mask) {
+        size_t *bucket = &self->bucket[idx];
+        if (0 == *bucket) {
+            return bucket;
+        }   // end if
+        const DkimHeaderIndexName *name = &self->name[*bucket - 1];
+        if (name->hash == hash && 0 == strcasecmp(name->fieldname, fieldname)) {
+            return bucket;
+        }   // end if
+    }   // end for
+}   // end function: DkimHeaderIndex_findBucket
+
+/**
+ * create DkimHeaderIndex object
+ * @param headers MailHeaders object that stores all headers.
+ *                It must not be modified nor released while the DkimHeaderIndex object is in use.
+ * @return initialized DkimHeaderIndex object, or NULL if memory allocation failed.
+ */
+DkimHeaderIndex *
+DkimHeaderIndex_new(const MailHeaders *headers)
+{
+    assert(NULL != headers);
+
+    DkimHeaderIndex *self = (DkimHeaderIndex *) malloc(sizeof(DkimHeaderIndex));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(DkimHeaderIndex));
+    self->headers = headers;
+
+    size_t headernum = MailHeaders_getCount(headers);
+    self->bucket_num = 16;
+    while (self->bucket_num < headernum * 2) {
+        self->bucket_num <<= 1;
+    }   // end while
+    self->bucket = (size_t *) calloc(self->bucket_num, sizeof(size_t));
+    self->name = (DkimHeaderIndexName *) malloc(sizeof(DkimHeaderIndexName) * (headernum + 1));
+    self->upper = (size_t *) malloc(sizeof(size_t) * (headernum + 1));
+    self->headernum = headernum;
+    self->canon = (DkimHeaderIndexCanon **) calloc(headernum * DKIM_HEADER_INDEX_CANON_VARIANT_NUM + 1,
+                                                   sizeof(DkimHeaderIndexCanon *));
+    if (NULL == self->bucket || NULL == self->name || NULL == self->upper || NULL == self->canon) {
+        goto cleanup;
+    }   // end if
+
+    // scan from the bottom of the header block
+    for (size_t pos = headernum; 0 < pos--;) {
+        const char *headerf, *headerv;
+        MailHeaders_get(headers, pos, &headerf, &headerv);
+        self->upper[pos] = DKIM_HEADER_INDEX_NONE;
+        if (NULL == headerf || NULL == headerv) {
+            continue;
+        }   // end if
+
+        unsigned int hash = DkimHeaderIndex_hash(headerf);
+        size_t *bucket = DkimHeaderIndex_findBucket(self, headerf, hash);
+        if (0 == *bucket) {
+            // the bottom-most instance of the field name
+            DkimHeaderIndexName *name = &self->name[self->namenum];
+            name->hash = hash;
+            name->fieldname = headerf;
+            name->bottom = pos;
+            name->top = pos;
+            *bucket = ++(self->namenum);
+        } else {
+            DkimHeaderIndexName *name = &self->name[*bucket - 1];
+            self->upper[name->top] = pos;
+            name->top = pos;
+        }   // end if
+    }   // end for
+
+    return self;
+
+  cleanup:
+    DkimHeaderIndex_free(self);
+    return NULL;
+}   // end function: DkimHeaderIndex_new
+
+/**
+ * release DkimHeaderIndex object
+ * @param self DkimHeaderIndex object to release
+ */
+void
+DkimHeaderIndex_free(DkimHeaderIndex *self)
+{
+    assert(NULL != self);
+    if (NULL != self->canon) {
+        for (size_t i = 0; i < self->headernum * DKIM_HEADER_INDEX_CANON_VARIANT_NUM; ++i) {
+            free(self->canon[i]);
+        }   // end for
+        free(self->canon);
+    }   // end if
+    free(self->bucket);
+    free(self->name);
+    free(self->upper);
+    free(self);
+}   // end function: DkimHeaderIndex_free
+
+/**
+ * @return MailHeaders object which the index is built from
+ */
+const MailHeaders *
+DkimHeaderIndex_getHeaders(const DkimHeaderIndex *self)
+{
+    assert(NULL != self);
+    return self->headers;
+}   // end function: DkimHeaderIndex_getHeaders
+
+/**
+ * @return the number of the distinct header field names,
+ *         which is the number of the cursors DkimHeaderIndex_pickBottomMost() requires.
+ */
+size_t
+DkimHeaderIndex_getNameCount(const DkimHeaderIndex *self)
+{
+    assert(NULL != self);
+    return self->namenum;
+}   // end function: DkimHeaderIndex_getNameCount
+
+/**
+ * pick the bottom-most header field named "fieldname" that has not been picked yet.
+ * @param fieldname header field name to pick, compared case-insensitively
+ * @param cursor array of the cursors with DkimHeaderIndex_getNameCount() elements,
+ *               which must be zero-filled before the first call of each selection.
+ *               The cursor of "fieldname" is advanced if the header field is picked.
+ * @param headerf a pointer to a variable to receive the header field name
+ * @param headerv a pointer to a variable to receive the header field value
+ * @param headeridx a pointer to a variable to receive the position of the header field,
+ *                  which is passed to DkimHeaderIndex_canonicalize()
+ * @return true if the header field is picked,
+ *         false if no more header fields named "fieldname" exist.
+ */
+bool
+DkimHeaderIndex_pickBottomMost(const DkimHeaderIndex *self, const char *fieldname,
+                               size_t *cursor, const char **headerf, const char **headerv,
+                               size_t *headeridx)
+{
+    assert(NULL != self);
+    assert(NULL != fieldname);
+
+    size_t bucket = *DkimHeaderIndex_findBucket(self, fieldname, DkimHeaderIndex_hash(fieldname));
+    if (0 == bucket) {
+        return false;
+    }   // end if
+
+    // cursor holds (the position of the instance picked last + 1), or 0 if none is picked yet
+    size_t nameidx = bucket - 1;
+    size_t pos = (0 == cursor[nameidx])
+        ? self->name[nameidx].bottom : self->upper[cursor[nameidx] - 1];
+    if (DKIM_HEADER_INDEX_NONE == pos) {
+        return false;
+    }   // end if
+    cursor[nameidx] = pos + 1;
+    MailHeaders_get(self->headers, pos, headerf, headerv);
+    *headeridx = pos;
+    return true;
+}   // end function: DkimHeaderIndex_pickBottomMost
+
+/**
+ * canonicalize the header field at "headeridx" with the header canonicalization algorithm of "canon".
+ * the result is memoized in the index, so that the other signatures sharing the index
+ * can reuse it without canonicalizing the same header field again.
+ * @param headeridx position of the header field, obtained by DkimHeaderIndex_pickBottomMost()
+ * @param canon DkimCanonicalizer object used if the result is not memoized yet
+ * @param suppose_leading_header_space passed to DkimCanonicalizer_header()
+ * @param canonbuf a pointer to a variable to receive the canonicalized header field,
+ *                 including trailing CRLF.
+ *                 The buffer is valid until the index is released, or,
+ *                 if the memory to memoize could not be allocated,
+ *                 until the next operation on "canon".
+ * @param canonsize a pointer to a variable to receive the length of "canonbuf"
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error the errors DkimCanonicalizer_header() returns
+ */
+DkimStatus
+DkimHeaderIndex_canonicalize(const DkimHeaderIndex *self, size_t headeridx,
+                             DkimCanonicalizer *canon, bool suppose_leading_header_space,
+                             const unsigned char **canonbuf, size_t *canonsize)
+{
+    assert(NULL != self);
+    assert(headeridx < self->headernum);
+    assert(NULL != canon);
+
+    size_t variant = (DKIM_C14N_ALGORITHM_RELAXED == DkimCanonicalizer_getHeaderAlgorithm(canon)
+                      ? 2 : 0) + (suppose_leading_header_space ? 1 : 0);
+    DkimHeaderIndexCanon **slot =
+        &self->canon[headeridx * DKIM_HEADER_INDEX_CANON_VARIANT_NUM + variant];
+    DkimHeaderIndexCanon *memo = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (NULL != memo) {
+        *canonbuf = memo->buf;
+        *canonsize = memo->len;
+        return DSTAT_OK;
+    }   // end if
+
+    const char *headerf, *headerv;
+    MailHeaders_get(self->headers, headeridx, &headerf, &headerv);
+    DkimStatus ret = DkimCanonicalizer_header(canon, headerf, headerv, true,
+                                              suppose_leading_header_space, canonbuf, canonsize);
+    if (DSTAT_OK != ret) {
+        return ret;
+    }   // end if
+
+    memo = (DkimHeaderIndexCanon *) malloc(sizeof(DkimHeaderIndexCanon) + *canonsize);
+    if (NULL == memo) {
+        // not memoized, but the result in the buffer of "canon" is still available
+        return DSTAT_OK;
+    }   // end if
+    memo->len = *canonsize;
+    memcpy(memo->buf, *canonbuf, *canonsize);
+
+    DkimHeaderIndexCanon *expected = NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, memo, false, __ATOMIC_RELEASE,
+                                     __ATOMIC_ACQUIRE)) {
+        // another thread has memoized the same header field first
+        free(memo);
+        memo = expected;
+    }   // end if
+    *canonbuf = memo->buf;
+    *canonsize = memo->len;
+    return DSTAT_OK;
+}   // end function: DkimHeaderIndex_canonicalize
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "dnsresolv.h"
+#include "dkimlookuppool.h"
+
+/*
+ * Fixed-size thread pool to run the DNS lookups started ahead of the verification,
+ * so that the number of the threads and DnsResolver objects does not grow with the traffic.
+ * Each worker thread owns a DnsResolver object for its whole life.
+ * DkimLookupPool_submit() enqueues a lookup without waiting for it,
+ * and refuses it once the number of the lookups in flight (queued or running) reaches the limit.
+ * DkimLookupPool_wait() waits for a running lookup, or withdraws a queued one,
+ * in which case the caller is expected to do the lookup by itself.
+ * The worker threads are started on the first use, so that the pool can be created
+ * before the process forks (daemonizes).
+ */
+
+struct DkimLookupTask {
+    DkimLookupJob job;
+    void *arg;
+    bool running;
+    bool done;
+    struct DkimLookupTask *queue_next;
+};
+
+typedef struct DkimLookupWorker {
+    DkimLookupPool *pool;
+    DnsResolver *resolver;
+    pthread_t thread;
+} DkimLookupWorker;
+
+struct DkimLookupPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;        // signaled when a task is completed
+    DkimLookupTask *queue_head;
+    DkimLookupTask *queue_tail;
+    bool shutdown;
+    size_t inflight_limit;
+    size_t inflight_num;        // number of the tasks queued or running
+    size_t thread_max;
+    size_t thread_num;          // number of the worker threads running
+    DkimLookupWorker *worker;
+};
+
+static void *
+DkimLookupPool_worker(void *arg)
+{
+    DkimLookupWorker *worker = (DkimLookupWorker *) arg;
+    DkimLookupPool *self = worker->pool;
+
+    (void) pthread_mutex_lock(&self->lock);
+    while (true) {
+        while (NULL == self->queue_head && !self->shutdown) {
+            (void) pthread_cond_wait(&self->work, &self->lock);
+        }   // end while
+        if (NULL == self->queue_head) {
+            // shutting down
+            break;
+        }   // end if
+
+        // pick up a task from the head of the queue
+        DkimLookupTask *task = self->queue_head;
+        self->queue_head = task->queue_next;
+        if (NULL == self->queue_head) {
+            self->queue_tail = NULL;
+        }   // end if
+        task->running = true;
+        (void) pthread_mutex_unlock(&self->lock);
+
+        task->job(task->arg, worker->resolver);
+
+        (void) pthread_mutex_lock(&self->lock);
+        task->done = true;
+        --(self->inflight_num);
+        (void) pthread_cond_broadcast(&self->done);
+    }   // end while
+    (void) pthread_mutex_unlock(&self->lock);
+    return NULL;
+}   // end function: DkimLookupPool_worker
+
+/**
+ * start the worker threads not running yet.
+ * the lock must be held by the caller.
+ * @return true if at least one worker thread is running, false otherwise.
+ */
+static bool
+DkimLookupPool_start(DkimLookupPool *self)
+{
+    while (self->thread_num < self->thread_max) {
+        DkimLookupWorker *worker = &(self->worker[self->thread_num]);
+        worker->pool = self;
+        worker->resolver = DnsResolver_new();
+        if (NULL == worker->resolver) {
+            break;
+        }   // end if
+        if (0 != pthread_create(&(worker->thread), NULL, DkimLookupPool_worker, worker)) {
+            DnsResolver_free(worker->resolver);
+            worker->resolver = NULL;
+            break;
+        }   // end if
+        ++(self->thread_num);
+    }   // end while
+    return 0 < self->thread_num;
+}   // end function: DkimLookupPool_start
+
+/**
+ * create DkimLookupPool object.
+ * the worker threads are not started until DkimLookupPool_submit() is called first.
+ * @param thread_num the number of the worker threads, that is, the number of the lookups
+ *                   which run at the same time.
+ * @param inflight_limit the maximum number of the lookups queued or running.
+ * @return initialized DkimLookupPool object, or NULL if memory allocation failed.
+ */
+DkimLookupPool *
+DkimLookupPool_new(size_t thread_num, size_t inflight_limit)
+{
+    assert(0 < thread_num);
+    assert(0 < inflight_limit);
+
+    DkimLookupPool *self = (DkimLookupPool *) malloc(sizeof(DkimLookupPool));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(DkimLookupPool));
+    self->worker = (DkimLookupWorker *) malloc(sizeof(DkimLookupWorker) * thread_num);
+    if (NULL == self->worker) {
+        goto cleanup;
+    }   // end if
+    memset(self->worker, 0, sizeof(DkimLookupWorker) * thread_num);
+    if (0 != pthread_mutex_init(&self->lock, NULL)) {
+        goto cleanup;
+    }   // end if
+    if (0 != pthread_cond_init(&self->work, NULL)) {
+        (void) pthread_mutex_destroy(&self->lock);
+        goto cleanup;
+    }   // end if
+    if (0 != pthread_cond_init(&self->done, NULL)) {
+        (void) pthread_cond_destroy(&self->work);
+        (void) pthread_mutex_destroy(&self->lock);
+        goto cleanup;
+    }   // end if
+    self->thread_max = thread_num;
+    self->inflight_limit = inflight_limit;
+    return self;
+
+  cleanup:
+    free(self->worker);
+    free(self);
+    return NULL;
+}   // end function: DkimLookupPool_new
+
+/**
+ * stop the worker threads and release DkimLookupPool object.
+ * must not be called while any task submitted is not passed to DkimLookupPool_wait().
+ * @param self DkimLookupPool object to release
+ */
+void
+DkimLookupPool_free(DkimLookupPool *self)
+{
+    assert(NULL != self);
+
+    (void) pthread_mutex_lock(&self->lock);
+    self->shutdown = true;
+    (void) pthread_cond_broadcast(&self->work);
+    (void) pthread_mutex_unlock(&self->lock);
+    for (size_t i = 0; i < self->thread_num; ++i) {
+        (void) pthread_join(self->worker[i].thread, NULL);
+        DnsResolver_free(self->worker[i].resolver);
+    }   // end for
+
+    (void) pthread_cond_destroy(&self->done);
+    (void) pthread_cond_destroy(&self->work);
+    (void) pthread_mutex_destroy(&self->lock);
+    free(self->worker);
+    free(self);
+}   // end function: DkimLookupPool_free
+
+/**
+ * enqueue "job" to run on one of the worker threads, without waiting for it.
+ * the returned task must be passed to DkimLookupPool_wait() exactly once.
+ * @param job function to run, called as job(arg, resolver) with the DnsResolver object
+ *            owned by the worker thread.
+ * @param arg the first argument passed to "job"
+ * @return DkimLookupTask object, or NULL if the number of the lookups in flight reaches the limit,
+ *         no worker thread could be started, or memory allocation failed.
+ *         "job" is never run in that case.
+ */
+DkimLookupTask *
+DkimLookupPool_submit(DkimLookupPool *self, DkimLookupJob job, void *arg)
+{
+    assert(NULL != self);
+    assert(NULL != job);
+
+    DkimLookupTask *task = (DkimLookupTask *) malloc(sizeof(DkimLookupTask));
+    if (NULL == task) {
+        return NULL;
+    }   // end if
+    memset(task, 0, sizeof(DkimLookupTask));
+    task->job = job;
+    task->arg = arg;
+
+    (void) pthread_mutex_lock(&self->lock);
+    if (self->inflight_limit <= self->inflight_num || !DkimLookupPool_start(self)) {
+        (void) pthread_mutex_unlock(&self->lock);
+        free(task);
+        return NULL;
+    }   // end if
+    if (NULL != self->queue_tail) {
+        self->queue_tail->queue_next = task;
+    } else {
+        self->queue_head = task;
+    }   // end if
+    self->queue_tail = task;
+    ++(self->inflight_num);
+    (void) pthread_cond_signal(&self->work);
+    (void) pthread_mutex_unlock(&self->lock);
+    return task;
+}   // end function: DkimLookupPool_submit
+
+/**
+ * wait for the task to complete if it is running, or withdraw it from the queue
+ * if it has not been picked up by the worker threads yet, and release it.
+ * @param task DkimLookupTask object returned by DkimLookupPool_submit()
+ * @return true if the job has been run, false if it is withdrawn without being run.
+ */
+bool
+DkimLookupPool_wait(DkimLookupPool *self, DkimLookupTask *task)
+{
+    assert(NULL != self);
+    assert(NULL != task);
+
+    bool completed = true;
+    (void) pthread_mutex_lock(&self->lock);
+    if (!task->running) {
+        // unlink the task from the queue
+        DkimLookupTask *prev = NULL;
+        for (DkimLookupTask *p = self->queue_head; p != task; p = p->queue_next) {
+            prev = p;
+        }   // end for
+        if (NULL != prev) {
+            prev->queue_next = task->queue_next;
+        } else {
+            self->queue_head = task->queue_next;
+        }   // end if
+        if (self->queue_tail == task) {
+            self->queue_tail = prev;
+        }   // end if
+        --(self->inflight_num);
+        completed = false;
+    } else {
+        while (!task->done) {
+            (void) pthread_cond_wait(&self->done, &self->lock);
+        }   // end while
+    }   // end if
+    (void) pthread_mutex_unlock(&self->lock);
+
+    free(task);
+    return completed;
+}   // end function: DkimLookupPool_wait
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dkimlrucache.h"
+
+/*
+ * Hash table of the cache entries with the least recently used eviction,
+ * shared by DkimPublicKeyCache and DkimVerdictCache.
+ * The entries are linked through DkimLruCacheEntry embedded in them,
+ * and all the operations are serialized by the lock of the cache.
+ * An entry is discarded when it is found expired, or when it is the least recently used one
+ * and the cache is full.
+ */
+
+struct DkimLruCache {
+    pthread_mutex_t lock;
+    size_t max_entries;
+    size_t bucket_num;          // power of 2
+    DkimLruCacheEntry **bucket;
+    DkimLruCacheEntry *lru_head;
+    DkimLruCacheEntry *lru_tail;
+    size_t count;
+    DkimLruCacheMatcher matcher;
+    DkimLruCacheReleaser releaser;
+};
+
+/**
+ * create DkimLruCache object
+ * @param max_entries the maximum number of the entries to hold.
+ *                    the least recently used entry is discarded when the cache is full.
+ * @param matcher function to test whether the entry has the key
+ * @param releaser function to release the entry discarded from the cache
+ * @return initialized DkimLruCache object, or NULL if memory allocation failed.
+ */
+DkimLruCache *
+DkimLruCache_new(size_t max_entries, DkimLruCacheMatcher matcher, DkimLruCacheReleaser releaser)
+{
+    assert(0 < max_entries);
+    assert(NULL != matcher);
+    assert(NULL != releaser);
+
+    DkimLruCache *self = (DkimLruCache *) malloc(sizeof(DkimLruCache));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(DkimLruCache));
+
+    self->bucket_num = 16;
+    while (self->bucket_num < max_entries) {
+        self->bucket_num <<= 1;
+    }   // end while
+    self->bucket = (DkimLruCacheEntry **) calloc(self->bucket_num, sizeof(DkimLruCacheEntry *));
+    if (NULL == self->bucket) {
+        free(self);
+        return NULL;
+    }   // end if
+    if (0 != pthread_mutex_init(&self->lock, NULL)) {
+        free(self->bucket);
+        free(self);
+        return NULL;
+    }   // end if
+
+    self->max_entries = max_entries;
+    self->matcher = matcher;
+    self->releaser = releaser;
+    return self;
+}   // end function: DkimLruCache_new
+
+/**
+ * release DkimLruCache object and all the entries it holds
+ * @param self DkimLruCache object to release
+ */
+void
+DkimLruCache_free(DkimLruCache *self)
+{
+    assert(NULL != self);
+
+    DkimLruCacheEntry *entry = self->lru_head;
+    while (NULL != entry) {
+        DkimLruCacheEntry *next = entry->lru_next;
+        self->releaser(entry);
+        entry = next;
+    }   // end while
+    (void) pthread_mutex_destroy(&self->lock);
+    free(self->bucket);
+    free(self);
+}   // end function: DkimLruCache_free
+
+static void
+DkimLruCache_unlinkLru(DkimLruCache *self, DkimLruCacheEntry *entry)
+{
+    if (NULL != entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        self->lru_head = entry->lru_next;
+    }   // end if
+    if (NULL != entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        self->lru_tail = entry->lru_prev;
+    }   // end if
+    entry->lru_prev = entry->lru_next = NULL;
+}   // end function: DkimLruCache_unlinkLru
+
+static void
+DkimLruCache_pushLru(DkimLruCache *self, DkimLruCacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = self->lru_head;
+    if (NULL != self->lru_head) {
+        self->lru_head->lru_prev = entry;
+    } else {
+        self->lru_tail = entry;
+    }   // end if
+    self->lru_head = entry;
+}   // end function: DkimLruCache_pushLru
+
+/**
+ * remove the entry from the cache and release it.
+ * the lock must be held by the caller.
+ */
+static void
+DkimLruCache_remove(DkimLruCache *self, DkimLruCacheEntry *entry)
+{
+    DkimLruCacheEntry **slot = &self->bucket[entry->hash & (self->bucket_num - 1)];
+    while (*slot != entry) {
+        assert(NULL != *slot);
+        slot = &(*slot)->chain;
+    }   // end while
+    *slot = entry->chain;
+    DkimLruCache_unlinkLru(self, entry);
+    --(self->count);
+    self->releaser(entry);
+}   // end function: DkimLruCache_remove
+
+/**
+ * the lock must be held by the caller.
+ */
+static DkimLruCacheEntry *
+DkimLruCache_find(const DkimLruCache *self, const void *key, unsigned int hash)
+{
+    DkimLruCacheEntry *entry = self->bucket[hash & (self->bucket_num - 1)];
+    for (; NULL != entry; entry = entry->chain) {
+        if (entry->hash == hash && self->matcher(entry, key)) {
+            return entry;
+        }   // end if
+    }   // end for
+    return NULL;
+}   // end function: DkimLruCache_find
+
+/**
+ * look up the entry and let "reader" copy out its content.
+ * the expired entry is discarded, and the entry read is marked as the most recently used.
+ * @param key the key passed to the matcher
+ * @param hash the hash value of the key
+ * @param reader function called with the entry while the lock is held.
+ *               it returns false to treat the entry as a cache miss.
+ * @param arg the argument passed to "reader"
+ * @return true if the valid entry is found and read, false otherwise.
+ */
+bool
+DkimLruCache_lookup(DkimLruCache *self, const void *key, unsigned int hash,
+                    DkimLruCacheReader reader, void *arg)
+{
+    assert(NULL != self);
+    assert(NULL != reader);
+
+    time_t now = time(NULL);
+    bool found = false;
+
+    (void) pthread_mutex_lock(&self->lock);
+    DkimLruCacheEntry *entry = DkimLruCache_find(self, key, hash);
+    if (NULL != entry && entry->expire <= now) {
+        DkimLruCache_remove(self, entry);
+        entry = NULL;
+    }   // end if
+    if (NULL != entry && reader(entry, arg)) {
+        DkimLruCache_unlinkLru(self, entry);
+        DkimLruCache_pushLru(self, entry);
+        found = true;
+    }   // end if
+    (void) pthread_mutex_unlock(&self->lock);
+    return found;
+}   // end function: DkimLruCache_lookup
+
+/**
+ * insert the entry into the cache, which takes the ownership of it.
+ * the entry with the same key stored in the meantime is replaced,
+ * and the least recently used entry is discarded if the cache is full.
+ * @param entry the entry to insert, whose links are initialized by this function
+ * @param key the key of the entry
+ * @param hash the hash value of the key
+ * @param ttl the time to hold the entry (seconds)
+ */
+void
+DkimLruCache_insert(DkimLruCache *self, DkimLruCacheEntry *entry, const void *key,
+                    unsigned int hash, unsigned int ttl)
+{
+    assert(NULL != self);
+    assert(NULL != entry);
+
+    entry->hash = hash;
+    entry->expire = time(NULL) + ttl;
+
+    (void) pthread_mutex_lock(&self->lock);
+    DkimLruCacheEntry *stale = DkimLruCache_find(self, key, hash);
+    if (NULL != stale) {
+        DkimLruCache_remove(self, stale);
+    }   // end if
+    if (self->max_entries <= self->count) {
+        DkimLruCache_remove(self, self->lru_tail);
+    }   // end if
+    DkimLruCacheEntry **slot = &self->bucket[hash & (self->bucket_num - 1)];
+    entry->chain = *slot;
+    *slot = entry;
+    DkimLruCache_pushLru(self, entry);
+    ++(self->count);
+    (void) pthread_mutex_unlock(&self->lock);
+}   // end function: DkimLruCache_insert
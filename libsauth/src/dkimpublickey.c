@@ -26,6 +26,7 @@ RCSID("$Id: dkimpublickey.c 1368 2011-11-07 02:09:09Z takahiko $");
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include <openssl/evp.h>
 #include <openssl/x509.h>
 
 #include "dkimlogger.h"
@@ -47,6 +48,8 @@ RCSID("$Id: dkimpublickey.c 1368 2011-11-07 02:09:09Z takahiko $");
 #include "dkimconverter.h"
 #include "dkimsignature.h"
 #include "dkimpublickey.h"
+#include "dkimpublickeycache.h"
+#include "ed25519.h"
 
 // a limit number of records to try to check where it is valid as DKIM public key record
 #define DKIM_PUBKEY_CANDIDATE_MAX   10
@@ -57,8 +60,12 @@ struct DkimPublicKey {
     DkimKeyType keytype;        // key-k-tag
     DkimServiceType service_type;   // key-s-tag
     DkimSelectorFlag selector_flag; // key-t-tag
-    EVP_PKEY *pkey;             // key-p-tag
+    XBuffer *rawpubkey;         // key-p-tag (decoded), converted according to key-k-tag in DkimPublicKey_build()
+    EVP_PKEY *pkey;             // key-p-tag for RSA
+    unsigned char ed25519key[ED25519_PUBLICKEY_LEN];    // key-p-tag for Ed25519
+    unsigned char fingerprint[DKIM_PUBLICKEY_FINGERPRINT_LEN];  // SHA-256 digest of key-p-tag (decoded)
     char *granularity;          // key-g-tag
+    volatile unsigned int refcount; // shared with DkimPublicKeyCache and verification frames
 };
 
 static DkimStatus DkimPublicKey_parse_v(DkimTagListObject *base,
@@ -94,6 +101,9 @@ static const DkimTagListObjectFieldMap dkim_pubkey_field_table[] = {
     {NULL, NULL, false, NULL, 0},   // sentinel
 };
 
+static DkimTagListObjectFieldTable dkim_pubkey_tag_table =
+    DKIM_TAGLISTOBJECT_FIELD_TABLE(dkim_pubkey_field_table);
+
 ////////////////////////////////////////////////////////////////////////
 // private functions
 
@@ -210,6 +220,9 @@ DkimPublicKey_parse_h(DkimTagListObject *base, const DkimTagParseContext *contex
  * key-k-tag        = %x76 [FWS] "=" [FWS] key-k-tag-type
  * key-k-tag-type   = "rsa" / x-key-k-tag-type
  * x-key-k-tag-type = hyphenated-word   ; for future extension
+ *
+ * [RFC8463] 3.
+ * key-k-tag-type =/ "ed25519"
  */
 DkimStatus
 DkimPublicKey_parse_k(DkimTagListObject *base, const DkimTagParseContext *context,
@@ -239,6 +252,9 @@ DkimPublicKey_parse_k(DkimTagListObject *base, const DkimTagParseContext *contex
 /*
  * [RFC6376]
  * key-p-tag    = %x70 [FWS] "=" [ [FWS] base64string]
+ *
+ * The content of the public key depends on key-k-tag which may appear after key-p-tag,
+ * so only base64 decoding is done here and the rest is left to DkimPublicKey_build().
  */
 DkimStatus
 DkimPublicKey_parse_p(DkimTagListObject *base, const DkimTagParseContext *context,
@@ -256,24 +272,12 @@ DkimPublicKey_parse_p(DkimTagListObject *base, const DkimTagParseContext *contex
     }   // end if
 
     DkimStatus decode_stat;
-    XBuffer *rawpubkey =
+    self->rawpubkey =
         DkimConverter_decodeBase64(self->policy, p, context->value_tail, &p, &decode_stat);
-    if (NULL == rawpubkey) {
+    if (NULL == self->rawpubkey) {
         return decode_stat;
     }   // end if
 
-    const unsigned char *pbuf = XBuffer_getBytes(rawpubkey);
-    size_t psize = XBuffer_getSize(rawpubkey);
-
-    // ATTENTION: second parameter of d2i_PUBKEY() may be overwritten (!?)
-    self->pkey = d2i_PUBKEY(NULL, &pbuf, psize);
-    XBuffer_free(rawpubkey);
-    if (NULL == self->pkey) {
-        DkimLogPermFail(self->policy, "key-p-tag doesn't valid public key record: record=%s",
-                        context->value_head);
-        return DSTAT_PERMFAIL_PUBLICKEY_BROKEN;
-    }   // end if
-
     SETDEREF(nextp, p);
     return DSTAT_OK;
 }   // end function: DkimPublicKey_parse_p
@@ -373,6 +377,7 @@ DkimPublicKey_parse_t(DkimTagListObject *base, const DkimTagParseContext *contex
  * @error DSTAT_PERMFAIL_KEY_REVOKED Public key record has revoked
  * @error DSTAT_PERMFAIL_PUBLICKEY_BROKEN Public key is broken (returned by OpenSSL d2i_PUBKEY())
  * @error DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH key-k-tag and the content of public key (key-p-tag) does not matched
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest of the public key (returned by OpenSSL EVP_Digest())
  */
 DkimPublicKey *
 DkimPublicKey_build(const DkimPolicyBase *policy, const char *keyval, const char *domain,
@@ -385,7 +390,8 @@ DkimPublicKey_build(const DkimPolicyBase *policy, const char *keyval, const char
         return NULL;
     }   // end if
     memset(self, 0, sizeof(DkimPublicKey));
-    self->ftbl = dkim_pubkey_field_table;
+    self->refcount = 1;
+    self->ftbl = &dkim_pubkey_tag_table;
     self->policy = policy;
     DkimStatus build_stat =
         DkimTagListObject_build((DkimTagListObject *) self, keyval, STRTAIL(keyval), false);
@@ -395,9 +401,25 @@ DkimPublicKey_build(const DkimPolicyBase *policy, const char *keyval, const char
         goto cleanup;
     }   // end if
 
-    // compare key type key-k-tag declared and stored in key-p-tag
+    // convert key-p-tag according to key-k-tag
+    const unsigned char *pbuf = XBuffer_getBytes(self->rawpubkey);
+    size_t psize = XBuffer_getSize(self->rawpubkey);
+    if (0 == EVP_Digest(pbuf, psize, self->fingerprint, NULL, EVP_sha256(), NULL)) {
+        DkimLogSysError(policy, "Digest of public key failed: domain=%s", domain);
+        SETDEREF(dstat, DSTAT_SYSERR_DIGEST_UPDATE_FAILURE);
+        goto cleanup;
+    }   // end if
     switch (self->keytype) {
     case DKIM_KEY_TYPE_RSA:
+        // ATTENTION: second parameter of d2i_PUBKEY() may be overwritten (!?)
+        self->pkey = d2i_PUBKEY(NULL, &pbuf, psize);
+        if (NULL == self->pkey) {
+            DkimLogPermFail(policy, "key-p-tag doesn't valid public key record: domain=%s",
+                            domain);
+            SETDEREF(dstat, DSTAT_PERMFAIL_PUBLICKEY_BROKEN);
+            goto cleanup;
+        }   // end if
+        // compare key type key-k-tag declared and stored in key-p-tag
         if (EVP_PKEY_RSA != EVP_PKEY_type(self->pkey->type)) {
             DkimLogPermFail
                 (policy,
@@ -407,11 +429,28 @@ DkimPublicKey_build(const DkimPolicyBase *policy, const char *keyval, const char
             goto cleanup;
         }   // end if
         break;
+    case DKIM_KEY_TYPE_ED25519:
+        /*
+         * [RFC8463] 4.2.
+         * The Ed25519-SHA256 public key is a 32-octet value, which is base64 encoded
+         * as the p= value of the DNS record.
+         */
+        if (ED25519_PUBLICKEY_LEN != psize) {
+            DkimLogPermFail(policy,
+                            "key-p-tag doesn't valid ed25519 public key: domain=%s, length=%u",
+                            domain, (unsigned int) psize);
+            SETDEREF(dstat, DSTAT_PERMFAIL_PUBLICKEY_BROKEN);
+            goto cleanup;
+        }   // end if
+        memcpy(self->ed25519key, pbuf, ED25519_PUBLICKEY_LEN);
+        break;
     default:
         DkimLogImplError(policy, "unexpected public key algorithm: pubkeyalg=0x%x", self->keytype);
         SETDEREF(dstat, DSTAT_SYSERR_IMPLERROR);
         goto cleanup;
     }   // end switch
+    XBuffer_free(self->rawpubkey);
+    self->rawpubkey = NULL;
 
     SETDEREF(dstat, DSTAT_OK);
     return self;
@@ -422,14 +461,35 @@ DkimPublicKey_build(const DkimPolicyBase *policy, const char *keyval, const char
 }   // end function: DkimPublicKey_build
 
 /**
- * release DkimPublicKey object
+ * add a reference to DkimPublicKey object.
+ * DkimPublicKey object is immutable once built, so it can be shared among threads.
+ * @param self DkimPublicKey object
+ * @return "self"
+ */
+DkimPublicKey *
+DkimPublicKey_ref(DkimPublicKey *self)
+{
+    assert(NULL != self);
+    (void) __sync_add_and_fetch(&self->refcount, 1);
+    return self;
+}   // end function: DkimPublicKey_ref
+
+/**
+ * release a reference to DkimPublicKey object,
+ * the object is released when the last reference is released.
  * @param self DkimPublicKey object to release
  */
 void
 DkimPublicKey_free(DkimPublicKey *self)
 {
     assert(NULL != self);
+    if (0 < __sync_sub_and_fetch(&self->refcount, 1)) {
+        return;
+    }   // end if
     free(self->granularity);
+    if (NULL != self->rawpubkey) {
+        XBuffer_free(self->rawpubkey);
+    }   // end if
     if (NULL != self->pkey) {
         EVP_PKEY_free(self->pkey);
     }   // end if
@@ -459,13 +519,14 @@ DkimPublicKey_isPubKeyAlgMatched(const DkimPublicKey *self, DkimKeyType pubkeyal
  * @error DSTAT_PERMFAIL_INAPPLICABLE_KEY the local-part of "i=" tag of the signature (sig-i-tag) does not match the granularity of the public key record (key-g-tag)
  */
 static DkimStatus
-DkimPublicKey_validate(DkimPublicKey *self, const char *record, const DkimSignature *signature)
+DkimPublicKey_validate(const DkimPublicKey *self, const char *domain,
+                       const DkimSignature *signature)
 {
     // check service type.
     // reject if "email" is not listed.
     if (!DkimPublicKey_isEMailServiceUsable(self)) {
         DkimLogPermFail(self->policy,
-                        "omitting public key record for service type mismatch: pubkey=%s", record);
+                        "omitting public key record for service type mismatch: domain=%s", domain);
         return DSTAT_PERMFAIL_INAPPROPRIATE_SERVICE_TYPE;
     }   // end if
 
@@ -481,9 +542,9 @@ DkimPublicKey_validate(DkimPublicKey *self, const char *record, const DkimSignat
     if (!DkimPublicKey_isDigestAlgMatched(self, DkimSignature_getHashAlgorithm(signature))) {
         DkimLogPermFail
             (self->policy,
-             "omitting public key record for digest algorithm mismatch: digestalg=%s, pubkey=%s",
+             "omitting public key record for digest algorithm mismatch: digestalg=%s, domain=%s",
              DkimEnum_lookupHashAlgorithmByValue(DkimSignature_getHashAlgorithm(signature)),
-             record);
+             domain);
         return DSTAT_PERMFAIL_INAPPROPRIATE_HASH_ALGORITHM;
     }   // end if
 
@@ -499,8 +560,8 @@ DkimPublicKey_validate(DkimPublicKey *self, const char *record, const DkimSignat
     if (!DkimPublicKey_isPubKeyAlgMatched(self, DkimSignature_getKeyType(signature))) {
         DkimLogPermFail
             (self->policy,
-             "omitting public key record for public key algorithm mismatch: pubkeyalg=%s, pubkey=%s",
-             DkimEnum_lookupKeyTypeByValue(DkimSignature_getKeyType(signature)), record);
+             "omitting public key record for public key algorithm mismatch: pubkeyalg=%s, domain=%s",
+             DkimEnum_lookupKeyTypeByValue(DkimSignature_getKeyType(signature)), domain);
         return DSTAT_PERMFAIL_INAPPROPRIATE_KEY_ALGORITHM;
     }   // end if
 
@@ -562,48 +623,31 @@ DkimPublicKey_validate(DkimPublicKey *self, const char *record, const DkimSignat
 }   // end function: DkimPublicKey_validate
 
 /**
+ * choose the public key suitable for the signature from the candidates.
  * @attention public key intended not to used for "email" as service type is rejected.
- * @error DSTAT_PERMFAIL_TAG_SYNTAX_VIOLATION tag-value syntax violation
- * @error DSTAT_PERMFAIL_MISSING_REQUIRED_TAG missing required tag
- * @error DSTAT_PERMFAIL_TAG_DUPLICATED multiple identical tags are found
- * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
- * @error DSTAT_SYSERR_NORESOURCE memory allocation error
- * @error DSTAT_PERMFAIL_INCOMPATIBLE_KEY_VERSION unsupported public key version
- * @error DSTAT_PERMFAIL_UNSUPPORTED_KEY_ALGORITHM unsupported public key algorithm
- * @error DSTAT_PERMFAIL_KEY_REVOKED Public key record has revoked
- * @error DSTAT_PERMFAIL_PUBLICKEY_BROKEN Public key is broken (returned by OpenSSL d2i_PUBKEY())
- * @error DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH key-k-tag and the content of public key (key-p-tag) does not matched
- * @error DSTAT_PERMFAIL_INAPPROPRIATE_SERVICE_TYPE service type dose not allow the public key record to be applied to email
- * @error DSTAT_PERMFAIL_INAPPROPRIATE_HASH_ALGORITHM digest algorithm of the public key record (key-h-tag) does not match the one of the signature (sig-a-tag-h)
- * @error DSTAT_PERMFAIL_INAPPROPRIATE_KEY_ALGORITHM public key algorithm of the public key record (key-k-tag) does not match the one of the signature (sig-a-tag-k)
- * @error DSTAT_PERMFAIL_PUBLICKEY_SUBDOMAIN_PROHIBITED public key record does not accept subdomain
- * @error DSTAT_PERMFAIL_INAPPLICABLE_KEY the local-part of "i=" tag of the signature (sig-i-tag) does not match the granularity of the public key record (key-g-tag)
+ * @return DkimPublicKey object with a reference added, or NULL if no candidate is suitable.
+ * @error DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE no suitable public key record
  */
 static DkimPublicKey *
-DkimPublicKey_retrieveFromDns(const DkimPolicyBase *policy, const char *record,
-                              const char *dkimdomain, const DkimSignature *signature,
-                              DkimStatus *dstat)
+DkimPublicKey_select(const DkimPolicyBase *policy, const PtrArray *candidates,
+                     const char *domain, const DkimSignature *signature, DkimStatus *dstat)
 {
-    assert(NULL != record);
-    assert(NULL != dkimdomain);
-    assert(NULL != signature);
-
-    DkimPublicKey *self = DkimPublicKey_build(policy, record, dkimdomain, dstat);
-    if (NULL == self) {
-        return NULL;
-    }   // end if
-
-    // validate public key
-    DkimStatus validate_stat = DkimPublicKey_validate(self, record, signature);
-    if (DSTAT_OK != validate_stat) {
-        SETDEREF(dstat, validate_stat);
-        DkimPublicKey_free(self);
-        return NULL;
-    }   // end if
+    size_t keynum = PtrArray_getCount(candidates);
+    for (size_t i = 0; i < keynum; ++i) {
+        DkimPublicKey *key = (DkimPublicKey *) PtrArray_get(candidates, i);
+        DkimStatus validate_stat = DkimPublicKey_validate(key, domain, signature);
+        if (DSTAT_OK == validate_stat) {
+            SETDEREF(dstat, DSTAT_OK);
+            return DkimPublicKey_ref(key);
+        }   // end if
+        DkimLogDebug(policy, "public key candidate discarded: domain=%s, err=%s", domain,
+                     DKIM_strerror(validate_stat));
+    }   // end for
 
-    SETDEREF(dstat, DSTAT_OK);
-    return self;
-}   // end function: DkimPublicKey_retrieveFromDns
+    DkimLogPermFail(policy, "No suitable public key record found from DNS: domain=%s", domain);
+    SETDEREF(dstat, DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE);
+    return NULL;
+}   // end function: DkimPublicKey_select
 
 /**
  * @attention The returned string should be released with free() when no longer needed.
@@ -646,27 +690,22 @@ DkimPublicKey_buildQueryDomain(const DkimPolicyBase *policy, const DkimSignature
 }   // end function: DkimPublicKey_buildQueryDomain
 
 /**
+ * retrieve the public key records from DNS and build DkimPublicKey objects from them.
+ * the records which are not valid as DKIM public key records are discarded.
+ * @param candidates PtrArray object to receive DkimPublicKey objects built
+ * @param ttl a pointer to a variable to receive TTL of the TXT RRs
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
  * @error DSTAT_SYSERR_NORESOURCE memory allocation error
  * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
  * @error DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE Public key record does not exist
  * @error DSTAT_TMPERR_DNS_ERROR_RESPONSE DNS lookup error (received error response)
  * @error DSTAT_SYSERR_DNS_LOOKUP_FAILURE DNS lookup error (failed to lookup itself)
  */
-static DkimPublicKey *
-DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signature,
-                       DnsResolver *resolver, DkimStatus *dstat)
+static DkimStatus
+DkimPublicKey_fetch(const DkimPolicyBase *policy, const char *domain, DnsResolver *resolver,
+                    PtrArray *candidates, uint32_t *ttl)
 {
-    assert(NULL != signature);
-    assert(NULL != resolver);
-
-    DkimPublicKey *self = NULL;
     DnsTxtResponse *txt_rr = NULL;
-
-    char *domain = DkimPublicKey_buildQueryDomain(policy, signature, dstat);
-    if (NULL == domain) {
-        goto finally;
-    }   // end if
-
     dns_stat_t txtquery_stat = DnsResolver_lookupTxt(resolver, domain, &txt_rr);
     switch (txtquery_stat) {
     case DNS_STAT_NOERROR:;
@@ -688,25 +727,26 @@ DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signat
          */
         int recnum = MIN(DnsTxtResponse_size(txt_rr), DKIM_PUBKEY_CANDIDATE_MAX);   // limit the number of RRs to prevent DoS attack
         for (int i = 0; i < recnum; ++i) {
-            DkimStatus retr_dstat;
-            self =
-                DkimPublicKey_retrieveFromDns(policy, DnsTxtResponse_data(txt_rr, i), domain,
-                                              signature, &retr_dstat);
-            if (NULL != self) {
+            DkimStatus build_stat;
+            DkimPublicKey *key =
+                DkimPublicKey_build(policy, DnsTxtResponse_data(txt_rr, i), domain, &build_stat);
+            if (NULL != key) {
                 // valid as public key record
-                DnsTxtResponse_free(txt_rr);
-                SETDEREF(dstat, DSTAT_OK);
-                goto finally;   // successful completion
-            } else if (DSTAT_ISCRITERR(retr_dstat)) {
+                if (0 > PtrArray_append(candidates, key)) {
+                    DkimPublicKey_free(key);
+                    DnsTxtResponse_free(txt_rr);
+                    DkimLogNoResource(policy);
+                    return DSTAT_SYSERR_NORESOURCE;
+                }   // end if
+            } else if (DSTAT_ISCRITERR(build_stat)) {
                 // propagate system errors as-is
                 DkimLogSysError
                     (policy,
                      "System error occurred while parsing public key: domain=%s, err=%s, record=%s",
-                     domain, DKIM_strerror(retr_dstat), NNSTR(DnsTxtResponse_data(txt_rr, i)));
+                     domain, DKIM_strerror(build_stat), NNSTR(DnsTxtResponse_data(txt_rr, i)));
                 DnsTxtResponse_free(txt_rr);
-                SETDEREF(dstat, retr_dstat);
-                goto finally;
-            } else if (DSTAT_ISPERMFAIL(retr_dstat)) {
+                return build_stat;
+            } else if (DSTAT_ISPERMFAIL(build_stat)) {
                 /*
                  * discard invalid public key record candidate
                  * [RFC6376] 6.1.2.
@@ -715,14 +755,18 @@ DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signat
                  */
                 DkimLogDebug(policy,
                              "public key candidate discarded: domain=%s, err=%s, record=%s", domain,
-                             DKIM_strerror(retr_dstat), NNSTR(DnsTxtResponse_data(txt_rr, i)));
+                             DKIM_strerror(build_stat), NNSTR(DnsTxtResponse_data(txt_rr, i)));
             }   // end if
         }   // end for
-        // no valid public key record is found
         DnsTxtResponse_free(txt_rr);
-        DkimLogPermFail(policy, "No suitable public key record found from DNS: domain=%s", domain);
-        SETDEREF(dstat, DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE);
-        break;
+        if (0 == PtrArray_getCount(candidates)) {
+            // no valid public key record is found
+            DkimLogPermFail(policy, "No suitable public key record found from DNS: domain=%s",
+                            domain);
+            return DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE;
+        }   // end if
+        SETDEREF(ttl, DnsResolver_getTtl(resolver));
+        return DSTAT_OK;
 
     case DNS_STAT_NXDOMAIN:
     case DNS_STAT_NODATA:
@@ -734,8 +778,7 @@ DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signat
          */
         DkimLogPermFail(policy, "No public key record is found on DNS: domain=%s, err=%s",
                         domain, DnsResolver_getErrorString(resolver));
-        SETDEREF(dstat, DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE);
-        break;
+        return DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE;
 
     case DNS_STAT_FORMERR:
     case DNS_STAT_SERVFAIL:
@@ -759,37 +802,90 @@ DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signat
          */
         DkimLogInfo(policy, "DNS look-up error for public key record: domain=%s, type=txt, err=%s",
                     domain, DnsResolver_getErrorString(resolver));
-        SETDEREF(dstat, DSTAT_TMPERR_DNS_ERROR_RESPONSE);
-        break;
+        return DSTAT_TMPERR_DNS_ERROR_RESPONSE;
 
     case DNS_STAT_SYSTEM:
     case DNS_STAT_RESOLVER:
     case DNS_STAT_RESOLVER_INTERNAL:
         DkimLogSysError(policy, "error occurred during DNS lookup: domain=%s, type=txt, err=%s",
                         domain, DnsResolver_getErrorString(resolver));
-        SETDEREF(dstat, DSTAT_SYSERR_DNS_LOOKUP_FAILURE);
-        break;
+        return DSTAT_SYSERR_DNS_LOOKUP_FAILURE;
 
     case DNS_STAT_NOMEMORY:
         DkimLogNoResource(policy);
-        SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
-        break;
+        return DSTAT_SYSERR_NORESOURCE;
 
     case DNS_STAT_BADREQUEST:
     default:
         DkimLogImplError(policy,
                          "DnsResolver_lookupTxt returns unexpected value: value=0x%x, domain=%s, type=txt",
                          txtquery_stat, domain);
-        SETDEREF(dstat, DSTAT_SYSERR_IMPLERROR);
-        break;
+        return DSTAT_SYSERR_IMPLERROR;
     }   // end switch
+}   // end function: DkimPublicKey_fetch
+
+/**
+ * retrieve the public key suitable for the signature,
+ * from the cache if available, otherwise from DNS.
+ * @param cache DkimPublicKeyCache object, or NULL not to use the cache
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE Public key record does not exist
+ * @error DSTAT_TMPERR_DNS_ERROR_RESPONSE DNS lookup error (received error response)
+ * @error DSTAT_SYSERR_DNS_LOOKUP_FAILURE DNS lookup error (failed to lookup itself)
+ */
+static DkimPublicKey *
+DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signature,
+                       DnsResolver *resolver, DkimPublicKeyCache *cache, DkimStatus *dstat)
+{
+    assert(NULL != signature);
+    assert(NULL != resolver);
+
+    DkimPublicKey *self = NULL;
+    PtrArray *candidates = NULL;
+
+    char *domain = DkimPublicKey_buildQueryDomain(policy, signature, dstat);
+    if (NULL == domain) {
+        goto finally;
+    }   // end if
+    candidates = PtrArray_new(0, (void (*)(void *)) DkimPublicKey_free);
+    if (NULL == candidates) {
+        DkimLogNoResource(policy);
+        SETDEREF(dstat, DSTAT_SYSERR_NORESOURCE);
+        goto finally;
+    }   // end if
+
+    DkimStatus fetch_stat;
+    if (NULL != cache && DkimPublicKeyCache_lookup(cache, domain, candidates, &fetch_stat)) {
+        DkimLogDebug(policy, "public key record found in cache: domain=%s, err=%s", domain,
+                     DKIM_strerror(fetch_stat));
+    } else {
+        uint32_t ttl = 0;
+        fetch_stat = DkimPublicKey_fetch(policy, domain, resolver, candidates, &ttl);
+        // cache the results except temporary or system errors
+        if (NULL != cache && (DSTAT_OK == fetch_stat || DSTAT_ISPERMFAIL(fetch_stat))
+            && DSTAT_OK != DkimPublicKeyCache_store(cache, domain, candidates, fetch_stat, ttl)) {
+            DkimLogNotice(policy, "failed to cache public key record: domain=%s", domain);
+        }   // end if
+    }   // end if
+    if (DSTAT_OK != fetch_stat) {
+        SETDEREF(dstat, fetch_stat);
+        goto finally;
+    }   // end if
+
+    self = DkimPublicKey_select(policy, candidates, domain, signature, dstat);
 
   finally:
+    if (NULL != candidates) {
+        PtrArray_free(candidates);
+    }   // end if
     free(domain);
     return self;
 }   // end function: DkimPublicKey_retrieve
 
 /**
+ * @param cache DkimPublicKeyCache object shared among verifications, or NULL not to use the cache
+ * @attention The returned object should be released with DkimPublicKey_free() when no longer needed.
  * @error DSTAT_SYSERR_NORESOURCE memory allocation error
  * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
  * @error DSTAT_PERMFAIL_NO_KEY_FOR_SIGNATURE Public key record does not exist
@@ -798,7 +894,7 @@ DkimPublicKey_retrieve(const DkimPolicyBase *policy, const DkimSignature *signat
  */
 DkimPublicKey *
 DkimPublicKey_lookup(const DkimPolicyBase *policy, const DkimSignature *signature,
-                     DnsResolver *resolver, DkimStatus *dstat)
+                     DnsResolver *resolver, DkimPublicKeyCache *cache, DkimStatus *dstat)
 {
     assert(NULL != signature);
     assert(NULL != resolver);
@@ -817,7 +913,8 @@ DkimPublicKey_lookup(const DkimPolicyBase *policy, const DkimSignature *signatur
         switch (keyretr_method) {
         case DKIM_QUERY_METHOD_DNS_TXT:;
             DkimStatus retr_dstat;
-            DkimPublicKey *self = DkimPublicKey_retrieve(policy, signature, resolver, &retr_dstat);
+            DkimPublicKey *self =
+                DkimPublicKey_retrieve(policy, signature, resolver, cache, &retr_dstat);
             if (NULL != self) {
                 SETDEREF(dstat, DSTAT_OK);
                 return self;
@@ -854,6 +951,28 @@ DkimPublicKey_getPublicKey(const DkimPublicKey *self)
     return self->pkey;
 }   // end function: DkimPublicKey_getPublicKey
 
+/**
+ * @return the raw Ed25519 public key of ED25519_PUBLICKEY_LEN octets,
+ *         meaningful only if the key type is DKIM_KEY_TYPE_ED25519.
+ */
+const unsigned char *
+DkimPublicKey_getEd25519Key(const DkimPublicKey *self)
+{
+    assert(NULL != self);
+    return self->ed25519key;
+}   // end function: DkimPublicKey_getEd25519Key
+
+/**
+ * @return the SHA-256 digest of the public key (key-p-tag) of DKIM_PUBLICKEY_FINGERPRINT_LEN octets,
+ *         which identifies the public key regardless of the key type.
+ */
+const unsigned char *
+DkimPublicKey_getFingerprint(const DkimPublicKey *self)
+{
+    assert(NULL != self);
+    return self->fingerprint;
+}   // end function: DkimPublicKey_getFingerprint
+
 bool
 DkimPublicKey_isTesting(const DkimPublicKey *self)
 {
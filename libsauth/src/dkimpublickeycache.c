@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "stdaux.h"
+#include "ptrop.h"
+#include "ptrarray.h"
+#include "dkim.h"
+#include "dkimpublickey.h"
+#include "dkimlrucache.h"
+#include "dkimpublickeycache.h"
+
+/*
+ * Cache of the public key records retrieved from DNS, keyed by "selector._domainkey.domain".
+ * Each entry holds the DkimPublicKey objects successfully built from the TXT RRs,
+ * or the status of the failed retrieval (negative cache).
+ * Since the suitability of a public key depends on the signature,
+ * the validation against each signature is left to the caller.
+ * The entries are immutable once stored, and the DkimPublicKey objects are handed out
+ * by reference counting, so that they can be shared among threads.
+ */
+
+typedef struct DkimPublicKeyCacheEntry {
+    DkimLruCacheEntry link;     // must be the first member
+    char *name;                 // "selector._domainkey.domain", compared case-insensitively
+    DkimStatus status;          // DSTAT_OK, or the status of the failed retrieval
+    PtrArray *keys;             // array of DkimPublicKey, each element holds a reference
+} DkimPublicKeyCacheEntry;
+
+struct DkimPublicKeyCache {
+    DkimLruCache *entries;
+    unsigned int max_ttl;       // upper limit of TTL of the positive entries (seconds)
+    unsigned int negative_ttl;  // TTL of the negative entries (seconds), 0 not to cache
+};
+
+// the destination of DkimPublicKeyCacheEntry_read()
+typedef struct DkimPublicKeyCacheReadArg {
+    PtrArray *keys;
+    DkimStatus *status;
+} DkimPublicKeyCacheReadArg;
+
+/**
+ * FNV-1a hash of the domain name, case-insensitive
+ */
+static unsigned int
+DkimPublicKeyCache_hash(const char *name)
+{
+    unsigned int hash = 2166136261U;
+    for (const unsigned char *p = (const unsigned char *) name; '\0' != *p; ++p) {
+        hash ^= (unsigned int) tolower(*p);
+        hash *= 16777619U;
+    }   // end for
+    return hash;
+}   // end function: DkimPublicKeyCache_hash
+
+static bool
+DkimPublicKeyCacheEntry_match(const DkimLruCacheEntry *link, const void *name)
+{
+    const DkimPublicKeyCacheEntry *entry = (const DkimPublicKeyCacheEntry *) link;
+    return 0 == strcasecmp(entry->name, (const char *) name);
+}   // end function: DkimPublicKeyCacheEntry_match
+
+/**
+ * append the references to the cached DkimPublicKey objects to the destination.
+ * @return true for success, false to treat the entry as a cache miss.
+ */
+static bool
+DkimPublicKeyCacheEntry_read(const DkimLruCacheEntry *link, void *arg)
+{
+    const DkimPublicKeyCacheEntry *entry = (const DkimPublicKeyCacheEntry *) link;
+    DkimPublicKeyCacheReadArg *dest = (DkimPublicKeyCacheReadArg *) arg;
+    size_t keynum = PtrArray_getCount(entry->keys);
+    for (size_t i = 0; i < keynum; ++i) {
+        DkimPublicKey *key = (DkimPublicKey *) PtrArray_get(entry->keys, i);
+        if (0 > PtrArray_append(dest->keys, DkimPublicKey_ref(key))) {
+            DkimPublicKey_free(key);
+            PtrArray_reset(dest->keys);
+            return false;
+        }   // end if
+    }   // end for
+    SETDEREF(dest->status, entry->status);
+    return true;
+}   // end function: DkimPublicKeyCacheEntry_read
+
+static void
+DkimPublicKeyCacheEntry_free(DkimLruCacheEntry *link)
+{
+    DkimPublicKeyCacheEntry *entry = (DkimPublicKeyCacheEntry *) link;
+    if (NULL != entry->keys) {
+        PtrArray_free(entry->keys);
+    }   // end if
+    free(entry->name);
+    free(entry);
+}   // end function: DkimPublicKeyCacheEntry_free
+
+/**
+ * create DkimPublicKeyCache object
+ * @param max_entries the maximum number of the entries to hold.
+ *                    the least recently used entry is discarded when the cache is full.
+ * @param max_ttl upper limit of the time to hold the public keys (seconds),
+ *                they are held for TTL of the TXT RRs unless it exceeds this value.
+ * @param negative_ttl the time to hold the result of failed retrieval,
+ *                     such as NXDOMAIN or no valid public key records (seconds), 0 not to cache.
+ * @return initialized DkimPublicKeyCache object, or NULL if memory allocation failed.
+ */
+DkimPublicKeyCache *
+DkimPublicKeyCache_new(size_t max_entries, unsigned int max_ttl, unsigned int negative_ttl)
+{
+    assert(0 < max_entries);
+
+    DkimPublicKeyCache *self = (DkimPublicKeyCache *) malloc(sizeof(DkimPublicKeyCache));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(DkimPublicKeyCache));
+
+    self->entries =
+        DkimLruCache_new(max_entries, DkimPublicKeyCacheEntry_match, DkimPublicKeyCacheEntry_free);
+    if (NULL == self->entries) {
+        free(self);
+        return NULL;
+    }   // end if
+    self->max_ttl = max_ttl;
+    self->negative_ttl = negative_ttl;
+    return self;
+}   // end function: DkimPublicKeyCache_new
+
+/**
+ * release DkimPublicKeyCache object.
+ * DkimPublicKey objects obtained from the cache remain valid until they are released.
+ * @param self DkimPublicKeyCache object to release
+ */
+void
+DkimPublicKeyCache_free(DkimPublicKeyCache *self)
+{
+    assert(NULL != self);
+
+    DkimLruCache_free(self->entries);
+    free(self);
+}   // end function: DkimPublicKeyCache_free
+
+/**
+ * look up the cached public key records.
+ * @param name "selector._domainkey.domain" to look up
+ * @param keys PtrArray object to receive the cached DkimPublicKey objects.
+ *             each DkimPublicKey object appended holds a reference,
+ *             so "keys" should be created with DkimPublicKey_free() as the element destructor.
+ * @param status a pointer to a variable to receive DSTAT_OK for the positive entry,
+ *               or the status of the failed retrieval for the negative entry.
+ * @return true if the valid entry is found, false otherwise.
+ */
+bool
+DkimPublicKeyCache_lookup(DkimPublicKeyCache *self, const char *name, PtrArray *keys,
+                          DkimStatus *status)
+{
+    assert(NULL != self);
+    assert(NULL != name);
+    assert(NULL != keys);
+
+    DkimPublicKeyCacheReadArg dest = { keys, status };
+    return DkimLruCache_lookup(self->entries, name, DkimPublicKeyCache_hash(name),
+                               DkimPublicKeyCacheEntry_read, &dest);
+}   // end function: DkimPublicKeyCache_lookup
+
+/**
+ * store the result of the public key retrieval.
+ * nothing is stored if the time to hold the entry is 0.
+ * @param name "selector._domainkey.domain" the public key records are retrieved from
+ * @param keys array of DkimPublicKey objects built from the TXT RRs.
+ *             the cache takes its own references to them, and "keys" is left untouched.
+ *             may be NULL for the negative entry.
+ * @param status DSTAT_OK for the positive entry, or the status of the failed retrieval
+ * @param ttl TTL of the TXT RRs (seconds), ignored for the negative entry
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimPublicKeyCache_store(DkimPublicKeyCache *self, const char *name, const PtrArray *keys,
+                         DkimStatus status, uint32_t ttl)
+{
+    assert(NULL != self);
+    assert(NULL != name);
+
+    unsigned int hold = (DSTAT_OK == status) ? MIN(ttl, self->max_ttl) : self->negative_ttl;
+    if (0 == hold) {
+        return DSTAT_OK;
+    }   // end if
+
+    DkimPublicKeyCacheEntry *entry =
+        (DkimPublicKeyCacheEntry *) malloc(sizeof(DkimPublicKeyCacheEntry));
+    if (NULL == entry) {
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+    memset(entry, 0, sizeof(DkimPublicKeyCacheEntry));
+    entry->name = strdup(name);
+    entry->keys = PtrArray_new(0, (void (*)(void *)) DkimPublicKey_free);
+    if (NULL == entry->name || NULL == entry->keys) {
+        goto cleanup;
+    }   // end if
+    size_t keynum = (NULL != keys) ? PtrArray_getCount(keys) : 0;
+    for (size_t i = 0; i < keynum; ++i) {
+        DkimPublicKey *key = (DkimPublicKey *) PtrArray_get(keys, i);
+        if (0 > PtrArray_append(entry->keys, DkimPublicKey_ref(key))) {
+            DkimPublicKey_free(key);
+            goto cleanup;
+        }   // end if
+    }   // end for
+    entry->status = status;
+
+    DkimLruCache_insert(self->entries, &entry->link, entry->name, DkimPublicKeyCache_hash(name),
+                        hold);
+    return DSTAT_OK;
+
+  cleanup:
+    DkimPublicKeyCacheEntry_free(&entry->link);
+    return DSTAT_SYSERR_NORESOURCE;
+}   // end function: DkimPublicKeyCache_store
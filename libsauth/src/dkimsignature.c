@@ -110,6 +110,9 @@ static const DkimTagListObjectFieldMap dkim_signature_field_table[] = {
     {NULL, NULL, false, NULL, 0},   // sentinel
 };
 
+static DkimTagListObjectFieldTable dkim_signature_tag_table =
+    DKIM_TAGLISTOBJECT_FIELD_TABLE(dkim_signature_field_table);
+
 ////////////////////////////////////////////////////////////////////////
 // private functions
 
@@ -153,6 +156,9 @@ DkimSignature_parse_v(DkimTagListObject *base, const DkimTagParseContext *contex
  * sig-a-tag       = %x61 [FWS] "=" [FWS] sig-a-tag-alg
  * sig-a-tag-alg   = sig-a-tag-k "-" sig-a-tag-h
  * sig-a-tag-k     = "rsa" / x-sig-a-tag-k
+ *
+ * [RFC8463] 3.
+ * sig-a-tag-k =/ "ed25519"
  * sig-a-tag-h     = "sha1" / "sha256" / x-sig-a-tag-h
  * x-sig-a-tag-k   = ALPHA *(ALPHA / DIGIT)
  *                      ; for later extension
@@ -198,6 +204,13 @@ DkimSignature_parse_a(DkimTagListObject *base, const DkimTagParseContext *contex
         return DSTAT_PERMFAIL_UNSUPPORTED_HASH_ALGORITHM;
     }   // end if
 
+    // [RFC8463] defines Ed25519 only in combination with SHA-256
+    if (DKIM_KEY_TYPE_ED25519 == self->keytype && DKIM_HASH_ALGORITHM_SHA256 != self->hashalg) {
+        DkimLogPermFail(self->policy, "unsupported digest algorithm for ed25519: near %.50s",
+                        context->value_head);
+        return DSTAT_PERMFAIL_UNSUPPORTED_HASH_ALGORITHM;
+    }   // end if
+
     SETDEREF(nextp, tailp);
     return DSTAT_OK;
 }   // end function: DkimSignature_parse_a
@@ -663,7 +676,7 @@ DkimSignature_new(const DkimPolicyBase *policy)
         goto cleanup;
     }   // end if
     self->policy = policy;
-    self->ftbl = dkim_signature_field_table;
+    self->ftbl = &dkim_signature_tag_table;
     self->signing_timestamp = -1LL;
     self->expiration_date = -1LL;
     self->body_length_limit = -1LL;
@@ -29,15 +29,22 @@ RCSID("$Id: dkimsigner.c 1293 2010-02-23 07:24:28Z takahiko $");
 #include "inetmailbox.h"
 #include "dkim.h"
 #include "dkimdigester.h"
+#include "dkimcryptopool.h"
+#include "dkimheaderindex.h"
 #include "dkimsignpolicy.h"
+#include "dkimverifier.h"
 
 struct DkimSigner {
     const DkimSignPolicy *spolicy;
     DkimStatus status;
     const MailHeaders *headers;
+    DkimHeaderIndex *header_index;
 
     DkimDigester *digester;
     DkimSignature *signature;
+    // true if the body hash is computed by a verification frame of DkimVerifier
+    // or by another DkimSigner object
+    bool body_shared;
 };
 
 /**
@@ -86,6 +93,9 @@ DkimSigner_free(DkimSigner *self)
     if (NULL != self->digester) {
         DkimDigester_free(self->digester);
     }   // end if
+    if (NULL != self->header_index) {
+        DkimHeaderIndex_free(self->header_index);
+    }   // end if
     free(self);
 }   // end function: DkimSigner_free
 
@@ -188,15 +198,83 @@ DkimSigner_setup(DkimSigner *self, const InetMailbox *auid, const char *sdid,
         return self->status;
     }   // end if
 
+    self->header_index = DkimHeaderIndex_new(self->headers);
+    if (NULL == self->header_index) {
+        DkimLogNoResource(self->spolicy);
+        self->status = DSTAT_SYSERR_NORESOURCE;
+        return self->status;
+    }   // end if
+
     return DSTAT_OK;
 }   // end function: DkimSigner_setup
 
+/**
+ * share the body hash with a verification frame of "verifier" that has the same
+ * body canonicalization algorithm, digest algorithm and body length limit,
+ * so that the message body is canonicalized and digested only once
+ * when the message is both verified and signed.
+ * If shared, the message body must be given to DkimVerifier_updateBody(),
+ * and "verifier" must not be released before DkimSigner_sign().
+ * @param self DkimSigner object, DkimSigner_setup() has been called.
+ * @param verifier DkimVerifier object, DkimVerifier_setup() has been called
+ *                 and no message body has been given yet.
+ * @return true if the body hash is shared, false otherwise.
+ */
+bool
+DkimSigner_shareBodyDigest(DkimSigner *self, const DkimVerifier *verifier)
+{
+    assert(NULL != self);
+    assert(NULL != verifier);
+
+    if (DSTAT_OK != self->status || self->body_shared) {
+        return false;
+    }   // end if
+    DkimDigester *source = DkimVerifier_findBodyDigester(verifier, self->digester);
+    if (NULL == source) {
+        return false;
+    }   // end if
+    DkimDigester_shareBodyDigest(self->digester, source);
+    self->body_shared = true;
+    return true;
+}   // end function: DkimSigner_shareBodyDigest
+
+/**
+ * use the body hash computed by "source", so that the copies of a message
+ * which differ only in their headers are signed with the body canonicalized and digested once.
+ * The message body must be given to DkimSigner_updateBody() of "source" only,
+ * and "source" must not be released before the DkimSigner objects reusing its body hash.
+ * @param self DkimSigner object, DkimSigner_setup() has been called.
+ * @param source DkimSigner object, DkimSigner_setup() has been called
+ *               and its body hash is computed by itself.
+ * @return true if the body hash is shared,
+ *         false if the canonicalization or digest algorithm of "source" differs.
+ */
+bool
+DkimSigner_reuseBodyDigest(DkimSigner *self, DkimSigner *source)
+{
+    assert(NULL != self);
+    assert(NULL != source);
+    assert(self != source);
+    assert(!source->body_shared);
+
+    if (DSTAT_OK != self->status || DSTAT_OK != source->status || self->body_shared) {
+        return false;
+    }   // end if
+    if (!DkimDigester_isBodyDigestShareable(self->digester, source->digester)) {
+        return false;
+    }   // end if
+    DkimDigester_shareBodyDigest(self->digester, source->digester);
+    self->body_shared = true;
+    return true;
+}   // end function: DkimSigner_reuseBodyDigest
+
 /**
  * @param self DkimSigner object
  * @return DSTAT_OK for success, otherwise status code that indicates error.
  * @error DSTAT_SYSERR_NORESOURCE memory allocation error
  * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
  * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ * @attention does nothing if the body hash is shared by DkimSigner_shareBodyDigest().
  */
 DkimStatus
 DkimSigner_updateBody(DkimSigner *self, const unsigned char *bodyp, size_t len)
@@ -212,6 +290,24 @@ DkimSigner_updateBody(DkimSigner *self, const unsigned char *bodyp, size_t len)
     return self->status;
 }   // end function: DkimSigner_updateBody
 
+/**
+ * build DKIM-Signature header after the signature value is computed.
+ * @param sign_stat status of the signature generation
+ */
+static DkimStatus
+DkimSigner_buildSignatureHeader(DkimSigner *self, DkimStatus sign_stat, const char **headerf,
+                                const char **headerv)
+{
+    if (DSTAT_OK != sign_stat) {
+        self->status = sign_stat;
+        return self->status;
+    }   // end if
+    self->status =
+        DkimSignature_buildRawHeader(self->signature, false, self->spolicy->sign_header_with_crlf,
+                                     headerf, headerv);
+    return self->status;
+}   // end function: DkimSigner_buildSignatureHeader
+
 /**
  * finalize message body update, and generate the DKIM-Signature header.
  * @param self DkimSigner object
@@ -247,16 +343,184 @@ DkimSigner_sign(DkimSigner *self, const char *selector, EVP_PKEY *privatekey,
         return self->status;
     }   // end if
 
-    ret = DkimDigester_signMessage(self->digester, self->headers, self->signature, privatekey);
+    ret =
+        DkimDigester_signMessage(self->digester, self->header_index, self->signature, privatekey);
+    return DkimSigner_buildSignatureHeader(self, ret, headerf, headerv);
+}   // end function: DkimSigner_sign
+
+/**
+ * sign the message with Ed25519 [RFC8463].
+ * The key type of DkimSignPolicy must be "ed25519".
+ * @param selector selector
+ * @param privatekey Ed25519 private key of 32 octets
+ *                   (the last 32 octets of PKCS#8 DER form generated by "openssl genpkey -algorithm ed25519")
+ * @param headerf a pointer to a variable to receive the header field name.
+ *                Buffer is allocated inside the DkimSigner object
+ *                and is available until destruction of the DkimSigner object.
+ *                "DKIM-Signature" is returned normally.
+ * @param headerv a pointer to a variable to receive the header field value.
+ *                Buffer is allocated inside the DkimSigner object
+ *                and is available until destruction of the DkimSigner object.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH the key type of DkimSignPolicy is not "ed25519"
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+DkimStatus
+DkimSigner_signWithEd25519Key(DkimSigner *self, const char *selector,
+                              const unsigned char *privatekey, const char **headerf,
+                              const char **headerv)
+{
+    assert(NULL != self);
+    assert(NULL != selector);
+    assert(NULL != privatekey);
+
+    if (DSTAT_OK != self->status) {
+        return self->status;    // return status code if an error occurred
+    }   // end if
+
+    DkimStatus ret = DkimSignature_setSelector(self->signature, selector);
     if (DSTAT_OK != ret) {
         self->status = ret;
         return self->status;
     }   // end if
-    self->status =
-        DkimSignature_buildRawHeader(self->signature, false, self->spolicy->sign_header_with_crlf,
-                                     headerf, headerv);
-    return self->status;
-}   // end function: DkimSigner_sign
+
+    ret = DkimDigester_signMessageWithEd25519(self->digester, self->header_index, self->signature,
+                                              privatekey);
+    return DkimSigner_buildSignatureHeader(self, ret, headerf, headerv);
+}   // end function: DkimSigner_signWithEd25519Key
+
+typedef struct DkimSignerBatch {
+    DkimSigner *const *signers;
+    const char *selector;
+    EVP_PKEY *pkey;             // RSA private key, NULL for Ed25519
+    const unsigned char *ed25519key;
+    const char **headerf;
+    const char **headerv;
+} DkimSignerBatch;
+
+/**
+ * sign the message of the signer specified by "signeridx".
+ * may be called on the worker threads, one thread per signer.
+ */
+static void
+DkimSigner_signBatchJob(void *arg, size_t signeridx)
+{
+    DkimSignerBatch *batch = (DkimSignerBatch *) arg;
+    DkimSigner *signer = batch->signers[signeridx];
+
+    DkimStatus ret;
+    if (NULL != batch->pkey) {
+        ret = DkimSigner_sign(signer, batch->selector, batch->pkey, &batch->headerf[signeridx],
+                              &batch->headerv[signeridx]);
+    } else {
+        ret = DkimSigner_signWithEd25519Key(signer, batch->selector, batch->ed25519key,
+                                            &batch->headerf[signeridx],
+                                            &batch->headerv[signeridx]);
+    }   // end if
+    if (DSTAT_OK != ret) {
+        batch->headerf[signeridx] = NULL;
+        batch->headerv[signeridx] = NULL;
+    }   // end if
+}   // end function: DkimSigner_signBatchJob
+
+static DkimStatus
+DkimSigner_executeBatch(DkimSignerBatch *batch, size_t signernum)
+{
+    // The body hashes may be shared among the signers,
+    // so finalize them before the messages are signed concurrently.
+    for (size_t signeridx = 0; signeridx < signernum; ++signeridx) {
+        DkimSigner *signer = batch->signers[signeridx];
+        if (DSTAT_OK == signer->status) {
+            signer->status = DkimDigester_finalizeBodyDigest(signer->digester);
+        }   // end if
+    }   // end for
+
+    DkimCryptoPool *pool = batch->signers[0]->spolicy->crypto_pool;
+    if (NULL == pool
+        || DSTAT_OK != DkimCryptoPool_execute(pool, DkimSigner_signBatchJob, batch, signernum)) {
+        for (size_t signeridx = 0; signeridx < signernum; ++signeridx) {
+            DkimSigner_signBatchJob(batch, signeridx);
+        }   // end for
+    }   // end if
+
+    for (size_t signeridx = 0; signeridx < signernum; ++signeridx) {
+        if (DSTAT_OK != batch->signers[signeridx]->status) {
+            return batch->signers[signeridx]->status;
+        }   // end if
+    }   // end for
+    return DSTAT_OK;
+}   // end function: DkimSigner_executeBatch
+
+/**
+ * sign the messages of the DkimSigner objects at once with the same key and selector.
+ * The private key operations are run on the worker threads
+ * if DkimSignPolicy_setCryptoWorkers() is configured for the policy of signers[0].
+ * Combined with DkimSigner_reuseBodyDigest(), the cost to sign each copy of a message
+ * is bounded by its headers rather than its body.
+ * @param signers array of DkimSigner objects, whose message bodies are completely given.
+ * @param signernum the number of the DkimSigner objects in "signers"
+ * @param selector selector
+ * @param pkey private key, which must be safe to use from multiple threads
+ *             if the worker threads are configured.
+ * @param headerf an array of "signernum" elements to receive the header field names.
+ *                Each buffer is allocated inside the corresponding DkimSigner object
+ *                and is available until destruction of the DkimSigner object.
+ *                NULL is set for the signers failed to sign.
+ * @param headerv an array of "signernum" elements to receive the header field values,
+ *                in the same way as "headerf".
+ * @return DSTAT_OK if all the messages are signed,
+ *         otherwise status code of the first signer failed to sign.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+DkimStatus
+DkimSigner_signBatch(DkimSigner *const *signers, size_t signernum, const char *selector,
+                     EVP_PKEY *pkey, const char **headerf, const char **headerv)
+{
+    assert(NULL != signers);
+    assert(0 < signernum);
+    assert(NULL != selector);
+    assert(NULL != pkey);
+    assert(NULL != headerf);
+    assert(NULL != headerv);
+
+    DkimSignerBatch batch = {
+        signers, selector, pkey, NULL, headerf, headerv
+    };
+    return DkimSigner_executeBatch(&batch, signernum);
+}   // end function: DkimSigner_signBatch
+
+/**
+ * sign the messages of the DkimSigner objects at once with Ed25519 [RFC8463].
+ * The same as DkimSigner_signBatch() except the private key.
+ * @param privatekey Ed25519 private key of 32 octets
+ * @return DSTAT_OK if all the messages are signed,
+ *         otherwise status code of the first signer failed to sign.
+ * @error DSTAT_PERMFAIL_PUBLICKEY_TYPE_MISMATCH the key type of DkimSignPolicy is not "ed25519"
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ * @error DSTAT_SYSERR_IMPLERROR obvious implementation error
+ * @error DSTAT_SYSERR_DIGEST_UPDATE_FAILURE error on digest update (returned by OpenSSL EVP_DigestUpdate())
+ */
+DkimStatus
+DkimSigner_signBatchWithEd25519Key(DkimSigner *const *signers, size_t signernum,
+                                   const char *selector, const unsigned char *privatekey,
+                                   const char **headerf, const char **headerv)
+{
+    assert(NULL != signers);
+    assert(0 < signernum);
+    assert(NULL != selector);
+    assert(NULL != privatekey);
+    assert(NULL != headerf);
+    assert(NULL != headerv);
+
+    DkimSignerBatch batch = {
+        signers, selector, NULL, privatekey, headerf, headerv
+    };
+    return DkimSigner_executeBatch(&batch, signernum);
+}   // end function: DkimSigner_signBatchWithEd25519Key
 
 /**
  * @param self DkimSigner object
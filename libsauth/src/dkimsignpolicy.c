@@ -26,6 +26,7 @@ RCSID("$Id: dkimsignpolicy.c 1223 2009-09-13 06:00:33Z takahiko $");
 #include "ptrop.h"
 #include "dkim.h"
 #include "dkimenum.h"
+#include "dkimcryptopool.h"
 #include "dkimsignpolicy.h"
 
 /**
@@ -61,6 +62,9 @@ DkimSignPolicy_free(DkimSignPolicy *self)
 {
     assert(NULL != self);
 
+    if (NULL != self->crypto_pool) {
+        DkimCryptoPool_free(self->crypto_pool);
+    }   // end if
     DkimPolicyBase_cleanup((DkimPolicyBase *) self);
     free(self);
 }   // end function: DkimSignPolicy_free
@@ -151,3 +155,32 @@ DkimSignPolicy_setNewlineCharOfSignature(DkimSignPolicy *self, bool crlf)
     assert(NULL != self);
     self->sign_header_with_crlf = crlf;
 }   // end function: DkimSignPolicy_setNewlineCharOfSignature
+
+/**
+ * set the number of the worker threads dedicated to the private key operations
+ * of DkimSigner_signBatch() and DkimSigner_signBatchWithEd25519Key().
+ * The worker threads are started on the first batch,
+ * and should not be reconfigured while DkimSigner objects are in use.
+ * @param thread_num the number of the worker threads, 0 to sign on the caller's thread.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimSignPolicy_setCryptoWorkers(DkimSignPolicy *self, size_t thread_num)
+{
+    assert(NULL != self);
+
+    DkimCryptoPool *pool = NULL;
+    if (0 < thread_num) {
+        pool = DkimCryptoPool_new(thread_num);
+        if (NULL == pool) {
+            DkimLogNoResource(self);
+            return DSTAT_SYSERR_NORESOURCE;
+        }   // end if
+    }   // end if
+    if (NULL != self->crypto_pool) {
+        DkimCryptoPool_free(self->crypto_pool);
+    }   // end if
+    self->crypto_pool = pool;
+    return DSTAT_OK;
+}   // end function: DkimSignPolicy_setCryptoWorkers
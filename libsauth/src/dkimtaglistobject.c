@@ -12,10 +12,13 @@
 #include "rcsid.h"
 RCSID("$Id: dkimtaglistobject.c 1368 2011-11-07 02:09:09Z takahiko $");
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "ptrop.h"
 #include "dkimlogger.h"
@@ -24,6 +27,51 @@ RCSID("$Id: dkimtaglistobject.c 1368 2011-11-07 02:09:09Z takahiko $");
 #include "dkim.h"
 #include "dkimtaglistobject.h"
 
+static pthread_mutex_t DkimTagListObject_compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * compile the field map into the dispatch table and the bitmasks, only on the first call.
+ * @param table DkimTagListObjectFieldTable object to compile
+ */
+static void
+DkimTagListObject_compileFieldTable(DkimTagListObjectFieldTable *table)
+{
+    if (__atomic_load_n(&table->compiled, __ATOMIC_ACQUIRE)) {
+        return;
+    }   // end if
+
+    (void) pthread_mutex_lock(&DkimTagListObject_compile_lock);
+    if (!table->compiled) {
+        size_t fieldnum = 0;
+        for (DkimTagListObjectFieldMap *fieldmap = table->fieldmap; NULL != fieldmap->tagname;
+             ++fieldmap, ++fieldnum) {
+            assert(fieldnum < DKIM_TAGLISTOBJECT_FIELD_MAX);
+            unsigned char c = (unsigned char) fieldmap->tagname[0];
+            assert(c < DKIM_TAGLISTOBJECT_DISPATCH_SIZE);
+            // each tag must have its own bit
+            int bitpos = ffs((int) fieldmap->parsed_mask) - 1;
+            assert(0 <= bitpos && (uint32_t) (1U << bitpos) == fieldmap->parsed_mask);
+            table->bitindex[bitpos] = (uint8_t) fieldnum;
+            if (fieldmap->required) {
+                table->required_mask |= fieldmap->parsed_mask;
+            }   // end if
+            if (NULL != fieldmap->default_value && NULL != fieldmap->tagparser) {
+                table->default_mask |= fieldmap->parsed_mask;
+            }   // end if
+
+            // append to the tail of the candidates with the same first character
+            uint8_t *slot = &table->dispatch[c];
+            while (0 != *slot) {
+                slot = &table->collision[*slot - 1];
+            }   // end while
+            *slot = (uint8_t) (fieldnum + 1);
+        }   // end for
+        // publish the compiled table
+        __atomic_store_n(&table->compiled, true, __ATOMIC_RELEASE);
+    }   // end if
+    (void) pthread_mutex_unlock(&DkimTagListObject_compile_lock);
+}   // end function: DkimTagListObject_compileFieldTable
+
 /**
  * @return DSTAT_OK for success, otherwise status code that indicates error.
  * @error DSTAT_PERMFAIL_TAG_DUPLICATED multiple identical tags are found
@@ -33,8 +81,11 @@ static DkimStatus
 DkimTagListObject_dispatchParser(DkimTagListObject *self, const DkimTagParseContext *context,
                                  const char **nextp)
 {
-    DkimTagListObjectFieldMap *fieldmap;
-    for (fieldmap = self->ftbl; NULL != fieldmap->tagname; ++fieldmap) {
+    // tag-name begins with ALPHA, guaranteed by XSkip_tagName()
+    unsigned char c = (unsigned char) *(context->tag_head);
+    unsigned int candidate = c < DKIM_TAGLISTOBJECT_DISPATCH_SIZE ? self->ftbl->dispatch[c] : 0;
+    for (; 0 != candidate; candidate = self->ftbl->collision[candidate - 1]) {
+        DkimTagListObjectFieldMap *fieldmap = &self->ftbl->fieldmap[candidate - 1];
         /*
          * compare tag-name case-sensitively
          *
@@ -103,34 +154,33 @@ DkimTagListObject_dispatchParser(DkimTagListObject *self, const DkimTagParseCont
 static DkimStatus
 DkimTagListObject_applyDefaultValue(DkimTagListObject *self)
 {
-    DkimTagListObjectFieldMap *fieldmap;
-    DkimTagParseContext context;
-    for (fieldmap = self->ftbl; NULL != fieldmap->tagname; ++fieldmap) {
-        if (self->parsed_flag & fieldmap->parsed_mask) {
-            continue;   // skip if already set
-        }   // end if
+    const DkimTagListObjectFieldTable *table = self->ftbl;
 
-        if (fieldmap->required) {
-            // error if this tag is required
-            DkimLogPermFail(self->policy, "missing required tag: %s", fieldmap->tagname);
-            return DSTAT_PERMFAIL_MISSING_REQUIRED_TAG;
-        }   // end if
+    uint32_t missing = table->required_mask & ~(self->parsed_flag);
+    if (0 != missing) {
+        // error if any required tag is missing
+        DkimLogPermFail(self->policy, "missing required tag: %s",
+                        table->fieldmap[table->bitindex[ffs((int) missing) - 1]].tagname);
+        return DSTAT_PERMFAIL_MISSING_REQUIRED_TAG;
+    }   // end if
 
-        // apply default value if defined by the specification.
-        if (NULL != fieldmap->default_value && NULL != fieldmap->tagparser) {
-            context.tag_no = DKIM_TAGLISTOBJECT_TAG_NO_AS_DEFAULT_VALUE;
-            context.tag_head = fieldmap->tagname;
-            context.tag_tail = STRTAIL(context.tag_head);
-            context.value_head = fieldmap->default_value;
-            context.value_tail = STRTAIL(context.value_head);
-
-            const char *retp;
-            DkimStatus parse_stat = (fieldmap->tagparser) (self, &context, &retp);
-            if (DSTAT_OK != parse_stat) {
-                DkimLogImplError(self->policy, "default value is unable to parse: %s=%s",
-                                 fieldmap->tagname, context.value_head);
-                return DSTAT_SYSERR_IMPLERROR;
-            }   // end if
+    // apply default value if defined by the specification.
+    uint32_t unset = table->default_mask & ~(self->parsed_flag);
+    for (int bitpos; 0 < (bitpos = ffs((int) unset)); unset &= unset - 1) {
+        DkimTagListObjectFieldMap *fieldmap = &table->fieldmap[table->bitindex[bitpos - 1]];
+        DkimTagParseContext context;
+        context.tag_no = DKIM_TAGLISTOBJECT_TAG_NO_AS_DEFAULT_VALUE;
+        context.tag_head = fieldmap->tagname;
+        context.tag_tail = STRTAIL(context.tag_head);
+        context.value_head = fieldmap->default_value;
+        context.value_tail = STRTAIL(context.value_head);
+
+        const char *retp;
+        DkimStatus parse_stat = (fieldmap->tagparser) (self, &context, &retp);
+        if (DSTAT_OK != parse_stat) {
+            DkimLogImplError(self->policy, "default value is unable to parse: %s=%s",
+                             fieldmap->tagname, context.value_head);
+            return DSTAT_SYSERR_IMPLERROR;
         }   // end if
     }   // end for
     return DSTAT_OK;
@@ -161,6 +211,8 @@ DkimStatus
 DkimTagListObject_build(DkimTagListObject *self, const char *record_head, const char *record_tail,
                         bool wsp_restriction)
 {
+    DkimTagListObject_compileFieldTable(self->ftbl);
+
     DkimTagParseContext context;
     context.tag_no = 0;
     self->parsed_flag = 0;
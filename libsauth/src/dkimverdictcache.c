@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "ptrop.h"
+#include "dkim.h"
+#include "dkimlrucache.h"
+#include "dkimverdictcache.h"
+
+/*
+ * Cache of the results of the signature verification, so that a message verified once,
+ * such as one re-delivered after a temporary failure or redistributed by a mailing list,
+ * is not verified again with the public key algorithm.
+ * The key is a digest computed by DkimDigester over the signature value, the body hash,
+ * the header hash and the public key, which determine the result of the verification.
+ * Since the key is already a cryptographic digest, its leading octets are used as the hash value.
+ */
+
+typedef struct DkimVerdictCacheEntry {
+    DkimLruCacheEntry link;     // must be the first member
+    unsigned char key[DKIM_VERDICTCACHE_KEY_LEN];
+    DkimStatus verdict;
+} DkimVerdictCacheEntry;
+
+struct DkimVerdictCache {
+    DkimLruCache *entries;
+    unsigned int ttl;           // time to hold the entries (seconds)
+};
+
+static unsigned int
+DkimVerdictCache_hash(const unsigned char *key)
+{
+    return ((unsigned int) key[0] << 24) | ((unsigned int) key[1] << 16)
+        | ((unsigned int) key[2] << 8) | (unsigned int) key[3];
+}   // end function: DkimVerdictCache_hash
+
+static bool
+DkimVerdictCacheEntry_match(const DkimLruCacheEntry *link, const void *key)
+{
+    const DkimVerdictCacheEntry *entry = (const DkimVerdictCacheEntry *) link;
+    return 0 == memcmp(entry->key, key, DKIM_VERDICTCACHE_KEY_LEN);
+}   // end function: DkimVerdictCacheEntry_match
+
+static bool
+DkimVerdictCacheEntry_read(const DkimLruCacheEntry *link, void *arg)
+{
+    const DkimVerdictCacheEntry *entry = (const DkimVerdictCacheEntry *) link;
+    SETDEREF((DkimStatus *) arg, entry->verdict);
+    return true;
+}   // end function: DkimVerdictCacheEntry_read
+
+static void
+DkimVerdictCacheEntry_free(DkimLruCacheEntry *link)
+{
+    free(link);
+}   // end function: DkimVerdictCacheEntry_free
+
+/**
+ * create DkimVerdictCache object
+ * @param max_entries the maximum number of the entries to hold.
+ *                    the least recently used entry is discarded when the cache is full.
+ * @param ttl the time to hold the result of the verification (seconds)
+ * @return initialized DkimVerdictCache object, or NULL if memory allocation failed.
+ */
+DkimVerdictCache *
+DkimVerdictCache_new(size_t max_entries, unsigned int ttl)
+{
+    assert(0 < max_entries);
+
+    DkimVerdictCache *self = (DkimVerdictCache *) malloc(sizeof(DkimVerdictCache));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(DkimVerdictCache));
+
+    self->entries =
+        DkimLruCache_new(max_entries, DkimVerdictCacheEntry_match, DkimVerdictCacheEntry_free);
+    if (NULL == self->entries) {
+        free(self);
+        return NULL;
+    }   // end if
+    self->ttl = ttl;
+    return self;
+}   // end function: DkimVerdictCache_new
+
+/**
+ * release DkimVerdictCache object
+ * @param self DkimVerdictCache object to release
+ */
+void
+DkimVerdictCache_free(DkimVerdictCache *self)
+{
+    assert(NULL != self);
+
+    DkimLruCache_free(self->entries);
+    free(self);
+}   // end function: DkimVerdictCache_free
+
+/**
+ * look up the cached result of the verification.
+ * @param key the key of DKIM_VERDICTCACHE_KEY_LEN octets
+ * @param verdict a pointer to a variable to receive the cached result,
+ *                DSTAT_INFO_DIGEST_MATCH or DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY.
+ * @return true if the valid entry is found, false otherwise.
+ */
+bool
+DkimVerdictCache_lookup(DkimVerdictCache *self, const unsigned char *key, DkimStatus *verdict)
+{
+    assert(NULL != self);
+    assert(NULL != key);
+
+    return DkimLruCache_lookup(self->entries, key, DkimVerdictCache_hash(key),
+                               DkimVerdictCacheEntry_read, verdict);
+}   // end function: DkimVerdictCache_lookup
+
+/**
+ * store the result of the verification.
+ * @param key the key of DKIM_VERDICTCACHE_KEY_LEN octets
+ * @param verdict the result of the verification.
+ *                only DSTAT_INFO_DIGEST_MATCH and DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY are stored,
+ *                since the others depend on the environment rather than the message.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerdictCache_store(DkimVerdictCache *self, const unsigned char *key, DkimStatus verdict)
+{
+    assert(NULL != self);
+    assert(NULL != key);
+
+    if (0 == self->ttl || (DSTAT_INFO_DIGEST_MATCH != verdict
+                           && DSTAT_PERMFAIL_SIGNATURE_DID_NOT_VERIFY != verdict)) {
+        return DSTAT_OK;
+    }   // end if
+
+    DkimVerdictCacheEntry *entry = (DkimVerdictCacheEntry *) malloc(sizeof(DkimVerdictCacheEntry));
+    if (NULL == entry) {
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+    memset(entry, 0, sizeof(DkimVerdictCacheEntry));
+    memcpy(entry->key, key, DKIM_VERDICTCACHE_KEY_LEN);
+    entry->verdict = verdict;
+
+    DkimLruCache_insert(self->entries, &entry->link, entry->key, DkimVerdictCache_hash(key),
+                        self->ttl);
+    return DSTAT_OK;
+}   // end function: DkimVerdictCache_store
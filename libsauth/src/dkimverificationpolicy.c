@@ -24,6 +24,10 @@ RCSID("$Id: dkimverificationpolicy.c 1370 2011-11-07 02:58:25Z takahiko $");
 #include "dkim.h"
 #include "dkimenum.h"
 #include "dkimverificationpolicy.h"
+#include "dkimpublickeycache.h"
+#include "dkimverdictcache.h"
+#include "dkimcryptopool.h"
+#include "dkimlookuppool.h"
 
 /**
  * create DkimVerificationPolicy object
@@ -53,6 +57,18 @@ void
 DkimVerificationPolicy_free(DkimVerificationPolicy *self)
 {
     assert(NULL != self);
+    if (NULL != self->pubkey_cache) {
+        DkimPublicKeyCache_free(self->pubkey_cache);
+    }   // end if
+    if (NULL != self->verdict_cache) {
+        DkimVerdictCache_free(self->verdict_cache);
+    }   // end if
+    if (NULL != self->crypto_pool) {
+        DkimCryptoPool_free(self->crypto_pool);
+    }   // end if
+    if (NULL != self->lookup_pool) {
+        DkimLookupPool_free(self->lookup_pool);
+    }   // end if
     DkimPolicyBase_cleanup((DkimPolicyBase *) self);
     free(self);
 }   // end function: DkimVerificationPolicy_free
@@ -80,3 +96,169 @@ DkimVerificationPolicy_acceptExpiredSignature(DkimVerificationPolicy *self, bool
     assert(NULL != self);
     self->accept_expired_signature = accept;
 }   // end function: DkimVerificationPolicy_acceptExpiredSignature
+
+/**
+ * set whether or not to prefer Ed25519 signatures [RFC8463] to RSA ones.
+ * If enabled, RSA signatures are not verified (neither their public keys are looked up)
+ * when an Ed25519 signature with the same "d=" tag is available,
+ * and they are reported as "policy".
+ * @param prefer true to prefer Ed25519 signatures, false to verify all signatures (default)
+ */
+void
+DkimVerificationPolicy_preferEd25519(DkimVerificationPolicy *self, bool prefer)
+{
+    assert(NULL != self);
+    self->prefer_ed25519 = prefer;
+}   // end function: DkimVerificationPolicy_preferEd25519
+
+/**
+ * whether or not to leave the rest of the signatures unevaluated
+ * once an author domain signature (whose SDID is the same as the author domain) is verified.
+ * If true, the author domain signatures are verified first, and once one of them is verified
+ * including its body hash, the public keys of the rest are not retrieved
+ * and their signatures are not verified.
+ * Their body hashes are computed all the same.
+ * They are reported as "policy", and DkimVerifier_isFrameEvaluated() returns false for them.
+ * @param stop true to stop at an author domain signature, false to verify all signatures (default)
+ */
+void
+DkimVerificationPolicy_stopAtAuthorSignature(DkimVerificationPolicy *self, bool stop)
+{
+    assert(NULL != self);
+    self->stop_at_author_signature = stop;
+}   // end function: DkimVerificationPolicy_stopAtAuthorSignature
+
+/**
+ * enable the cache of public key records shared among DkimVerifier objects
+ * created with this policy.
+ * The cache is thread-safe, but should not be reconfigured while DkimVerifier objects are in use.
+ * @param max_entries the maximum number of public key records (including negative results) to cache,
+ *                    0 to disable the cache.
+ * @param max_ttl the upper limit of the time (in seconds) to keep a public key record,
+ *                the TTL of the record is used if it is shorter.
+ * @param negative_ttl the time (in seconds) to keep the absence or invalidity of a public key record.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerificationPolicy_setPublicKeyCache(DkimVerificationPolicy *self, size_t max_entries,
+                                         unsigned int max_ttl, unsigned int negative_ttl)
+{
+    assert(NULL != self);
+
+    DkimPublicKeyCache *cache = NULL;
+    if (0 < max_entries) {
+        cache = DkimPublicKeyCache_new(max_entries, max_ttl, negative_ttl);
+        if (NULL == cache) {
+            DkimLogNoResource(self);
+            return DSTAT_SYSERR_NORESOURCE;
+        }   // end if
+    }   // end if
+    if (NULL != self->pubkey_cache) {
+        DkimPublicKeyCache_free(self->pubkey_cache);
+    }   // end if
+    self->pubkey_cache = cache;
+    return DSTAT_OK;
+}   // end function: DkimVerificationPolicy_setPublicKeyCache
+
+/**
+ * enable the cache of the results of signature verification shared among DkimVerifier objects
+ * created with this policy.
+ * A signature verified once, such as that of a message re-delivered after a temporary failure
+ * or of identical copies redistributed by a mailing list, is not verified again
+ * with the public key algorithm as long as the signature, the message hash and the public key are the same.
+ * The cache is thread-safe, but should not be reconfigured while DkimVerifier objects are in use.
+ * @param max_entries the maximum number of the results to cache, 0 to disable the cache.
+ * @param ttl the time (in seconds) to keep a result.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerificationPolicy_setVerdictCache(DkimVerificationPolicy *self, size_t max_entries,
+                                       unsigned int ttl)
+{
+    assert(NULL != self);
+
+    DkimVerdictCache *cache = NULL;
+    if (0 < max_entries) {
+        cache = DkimVerdictCache_new(max_entries, ttl);
+        if (NULL == cache) {
+            DkimLogNoResource(self);
+            return DSTAT_SYSERR_NORESOURCE;
+        }   // end if
+    }   // end if
+    if (NULL != self->verdict_cache) {
+        DkimVerdictCache_free(self->verdict_cache);
+    }   // end if
+    self->verdict_cache = cache;
+    return DSTAT_OK;
+}   // end function: DkimVerificationPolicy_setVerdictCache
+
+/**
+ * verify the signatures on the dedicated worker threads shared among DkimVerifier objects
+ * created with this policy, instead of the threads calling DkimVerifier_verify().
+ * It bounds the number of threads doing CPU-bound jobs,
+ * and lets the signatures of a message be verified in parallel.
+ * The worker threads are started on the first verification,
+ * and should not be reconfigured while DkimVerifier objects are in use.
+ * @param thread_num the number of the worker threads, 0 to verify on the caller's thread.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerificationPolicy_setCryptoWorkers(DkimVerificationPolicy *self, size_t thread_num)
+{
+    assert(NULL != self);
+
+    DkimCryptoPool *pool = NULL;
+    if (0 < thread_num) {
+        pool = DkimCryptoPool_new(thread_num);
+        if (NULL == pool) {
+            DkimLogNoResource(self);
+            return DSTAT_SYSERR_NORESOURCE;
+        }   // end if
+    }   // end if
+    if (NULL != self->crypto_pool) {
+        DkimCryptoPool_free(self->crypto_pool);
+    }   // end if
+    self->crypto_pool = pool;
+    return DSTAT_OK;
+}   // end function: DkimVerificationPolicy_setCryptoWorkers
+
+/**
+ * run the DNS lookups started by DkimVerifier_prefetchPublicKey() and DkimVerifier_prefetchAdsp()
+ * on the dedicated worker threads shared among DkimVerifier objects created with this policy.
+ * Each worker thread has its own DnsResolver object.
+ * The lookups beyond "inflight_limit" are not started ahead,
+ * and are done by DkimVerifier_setup() or DkimVerifier_checkAdsp() on the caller's thread instead.
+ * The worker threads are started on the first lookup,
+ * and should not be reconfigured while DkimVerifier objects are in use.
+ * @param thread_num the number of the worker threads, 0 to disable the lookups ahead.
+ * @param inflight_limit the maximum number of the lookups queued or running at the same time.
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerificationPolicy_setLookupWorkers(DkimVerificationPolicy *self, size_t thread_num,
+                                        size_t inflight_limit)
+{
+    assert(NULL != self);
+
+    DkimLookupPool *pool = NULL;
+    if (0 < thread_num) {
+        // let all the worker threads be busy at least
+        if (inflight_limit < thread_num) {
+            inflight_limit = thread_num;
+        }   // end if
+        pool = DkimLookupPool_new(thread_num, inflight_limit);
+        if (NULL == pool) {
+            DkimLogNoResource(self);
+            return DSTAT_SYSERR_NORESOURCE;
+        }   // end if
+    }   // end if
+    if (NULL != self->lookup_pool) {
+        DkimLookupPool_free(self->lookup_pool);
+    }   // end if
+    self->lookup_pool = pool;
+    return DSTAT_OK;
+}   // end function: DkimVerificationPolicy_setLookupWorkers
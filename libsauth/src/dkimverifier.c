@@ -28,6 +28,8 @@ RCSID("$Id: dkimverifier.c 1355 2011-10-15 16:47:16Z takahiko $");
 #include "inetdomain.h"
 #include "inetmailbox.h"
 #include "mailheaders.h"
+#include "xskip.h"
+#include "dnsresolv.h"
 #include "dkimlogger.h"
 #include "dkim.h"
 #include "dkimenum.h"
@@ -36,7 +38,43 @@ RCSID("$Id: dkimverifier.c 1355 2011-10-15 16:47:16Z takahiko $");
 #include "dkimadsp.h"
 #include "dkimsignature.h"
 #include "dkimdigester.h"
+#include "dkimheaderindex.h"
 #include "dkimverificationpolicy.h"
+#include "dkimcryptopool.h"
+#include "dkimlookuppool.h"
+#include "dkimverifier.h"
+
+// the maximum number of the DNS lookups started ahead of DkimVerifier_setup() for each message
+#define DKIM_VERIFIER_PREFETCH_MAX 8
+
+/*
+ * DNS lookup started while the header of the message is still arriving,
+ * by DkimVerifier_prefetchPublicKey() or DkimVerifier_prefetchAdsp().
+ * Each lookup runs on the DkimLookupPool of the verification policy,
+ * and its results are taken over by DkimVerifier_setup() or DkimVerifier_checkAdsp()
+ * after the lookup is completed.
+ */
+typedef struct DkimVerifierPrefetch {
+    /// Verification policy
+    const DkimVerificationPolicy *vpolicy;
+    /// raw value of the DKIM-Signature header, NULL for the ADSP record
+    char *sigheaderv;
+    /// DkimSignature object built from "sigheaderv", until taken over by a verification frame
+    DkimSignature *signature;
+    /// status of building "signature"
+    DkimStatus signature_stat;
+    /// true if taken over by a verification frame
+    bool taken;
+    /// author domain to retrieve the ADSP record, NULL for the public key
+    char *author_domain;
+    /// the lookup submitted to DkimLookupPool, NULL if not submitted or already waited for
+    DkimLookupTask *task;
+    /// true if the lookup has completed, "publickey", "adsp" and "lookup_stat" are valid
+    bool done;
+    DkimPublicKey *publickey;
+    DkimAdsp *adsp;
+    DkimStatus lookup_stat;
+} DkimVerifierPrefetch;
 
 typedef struct DkimVerificationFrame {
     /// status of the verification process for each DKIM-Signature header
@@ -47,6 +85,14 @@ typedef struct DkimVerificationFrame {
     DkimPublicKey *publickey;
     /// DkimDigester object to computes a message hash
     DkimDigester *digester;
+    /// the lookup of the public key started ahead, if any (reference, DO NOT RELEASE)
+    DkimVerifierPrefetch *prefetch;
+    /// true if the body hash is computed by the digester of another frame
+    bool body_shared;
+    /// true if the signature over the headers is verified in advance of the message body
+    bool header_verified;
+    /// true if the retrieval of the public key is deferred until the author domain signatures are verified
+    bool key_deferred;
     /// DKIM score (as cache)
     DkimBaseScore score;
 } DkimVerificationFrame;
@@ -66,8 +112,16 @@ struct DkimVerifier {
 
     /// reference to MailHeaders object
     const MailHeaders *headers;
+    /// index of "headers" shared by all the verification frames
+    DkimHeaderIndex *header_index;
     /// Array of DkimVerificationFrame
     PtrArray *frame;
+    /// Array of DkimVerifierPrefetch
+    PtrArray *prefetch;
+    /// the number of DKIM-Signature headers passed to DkimVerifier_prefetchPublicKey()
+    size_t prefetch_sigheader_num;
+    /// true if the Author header has been passed to DkimVerifier_prefetchAdsp()
+    bool prefetch_author;
     /// ADSP record
     DkimAdsp *adsp;
     /// DKIM ADSP score (as cache)
@@ -120,6 +174,102 @@ DkimVerificationFrame_free(DkimVerificationFrame *frame)
     free(frame);
 }   // end function: DkimVerificationFrame_free
 
+/**
+ * run the DNS lookup of DkimVerifierPrefetch object on a worker thread of DkimLookupPool.
+ * @param arg DkimVerifierPrefetch object
+ * @param resolver DnsResolver object owned by the worker thread
+ */
+static void
+DkimVerifierPrefetch_run(void *arg, DnsResolver *resolver)
+{
+    DkimVerifierPrefetch *prefetch = (DkimVerifierPrefetch *) arg;
+
+    if (NULL != prefetch->signature) {
+        prefetch->publickey =
+            DkimPublicKey_lookup((const DkimPolicyBase *) prefetch->vpolicy, prefetch->signature,
+                                 resolver, prefetch->vpolicy->pubkey_cache,
+                                 &(prefetch->lookup_stat));
+    } else {
+        prefetch->adsp =
+            DkimAdsp_lookup((const DkimPolicyBase *) prefetch->vpolicy, prefetch->author_domain,
+                            resolver, &(prefetch->lookup_stat));
+    }   // end if
+    prefetch->done = true;
+}   // end function: DkimVerifierPrefetch_run
+
+/**
+ * submit the lookup of DkimVerifierPrefetch object to DkimLookupPool.
+ * @return true if the lookup is submitted, false if the pool is full.
+ */
+static bool
+DkimVerifierPrefetch_start(DkimVerifierPrefetch *prefetch)
+{
+    prefetch->task =
+        DkimLookupPool_submit(prefetch->vpolicy->lookup_pool, DkimVerifierPrefetch_run, prefetch);
+    if (NULL == prefetch->task) {
+        DkimLogDebug(prefetch->vpolicy, "lookup workers are busy, DNS lookup is not started ahead");
+        return false;
+    }   // end if
+    return true;
+}   // end function: DkimVerifierPrefetch_start
+
+/**
+ * wait for the lookup of DkimVerifierPrefetch object to complete.
+ * the lookup still waiting in the queue is withdrawn, and "done" remains false
+ * so that the caller retrieves the record by itself.
+ */
+static void
+DkimVerifierPrefetch_join(DkimVerifierPrefetch *prefetch)
+{
+    if (NULL != prefetch->task) {
+        (void) DkimLookupPool_wait(prefetch->vpolicy->lookup_pool, prefetch->task);
+        prefetch->task = NULL;
+    }   // end if
+}   // end function: DkimVerifierPrefetch_join
+
+/**
+ * release DkimVerifierPrefetch object, waiting for the lookup thread to complete.
+ */
+static void
+DkimVerifierPrefetch_free(DkimVerifierPrefetch *prefetch)
+{
+    assert(NULL != prefetch);
+
+    DkimVerifierPrefetch_join(prefetch);
+    if (NULL != prefetch->signature) {
+        DkimSignature_free(prefetch->signature);
+    }   // end if
+    if (NULL != prefetch->publickey) {
+        DkimPublicKey_free(prefetch->publickey);
+    }   // end if
+    if (NULL != prefetch->adsp) {
+        DkimAdsp_free(prefetch->adsp);
+    }   // end if
+    free(prefetch->sigheaderv);
+    free(prefetch->author_domain);
+    free(prefetch);
+}   // end function: DkimVerifierPrefetch_free
+
+/**
+ * create DkimVerifierPrefetch object and register it to the DkimVerifier object.
+ * @return DkimVerifierPrefetch object, or NULL if memory allocation failed.
+ */
+static DkimVerifierPrefetch *
+DkimVerifier_newPrefetch(DkimVerifier *self)
+{
+    DkimVerifierPrefetch *prefetch = (DkimVerifierPrefetch *) malloc(sizeof(DkimVerifierPrefetch));
+    if (NULL == prefetch) {
+        return NULL;
+    }   // end if
+    memset(prefetch, 0, sizeof(DkimVerifierPrefetch));
+    prefetch->vpolicy = self->vpolicy;
+    if (0 > PtrArray_append(self->prefetch, prefetch)) {
+        free(prefetch);
+        return NULL;
+    }   // end if
+    return prefetch;
+}   // end function: DkimVerifier_newPrefetch
+
 /**
  * create DkimVerifier object
  * @param vpolicy DkimVerificationPolicy object to be associated with the created DkimVerifier object.
@@ -141,7 +291,8 @@ DkimVerifier_new(const DkimVerificationPolicy *vpolicy, DnsResolver *resolver)
 
     // minimum initialization
     self->frame = PtrArray_new(0, (void (*)(void *)) DkimVerificationFrame_free);
-    if (NULL == self->frame) {
+    self->prefetch = PtrArray_new(0, (void (*)(void *)) DkimVerifierPrefetch_free);
+    if (NULL == self->frame || NULL == self->prefetch) {
         goto cleanup;
     }   // end if
 
@@ -169,6 +320,12 @@ DkimVerifier_free(DkimVerifier *self)
     if (NULL != self->frame) {
         PtrArray_free(self->frame);
     }   // end if
+    if (NULL != self->prefetch) {
+        PtrArray_free(self->prefetch);
+    }   // end if
+    if (NULL != self->header_index) {
+        DkimHeaderIndex_free(self->header_index);
+    }   // end if
     if (NULL != self->adsp) {
         DkimAdsp_free(self->adsp);
     }   // end if
@@ -180,6 +337,172 @@ DkimVerifier_free(DkimVerifier *self)
 }   // end function: DkimVerifier_free
 
 /**
+ * extract the author of the message, only once for each message.
+ * @param self DkimVerifier object
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_PERMFAIL_AUTHOR_AMBIGUOUS no or multiple author headers are found
+ * @error DSTAT_PERMFAIL_AUTHOR_UNPARSABLE unable to parse author header field value
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+static DkimStatus
+DkimVerifier_extractAuthor(DkimVerifier *self)
+{
+    if (NULL != self->author) {
+        // already extracted
+        return DSTAT_OK;
+    }   // end if
+    return DkimAuthor_extract((const DkimPolicyBase *) self->vpolicy, self->headers,
+                              &(self->author_header_index), &(self->raw_author_field),
+                              &(self->raw_author_value), &(self->author));
+}   // end function: DkimVerifier_extractAuthor
+
+/**
+ * start retrieving the public key of a DKIM-Signature header ahead of DkimVerifier_setup(),
+ * so that the DNS lookup overlaps with the arrival of the rest of the message header.
+ * The header is parsed here, and DkimVerifier_setup() takes over the result
+ * if the same DKIM-Signature header is found in the MailHeaders object.
+ * Headers other than DKIM-Signature are ignored.
+ * The lookups are not started beyond the limit of the number of DKIM-Signature headers,
+ * nor unless DkimVerificationPolicy_setLookupWorkers() is enabled.
+ * @param self DkimVerifier object, DkimVerifier_setup() is not called yet.
+ * @param headerf header field name
+ * @param headerv header field value
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerifier_prefetchPublicKey(DkimVerifier *self, const char *headerf, const char *headerv)
+{
+    assert(NULL != self);
+
+    if (DSTAT_OK != self->status || NULL != self->headers || NULL == self->vpolicy->lookup_pool
+        || NULL == headerf || NULL == headerv || 0 != strcasecmp(DKIM_SIGNHEADER, headerf)) {
+        return DSTAT_OK;
+    }   // end if
+    ++(self->prefetch_sigheader_num);
+    if ((0 < self->vpolicy->sign_header_limit
+         && self->vpolicy->sign_header_limit < self->prefetch_sigheader_num)
+        || DKIM_VERIFIER_PREFETCH_MAX < self->prefetch_sigheader_num) {
+        return DSTAT_OK;
+    }   // end if
+
+    DkimVerifierPrefetch *prefetch = DkimVerifier_newPrefetch(self);
+    if (NULL == prefetch || NULL == (prefetch->sigheaderv = strdup(headerv))) {
+        DkimLogNoResource(self->vpolicy);
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+
+    // the signature is built (and the errors are logged) only once, here
+    prefetch->signature =
+        DkimSignature_build((const DkimPolicyBase *) self->vpolicy, headerf, headerv,
+                            &(prefetch->signature_stat));
+    if (NULL == prefetch->signature) {
+        return DSTAT_ISCRITERR(prefetch->signature_stat) ? prefetch->signature_stat : DSTAT_OK;
+    }   // end if
+    if (!self->vpolicy->accept_expired_signature
+        && DSTAT_OK != DkimSignature_isExpired(prefetch->signature)) {
+        // DkimVerifier_setup() will reject the signature without the public key
+        return DSTAT_OK;
+    }   // end if
+
+    // failure to start the lookup is not an error, DkimVerifier_setup() retrieves the public key
+    (void) DkimVerifierPrefetch_start(prefetch);
+    return DSTAT_OK;
+}   // end function: DkimVerifier_prefetchPublicKey
+
+/**
+ * start retrieving the ADSP record of the author domain ahead of DkimVerifier_checkAdsp(),
+ * so that the DNS lookup overlaps with the arrival of the rest of the message.
+ * Only the first header of the most preferred "Author" header name is taken into account.
+ * DkimVerifier_checkAdsp() takes over the result if the author domain is the same.
+ * Does nothing unless DkimVerificationPolicy_setLookupWorkers() is enabled.
+ * @param self DkimVerifier object, DkimVerifier_setup() is not called yet.
+ * @param headerf header field name
+ * @param headerv header field value
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ * @error DSTAT_SYSERR_NORESOURCE memory allocation error
+ */
+DkimStatus
+DkimVerifier_prefetchAdsp(DkimVerifier *self, const char *headerf, const char *headerv)
+{
+    assert(NULL != self);
+
+    if (DSTAT_OK != self->status || NULL != self->headers || self->prefetch_author
+        || NULL == self->vpolicy->lookup_pool || NULL == headerf || NULL == headerv
+        || 0 == StrArray_getCount(self->vpolicy->author_priority)
+        || 0 != strcasecmp(StrArray_get(self->vpolicy->author_priority, 0), headerf)) {
+        return DSTAT_OK;
+    }   // end if
+    self->prefetch_author = true;
+
+    // parse errors are logged later by DkimVerifier_checkAdsp()
+    const char *tail = STRTAIL(headerv);
+    const char *p, *errptr;
+    InetMailbox *mailbox = InetMailbox_build2822Mailbox(headerv, tail, &p, &errptr);
+    if (NULL == mailbox) {
+        if (NULL != errptr) {
+            return DSTAT_OK;
+        }   // end if
+        DkimLogNoResource(self->vpolicy);
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+    XSkip_fws(p, tail, &p);
+    if (p != tail) {
+        InetMailbox_free(mailbox);
+        return DSTAT_OK;
+    }   // end if
+
+    DkimVerifierPrefetch *prefetch = DkimVerifier_newPrefetch(self);
+    if (NULL == prefetch
+        || NULL == (prefetch->author_domain = strdup(InetMailbox_getDomain(mailbox)))) {
+        InetMailbox_free(mailbox);
+        DkimLogNoResource(self->vpolicy);
+        return DSTAT_SYSERR_NORESOURCE;
+    }   // end if
+    InetMailbox_free(mailbox);
+
+    (void) DkimVerifierPrefetch_start(prefetch);
+    return DSTAT_OK;
+}   // end function: DkimVerifier_prefetchAdsp
+
+/**
+ * find the lookup of the public key started ahead for the DKIM-Signature header.
+ * @return DkimVerifierPrefetch object not taken over yet, or NULL if not found.
+ */
+static DkimVerifierPrefetch *
+DkimVerifier_findPrefetchedSignature(const DkimVerifier *self, const char *headerv)
+{
+    size_t prefetchnum = PtrArray_getCount(self->prefetch);
+    for (size_t i = 0; i < prefetchnum; ++i) {
+        DkimVerifierPrefetch *prefetch = (DkimVerifierPrefetch *) PtrArray_get(self->prefetch, i);
+        if (!prefetch->taken && NULL != prefetch->sigheaderv
+            && 0 == strcmp(prefetch->sigheaderv, headerv)) {
+            return prefetch;
+        }   // end if
+    }   // end for
+    return NULL;
+}   // end function: DkimVerifier_findPrefetchedSignature
+
+/**
+ * find the lookup of the ADSP record started ahead for the author domain.
+ * @return DkimVerifierPrefetch object, or NULL if not found.
+ */
+static DkimVerifierPrefetch *
+DkimVerifier_findPrefetchedAdsp(const DkimVerifier *self, const char *author_domain)
+{
+    size_t prefetchnum = PtrArray_getCount(self->prefetch);
+    for (size_t i = 0; i < prefetchnum; ++i) {
+        DkimVerifierPrefetch *prefetch = (DkimVerifierPrefetch *) PtrArray_get(self->prefetch, i);
+        if (NULL != prefetch->author_domain
+            && InetDomain_equals(prefetch->author_domain, author_domain)) {
+            return prefetch;
+        }   // end if
+    }   // end for
+    return NULL;
+}   // end function: DkimVerifier_findPrefetchedAdsp
+
+/**
+ * parse a DKIM-Signature header and register it as a verification frame.
  * @param self DkimVerifier object
  * @return DSTAT_OK for success, otherwise status code that indicates error.
  */
@@ -205,9 +528,19 @@ DkimVerifier_setupFrame(DkimVerifier *self, const char *headerf, const char *hea
         return self->status;
     }   // end if
 
-    // parse and verify DKIM-Signature header
-    frame->signature =
-        DkimSignature_build((const DkimPolicyBase *) self->vpolicy, headerf, headerv, &ret);
+    // parse and verify DKIM-Signature header,
+    // or take over the one already parsed by DkimVerifier_prefetchPublicKey()
+    frame->prefetch = DkimVerifier_findPrefetchedSignature(self, headerv);
+    if (NULL != frame->prefetch) {
+        DkimVerifierPrefetch_join(frame->prefetch);
+        frame->prefetch->taken = true;
+        frame->signature = frame->prefetch->signature;
+        frame->prefetch->signature = NULL;
+        ret = frame->prefetch->signature_stat;
+    } else {
+        frame->signature =
+            DkimSignature_build((const DkimPolicyBase *) self->vpolicy, headerf, headerv, &ret);
+    }   // end if
     if (NULL == frame->signature) {
         frame->status = ret;
         return frame->status;
@@ -235,14 +568,61 @@ DkimVerifier_setupFrame(DkimVerifier *self, const char *headerf, const char *hea
                                              (frame->signature)),
          DkimEnum_lookupC14nAlgorithmByValue(DkimSignature_getBodyC14nAlgorithm(frame->signature)));
 
-    // retrieve public key
-    frame->publickey =
-        DkimPublicKey_lookup((const DkimPolicyBase *) self->vpolicy, frame->signature,
-                             self->resolver, &ret);
+    return DSTAT_OK;
+}   // end function: DkimVerifier_setupFrame
+
+/**
+ * create the digester of the verification frame without retrieving its public key,
+ * so that the message body is digested while the retrieval is deferred.
+ * @param self DkimVerifier object
+ * @param frame DkimVerificationFrame object whose signature is syntactically valid
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ */
+static DkimStatus
+DkimVerifier_deferFrame(DkimVerifier *self, DkimVerificationFrame *frame)
+{
+    DkimStatus ret;
+    frame->digester =
+        DkimDigester_newWithSignature((const DkimPolicyBase *) self->vpolicy, frame->signature,
+                                      &ret);
+    if (NULL == frame->digester) {
+        frame->status = ret;
+        return frame->status;
+    }   // end if
+    frame->key_deferred = true;
+    return DSTAT_OK;
+}   // end function: DkimVerifier_deferFrame
+
+/**
+ * retrieve the public key and create the digester of the verification frame.
+ * the digester is kept if it has been created by DkimVerifier_deferFrame().
+ * @param self DkimVerifier object
+ * @param frame DkimVerificationFrame object whose signature is syntactically valid
+ * @return DSTAT_OK for success, otherwise status code that indicates error.
+ */
+static DkimStatus
+DkimVerifier_prepareFrame(DkimVerifier *self, DkimVerificationFrame *frame)
+{
+    DkimStatus ret;
+
+    frame->key_deferred = false;
+    // retrieve public key, unless it has been retrieved ahead
+    if (NULL != frame->prefetch && frame->prefetch->done) {
+        frame->publickey = frame->prefetch->publickey;
+        frame->prefetch->publickey = NULL;
+        ret = frame->prefetch->lookup_stat;
+    } else {
+        frame->publickey =
+            DkimPublicKey_lookup((const DkimPolicyBase *) self->vpolicy, frame->signature,
+                                 self->resolver, self->vpolicy->pubkey_cache, &ret);
+    }   // end if
     if (NULL == frame->publickey) {
         frame->status = ret;
         return frame->status;
     }   // end if
+    if (NULL != frame->digester) {
+        return DSTAT_OK;
+    }   // end if
 
     // create DkimDigester object
     frame->digester =
@@ -254,7 +634,200 @@ DkimVerifier_setupFrame(DkimVerifier *self, const char *headerf, const char *hea
     }   // end if
 
     return DSTAT_OK;
-}   // end function: DkimVerifier_setupFrame
+}   // end function: DkimVerifier_prepareFrame
+
+/**
+ * check if the verification frame is superseded by an Ed25519 signature of the same domain.
+ * @param self DkimVerifier object
+ * @param frame DkimVerificationFrame object with a RSA signature
+ * @return true if another frame has an Ed25519 signature with the same SDID,
+ *         whose public key is successfully retrieved.
+ */
+static bool
+DkimVerifier_isSuperseded(const DkimVerifier *self, const DkimVerificationFrame *frame)
+{
+    const char *sdid = DkimSignature_getSdid(frame->signature);
+    size_t framenum = PtrArray_getCount(self->frame);
+    for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+        const DkimVerificationFrame *other =
+            (const DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+        if (DSTAT_OK == other->status
+            && DKIM_KEY_TYPE_ED25519 == DkimSignature_getKeyType(other->signature)
+            && 0 == strcasecmp(sdid, DkimSignature_getSdid(other->signature))) {
+            return true;
+        }   // end if
+    }   // end for
+    return false;
+}   // end function: DkimVerifier_isSuperseded
+
+/**
+ * rank the verification frame to decide the order to prepare the frames.
+ * the frames are prepared in ascending order of the rank.
+ * @param prefer_ed25519 true if DkimVerificationPolicy prefers Ed25519 signatures
+ * @param author_domain the author domain if DkimVerificationPolicy stops at an author domain signature,
+ *                      NULL otherwise.
+ * @return rank of the frame
+ */
+static int
+DkimVerifier_getFrameRank(const DkimVerificationFrame *frame, bool prefer_ed25519,
+                          const char *author_domain)
+{
+    int rank = 0;
+    if (NULL != author_domain
+        && !InetDomain_equals(DkimSignature_getSdid(frame->signature), author_domain)) {
+        // third party signatures follow author domain signatures
+        rank += 2;
+    }   // end if
+    if (prefer_ed25519 && DKIM_KEY_TYPE_ED25519 != DkimSignature_getKeyType(frame->signature)) {
+        // RSA signatures follow Ed25519 signatures
+        rank += 1;
+    }   // end if
+    return rank;
+}   // end function: DkimVerifier_getFrameRank
+
+/**
+ * retrieve the public keys and create the digesters of all the verification frames.
+ * If DkimVerificationPolicy prefers Ed25519, the frames with Ed25519 signatures are prepared first,
+ * then the frames with RSA signatures of the same domain are skipped.
+ * If DkimVerificationPolicy stops at an author domain signature, the author domain signatures
+ * are prepared and their signatures over the headers are verified in advance,
+ * while only the digesters of the rest of the frames are created
+ * and the retrieval of their public keys is left to DkimVerifier_prepareDeferredFrames().
+ * @param self DkimVerifier object
+ * @return DSTAT_OK for success, otherwise status code that indicates critical error.
+ */
+static DkimStatus
+DkimVerifier_prepareFrames(DkimVerifier *self)
+{
+    bool prefer_ed25519 = self->vpolicy->prefer_ed25519;
+    const char *author_domain = NULL;
+    if (self->vpolicy->stop_at_author_signature) {
+        DkimStatus ext_stat = DkimVerifier_extractAuthor(self);
+        if (DSTAT_ISCRITERR(ext_stat)) {
+            return ext_stat;
+        } else if (DSTAT_OK == ext_stat) {
+            author_domain = InetMailbox_getDomain(self->author);
+        }   // end if
+        // all the frames are evaluated if the author is not available
+    }   // end if
+
+    size_t framenum = PtrArray_getCount(self->frame);
+    for (int rank = 0; rank < 4; ++rank) {
+        for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+            DkimVerificationFrame *frame =
+                (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+            if (DSTAT_OK != frame->status || NULL != frame->digester) {
+                // frames with errors or already prepared
+                continue;
+            }   // end if
+            if (rank != DkimVerifier_getFrameRank(frame, prefer_ed25519, author_domain)) {
+                continue;
+            }   // end if
+            if (rank >= 2) {
+                // third party signatures wait for the author domain signatures to be verified
+                DkimStatus defer_stat = DkimVerifier_deferFrame(self, frame);
+                if (DSTAT_ISCRITERR(defer_stat)) {
+                    return defer_stat;
+                }   // end if
+                continue;
+            }   // end if
+            bool is_ed25519 = DKIM_KEY_TYPE_ED25519 == DkimSignature_getKeyType(frame->signature);
+            if (prefer_ed25519 && !is_ed25519 && DkimVerifier_isSuperseded(self, frame)) {
+                DkimLogInfo(self->vpolicy,
+                            "signature no.%u is skipped in favor of Ed25519 signature: domain=%s",
+                            (unsigned int) frameidx, DkimSignature_getSdid(frame->signature));
+                frame->status = DSTAT_INFO_SIGNATURE_SUPERSEDED;
+                continue;
+            }   // end if
+            DkimStatus prepare_stat = DkimVerifier_prepareFrame(self, frame);
+            if (DSTAT_ISCRITERR(prepare_stat)) {
+                return prepare_stat;
+            }   // end if
+            if (DSTAT_OK != prepare_stat || NULL == author_domain) {
+                continue;
+            }   // end if
+
+            /*
+             * verify the signature of the author domain signature over the headers
+             * without waiting for the message body.
+             * the frame is not regarded as verified until its body hash also matches.
+             */
+            DkimStatus header_stat =
+                DkimDigester_verifyHeader(frame->digester, self->header_index, frame->signature,
+                                          frame->publickey, self->vpolicy->verdict_cache);
+            if (DSTAT_ISCRITERR(header_stat)) {
+                return header_stat;
+            } else if (DSTAT_INFO_DIGEST_MATCH == header_stat) {
+                frame->header_verified = true;
+            } else {
+                frame->status = header_stat;
+            }   // end if
+        }   // end for
+    }   // end for
+    return DSTAT_OK;
+}   // end function: DkimVerifier_prepareFrames
+
+/**
+ * group the verification frames by (body canonicalization algorithm, digest algorithm, sig-l-tag)
+ * so that the message body is canonicalized and digested once for each group.
+ * the first frame of each group computes the body hash on behalf of the others.
+ * @param self DkimVerifier object
+ */
+static void
+DkimVerifier_shareBodyDigests(DkimVerifier *self)
+{
+    size_t framenum = PtrArray_getCount(self->frame);
+    for (size_t frameidx = 1; frameidx < framenum; ++frameidx) {
+        DkimVerificationFrame *frame =
+            (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+        if (DSTAT_OK != frame->status) {
+            continue;
+        }   // end if
+        for (size_t leaderidx = 0; leaderidx < frameidx; ++leaderidx) {
+            DkimVerificationFrame *leader =
+                (DkimVerificationFrame *) PtrArray_get(self->frame, leaderidx);
+            if (DSTAT_OK != leader->status || leader->body_shared) {
+                continue;
+            }   // end if
+            if (DkimDigester_isBodyDigestShareable(frame->digester, leader->digester)) {
+                DkimDigester_shareBodyDigest(frame->digester, leader->digester);
+                frame->body_shared = true;
+                DkimLogDebug(self->vpolicy, "body hash of signature no.%u is shared with no.%u",
+                             (unsigned int) frameidx, (unsigned int) leaderidx);
+                break;
+            }   // end if
+        }   // end for
+    }   // end for
+}   // end function: DkimVerifier_shareBodyDigests
+
+/**
+ * find the digester of a verification frame whose body hash can be shared with "digester",
+ * so that the message body given to DkimVerifier_updateBody() is digested only once
+ * for both signing and verification.
+ * @param self DkimVerifier object, DkimVerifier_setup() has been called.
+ * @param digester DkimDigester object to share the body hash
+ * @return DkimDigester object which computes the body hash, or NULL if not found.
+ */
+DkimDigester *
+DkimVerifier_findBodyDigester(const DkimVerifier *self, const DkimDigester *digester)
+{
+    assert(NULL != self);
+    assert(NULL != digester);
+
+    if (DSTAT_OK != self->status) {
+        return NULL;
+    }   // end if
+    size_t framenum = PtrArray_getCount(self->frame);
+    for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+        const DkimVerificationFrame *frame =
+            (const DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+        if (DSTAT_OK == frame->status && !frame->body_shared && NULL != frame->digester
+            && DkimDigester_isBodyDigestShareable(digester, frame->digester)) {
+            return frame->digester;
+        }   // end if
+    }   // end for
+    return NULL;
+}   // end function: DkimVerifier_findBodyDigester
 
 /**
  * registers the message headers and checks if the message has any valid signatures.
@@ -332,6 +905,19 @@ DkimVerifier_setup(DkimVerifier *self, const MailHeaders *headers)
     }   // end if
 
     // message is DKIM-signed
+    self->header_index = DkimHeaderIndex_new(self->headers);
+    if (NULL == self->header_index) {
+        DkimLogNoResource(self->vpolicy);
+        self->status = DSTAT_SYSERR_NORESOURCE;
+        return self->status;
+    }   // end if
+    DkimStatus prepare_stat = DkimVerifier_prepareFrames(self);
+    if (DSTAT_OK != prepare_stat) {
+        // return on system errors
+        self->status = prepare_stat;
+        return self->status;
+    }   // end if
+    DkimVerifier_shareBodyDigests(self);
     self->status = DSTAT_OK;
     return self->status;
 }   // end function: DkimVerifier_setup
@@ -355,8 +941,9 @@ DkimVerifier_updateBody(DkimVerifier *self, const unsigned char *bodyp, size_t l
     for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
         DkimVerificationFrame *frame =
             (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
-        // skip verification frames with errors
-        if (DSTAT_OK != frame->status) {
+        // skip verification frames with errors,
+        // and frames whose body hash is computed by another frame
+        if (DSTAT_OK != frame->status || frame->body_shared) {
             continue;
         }   // end if
 
@@ -371,6 +958,145 @@ DkimVerifier_updateBody(DkimVerifier *self, const unsigned char *bodyp, size_t l
     return DSTAT_OK;
 }   // end function: DkimVerifier_updateBody
 
+/**
+ * verify the signature of the frame specified by "frameidx".
+ * may be called on the worker threads, one thread per frame.
+ */
+static void
+DkimVerifier_verifyFrame(void *arg, size_t frameidx)
+{
+    DkimVerifier *self = (DkimVerifier *) arg;
+    DkimVerificationFrame *frame = (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+    // skip verification frames with errors,
+    // and frames whose public keys are not retrieved yet
+    if (DSTAT_OK != frame->status || frame->key_deferred) {
+        return;
+    }   // end if
+
+    if (frame->header_verified) {
+        // the signature over the headers has been verified by DkimVerifier_prepareFrames()
+        frame->status = DkimDigester_verifyBody(frame->digester, frame->signature);
+    } else {
+        frame->status =
+            DkimDigester_verifyMessage(frame->digester, self->header_index, frame->signature,
+                                       frame->publickey, self->vpolicy->verdict_cache);
+    }   // end if
+}   // end function: DkimVerifier_verifyFrame
+
+/**
+ * verify the signatures of all the frames on the worker threads.
+ * @return true if the verification is completed, false if the worker threads are not available,
+ *         in which case the caller should verify the frames by itself.
+ */
+static bool
+DkimVerifier_verifyOnWorkers(DkimVerifier *self)
+{
+    size_t framenum = PtrArray_getCount(self->frame);
+    // The body hashes may be shared among the frames,
+    // so finalize them before the frames are verified concurrently.
+    for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+        DkimVerificationFrame *frame =
+            (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+        if (DSTAT_OK == frame->status) {
+            DkimStatus final_stat = DkimDigester_finalizeBodyDigest(frame->digester);
+            if (DSTAT_OK != final_stat) {
+                frame->status = final_stat;
+            }   // end if
+        }   // end if
+    }   // end for
+
+    DkimStatus exec_stat =
+        DkimCryptoPool_execute(self->vpolicy->crypto_pool, DkimVerifier_verifyFrame, self,
+                               framenum);
+    if (DSTAT_OK != exec_stat) {
+        DkimLogWarning(self->vpolicy,
+                       "failed to start crypto worker threads, verifying on the current thread");
+        return false;
+    }   // end if
+    return true;
+}   // end function: DkimVerifier_verifyOnWorkers
+
+/**
+ * verify the signatures of all the frames whose public keys are retrieved.
+ * @param self DkimVerifier object
+ */
+static void
+DkimVerifier_verifyFrames(DkimVerifier *self)
+{
+    if (NULL != self->vpolicy->crypto_pool && DkimVerifier_verifyOnWorkers(self)) {
+        return;
+    }   // end if
+    size_t framenum = PtrArray_getCount(self->frame);
+    for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+        DkimVerifier_verifyFrame(self, frameidx);
+    }   // end for
+}   // end function: DkimVerifier_verifyFrames
+
+/**
+ * retrieve the public keys of the frames deferred by DkimVerifier_prepareFrames(),
+ * unless one of the author domain signatures has been verified including its body hash,
+ * in which case the deferred frames are not evaluated.
+ * @param self DkimVerifier object
+ * @param prepared receives true if the public key of any deferred frame is retrieved.
+ * @return DSTAT_OK for success, otherwise status code that indicates critical error.
+ */
+static DkimStatus
+DkimVerifier_prepareDeferredFrames(DkimVerifier *self, bool *prepared)
+{
+    *prepared = false;
+    bool satisfied = false;
+    size_t framenum = PtrArray_getCount(self->frame);
+    for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+        const DkimVerificationFrame *frame =
+            (const DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+        if (frame->key_deferred) {
+            continue;
+        } else if (DSTAT_INFO_DIGEST_MATCH == frame->status) {
+            // frames other than the deferred ones are author domain signatures
+            satisfied = true;
+            break;
+        }   // end if
+    }   // end for
+
+    bool prefer_ed25519 = self->vpolicy->prefer_ed25519;
+    const char *author_domain = InetMailbox_getDomain(self->author);
+    for (int rank = 2; rank < 4; ++rank) {
+        for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
+            DkimVerificationFrame *frame =
+                (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
+            if (DSTAT_OK != frame->status || !frame->key_deferred) {
+                continue;
+            }   // end if
+            if (rank != DkimVerifier_getFrameRank(frame, prefer_ed25519, author_domain)) {
+                continue;
+            }   // end if
+            if (satisfied) {
+                DkimLogInfo(self->vpolicy,
+                            "signature no.%u is not evaluated since an author domain signature "
+                            "is verified: domain=%s", (unsigned int) frameidx,
+                            DkimSignature_getSdid(frame->signature));
+                frame->status = DSTAT_INFO_SIGNATURE_NOT_EVALUATED;
+                continue;
+            }   // end if
+            bool is_ed25519 = DKIM_KEY_TYPE_ED25519 == DkimSignature_getKeyType(frame->signature);
+            if (prefer_ed25519 && !is_ed25519 && DkimVerifier_isSuperseded(self, frame)) {
+                DkimLogInfo(self->vpolicy,
+                            "signature no.%u is skipped in favor of Ed25519 signature: domain=%s",
+                            (unsigned int) frameidx, DkimSignature_getSdid(frame->signature));
+                frame->status = DSTAT_INFO_SIGNATURE_SUPERSEDED;
+                continue;
+            }   // end if
+            DkimStatus prepare_stat = DkimVerifier_prepareFrame(self, frame);
+            if (DSTAT_ISCRITERR(prepare_stat)) {
+                return prepare_stat;
+            } else if (DSTAT_OK == prepare_stat) {
+                *prepared = true;
+            }   // end if
+        }   // end for
+    }   // end for
+    return DSTAT_OK;
+}   // end function: DkimVerifier_prepareDeferredFrames
+
 /**
  * @param self DkimVerifier object
  * @return DSTAT_OK for success, otherwise status code that indicates error.
@@ -385,19 +1111,22 @@ DkimVerifier_verify(DkimVerifier *self)
         return self->status;
     }   // end if
 
-    size_t framenum = PtrArray_getCount(self->frame);
-    for (size_t frameidx = 0; frameidx < framenum; ++frameidx) {
-        DkimVerificationFrame *frame =
-            (DkimVerificationFrame *) PtrArray_get(self->frame, frameidx);
-        // skip verification frames with errors
-        if (DSTAT_OK != frame->status) {
-            continue;
-        }   // end if
+    DkimVerifier_verifyFrames(self);
+    if (!self->vpolicy->stop_at_author_signature || NULL == self->author) {
+        return DSTAT_OK;
+    }   // end if
 
-        frame->status =
-            DkimDigester_verifyMessage(frame->digester, self->headers, frame->signature,
-                                       DkimPublicKey_getPublicKey(frame->publickey));
-    }   // end for
+    // the third party signatures are evaluated only if no author domain signature is verified
+    bool prepared;
+    DkimStatus prepare_stat = DkimVerifier_prepareDeferredFrames(self, &prepared);
+    if (DSTAT_OK != prepare_stat) {
+        // return on system errors
+        self->status = prepare_stat;
+        return self->status;
+    }   // end if
+    if (prepared) {
+        DkimVerifier_verifyFrames(self);
+    }   // end if
 
     return DSTAT_OK;
 }   // end function: DkimVerifier_verify
@@ -446,10 +1175,7 @@ DkimVerifier_checkAdsp(DkimVerifier *self)
     }   // end if
 
     // extract Author
-    DkimStatus ext_stat = DkimAuthor_extract((const DkimPolicyBase *) self->vpolicy, self->headers,
-                                             &(self->author_header_index),
-                                             &(self->raw_author_field),
-                                             &(self->raw_author_value), &(self->author));
+    DkimStatus ext_stat = DkimVerifier_extractAuthor(self);
     switch (ext_stat) {
     case DSTAT_OK:
         // Author header successfully extracted
@@ -524,9 +1250,20 @@ DkimVerifier_checkAdsp(DkimVerifier *self)
     // retrieving ADSP record if the message doesn't have an author domain signature
     if (NULL == self->adsp) {
         DkimStatus adsp_stat;
-        self->adsp =
-            DkimAdsp_lookup((const DkimPolicyBase *) self->vpolicy,
-                            author_domain, self->resolver, &adsp_stat);
+        DkimVerifierPrefetch *prefetch = DkimVerifier_findPrefetchedAdsp(self, author_domain);
+        if (NULL != prefetch) {
+            DkimVerifierPrefetch_join(prefetch);
+        }   // end if
+        if (NULL != prefetch && prefetch->done) {
+            // take over the ADSP record retrieved by DkimVerifier_prefetchAdsp()
+            self->adsp = prefetch->adsp;
+            prefetch->adsp = NULL;
+            adsp_stat = prefetch->lookup_stat;
+        } else {
+            self->adsp =
+                DkimAdsp_lookup((const DkimPolicyBase *) self->vpolicy,
+                                author_domain, self->resolver, &adsp_stat);
+        }   // end if
         switch (adsp_stat) {
         case DSTAT_OK:
             // do nothing
@@ -692,6 +1429,26 @@ DkimVerifier_getFrameScore(DkimVerificationFrame *frame)
          *    test(s).
          */
         return frame->score = DKIM_BASE_SCORE_FAIL;
+    case DSTAT_INFO_SIGNATURE_SUPERSEDED:
+        /*
+         * SPEC: dkim score is "policy" if the RSA signature is not verified
+         * in favor of an Ed25519 signature of the same domain.
+         *
+         * [RFC5451] 2.4.1.
+         * policy:  The message was signed but the signature or signatures were
+         *    not acceptable to the verifier.
+         */
+        return frame->score = DKIM_BASE_SCORE_POLICY;
+    case DSTAT_INFO_SIGNATURE_NOT_EVALUATED:
+        /*
+         * SPEC: dkim score is "policy" if the signature is not evaluated
+         * since an author domain signature has been verified.
+         *
+         * [RFC5451] 2.4.1.
+         * policy:  The message was signed but the signature or signatures were
+         *    not acceptable to the verifier.
+         */
+        return frame->score = DKIM_BASE_SCORE_POLICY;
     default:
         /*
          * [RFC5451] 2.4.1.
@@ -738,6 +1495,26 @@ DkimVerifier_getFrameResult(const DkimVerifier *self, size_t signo, const InetMa
     return rawscore;
 }   // end function: DkimVerifier_getFrameResult
 
+/**
+ * check if the signature of specified verification frame is evaluated.
+ * the signatures are left unevaluated when DkimVerificationPolicy stops at an author domain signature
+ * and one of the author domain signatures is verified.
+ * @param self DkimVerifier object
+ * @return false if the signature is not evaluated, true otherwise.
+ */
+bool
+DkimVerifier_isFrameEvaluated(const DkimVerifier *self, size_t signo)
+{
+    assert(NULL != self);
+
+    if (PtrArray_getCount(self->frame) <= signo) {
+        return true;
+    }   // end if
+    const DkimVerificationFrame *frame =
+        (const DkimVerificationFrame *) PtrArray_get(self->frame, signo);
+    return DSTAT_INFO_SIGNATURE_NOT_EVALUATED != frame->status;
+}   // end function: DkimVerifier_isFrameEvaluated
+
 /**
  * @param self DkimVerifier object
  * @attention for debugging use only.
@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#include "ed25519.h"
+
+/*
+ * Ed25519 signature scheme [RFC8032] (PureEdDSA), for the DKIM "ed25519-sha256" algorithm [RFC8463].
+ * The arithmetic on GF(2^255-19) and the twisted Edwards curve follows TweetNaCl (public domain),
+ * using 16 limbs of 16 bits each held in 64-bit integers.
+ * SHA-512 is provided by OpenSSL, which lacks Ed25519 itself before 1.1.1.
+ */
+
+typedef int64_t gf[16];
+
+static const gf gf0 = { 0 };
+static const gf gf1 = { 1 };
+
+// d = -121665/121666
+static const gf ed25519_d = {
+    0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070,
+    0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203
+};
+
+// 2 * d
+static const gf ed25519_d2 = {
+    0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0,
+    0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406
+};
+
+// x-coordinate of the base point
+static const gf ed25519_bx = {
+    0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c,
+    0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169
+};
+
+// y-coordinate of the base point, 4/5
+static const gf ed25519_by = {
+    0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666,
+    0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666
+};
+
+// sqrt(-1)
+static const gf ed25519_i = {
+    0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43,
+    0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83
+};
+
+// order of the base point, 2^252 + 27742317777372353535851937790883648493, little-endian
+static const int64_t ed25519_l[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10
+};
+
+static void
+Gf_copy(gf r, const gf a)
+{
+    memcpy(r, a, sizeof(gf));
+}   // end function: Gf_copy
+
+static void
+Gf_carry(gf o)
+{
+    for (int i = 0; i < 16; ++i) {
+        o[i] += (int64_t) 1 << 16;
+        int64_t c = o[i] >> 16;
+        if (i < 15) {
+            o[i + 1] += c - 1;
+        } else {
+            o[0] += 38 * (c - 1);
+        }   // end if
+        o[i] -= c * 65536;
+    }   // end for
+}   // end function: Gf_carry
+
+/**
+ * swap "p" and "q" if "b" is 1, keep them if "b" is 0, in constant time.
+ */
+static void
+Gf_select(gf p, gf q, int b)
+{
+    int64_t c = ~(b - 1);
+    for (int i = 0; i < 16; ++i) {
+        int64_t t = c & (p[i] ^ q[i]);
+        p[i] ^= t;
+        q[i] ^= t;
+    }   // end for
+}   // end function: Gf_select
+
+static void
+Gf_pack(unsigned char *o, const gf n)
+{
+    gf m, t;
+    Gf_copy(t, n);
+    Gf_carry(t);
+    Gf_carry(t);
+    Gf_carry(t);
+    for (int j = 0; j < 2; ++j) {
+        m[0] = t[0] - 0xffed;
+        for (int i = 1; i < 15; ++i) {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }   // end for
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        int b = (int) ((m[15] >> 16) & 1);
+        m[14] &= 0xffff;
+        Gf_select(t, m, 1 - b);
+    }   // end for
+    for (int i = 0; i < 16; ++i) {
+        o[2 * i] = (unsigned char) (t[i] & 0xff);
+        o[2 * i + 1] = (unsigned char) (t[i] >> 8);
+    }   // end for
+}   // end function: Gf_pack
+
+static void
+Gf_unpack(gf o, const unsigned char *n)
+{
+    for (int i = 0; i < 16; ++i) {
+        o[i] = n[2 * i] + ((int64_t) n[2 * i + 1] << 8);
+    }   // end for
+    o[15] &= 0x7fff;
+}   // end function: Gf_unpack
+
+static bool
+Gf_equals(const gf a, const gf b)
+{
+    unsigned char c[32], d[32];
+    Gf_pack(c, a);
+    Gf_pack(d, b);
+    return 0 == memcmp(c, d, 32);
+}   // end function: Gf_equals
+
+static int
+Gf_parity(const gf a)
+{
+    unsigned char d[32];
+    Gf_pack(d, a);
+    return d[0] & 1;
+}   // end function: Gf_parity
+
+static void
+Gf_add(gf o, const gf a, const gf b)
+{
+    for (int i = 0; i < 16; ++i) {
+        o[i] = a[i] + b[i];
+    }   // end for
+}   // end function: Gf_add
+
+static void
+Gf_sub(gf o, const gf a, const gf b)
+{
+    for (int i = 0; i < 16; ++i) {
+        o[i] = a[i] - b[i];
+    }   // end for
+}   // end function: Gf_sub
+
+static void
+Gf_mul(gf o, const gf a, const gf b)
+{
+    int64_t t[31];
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < 16; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            t[i + j] += a[i] * b[j];
+        }   // end for
+    }   // end for
+    for (int i = 0; i < 15; ++i) {
+        t[i] += 38 * t[i + 16];
+    }   // end for
+    for (int i = 0; i < 16; ++i) {
+        o[i] = t[i];
+    }   // end for
+    Gf_carry(o);
+    Gf_carry(o);
+}   // end function: Gf_mul
+
+static void
+Gf_square(gf o, const gf a)
+{
+    Gf_mul(o, a, a);
+}   // end function: Gf_square
+
+/**
+ * o = i^(p-2) = 1/i
+ */
+static void
+Gf_invert(gf o, const gf i)
+{
+    gf c;
+    Gf_copy(c, i);
+    for (int a = 253; a >= 0; --a) {
+        Gf_square(c, c);
+        if (a != 2 && a != 4) {
+            Gf_mul(c, c, i);
+        }   // end if
+    }   // end for
+    Gf_copy(o, c);
+}   // end function: Gf_invert
+
+/**
+ * o = i^((p-5)/8) = i^(2^252-3)
+ */
+static void
+Gf_pow2523(gf o, const gf i)
+{
+    gf c;
+    Gf_copy(c, i);
+    for (int a = 250; a >= 0; --a) {
+        Gf_square(c, c);
+        if (a != 1) {
+            Gf_mul(c, c, i);
+        }   // end if
+    }   // end for
+    Gf_copy(o, c);
+}   // end function: Gf_pow2523
+
+/*
+ * points on the curve in extended coordinates (X:Y:Z:T), x = X/Z, y = Y/Z, x * y = T/Z
+ */
+
+static void
+Point_add(gf p[4], gf q[4])
+{
+    gf a, b, c, d, t, e, f, g, h;
+
+    Gf_sub(a, p[1], p[0]);
+    Gf_sub(t, q[1], q[0]);
+    Gf_mul(a, a, t);
+    Gf_add(b, p[0], p[1]);
+    Gf_add(t, q[0], q[1]);
+    Gf_mul(b, b, t);
+    Gf_mul(c, p[3], q[3]);
+    Gf_mul(c, c, ed25519_d2);
+    Gf_mul(d, p[2], q[2]);
+    Gf_add(d, d, d);
+    Gf_sub(e, b, a);
+    Gf_sub(f, d, c);
+    Gf_add(g, d, c);
+    Gf_add(h, b, a);
+
+    Gf_mul(p[0], e, f);
+    Gf_mul(p[1], h, g);
+    Gf_mul(p[2], g, f);
+    Gf_mul(p[3], e, h);
+}   // end function: Point_add
+
+static void
+Point_swap(gf p[4], gf q[4], int b)
+{
+    for (int i = 0; i < 4; ++i) {
+        Gf_select(p[i], q[i], b);
+    }   // end for
+}   // end function: Point_swap
+
+static void
+Point_pack(unsigned char *r, gf p[4])
+{
+    gf tx, ty, zi;
+    Gf_invert(zi, p[2]);
+    Gf_mul(tx, p[0], zi);
+    Gf_mul(ty, p[1], zi);
+    Gf_pack(r, ty);
+    r[31] ^= (unsigned char) (Gf_parity(tx) << 7);
+}   // end function: Point_pack
+
+/**
+ * p = s * q, in constant time. "q" is destroyed.
+ */
+static void
+Point_scalarMult(gf p[4], gf q[4], const unsigned char *s)
+{
+    Gf_copy(p[0], gf0);
+    Gf_copy(p[1], gf1);
+    Gf_copy(p[2], gf1);
+    Gf_copy(p[3], gf0);
+    for (int i = 255; i >= 0; --i) {
+        int b = (s[i / 8] >> (i & 7)) & 1;
+        Point_swap(p, q, b);
+        Point_add(q, p);
+        Point_add(p, p);
+        Point_swap(p, q, b);
+    }   // end for
+}   // end function: Point_scalarMult
+
+/**
+ * p = s * B, where B is the base point
+ */
+static void
+Point_scalarBase(gf p[4], const unsigned char *s)
+{
+    gf q[4];
+    Gf_copy(q[0], ed25519_bx);
+    Gf_copy(q[1], ed25519_by);
+    Gf_copy(q[2], gf1);
+    Gf_mul(q[3], ed25519_bx, ed25519_by);
+    Point_scalarMult(p, q, s);
+}   // end function: Point_scalarBase
+
+/**
+ * decode the point encoded in "p" and negate it.
+ * @return true on success, false if "p" is not a valid encoding of a point.
+ */
+static bool
+Point_unpackNegated(gf r[4], const unsigned char *p)
+{
+    gf t, chk, num, den, den2, den4, den6;
+
+    Gf_copy(r[2], gf1);
+    Gf_unpack(r[1], p);
+    Gf_square(num, r[1]);
+    Gf_mul(den, num, ed25519_d);
+    Gf_sub(num, num, r[2]);
+    Gf_add(den, r[2], den);
+
+    Gf_square(den2, den);
+    Gf_square(den4, den2);
+    Gf_mul(den6, den4, den2);
+    Gf_mul(t, den6, num);
+    Gf_mul(t, t, den);
+
+    Gf_pow2523(t, t);
+    Gf_mul(t, t, num);
+    Gf_mul(t, t, den);
+    Gf_mul(t, t, den);
+    Gf_mul(r[0], t, den);
+
+    Gf_square(chk, r[0]);
+    Gf_mul(chk, chk, den);
+    if (!Gf_equals(chk, num)) {
+        Gf_mul(r[0], r[0], ed25519_i);
+    }   // end if
+
+    Gf_square(chk, r[0]);
+    Gf_mul(chk, chk, den);
+    if (!Gf_equals(chk, num)) {
+        return false;
+    }   // end if
+
+    if (Gf_parity(r[0]) == (p[31] >> 7)) {
+        Gf_sub(r[0], gf0, r[0]);
+    }   // end if
+    Gf_mul(r[3], r[0], r[1]);
+    return true;
+}   // end function: Point_unpackNegated
+
+/**
+ * r = x mod L, where "x" is a little-endian integer of 64 limbs of 8 bits.
+ */
+static void
+Scalar_modL(unsigned char *r, int64_t x[64])
+{
+    int64_t carry;
+    for (int i = 63; i >= 32; --i) {
+        carry = 0;
+        int j;
+        for (j = i - 32; j < i - 12; ++j) {
+            x[j] += carry - 16 * x[i] * ed25519_l[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }   // end for
+        x[j] += carry;
+        x[i] = 0;
+    }   // end for
+    carry = 0;
+    for (int j = 0; j < 32; ++j) {
+        x[j] += carry - (x[31] >> 4) * ed25519_l[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }   // end for
+    for (int j = 0; j < 32; ++j) {
+        x[j] -= carry * ed25519_l[j];
+    }   // end for
+    for (int i = 0; i < 32; ++i) {
+        x[i + 1] += x[i] >> 8;
+        r[i] = (unsigned char) (x[i] & 255);
+    }   // end for
+}   // end function: Scalar_modL
+
+/**
+ * reduce the 64-octet little-endian integer in "r" modulo L, into the first 32 octets of "r".
+ */
+static void
+Scalar_reduce(unsigned char *r)
+{
+    int64_t x[64];
+    for (int i = 0; i < 64; ++i) {
+        x[i] = r[i];
+    }   // end for
+    memset(r, 0, 64);
+    Scalar_modL(r, x);
+}   // end function: Scalar_reduce
+
+/**
+ * check if the 32-octet little-endian integer "s" is less than L.
+ */
+static bool
+Scalar_isCanonical(const unsigned char *s)
+{
+    for (int i = 31; i >= 0; --i) {
+        if (s[i] != ed25519_l[i]) {
+            return s[i] < ed25519_l[i];
+        }   // end if
+    }   // end for
+    return false;
+}   // end function: Scalar_isCanonical
+
+/**
+ * SHA-512 of the concatenation of "a" (32 octets), "b" (32 octets) and "msg".
+ */
+static void
+Ed25519_hash(unsigned char *md, const unsigned char *a, const unsigned char *b,
+             const unsigned char *msg, size_t msglen)
+{
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+    if (NULL != a) {
+        SHA512_Update(&ctx, a, 32);
+    }   // end if
+    SHA512_Update(&ctx, b, 32);
+    SHA512_Update(&ctx, msg, msglen);
+    SHA512_Final(md, &ctx);
+}   // end function: Ed25519_hash
+
+/**
+ * expand the private key into the secret scalar (the first 32 octets of "az")
+ * and the prefix for the nonce (the last 32 octets).
+ */
+static void
+Ed25519_expandPrivateKey(unsigned char *az, const unsigned char *privatekey)
+{
+    SHA512(privatekey, ED25519_PRIVATEKEY_LEN, az);
+    az[0] &= 248;
+    az[31] &= 127;
+    az[31] |= 64;
+}   // end function: Ed25519_expandPrivateKey
+
+/**
+ * derive the public key from the private key.
+ * @param publickey buffer to receive the public key, ED25519_PUBLICKEY_LEN octets
+ * @param privatekey private key (seed), ED25519_PRIVATEKEY_LEN octets
+ */
+void
+Ed25519_derivePublicKey(unsigned char *publickey, const unsigned char *privatekey)
+{
+    unsigned char az[64];
+    gf p[4];
+
+    Ed25519_expandPrivateKey(az, privatekey);
+    Point_scalarBase(p, az);
+    Point_pack(publickey, p);
+}   // end function: Ed25519_derivePublicKey
+
+/**
+ * sign the message.
+ * @param signature buffer to receive the signature, ED25519_SIGNATURE_LEN octets
+ * @param privatekey private key (seed), ED25519_PRIVATEKEY_LEN octets
+ * @param publickey public key corresponding to "privatekey", ED25519_PUBLICKEY_LEN octets
+ */
+void
+Ed25519_sign(unsigned char *signature, const unsigned char *msg, size_t msglen,
+             const unsigned char *privatekey, const unsigned char *publickey)
+{
+    unsigned char az[64], r[64], h[64];
+    int64_t x[64];
+    gf p[4];
+
+    Ed25519_expandPrivateKey(az, privatekey);
+
+    // r = SHA512(prefix || M), R = r * B
+    Ed25519_hash(r, NULL, az + 32, msg, msglen);
+    Scalar_reduce(r);
+    Point_scalarBase(p, r);
+    Point_pack(signature, p);
+
+    // S = (r + SHA512(R || A || M) * s) mod L
+    Ed25519_hash(h, signature, publickey, msg, msglen);
+    Scalar_reduce(h);
+    memset(x, 0, sizeof(x));
+    for (int i = 0; i < 32; ++i) {
+        x[i] = r[i];
+    }   // end for
+    for (int i = 0; i < 32; ++i) {
+        for (int j = 0; j < 32; ++j) {
+            x[i + j] += h[i] * (int64_t) az[j];
+        }   // end for
+    }   // end for
+    Scalar_modL(signature + 32, x);
+}   // end function: Ed25519_sign
+
+/**
+ * verify the signature of the message.
+ * @param signature signature, ED25519_SIGNATURE_LEN octets
+ * @param publickey public key, ED25519_PUBLICKEY_LEN octets
+ * @return true if the signature is valid, false otherwise.
+ */
+bool
+Ed25519_verify(const unsigned char *signature, const unsigned char *msg, size_t msglen,
+               const unsigned char *publickey)
+{
+    unsigned char h[64], rcheck[32];
+    gf p[4], q[4];
+
+    if (!Scalar_isCanonical(signature + 32)) {
+        return false;
+    }   // end if
+    if (!Point_unpackNegated(q, publickey)) {
+        return false;
+    }   // end if
+
+    // check R == S * B - SHA512(R || A || M) * A
+    Ed25519_hash(h, signature, publickey, msg, msglen);
+    Scalar_reduce(h);
+    Point_scalarMult(p, q, h);
+    Point_scalarBase(q, signature + 32);
+    Point_add(p, q);
+    Point_pack(rcheck, p);
+    return 0 == memcmp(rcheck, signature, 32);
+}   // end function: Ed25519_verify
@@ -41,6 +41,7 @@ struct DnsResolver {
     ldns_resolver *res;
     dns_stat_t status;
     ldns_status res_stat;
+    uint32_t ttl;   // the minimum TTL of the answer records of the last response
 };
 
 // The followings are aliases of ldns_rr_list:
@@ -283,6 +284,7 @@ DnsResolver_resetErrorState(DnsResolver *self)
 {
     self->status = DNS_STAT_NOERROR;
     self->res_stat = LDNS_STATUS_OK;
+    self->ttl = 0;
 }   // end function: DnsResolver_resetErrorState
 
 static const char *
@@ -324,6 +326,16 @@ DnsResolver_getErrorString(const DnsResolver *self)
         : DnsResolver_statcode2string(self->status);
 }   // end function: DnsResolver_getErrorString
 
+/**
+ * @return the minimum TTL of the answer records of the last lookup,
+ *         0 if the last lookup didn't succeed.
+ */
+uint32_t
+DnsResolver_getTtl(const DnsResolver *self)
+{
+    return DNS_STAT_NOERROR == self->status ? self->ttl : 0;
+}   // end function: DnsResolver_getTtl
+
 /*
  * throw a DNS query and receive a response of it
  * @return
@@ -356,6 +368,12 @@ DnsResolver_query(DnsResolver *self, const char *domain, ldns_rr_type rrtype, ld
         ldns_pkt_free(packet);
         return DnsResolver_setError(self, DNS_STAT_NODATA);
     }   // end if
+    for (size_t n = 0; n < ldns_rr_list_rr_count(*rrlist); ++n) {
+        uint32_t ttl = ldns_rr_ttl(ldns_rr_list_rr(*rrlist, n));
+        if (0 == n || ttl < self->ttl) {
+            self->ttl = ttl;
+        }   // end if
+    }   // end for
     ldns_pkt_free(packet);
     return DNS_STAT_NOERROR;
 }   // end function: DnsResolver_query
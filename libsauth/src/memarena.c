@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2014 Ntools OSS Projects Nobby N Hirano All rights reserved.
+ *
+ * The terms and conditions of the accompanying program
+ * shall be provided separately by Internet Initiative Japan Inc.
+ * Any use, reproduction or distribution of the program are permitted
+ * provided that you agree to be bound to such terms and conditions.
+ *
+ * $Id$
+ */
+
+#include "rcsid.h"
+RCSID("$Id$");
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "stdaux.h"
+#include "memarena.h"
+
+#define ROUNDUP(c, base) ((((c) + (base) - 1) / (base)) * (base))
+
+#define BLOCKSIZE_DEFAULT 4096
+
+// the strictest alignment any object allocated from the arena may require
+typedef union MemArenaAlign {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*fp) (void);
+} MemArenaAlign;
+
+#define ALIGNMENT (sizeof(MemArenaAlign))
+
+typedef struct MemArenaBlock {
+    struct MemArenaBlock *next;
+    size_t capacity;            // size of the data area
+    size_t used;                // bytes already handed out from the data area
+    MemArenaAlign data[];
+} MemArenaBlock;
+
+struct MemArena {
+    // the block allocations are currently served from.
+    // older blocks are chained through "next", the first block is never released until MemArena_free().
+    MemArenaBlock *current;
+    MemArenaBlock *first;
+    size_t blocksize;
+    // total bytes handed out since the last reset
+    size_t usage;
+};
+
+static MemArenaBlock *
+MemArenaBlock_new(size_t capacity)
+{
+    MemArenaBlock *block = (MemArenaBlock *) malloc(sizeof(MemArenaBlock) + capacity);
+    if (NULL == block) {
+        return NULL;
+    }   // end if
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}   // end function: MemArenaBlock_new
+
+/**
+ * create MemArena object
+ * @param blocksize the unit size of memory blocks obtained with malloc().
+ *                  0 to use the default value.
+ * @return initialized MemArena object, or NULL if memory allocation failed.
+ */
+MemArena *
+MemArena_new(size_t blocksize)
+{
+    MemArena *self = (MemArena *) malloc(sizeof(MemArena));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    memset(self, 0, sizeof(MemArena));
+    self->blocksize = ROUNDUP(0 < blocksize ? blocksize : BLOCKSIZE_DEFAULT, ALIGNMENT);
+    self->first = MemArenaBlock_new(self->blocksize);
+    if (NULL == self->first) {
+        free(self);
+        return NULL;
+    }   // end if
+    self->current = self->first;
+    return self;
+}   // end function: MemArena_new
+
+static void
+MemArena_releaseBlocks(MemArenaBlock *block)
+{
+    while (NULL != block) {
+        MemArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }   // end while
+}   // end function: MemArena_releaseBlocks
+
+/**
+ * release MemArena object and all the memory allocated from it
+ * @param self MemArena object to release
+ */
+void
+MemArena_free(MemArena *self)
+{
+    assert(NULL != self);
+    MemArena_releaseBlocks(self->first);
+    free(self);
+}   // end function: MemArena_free
+
+/**
+ * release all the memory allocated from the arena at once.
+ * the first block is kept to serve subsequent allocations.
+ * @attention all the pointers obtained from the arena become invalid.
+ */
+void
+MemArena_reset(MemArena *self)
+{
+    assert(NULL != self);
+    MemArena_releaseBlocks(self->first->next);
+    self->first->next = NULL;
+    self->first->used = 0;
+    self->current = self->first;
+    self->usage = 0;
+}   // end function: MemArena_reset
+
+/**
+ * allocate a memory block from the arena.
+ * the returned memory is suitably aligned for any kind of variable.
+ * @return a pointer to the allocated memory, or NULL if memory allocation failed.
+ * @attention The returned memory must not be released with free().
+ *            It is released with MemArena_reset() or MemArena_free().
+ */
+void *
+MemArena_alloc(MemArena *self, size_t size)
+{
+    assert(NULL != self);
+
+    size_t aligned = ROUNDUP(0 < size ? size : 1, ALIGNMENT);
+    MemArenaBlock *block = self->current;
+    if (block->capacity - block->used < aligned) {
+        // oversized requests get a dedicated block so as not to waste the rest of the current one
+        block = MemArenaBlock_new(MAX(self->blocksize, aligned));
+        if (NULL == block) {
+            return NULL;
+        }   // end if
+        block->next = self->current->next;
+        self->current->next = block;
+        if (aligned <= self->blocksize) {
+            self->current = block;
+        }   // end if
+    }   // end if
+    void *p = (char *) block->data + block->used;
+    block->used += aligned;
+    self->usage += aligned;
+    return p;
+}   // end function: MemArena_alloc
+
+/**
+ * allocate a zero-filled memory block from the arena.
+ * @return a pointer to the allocated memory, or NULL if memory allocation failed.
+ */
+void *
+MemArena_calloc(MemArena *self, size_t size)
+{
+    void *p = MemArena_alloc(self, size);
+    if (NULL != p) {
+        memset(p, 0, size);
+    }   // end if
+    return p;
+}   // end function: MemArena_calloc
+
+/**
+ * duplicate the string between head and tail into the arena and terminate it with NULL.
+ * @return a pointer to the duplicated string, or NULL if memory allocation failed.
+ */
+char *
+MemArena_strpdup(MemArena *self, const char *head, const char *tail)
+{
+    assert(head <= tail);
+    size_t len = tail - head;
+    char *s = (char *) MemArena_alloc(self, len + 1);
+    if (NULL == s) {
+        return NULL;
+    }   // end if
+    memcpy(s, head, len);
+    s[len] = '\0';
+    return s;
+}   // end function: MemArena_strpdup
+
+/**
+ * duplicate the NULL-terminated string into the arena.
+ * @return a pointer to the duplicated string, or NULL if memory allocation failed.
+ */
+char *
+MemArena_strdup(MemArena *self, const char *s)
+{
+    return MemArena_strpdup(self, s, s + strlen(s));
+}   // end function: MemArena_strdup
+
+/**
+ * @return the total bytes handed out since the arena was created or reset.
+ */
+size_t
+MemArena_getUsage(const MemArena *self)
+{
+    assert(NULL != self);
+    return self->usage;
+}   // end function: MemArena_getUsage
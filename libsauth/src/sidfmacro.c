@@ -12,6 +12,7 @@
 #include "rcsid.h"
 RCSID("$Id: sidfmacro.c 1343 2011-07-30 19:21:50Z takahiko $");
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +29,7 @@ RCSID("$Id: sidfmacro.c 1343 2011-07-30 19:21:50Z takahiko $");
 #include "ptrop.h"
 #include "pstring.h"
 #include "xbuffer.h"
+#include "memarena.h"
 #include "xskip.h"
 #include "xparse.h"
 #include "inetdomain.h"
@@ -42,7 +44,6 @@ RCSID("$Id: sidfmacro.c 1343 2011-07-30 19:21:50Z takahiko $");
 #define IS_MACRO_LITERAL(c) ((0x21 <= (c) && (c) <= 0x7e) && '%' != (c))
 #define IS_MACRO_DELIMITER(c) ((c) == '.' || (c) == '-' || (c) == '+' || (c) == ',' || (c) == '/' || (c) == '_' || (c) == '=')
 
-#define SIDF_MACRO_DOMAIN_VALIDATION_PTRRR_MAXNUM 10
 #define SIDF_MACRO_ALL_DELIMITERS ".-+,/_="
 #define SIDF_MACRO_DEFAULT_DELIMITER '.'
 #define SIDF_MACRO_DEFAULT_P_MACRO_VALUE "unknown"
@@ -88,16 +89,16 @@ SidfMacro_init(SidfMacro *self)
 }   // end function: SidfMacro_init
 
 /**
- * @attention The returned string should be released with free() when no longer needed.
+ * @attention The returned string is allocated from the arena and must not be released with free().
  */
 static char *
-SidfMacro_dupMailboxAsString(const InetMailbox *mailbox)
+SidfMacro_dupMailboxAsString(MemArena *arena, const InetMailbox *mailbox)
 {
     const char *localpart = InetMailbox_getLocalPart(mailbox);
     const char *domainpart = InetMailbox_getDomain(mailbox);
     size_t localpart_len = strlen(localpart);
     size_t domainpart_len = strlen(domainpart);
-    char *mailaddr = (char *) malloc(localpart_len + domainpart_len + 2);   // 2 は '@' と終端文字
+    char *mailaddr = (char *) MemArena_alloc(arena, localpart_len + domainpart_len + 2);   // 2 は '@' と終端文字
     if (NULL == mailaddr) {
         return NULL;
     }   // end if
@@ -108,113 +109,6 @@ SidfMacro_dupMailboxAsString(const InetMailbox *mailbox)
     return mailaddr;
 }   // end function: SidfMacro_dupMailboxAsString
 
-/**
- * @attention The returned string should be released with free() when no longer needed.
- */
-static char *
-SidfMacro_dupValidatedDomainName(const SidfRequest *request, const char *domain)
-{
-    /*
-     * [RFC4408] 8.1.
-     * The "p" macro expands to the validated domain name of <ip>.  The
-     * procedure for finding the validated domain name is defined in Section
-     * 5.5.  If the <domain> is present in the list of validated domains, it
-     * SHOULD be used.  Otherwise, if a subdomain of the <domain> is
-     * present, it SHOULD be used.  Otherwise, any name from the list may be
-     * used.  If there are no validated domain names or if a DNS error
-     * occurs, the string "unknown" is used.
-     */
-
-    DnsPtrResponse *respptr;
-    dns_stat_t ptrquery_stat =
-        DnsResolver_lookupPtr(request->resolver, request->sa_family, &(request->ipaddr), &respptr);
-    if (DNS_STAT_NOERROR != ptrquery_stat) {
-        return strdup(SIDF_MACRO_DEFAULT_P_MACRO_VALUE);
-    }   // end if
-
-    // TODO: stable sort をする代わりにリストを3回なめている. stable sort をする方がエレガント.
-    size_t resp_num_limit =
-        MIN(DnsPtrResponse_size(respptr), SIDF_MACRO_DOMAIN_VALIDATION_PTRRR_MAXNUM);
-    char *expand = NULL;
-
-    /*
-     * [RFC4408] 8.1.
-     * If the <domain> is present in the list of validated domains, it SHOULD be used.
-     */
-    for (size_t n = 0; n < resp_num_limit; ++n) {
-        const char *revdomain = DnsPtrResponse_domain(respptr, n);
-        if (InetDomain_equals(domain, revdomain)) {
-            switch (SidfRequest_isValidatedDomainName(request, revdomain)) {
-            case 1:
-                expand = strdup(revdomain);
-                goto finally;
-            case 0:
-                // do nothing
-                break;
-            case -1:
-                goto use_default_macro_value;
-            default:
-                abort();
-            }   // end switch
-        }   // end if
-    }   // end for
-
-    /*
-     * [RFC4408] 8.1.
-     * Otherwise, if a subdomain of the <domain> is present, it SHOULD be used.
-     */
-    for (size_t n = 0; n < resp_num_limit; ++n) {
-        const char *revdomain = DnsPtrResponse_domain(respptr, n);
-        if (InetDomain_isParent(domain, revdomain) && !InetDomain_equals(domain, revdomain)) {
-            switch (SidfRequest_isValidatedDomainName(request, revdomain)) {
-            case 1:
-                expand = strdup(revdomain);
-                goto finally;
-            case 0:
-                // do nothing
-                break;
-            case -1:
-                goto use_default_macro_value;
-            default:
-                abort();
-            }   // end switch
-        }   // end if
-    }   // end for
-
-    /*
-     * [RFC4408] 8.1.
-     * Otherwise, any name from the list may be used.
-     */
-    for (size_t n = 0; n < resp_num_limit; ++n) {
-        const char *revdomain = DnsPtrResponse_domain(respptr, n);
-        if (!InetDomain_isParent(domain, revdomain)) {
-            switch (SidfRequest_isValidatedDomainName(request, revdomain)) {
-            case 1:
-                expand = strdup(revdomain);
-                goto finally;
-            case 0:
-                // do nothing
-                break;
-            case -1:
-                goto use_default_macro_value;
-            default:
-                abort();
-            }   // end switch
-        }   // end if
-    }   // end for
-
-  use_default_macro_value:
-    /*
-     * [RFC4408] 8.1.
-     * If there are no validated domain names or if a DNS error occurs, the string "unknown" is used.
-     */
-    expand = strdup(SIDF_MACRO_DEFAULT_P_MACRO_VALUE);
-
-  finally:
-    DnsPtrResponse_free(respptr);
-    return expand;
-}   // end function: SidfMacro_dupValidatedDomainName
-
 /*
  * The argument must be in the range 0-15, otherwise the behavior is undefined.
  */
@@ -225,7 +119,7 @@ xtoa(unsigned char p)
 }   // end function: xtoa
 
 /**
- * @attention The returned string should be released with free() when no longer needed.
+ * @attention The returned string is allocated from the arena of the request and must not be released with free().
  */
 static char *
 SidfMacro_dupDottedIpAddr(const SidfRequest *request)
@@ -234,7 +128,7 @@ SidfMacro_dupDottedIpAddr(const SidfRequest *request)
     case AF_INET:;
         char addrbuf4[INET_ADDRSTRLEN];
         (void) inet_ntop(AF_INET, &(request->ipaddr), addrbuf4, sizeof(addrbuf4));
-        return strdup(addrbuf4);
+        return MemArena_strdup(request->arena, addrbuf4);
     case AF_INET6:;
         char addrbuf6[SIDF_MACRO_DOTTED_INET6ADDRLEN];
         const unsigned char *rawaddr = (const unsigned char *) &(request->ipaddr.addr6);
@@ -246,126 +140,208 @@ SidfMacro_dupDottedIpAddr(const SidfRequest *request)
             *(bufp++) = xtoa(*(rawaddr++) & 0x0f);
             *(bufp++) = '.';
         }   // end for
-        return strpdup(addrbuf6, bufp - 1);
+        return MemArena_strpdup(request->arena, addrbuf6, bufp - 1);
     default:
         abort();
     }   // end switch
 }   // end function: SidfMacro_dupDottedIpAddr
 
 /**
- * @attention The returned string should be released with free() when no longer needed.
+ * @return the string the macro-letter refers to, or NULL if memory allocation failed.
+ * @attention The returned string is either allocated from the arena of the request
+ *            or a reference to the request itself. It must not be released with free().
  */
-static char *
-SidfMacro_dupMacroSource(const SidfRequest *request, SidfMacroLetter macro_letter)
+static const char *
+SidfMacro_getMacroSource(SidfRequest *request, SidfMacroLetter macro_letter)
 {
     switch (macro_letter) {
     case SIDF_MACRO_S_SENDER:
-        return SidfMacro_dupMailboxAsString(request->sender);
+        return SidfMacro_dupMailboxAsString(request->arena, request->sender);
     case SIDF_MACRO_L_SENDER_LOCALPART:
-        return strdup(InetMailbox_getLocalPart(request->sender));
+        return InetMailbox_getLocalPart(request->sender);
     case SIDF_MACRO_O_SENDER_DOMAIN:
-        return strdup(InetMailbox_getDomain(request->sender));
+        return InetMailbox_getDomain(request->sender);
     case SIDF_MACRO_D_DOMAIN:
-        return strdup(SidfRequest_getDomain(request));
+        return SidfRequest_getDomain(request);
     case SIDF_MACRO_I_DOTTED_IPADDR:
         return SidfMacro_dupDottedIpAddr(request);
     case SIDF_MACRO_P_IPADDR_VALID_DOMAIN:
-        return SidfMacro_dupValidatedDomainName(request, SidfRequest_getDomain(request));
+        /*
+         * the validated domain name of <ip> is resolved by the evaluation engine beforehand,
+         * as it needs DNS lookups which the engine may have to suspend on.
+         */
+        return PTROR(request->validated_domain, SIDF_MACRO_DEFAULT_P_MACRO_VALUE);
     case SIDF_MACRO_V_REVADDR_SUFFIX:
-        return strdup(AF_INET == request->sa_family ? "in-addr" : "ip6");
+        return AF_INET == request->sa_family ? "in-addr" : "ip6";
     case SIDF_MACRO_H_HELO_DOMAIN:
-        return strdup(request->helo_domain);
+        return request->helo_domain;
     case SIDF_MACRO_C_TEXT_IPADDR:;
         char addrbuf[INET6_ADDRSTRLEN];
         (void) inet_ntop(request->sa_family, &(request->ipaddr), addrbuf, sizeof(addrbuf));
-        return strdup(addrbuf);
+        return MemArena_strdup(request->arena, addrbuf);
     case SIDF_MACRO_R_CHECKING_DOMAIN:
         // 受信した MTA (= SPF の検証をしたホスト) の名前
-        return strdup(PTROR(request->policy->checking_domain, SIDF_MACRO_DEFAULT_R_MACRO_VALUE));
+        return PTROR(request->policy->checking_domain, SIDF_MACRO_DEFAULT_R_MACRO_VALUE);
     case SIDF_MACRO_T_TIMESTAMP:;
         char timebuf[20];
         snprintf(timebuf, sizeof(timebuf), "%ld", (long) time(NULL));
-        return strdup(timebuf);
+        return MemArena_strdup(request->arena, timebuf);
     default:
         abort();
     }   // end switch
-}   // end function: SidfMacro_dupMacroSource
+}   // end function: SidfMacro_getMacroSource
 
-/**
- * 与えられた文字列の領域をセパレーターで区切り, 2次元配列を構築する.
- * s 内の delimstr を NULL で置き換え, 各要素の先頭を示すポインタからなる配列を返す.
- * @param s 区切りたい文字列
- * @param delimstr デリミタとして使う文字を繋げたNULL終端文字列
- * @param num 要素の数を受け取る変数へのポインタ
- * @attention s will be overwritten
- * @attention The returned string should be released with free() when no longer needed.
+/*
+ * マクロの展開元の文字列を delimiter で区切り, transformer に従って xbuf に書き出す.
+ * 展開元の文字列は書き換えず, 区切った結果を保持する配列も作らずに1パスで処理する.
+ *
+ * [RFC4408] 8.1.
+ * The DIGIT transformer indicates the number of right-hand parts to
+ * use, after optional reversal.
  */
-static char **
-SidfMacro_splitMacroSource(char *s, const char *delimstr, size_t *num)
-{
-    // 必要な配列のサイズを見積もる
-    size_t n;
-    char *q;
-    for (n = 0, q = s; NULL != (q = strpbrk(q, delimstr)); ++n, ++q);
-    // メモリの確保
-    char **r = (char **) malloc((n + 2) * sizeof(char *));
-    if (NULL == r) {
-        return NULL;
-    }   // end if
-
-    char *token_tail;
-    int idx = 0;
-    r[idx] = s;
-    while (NULL != (token_tail = strpbrk(r[idx], delimstr))) {
-        *token_tail = '\0';
-        r[++idx] = token_tail + 1;
-    }   // end while
-    r[++idx] = NULL;
-    *num = idx;
-    return r;
-}   // end function: SidfMacro_splitMacroSource
-
 static SidfStat
-SidfMacro_expandMacro(const SidfMacro *macro, const SidfRequest *request, XBuffer *xbuf)
+SidfMacro_expandMacro(const SidfMacro *macro, SidfRequest *request, XBuffer *xbuf)
 {
-    char *macro_source = SidfMacro_dupMacroSource(request, macro->letter);
+    const char *macro_source = SidfMacro_getMacroSource(request, macro->letter);
     if (NULL == macro_source) {
         SidfLogNoResource(request->policy);
         return SIDF_STAT_NO_RESOURCE;
     }   // end if
-    size_t num;
-    char **macro_parts = SidfMacro_splitMacroSource(macro_source, macro->delims, &num);
-    if (NULL == macro_parts) {
-        free(macro_source);
-        SidfLogNoResource(request->policy);
-        return SIDF_STAT_NO_RESOURCE;
-    }   // end if
-
-    // reverse が指定されている場合は反転する
-    if (macro->reverse) {
-        for (size_t n = 0; n < num / 2; ++n) {
-            size_t pos = num - n - 1;
-            char *tmp = macro_parts[pos];
-            macro_parts[pos] = macro_parts[n];
-            macro_parts[n] = tmp;
-        }   // end for
-    }   // end if
+    const char *source_tail = STRTAIL(macro_source);
 
-    size_t idx = (0 == macro->transformer || num <= macro->transformer)
+    // 区切られた要素の数を数える
+    size_t num = 1;
+    for (const char *p = macro_source; p < source_tail; ++p) {
+        if (NULL != strchr(macro->delims, *p)) {
+            ++num;
+        }   // end if
+    }   // end for
+    // (reverse 後の) 先頭から読み飛ばす要素の数
+    size_t skip = (0 == macro->transformer || num <= macro->transformer)
         ? 0 : num - macro->transformer;
+
     // TODO: 大文字のマクロは対応する小文字のマクロと同様に展開し, URLエスケープすること
     // NOTE: URL エスケープは explanation レコードのみを対象とすべきではないのか?
-    XBuffer_appendString(xbuf, macro_parts[idx]);
-    for (++idx; NULL != macro_parts[idx]; ++idx) {
-        XBuffer_appendChar(xbuf, '.');
-        XBuffer_appendString(xbuf, macro_parts[idx]);
-    }   // end for
+    if (macro->reverse) {
+        // 末尾の要素から順に, 先頭から数えて num - skip 個の要素を書き出す
+        const char *part_tail = source_tail;
+        for (size_t idx = num; 0 < idx; --idx) {
+            const char *part_head = part_tail;
+            while (macro_source < part_head && NULL == strchr(macro->delims, *(part_head - 1))) {
+                --part_head;
+            }   // end while
+            if (idx <= num - skip) {
+                XBuffer_appendStringN(xbuf, part_head, part_tail - part_head);
+                if (1 < idx) {
+                    XBuffer_appendChar(xbuf, '.');
+                }   // end if
+            }   // end if
+            if (1 < idx) {
+                part_tail = part_head - 1;  // skip the delimiter
+            }   // end if
+        }   // end for
+    } else {
+        const char *p = macro_source;
+        for (size_t idx = 0; idx < skip; ++p) {
+            if (NULL != strchr(macro->delims, *p)) {
+                ++idx;
+            }   // end if
+        }   // end for
+        for (; p < source_tail; ++p) {
+            XBuffer_appendChar(xbuf, NULL != strchr(macro->delims, *p) ? '.' : *p);
+        }   // end for
+    }   // end if
 
-    free(macro_parts);
-    free(macro_source);
     return SIDF_STAT_OK;
 }   // end function: SidfMacro_expandMacro
 
+/*
+ * Compiled form of a macro-string.
+ * The literal parts (including "%%", "%_", "%-" and SP in explain-string) are concatenated
+ * into "literal", and ops refer to the spans of it or hold a parsed macro-expand.
+ */
+typedef enum SidfMacroOpType {
+    SIDF_MACRO_OP_LITERAL,
+    SIDF_MACRO_OP_EXPAND,
+} SidfMacroOpType;
+
+typedef struct SidfMacroOp {
+    SidfMacroOpType type;
+    size_t literal_offset;      // SIDF_MACRO_OP_LITERAL only
+    size_t literal_len;         // SIDF_MACRO_OP_LITERAL only
+    SidfMacro macro;            // SIDF_MACRO_OP_EXPAND only
+} SidfMacroOp;
+
+struct SidfMacroProgram {
+    char *literal;
+    size_t literal_len;
+    SidfMacroOp *ops;
+    unsigned int op_num;
+    unsigned int op_capacity;
+    unsigned int macro_num;     // the number of SIDF_MACRO_OP_EXPAND ops
+    // true if the last op is a literal taken from macro-literal, used to check domain-end
+    bool literal_terminated;
+};
+
+/**
+ * create SidfMacroProgram object in the arena of the request,
+ * large enough to hold the compiled form of the macro-string between head and tail.
+ * @return initialized SidfMacroProgram object, or NULL if memory allocation failed.
+ */
+static SidfMacroProgram *
+SidfMacroProgram_new(const SidfRequest *request, const char *head, const char *tail)
+{
+    SidfMacroProgram *self =
+        (SidfMacroProgram *) MemArena_calloc(request->arena, sizeof(SidfMacroProgram));
+    if (NULL == self) {
+        return NULL;
+    }   // end if
+    // each '%' produces at most one macro-expand op and one literal op after it
+    unsigned int percent_num = 0;
+    for (const char *p = head; p < tail; ++p) {
+        if ('%' == *p) {
+            ++percent_num;
+        }   // end if
+    }   // end for
+    self->op_capacity = percent_num * 2 + 1;
+    self->ops = (SidfMacroOp *) MemArena_alloc(request->arena,
+                                               self->op_capacity * sizeof(SidfMacroOp));
+    // "%-" is the only construct whose literal form ("%20") is longer than its source
+    self->literal = (char *) MemArena_alloc(request->arena, (tail - head) * 2 + 1);
+    if (NULL == self->ops || NULL == self->literal) {
+        return NULL;
+    }   // end if
+    return self;
+}   // end function: SidfMacroProgram_new
+
+static void
+SidfMacroProgram_appendLiteral(SidfMacroProgram *self, const char *s, size_t len)
+{
+    if (0 < self->op_num && SIDF_MACRO_OP_LITERAL == self->ops[self->op_num - 1].type) {
+        // merge into the preceding literal span
+        self->ops[self->op_num - 1].literal_len += len;
+    } else {
+        assert(self->op_num < self->op_capacity);
+        SidfMacroOp *op = &(self->ops[self->op_num++]);
+        op->type = SIDF_MACRO_OP_LITERAL;
+        op->literal_offset = self->literal_len;
+        op->literal_len = len;
+    }   // end if
+    memcpy(self->literal + self->literal_len, s, len);
+    self->literal_len += len;
+    self->literal[self->literal_len] = '\0';
+}   // end function: SidfMacroProgram_appendLiteral
+
+static void
+SidfMacroProgram_appendMacro(SidfMacroProgram *self, const SidfMacro *macro)
+{
+    assert(self->op_num < self->op_capacity);
+    SidfMacroOp *op = &(self->ops[self->op_num++]);
+    op->type = SIDF_MACRO_OP_EXPAND;
+    memcpy(&(op->macro), macro, sizeof(SidfMacro));
+    ++(self->macro_num);
+}   // end function: SidfMacroProgram_appendMacro
+
 /*
  * [RFC4408]
  * delimiter        = "." / "-" / "+" / "," / "/" / "_" / "="
@@ -483,7 +459,7 @@ SidfMacro_parseTransformers(SidfMacro *macro, const char *head, const char *tail
  */
 static SidfStat
 SidfMacro_parseMacroExpand(const SidfRequest *request, const char *head, const char *tail,
-                           bool exp_record, const char **nextp, XBuffer *xbuf)
+                           bool exp_record, const char **nextp, SidfMacroProgram *program)
 {
     const char *p = head;
     if (head + 1 < tail && '%' == *p) {
@@ -509,19 +485,8 @@ SidfMacro_parseMacroExpand(const SidfRequest *request, const char *head, const c
             }   // end if
 
             if (0 < XSkip_char(p, tail, '}', &p)) {
-                // ここでやっとマクロとして確定したので展開する
-                SidfStat expand_stat = SidfMacro_expandMacro(&macro, request, xbuf);
-                if (SIDF_STAT_OK != expand_stat) {
-                    *nextp = head;
-                    return expand_stat;
-                }   // end if
-                if (request->policy->macro_expansion_limit < XBuffer_getSize(xbuf)) {
-                    SidfLogPermFail(request->policy, "expanded macro too long: limit=%u, length=%u",
-                                    request->policy->macro_expansion_limit,
-                                    (unsigned int) XBuffer_getSize(xbuf));
-                    *nextp = head;
-                    return SIDF_STAT_MALICIOUS_MACRO_EXPANSION;
-                }   // end if
+                // ここでやっとマクロとして確定したので, 展開はせずに記録だけしておく
+                SidfMacroProgram_appendMacro(program, &macro);
                 *nextp = p;
                 return SIDF_STAT_OK;
             } else {
@@ -535,7 +500,7 @@ SidfMacro_parseMacroExpand(const SidfRequest *request, const char *head, const c
              * [RFC4408] 8.1.
              * A literal "%" is expressed by "%%".
              */
-            XBuffer_appendChar(xbuf, '%');
+            SidfMacroProgram_appendLiteral(program, "%", 1);
             *nextp = head + 2;
             return SIDF_STAT_OK;
 
@@ -544,7 +509,7 @@ SidfMacro_parseMacroExpand(const SidfRequest *request, const char *head, const c
              * [RFC4408] 8.1.
              * "%_" expands to a single " " space.
              */
-            XBuffer_appendChar(xbuf, 0x20);
+            SidfMacroProgram_appendLiteral(program, " ", 1);
             *nextp = head + 2;
             return SIDF_STAT_OK;
 
@@ -553,7 +518,7 @@ SidfMacro_parseMacroExpand(const SidfRequest *request, const char *head, const c
              * [RFC4408] 8.1.
              * "%-" expands to a URL-encoded space, viz., "%20".
              */
-            XBuffer_appendString(xbuf, "%20");
+            SidfMacroProgram_appendLiteral(program, "%20", 3);
             *nextp = head + 2;
             return SIDF_STAT_OK;
 
@@ -579,14 +544,14 @@ SidfMacro_parseMacroExpand(const SidfRequest *request, const char *head, const c
  */
 static int
 SidfMacro_parseMacroLiteralBlock(const char *head, const char *tail, const char **nextp,
-                                 XBuffer *xbuf)
+                                 SidfMacroProgram *program)
 {
     const char *p;
     for (p = head; p < tail && IS_MACRO_LITERAL(*p); ++p);
     *nextp = p;
     int matchlen = *nextp - head;
     if (0 < matchlen) {
-        XBuffer_appendStringN(xbuf, head, matchlen);
+        SidfMacroProgram_appendLiteral(program, head, matchlen);
     }   // end if
     return matchlen;
 }   // end function: SidfMacro_parseMacroLiteralBlock
@@ -597,19 +562,19 @@ SidfMacro_parseMacroLiteralBlock(const char *head, const char *tail, const char
  */
 static SidfStat
 SidfMacro_parseMacroString(const SidfRequest *request, const char *head, const char *tail,
-                           bool exp_record, const char **nextp, bool *literal_terminated,
-                           XBuffer *xbuf)
+                           bool exp_record, const char **nextp, SidfMacroProgram *program)
 {
     const char *p = head;
     while (true) {
-        int literal_len = SidfMacro_parseMacroLiteralBlock(p, tail, &p, xbuf);
-        SidfStat macro_stat = SidfMacro_parseMacroExpand(request, p, tail, exp_record, &p, xbuf);
+        int literal_len = SidfMacro_parseMacroLiteralBlock(p, tail, &p, program);
+        SidfStat macro_stat =
+            SidfMacro_parseMacroExpand(request, p, tail, exp_record, &p, program);
         switch (macro_stat) {
         case SIDF_STAT_OK:
             break;
         case SIDF_STAT_RECORD_NOT_MATCH:
             *nextp = p;
-            SETDEREF(literal_terminated, (0 < literal_len) ? true : false);
+            program->literal_terminated = (0 < literal_len) ? true : false;
             return (0 < p - head) ? SIDF_STAT_OK : SIDF_STAT_RECORD_NOT_MATCH;
         default:
             *nextp = head;
@@ -622,14 +587,17 @@ SidfMacro_parseMacroString(const SidfRequest *request, const char *head, const c
  * [RFC4408]
  * explain-string   = *( macro-string / SP )
  */
-SidfStat
-SidfMacro_parseExplainString(const SidfRequest *request, const char *head, const char *tail,
-                             const char **nextp, XBuffer *xbuf)
+static SidfStat
+SidfMacro_parseExplainStringBody(const SidfRequest *request, const char *head, const char *tail,
+                                 const char **nextp, SidfMacroProgram *program)
 {
     const char *p = head;
     while (true) {
-        int sp_match = XParse_char(p, tail, ' ', &p, xbuf);
-        SidfStat parse_stat = SidfMacro_parseMacroString(request, p, tail, true, &p, NULL, xbuf);
+        int sp_match = XSkip_char(p, tail, ' ', &p);
+        if (0 < sp_match) {
+            SidfMacroProgram_appendLiteral(program, " ", 1);
+        }   // end if
+        SidfStat parse_stat = SidfMacro_parseMacroString(request, p, tail, true, &p, program);
         switch (parse_stat) {
         case SIDF_STAT_OK:
             break;
@@ -644,7 +612,96 @@ SidfMacro_parseExplainString(const SidfRequest *request, const char *head, const
             return parse_stat;
         }   // end switch
     }   // end while
-}   // end function: SidfMacro_parseExplainString
+}   // end function: SidfMacro_parseExplainStringBody
+
+/**
+ * explain-string をコンパイルする.
+ * @param program コンパイル結果を受け取る変数へのポインタ.
+ *                コンパイル結果はリクエストのアリーナに確保される.
+ */
+SidfStat
+SidfMacro_compileExplainString(const SidfRequest *request, const char *head, const char *tail,
+                               const char **nextp, SidfMacroProgram **program)
+{
+    SidfMacroProgram *self = SidfMacroProgram_new(request, head, tail);
+    if (NULL == self) {
+        SidfLogNoResource(request->policy);
+        *nextp = head;
+        return SIDF_STAT_NO_RESOURCE;
+    }   // end if
+    SidfStat parse_stat = SidfMacro_parseExplainStringBody(request, head, tail, nextp, self);
+    if (SIDF_STAT_OK == parse_stat) {
+        *program = self;
+    }   // end if
+    return parse_stat;
+}   // end function: SidfMacro_compileExplainString
+
+/**
+ * コンパイル済みのマクロ文字列を展開し, xbuf に追記する.
+ * @return SIDF_STAT_OK: 展開に成功した
+ *         SIDF_STAT_MALICIOUS_MACRO_EXPANSION: 展開結果が SidfPolicy で指定された長さを越えた
+ *         SIDF_STAT_NO_RESOURCE: リソース不足
+ */
+SidfStat
+SidfMacro_expand(SidfRequest *request, const SidfMacroProgram *program, XBuffer *xbuf)
+{
+    // most expansions fit in the literal parts plus a domain name
+    (void) XBuffer_reserve(xbuf, XBuffer_getSize(xbuf) + program->literal_len
+                           + (0 < program->macro_num ? NS_MAXDNAME : 0));
+    for (unsigned int i = 0; i < program->op_num; ++i) {
+        const SidfMacroOp *op = &(program->ops[i]);
+        switch (op->type) {
+        case SIDF_MACRO_OP_LITERAL:
+            XBuffer_appendStringN(xbuf, program->literal + op->literal_offset, op->literal_len);
+            break;
+        case SIDF_MACRO_OP_EXPAND:;
+            SidfStat expand_stat = SidfMacro_expandMacro(&(op->macro), request, xbuf);
+            if (SIDF_STAT_OK != expand_stat) {
+                return expand_stat;
+            }   // end if
+            if (request->policy->macro_expansion_limit < XBuffer_getSize(xbuf)) {
+                SidfLogPermFail(request->policy, "expanded macro too long: limit=%u, length=%u",
+                                request->policy->macro_expansion_limit,
+                                (unsigned int) XBuffer_getSize(xbuf));
+                return SIDF_STAT_MALICIOUS_MACRO_EXPANSION;
+            }   // end if
+            break;
+        default:
+            abort();
+        }   // end switch
+    }   // end for
+    if (0 != XBuffer_status(xbuf)) {
+        SidfLogNoResource(request->policy);
+        return SIDF_STAT_NO_RESOURCE;
+    }   // end if
+    return SIDF_STAT_OK;
+}   // end function: SidfMacro_expand
+
+/**
+ * @return true if the compiled macro-string contains at least one macro-expand
+ *         other than "%%", "%_" and "%-", that is, its expansion depends on the request.
+ */
+bool
+SidfMacro_hasMacroExpand(const SidfMacroProgram *program)
+{
+    return 0 < program->macro_num;
+}   // end function: SidfMacro_hasMacroExpand
+
+/**
+ * @return true if the compiled macro-string contains "p" macro,
+ *         whose expansion needs the validated domain name of <ip> to be resolved in advance.
+ */
+bool
+SidfMacro_needsValidatedDomain(const SidfMacroProgram *program)
+{
+    for (unsigned int i = 0; i < program->op_num; ++i) {
+        if (SIDF_MACRO_OP_EXPAND == program->ops[i].type
+            && SIDF_MACRO_P_IPADDR_VALID_DOMAIN == program->ops[i].macro.letter) {
+            return true;
+        }   // end if
+    }   // end for
+    return false;
+}   // end function: SidfMacro_needsValidatedDomain
 
 /*
  * [RFC4408]
@@ -688,8 +745,8 @@ SidfMacro_skipbackTopLabel(const char *head, const char *tail, const char **prev
  * domain-spec      = *( macro-expand / macro-literal ) ( ( "." sub-domain [ "." ] ) / macro-expand )
  */
 SidfStat
-SidfMacro_parseDomainSpec(const SidfRequest *request, const char *head, const char *tail,
-                          const char **nextp, XBuffer *xbuf)
+SidfMacro_compileDomainSpec(const SidfRequest *request, const char *head, const char *tail,
+                            const char **nextp, SidfMacroProgram **program)
 // NOTE: macro-string 中の macro-literal がなんでも食っちゃう. domain-end を判別できないのが一番ツライ
 // NOTE: 少なくとも "/", "=", ":" は macro-string から抜くべき.
 // label = alphanum / "-" / "_" くらいでいいと思う
@@ -702,10 +759,15 @@ SidfMacro_parseDomainSpec(const SidfRequest *request, const char *head, const ch
 // Terms that do not contain any of "=", ":", or "/" are mechanisms, as
 // defined in Section 5.
 {
+    SidfMacroProgram *self = SidfMacroProgram_new(request, head, tail);
+    if (NULL == self) {
+        SidfLogNoResource(request->policy);
+        *nextp = head;
+        return SIDF_STAT_NO_RESOURCE;
+    }   // end if
+
     const char *p = head;
-    bool literal_terminated;
-    SidfStat parse_stat =
-        SidfMacro_parseMacroString(request, p, tail, false, &p, &literal_terminated, xbuf);
+    SidfStat parse_stat = SidfMacro_parseMacroString(request, p, tail, false, &p, self);
     if (SIDF_STAT_OK != parse_stat) {
         *nextp = head;
         return parse_stat;
@@ -715,7 +777,7 @@ SidfMacro_parseDomainSpec(const SidfRequest *request, const char *head, const ch
     // macro-string が macro-literal で終端している場合のみ,
     // domain-end が toplabel で終端しているか確認する.
     const char *q;
-    if (literal_terminated && 0 == SidfMacro_skipbackTopLabel(head, tail, &q)) {
+    if (self->literal_terminated && 0 == SidfMacro_skipbackTopLabel(head, tail, &q)) {
         SidfLogPermFail(request->policy,
                         "domain-spec does not terminate with domain-end: domain-spec=%.*s",
                         (int) (tail - head), head);
@@ -725,5 +787,6 @@ SidfMacro_parseDomainSpec(const SidfRequest *request, const char *head, const ch
     }   // end if
 
     *nextp = p;
+    *program = self;
     return SIDF_STAT_OK;
-}   // end function: SidfMacro_parseDomainSpec
+}   // end function: SidfMacro_compileDomainSpec
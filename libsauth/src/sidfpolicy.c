@@ -23,6 +23,7 @@ RCSID("$Id: sidfpolicy.c 1343 2011-07-30 19:21:50Z takahiko $");
 
 #define SIDF_POLICY_DEFAULT_MACRO_EXPANSION_LIMIT 10240
 #define SIDF_EVAL_MAX_DNSMECH 10
+#define SIDF_EVAL_MAX_VOID_LOOKUP 2
 #define SIDF_EVAL_MXMECH_MXRR_MAXNUM 10
 #define SIDF_EVAL_PTRMECH_PTRRR_MAXNUM 10
 #define SIDF_REQUEST_LABEL_MAX_LENGTH 63
@@ -45,6 +46,9 @@ SidfPolicy_new(void)
     self->local_policy_explanation = NULL;
     self->macro_expansion_limit = SIDF_POLICY_DEFAULT_MACRO_EXPANSION_LIMIT;
     self->max_dns_mech = SIDF_EVAL_MAX_DNSMECH;
+    self->max_void_lookup = SIDF_EVAL_MAX_VOID_LOOKUP;
+    self->max_dns_query = 0;
+    self->eval_timeout = 0;
     self->max_label_len = SIDF_REQUEST_LABEL_MAX_LENGTH;
     self->max_mxrr_per_mxmech = SIDF_EVAL_MXMECH_MXRR_MAXNUM;
     self->max_ptrrr_per_ptrmech = SIDF_EVAL_PTRMECH_PTRRR_MAXNUM;
@@ -109,6 +113,38 @@ SidfPolicy_setExplanationLookup(SidfPolicy *self, bool flag)
     self->lookup_exp = flag;
 }   // end function: SidfPolicy_setExplanationLogging
 
+/**
+ * set the limit of "void lookups" defined in RFC7208 4.6.4.
+ * @param limit the number of void lookups allowed per an evaluation, 0 for unlimited.
+ */
+void
+SidfPolicy_setMaxVoidLookup(SidfPolicy *self, unsigned int limit)
+{
+    self->max_void_lookup = limit;
+}   // end function: SidfPolicy_setMaxVoidLookup
+
+/**
+ * set the limit of DNS queries issued during an evaluation.
+ * exceeding the limit results in "PermError".
+ * @param limit the number of DNS queries allowed per an evaluation, 0 for unlimited.
+ */
+void
+SidfPolicy_setMaxDnsQuery(SidfPolicy *self, unsigned int limit)
+{
+    self->max_dns_query = limit;
+}   // end function: SidfPolicy_setMaxDnsQuery
+
+/**
+ * set the wall-clock time limit of an evaluation.
+ * no more DNS query is issued after the limit, and the evaluation results in "TempError".
+ * @param msec time limit in milliseconds, 0 for unlimited.
+ */
+void
+SidfPolicy_setEvalTimeout(SidfPolicy *self, unsigned int msec)
+{
+    self->eval_timeout = msec;
+}   // end function: SidfPolicy_setEvalTimeout
+
 /**
  * release SidfPolicy object
  * @param self SidfPolicy object to release
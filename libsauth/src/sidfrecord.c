@@ -29,6 +29,7 @@ RCSID("$Id: sidfrecord.c 1346 2011-08-10 02:15:43Z takahiko $");
 #include "keywordmap.h"
 #include "xskip.h"
 #include "inetdomain.h"
+#include "memarena.h"
 #include "sidf.h"
 #include "sidfmacro.h"
 #include "sidfrecord.h"
@@ -250,58 +251,95 @@ SidfRecord_parseQualifier(const char *head, const char *tail, const char **nextp
     return p->qualifier;
 }   // end function: SidfRecord_parseQualifier
 
+/*
+ * コンパイル済みの domain-spec を展開し, 展開結果と DNS クエリに使用するドメイン名を取得する.
+ * 展開結果はリクエストのアリーナに確保される.
+ */
+static SidfStat
+SidfTerm_expandDomainSpec(const SidfTerm *self, SidfRequest *request,
+                          const SidfMacroProgram *program, char **domain,
+                          const char **querydomain)
+{
+    XBuffer_reset(request->xbuf);
+    SidfStat expand_stat = SidfMacro_expand(request, program, request->xbuf);
+    if (SIDF_STAT_OK != expand_stat) {
+        return expand_stat;
+    }   // end if
+    *domain = MemArena_strdup(request->arena, XBuffer_getString(request->xbuf));
+    if (NULL == *domain) {
+        SidfLogNoResource(request->policy);
+        return SIDF_STAT_NO_RESOURCE;
+    }   // end if
+
+    /*
+     * 展開結果が253文字を越える場合はそれ以下に丸める.
+     * クエリを引く直前に丸める選択もあったが, domain-spec を引数にとる mechanism は
+     * 全てそれに基づいてクエリを引くので domain-spec を展開する時点で丸めることにした.
+     *
+     * [RFC4408] 8.1.
+     * When the result of macro expansion is used in a domain name query, if
+     * the expanded domain name exceeds 253 characters (the maximum length
+     * of a domain name), the left side is truncated to fit, by removing
+     * successive domain labels until the total length does not exceed 253
+     * characters.
+     */
+    *querydomain = *domain;
+    while (SIDF_MACRO_EXPANSION_MAX_LENGTH < strlen(*querydomain)) {
+        *querydomain = InetDomain_upward(*querydomain);
+        if (NULL == *querydomain) {
+            // サブドメインなしで 253 文字を突破していた場合
+            SidfLogPermFail(request->policy,
+                            "macro expansion exceeds limits of its length: domain=%s, %s=%s, expansion=%s",
+                            SidfRequest_getDomain(request),
+                            self->attr->is_mechanism ? "mech" : "mod", self->attr->name, *domain);
+            return SIDF_STAT_MALICIOUS_MACRO_EXPANSION;
+        }   // end if
+    }   // end while
+    if (*querydomain != *domain) {
+        SidfLogInfo(request->policy, "domain-spec truncated: domain=%s, %s=%s, domain-spec=%s",
+                    SidfRequest_getDomain(request), self->attr->is_mechanism ? "mech" : "mod",
+                    self->attr->name, *querydomain);
+    }   // end if
+    return SIDF_STAT_OK;
+}   // end function: SidfTerm_expandDomainSpec
+
+/**
+ * get <target-name> of the term, expanding its domain-spec if it contains macro-expand.
+ * @param target receives <target-name> truncated to fit in a DNS query,
+ *               or NULL if the term has no domain-spec, in which case <domain> should be used.
+ * @return SIDF_STAT_OK on success, SIDF_STAT_NO_RESOURCE if memory allocation failed,
+ *         otherwise the macro expansion failed.
+ */
+SidfStat
+SidfTerm_getTargetName(const SidfTerm *self, SidfRequest *request, const char **target)
+{
+    if (NULL == self->macro) {
+        *target = self->querydomain;
+        return SIDF_STAT_OK;
+    }   // end if
+    char *domain;
+    return SidfTerm_expandDomainSpec(self, request, self->macro, &domain, target);
+}   // end function: SidfTerm_getTargetName
+
 static SidfStat
 SidfRecord_parseDomainSpec(SidfRecord *self, const char *head, const char *tail, SidfTerm *term,
                            const char **nextp)
 {
-    XBuffer_reset(self->request->xbuf);
-    SidfStat parse_stat =
-        SidfMacro_parseDomainSpec(self->request, head, tail, nextp, self->request->xbuf);
-    if (SIDF_STAT_OK == parse_stat) {
-        SidfLogParseTrace("    domainspec: %.*s as [%s]\n",
-                          *nextp - head, head, XBuffer_getString(self->request->xbuf));
-        if (0 != XBuffer_status(self->request->xbuf)) {
-            SidfLogNoResource(self->request->policy);
-            return SIDF_STAT_NO_RESOURCE;
-        }   // end if
-        term->param.domain = XBuffer_dupString(self->request->xbuf);
-        if (NULL == term->param.domain) {
-            SidfLogNoResource(self->request->policy);
-            return SIDF_STAT_NO_RESOURCE;
-        }   // end if
+    SidfMacroProgram *program;
+    SidfStat parse_stat = SidfMacro_compileDomainSpec(self->request, head, tail, nextp, &program);
+    if (SIDF_STAT_OK != parse_stat) {
+        return parse_stat;
+    }   // end if
+    SidfLogParseTrace("    domainspec: %.*s\n", *nextp - head, head);
 
-        /*
-         * 展開結果が253文字を越える場合はそれ以下に丸める.
-         * クエリを引く直前に丸める選択もあったが, domain-spec を引数にとる mechanism は
-         * 全てそれに基づいてクエリを引くので domain-spec を解釈する時点で丸めることにした.
-         *
-         * [RFC4408] 8.1.
-         * When the result of macro expansion is used in a domain name query, if
-         * the expanded domain name exceeds 253 characters (the maximum length
-         * of a domain name), the left side is truncated to fit, by removing
-         * successive domain labels until the total length does not exceed 253
-         * characters.
-         */
-        term->querydomain = term->param.domain;
-        while (SIDF_MACRO_EXPANSION_MAX_LENGTH < strlen(term->querydomain)) {
-            term->querydomain = InetDomain_upward(term->querydomain);
-            if (NULL == term->querydomain) {
-                // サブドメインなしで 253 文字を突破していた場合
-                SidfLogPermFail
-                    (self->request->policy,
-                     "macro expansion exceeds limits of its length: domain=%s, domain-spec=[%.*s]",
-                     self->domain, (int) (*nextp - head), head);
-                return SIDF_STAT_MALICIOUS_MACRO_EXPANSION;
-            }   // end if
-        }   // end while
-        if (term->querydomain != term->param.domain) {
-            SidfLogInfo(self->request->policy,
-                        "domain-spec truncated: domain=%s, %s=%s, domain-spec=%s", self->domain,
-                        term->attr->is_mechanism ? "mech" : "mod", term->attr->name,
-                        term->querydomain);
-        }   // end if
+    if (SidfMacro_hasMacroExpand(program)) {
+        // the expansion depends on the state of evaluation, defer it until the term is evaluated
+        term->macro = program;
+        return SIDF_STAT_OK;
     }   // end if
-    return parse_stat;
+    // otherwise the domain-spec is a constant, so expand it only once here
+    return SidfTerm_expandDomainSpec(term, self->request, program, &(term->param.domain),
+                                     &(term->querydomain));
 }   // end function: SidfRecord_parseDomainSpec
 
 static SidfStat
@@ -515,43 +553,12 @@ SidfRecord_parseTermTargetName(SidfRecord *self, SidfTermParamType param_type, c
 }   // end function: SidfRecord_parseTermTargetName
 
 static SidfTerm *
-SidfTerm_new(SidfTermParamType param_type)
+SidfTerm_new(MemArena *arena)
 {
-    size_t contentsize;
-    switch (param_type) {
-    case SIDF_TERM_PARAM_NONE:
-        contentsize = 0;
-        break;
-    case SIDF_TERM_PARAM_DOMAINSPEC:
-        contentsize = 0;
-        break;
-    case SIDF_TERM_PARAM_IP4:
-        contentsize = sizeof(struct in_addr);
-        break;
-    case SIDF_TERM_PARAM_IP6:
-        contentsize = sizeof(struct in6_addr);
-        break;
-    default:
-        abort();
-    }   // end switch
-    SidfTerm *self = (SidfTerm *) malloc(sizeof(SidfTerm) + contentsize);
-    if (NULL == self) {
-        return NULL;
-    }   // end if
-    memset(self, 0, sizeof(SidfTerm) + contentsize);
-    return self;
+    // param is a union, so the term fits in sizeof(SidfTerm) whatever its parameter type is
+    return (SidfTerm *) MemArena_calloc(arena, sizeof(SidfTerm));
 }   // end function: SidfTerm_new
 
-static void
-SidfTerm_free(SidfTerm *self)
-{
-    assert(NULL != self);
-    if (SIDF_TERM_PARAM_DOMAINSPEC == self->attr->param_type && NULL != self->param.domain) {
-        free(self->param.domain);
-    }   // end if
-    free(self);
-}   // end function: SidfTerm_free
-
 static const SidfTermAttribute *
 SidfRecord_lookupMechanismAttribute(const char *head, const char *tail)
 {
@@ -595,7 +602,7 @@ static SidfStat
 SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
                      const SidfTermAttribute *termattr, SidfQualifier qualifier)
 {
-    SidfTerm *term = SidfTerm_new(termattr->param_type);
+    SidfTerm *term = SidfTerm_new(self->request->arena);
     if (NULL == term) {
         SidfLogNoResource(self->request->policy);
         return SIDF_STAT_NO_RESOURCE;
@@ -609,7 +616,6 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
                                    &param_tail);
     switch (cidr_stat) {
     case SIDF_STAT_RECORD_INVALID_CIDR_LENGTH:
-        SidfTerm_free(term);
         return cidr_stat;
     case SIDF_STAT_OK:
     case SIDF_STAT_RECORD_NOT_MATCH:   // cidr-length は全てオプショナルなので失敗してもパースは続行する.
@@ -627,7 +633,6 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
                 SidfRecord_parseTermTargetName(self, termattr->param_type, param_head, param_tail,
                                                term, &param_head);
             if (SIDF_STAT_OK != parse_stat) {
-                SidfTerm_free(term);
                 return parse_stat;
             }   // end if
         } else {
@@ -638,7 +643,6 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
                                 "parameter missing: domain=%s, %s=%s, near=[%.*s]", self->domain,
                                 termattr->is_mechanism ? "mech" : "mod", termattr->name,
                                 (int) (tail - head), head);
-                SidfTerm_free(term);
                 return SIDF_STAT_RECORD_SYNTAX_VIOLATION;
             }   // end if
         }   // end if
@@ -650,7 +654,6 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
         SidfLogPermFail(self->request->policy, "unparsable term: domain=%s, %s=%s, near=[%.*s]",
                         self->domain, termattr->is_mechanism ? "mech" : "mod", termattr->name,
                         (int) (tail - param_head), param_head);
-        SidfTerm_free(term);
         return SIDF_STAT_RECORD_SYNTAX_VIOLATION;
     }   // end if
 
@@ -658,11 +661,8 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
         SidfLogParseTrace("    type: mechanism\n");
         term->qualifier = (SIDF_QUALIFIER_NULL != qualifier) ? qualifier : SIDF_QUALIFIER_PLUS;
         SidfLogParseTrace("    qualifier: %d\n", qualifier);
-        if (0 > PtrArray_append(self->directives, term)) {
-            SidfLogNoResource(self->request->policy);
-            SidfTerm_free(term);
-            return SIDF_STAT_NO_RESOURCE;
-        }   // end if
+        // SidfRecord_new() has reserved a slot for every term in the record
+        self->directives[self->directive_num++] = term;
     } else {
         SidfLogParseTrace("    type: modifier\n");
         /*
@@ -687,7 +687,6 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
                 SidfLogPermFail(self->request->policy,
                                 "redirect modifier specified repeatedly: domain=%s, near=[%.*s]",
                                 self->domain, (int) (tail - head), head);
-                SidfTerm_free(term);
                 return SIDF_STAT_RECORD_SYNTAX_VIOLATION;
             }   // end if
             self->modifiers.rediect = term;
@@ -697,14 +696,12 @@ SidfRecord_buildTerm(SidfRecord *self, const char *head, const char *tail,
                 SidfLogPermFail(self->request->policy,
                                 "exp modifier specified repeatedly: domain=%s, near=[%.*s]",
                                 self->domain, (int) (tail - head), head);
-                SidfTerm_free(term);
                 return SIDF_STAT_RECORD_SYNTAX_VIOLATION;
             }   // end if
             self->modifiers.exp = term;
             break;
         case SIDF_TERM_MOD_UNKNOWN:
             // SidfRecord_parseTerms() 内で処理されるのでここは通らないハズ
-            SidfTerm_free(term);
             break;
         default:
             abort();
@@ -792,50 +789,24 @@ SidfRecord_parse(SidfRecord *self, const char *head, const char *tail)
 }   // end function: SidfRecord_parseTerms
 
 /**
- * release SidfRecord object
- * @param self SidfRecord object to release
- */
-void
-SidfRecord_free(SidfRecord *self)
-{
-    assert(NULL != self);
-    if (NULL != self->directives) {
-        PtrArray_free(self->directives);
-    }   // end if
-    if (NULL != self->modifiers.rediect) {
-        SidfTerm_free(self->modifiers.rediect);
-    }   // end if
-    if (NULL != self->modifiers.exp) {
-        SidfTerm_free(self->modifiers.exp);
-    }   // end if
-    free(self);
-}   // end function: SidfRecord_free
-
-/**
- * create SidfRecord object
+ * create SidfRecord object in the arena of the request
+ * @param max_terms the maximum number of terms the record may contain.
  * @return initialized SidfRecord object, or NULL if memory allocation failed.
  */
 static SidfRecord *
-SidfRecord_new(const SidfRequest *request)
+SidfRecord_new(SidfRequest *request, size_t max_terms)
 {
-    SidfRecord *self = (SidfRecord *) malloc(sizeof(SidfRecord));
+    SidfRecord *self = (SidfRecord *) MemArena_calloc(request->arena, sizeof(SidfRecord));
     if (NULL == self) {
-        SidfLogNoResource(request->policy);
         return NULL;
     }   // end if
-    memset(self, 0, sizeof(SidfRecord));
-    self->directives = PtrArray_new(0, (void (*)(void *)) SidfTerm_free);
+    self->directives =
+        (SidfTerm **) MemArena_alloc(request->arena, max_terms * sizeof(SidfTerm *));
     if (NULL == self->directives) {
-        SidfLogNoResource(request->policy);
-        goto cleanup;
+        return NULL;
     }   // end if
     self->request = request;
-
     return self;
-
-  cleanup:
-    SidfRecord_free(self);
-    return NULL;
 }   // end function: SidfRecord_new
 
 /**
@@ -844,7 +815,7 @@ SidfRecord_new(const SidfRequest *request)
  *              ここで指定するスコープとレコードの実際のスコープとの一貫性は呼び出し側が保証する必要がある.
  */
 SidfStat
-SidfRecord_build(const SidfRequest *request, SidfRecordScope scope, const char *record_head,
+SidfRecord_build(SidfRequest *request, SidfRecordScope scope, const char *record_head,
                  const char *record_tail, SidfRecord **recordobj)
 {
     assert(NULL != request);
@@ -856,7 +827,15 @@ SidfRecord_build(const SidfRequest *request, SidfRecordScope scope, const char *
                  NULL != request ? SidfRequest_getDomain(request) : "(null)",
                  (int) (record_tail - record_head), record_head);
 
-    SidfRecord *self = SidfRecord_new(request);
+    // terms are separated by SP, so the number of SPs gives the upper bound of the number of terms
+    size_t max_terms = 1;
+    for (const char *p = record_head; p < record_tail; ++p) {
+        if (' ' == *p) {
+            ++max_terms;
+        }   // end if
+    }   // end for
+
+    SidfRecord *self = SidfRecord_new(request, max_terms);
     if (NULL == self) {
         SidfLogNoResource(request->policy);
         return SIDF_STAT_NO_RESOURCE;
@@ -867,9 +846,8 @@ SidfRecord_build(const SidfRequest *request, SidfRecordScope scope, const char *
     SidfStat build_stat = SidfRecord_parse(self, record_head, record_tail);
     if (SIDF_STAT_OK == build_stat) {
         *recordobj = self;
-    } else {
-        SidfRecord_free(self);
     }   // end if
+    // on failure the half-built record is left in the arena, it is released with the request
     return build_stat;
 }   // end function: SidfRecord_build
 
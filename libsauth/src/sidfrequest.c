@@ -16,12 +16,11 @@
 #include "rcsid.h"
 
 
-#include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <arpa/nameser.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -43,6 +42,23 @@
 #include "sidfmacro.h"
 
 #define SIDF_REQUEST_DEFAULT_LOCALPART "postmaster"
+#define SIDF_REQUEST_DEFAULT_P_MACRO_VALUE "unknown"
+#define SIDF_REQUEST_DOMAIN_VALIDATION_PTRRR_MAXNUM 10
+
+/*
+ * check_host() result of an "include:" target, kept during a single evaluation
+ * so that the target reached again through another branch is not fetched and evaluated twice.
+ */
+typedef struct SidfIncludeMemo {
+    struct SidfIncludeMemo *next;
+    const char *domain;
+    SidfRecordScope scope;
+    SidfScore score;
+    // the number of DNS-involving mechanisms and void lookups the evaluation encountered,
+    // charged again on every reuse to keep the limit of RFC4408 10.1. and RFC7208 4.6.4.
+    unsigned int dns_mech_count;
+    unsigned int void_lookup_count;
+} SidfIncludeMemo;
 
 typedef struct SidfRawRecord {
     const char *record_head;
@@ -51,31 +67,111 @@ typedef struct SidfRawRecord {
     SidfRecordScope scope;
 } SidfRawRecord;
 
-int arecord_null = 1;
-int ipaddr_set = 0;
-
-static SidfScore SidfRequest_checkHost(SidfRequest *self, const char *domain);
+/*
+ * The evaluation runs as a state machine over a stack of frames instead of recursive calls,
+ * so that it can be suspended on every DNS query and resumed with the answer.
+ * The states marked "(wait)" are entered only with the answer to the query issued just before.
+ */
+typedef enum SidfFrameType {
+    SIDF_FRAME_CHECK_HOST,      // check_host() function
+    SIDF_FRAME_VALIDATED_DOMAIN,    // resolution of the validated domain name of <ip> for "p" macro
+} SidfFrameType;
+
+typedef enum SidfFrameState {
+    // SIDF_FRAME_CHECK_HOST
+    SIDF_STATE_FETCH_SPF,
+    SIDF_STATE_SPF_ANSWER,      // (wait)
+    SIDF_STATE_FETCH_TXT,
+    SIDF_STATE_TXT_ANSWER,      // (wait)
+    SIDF_STATE_NEXT_TERM,       // evaluate the directive at "term_index"
+    SIDF_STATE_TERM_TARGET,     // obtain <target-name> of the mechanism and issue the query
+    SIDF_STATE_MECH_A,          // (wait)
+    SIDF_STATE_MECH_MX,         // (wait)
+    SIDF_STATE_MECH_MX_NEXT,    // look up the address of the MX name at "name_index"
+    SIDF_STATE_MECH_MX_ADDR,    // (wait)
+    SIDF_STATE_MECH_PTR,        // (wait)
+    SIDF_STATE_MECH_PTR_NEXT,   // validate the PTR name at "name_index" or later
+    SIDF_STATE_MECH_PTR_ADDR,   // (wait)
+    SIDF_STATE_MECH_EXISTS,     // (wait)
+    SIDF_STATE_MECH_INCLUDE,    // check_host() called by "include:" returned
+    SIDF_STATE_MOD_REDIRECT_TARGET,
+    SIDF_STATE_MOD_REDIRECT,    // check_host() called by "redirect=" returned
+    SIDF_STATE_MOD_EXP_TARGET,
+    SIDF_STATE_MOD_EXP,         // (wait)
+    SIDF_STATE_EXPLANATION,     // expand "exp_text"
+    // SIDF_FRAME_VALIDATED_DOMAIN
+    SIDF_STATE_P_START,
+    SIDF_STATE_P_PTR,           // (wait)
+    SIDF_STATE_P_NEXT,          // validate the next candidate
+    SIDF_STATE_P_ADDR,          // (wait)
+} SidfFrameState;
+
+typedef struct SidfFrame {
+    struct SidfFrame *caller;
+    SidfFrameType type;
+    SidfFrameState state;
+    const char *domain;         // <domain> of check_host()
+    SidfRecord *record;         // the record (or local policy) whose directives are evaluated
+    unsigned int term_index;
+    const SidfTerm *term;       // the mechanism or modifier being evaluated
+    const char *target;         // <target-name> of "term"
+    const char **names;         // MX or PTR names to look up, allocated from the arena
+    size_t name_num;
+    size_t name_index;
+    unsigned int pass;          // SIDF_FRAME_VALIDATED_DOMAIN only
+    bool local_policy;          // true while evaluating the directives of local policy
+    SidfScore score;            // the result of check_host() decided before "exp=" is evaluated
+    SidfScore callee_score;     // the result of check_host() called by "include:" or "redirect="
+    unsigned int dns_mech_base; // counters when "include:" called check_host(), to memorize its cost
+    unsigned int void_lookup_base;
+    const char *exp_text;       // explanation string to expand
+    SidfMacroProgram *exp_program;
+} SidfFrame;
 
-FILE *dbg_fp = NULL;
 
-void debug_log(char *format, ...)
+/*
+ * @return milliseconds elapsed since the evaluation started.
+ */
+static unsigned int
+SidfRequest_getElapsedTime(const SidfRequest *self)
 {
-	va_list ap;
-
-	if(dbg_fp == NULL) return;
-
-	va_start(ap, format);
-	vfprintf(dbg_fp, format, ap);
-	va_end(ap);
-	fflush(dbg_fp);
-}
+    struct timeval now;
+    (void) gettimeofday(&now, NULL);
+    long elapsed = (now.tv_sec - self->eval_start.tv_sec) * 1000
+        + (now.tv_usec - self->eval_start.tv_usec) / 1000;
+    return 0 < elapsed ? (unsigned int) elapsed : 0;
+}   // end function: SidfRequest_getElapsedTime
 
-static void print_self_term(const SidfTerm *term)
+/*
+ * DNS クエリを発行する直前に呼び出し, SidfPolicy で設定されたクエリ数と評価時間の上限を確認する.
+ * 一度上限を越えた場合, その評価の中ではそれ以上クエリを発行しない.
+ * @return SIDF_SCORE_NULL if the query may be issued,
+ *         otherwise the score the evaluation should end with.
+ */
+static SidfScore
+SidfRequest_chargeDnsQuery(SidfRequest *self)
 {
-	if(term->param.addr4.s_addr != INADDR_ANY) ++ipaddr_set;
-	if(!ipaddr_set) debug_log("No IP4 detect\n");
-}
-
+    if (SIDF_SCORE_NULL != self->budget_score) {
+        return self->budget_score;
+    }   // end if
+    if (0 < self->policy->max_dns_query && self->policy->max_dns_query <= self->dns_query_count) {
+        SidfLogPermFail(self->policy, "over %u DNS queries issued: sender=%s, domain=%s",
+                        self->policy->max_dns_query, InetMailbox_getDomain(self->sender),
+                        NNSTR(SidfRequest_getDomain(self)));
+        self->budget_score = SIDF_SCORE_PERMERROR;
+        return self->budget_score;
+    }   // end if
+    if (0 < self->policy->eval_timeout
+        && self->policy->eval_timeout <= SidfRequest_getElapsedTime(self)) {
+        SidfLogDnsError(self->policy, "evaluation timed out: timeout=%ums, sender=%s, domain=%s",
+                        self->policy->eval_timeout, InetMailbox_getDomain(self->sender),
+                        NNSTR(SidfRequest_getDomain(self)));
+        self->budget_score = SIDF_SCORE_TEMPERROR;
+        return self->budget_score;
+    }   // end if
+    ++(self->dns_query_count);
+    return SIDF_SCORE_NULL;
+}   // end function: SidfRequest_chargeDnsQuery
 
 static unsigned int
 SidfRequest_getDepth(const SidfRequest *self)
@@ -83,10 +179,64 @@ SidfRequest_getDepth(const SidfRequest *self)
     return self->redirect_depth + self->include_depth;
 }   // end function: SidfRequest_getDepth
 
+static void
+SidfRequest_initTrace(const SidfRequest *self, SidfTraceEvent event, const char *domain,
+                      SidfTrace *trace)
+{
+    memset(trace, 0, sizeof(SidfTrace));
+    trace->event = event;
+    trace->depth = SidfRequest_getDepth(self);
+    trace->domain = domain;
+    trace->dns_mech_count = self->dns_mech_count;
+    trace->dns_query_count = self->dns_query_count;
+}   // end function: SidfRequest_initTrace
+
+/*
+ * トレースハンドラを呼び出す. ハンドラが設定されていない場合に何もしないよう,
+ * 呼び出し元で trace_handler が NULL でないことを確認すること.
+ */
+static void
+SidfRequest_trace(const SidfRequest *self, SidfTraceEvent event, const char *domain,
+                  const SidfTerm *term, SidfScore score)
+{
+    SidfTrace trace;
+    SidfRequest_initTrace(self, event, domain, &trace);
+    if (NULL != term) {
+        trace.term = term->attr->name;
+        trace.macro = (NULL != term->macro);
+    }   // end if
+    trace.score = score;
+    self->trace_handler(&trace, self->trace_arg);
+}   // end function: SidfRequest_trace
+
+/*
+ * DNS クエリの発行 (answer が NULL の場合) または応答の受け取りをトレースハンドラに通知する.
+ */
+static void
+SidfRequest_traceQuery(SidfRequest *self, const SidfAnswer *answer)
+{
+    SidfTrace trace;
+    SidfRequest_initTrace(self, NULL == answer ? SIDF_TRACE_DNS_QUERY : SIDF_TRACE_DNS_ANSWER,
+                          SidfRequest_getDomain(self), &trace);
+    trace.query = &(self->query);
+    if (NULL == answer) {
+        (void) gettimeofday(&(self->query_start), NULL);
+    } else {
+        struct timeval now;
+        (void) gettimeofday(&now, NULL);
+        long usec = (now.tv_sec - self->query_start.tv_sec) * 1000000L
+            + (now.tv_usec - self->query_start.tv_usec);
+        trace.answer = answer;
+        trace.latency = 0 < usec ? (unsigned int) usec : 0;
+    }   // end if
+    self->trace_handler(&trace, self->trace_arg);
+}   // end function: SidfRequest_traceQuery
+
 static SidfStat
 SidfRequest_pushDomain(SidfRequest *self, const char *domain)
 {
-    if (0 <= StrArray_append(self->domain, domain)) {
+    char *domain_copy = MemArena_strdup(self->arena, domain);
+    if (NULL != domain_copy && 0 <= PtrArray_append(self->domain, domain_copy)) {
         return SIDF_STAT_OK;
     } else {
         SidfLogNoResource(self->policy);
@@ -126,32 +276,6 @@ SidfRequest_getExplanation(const SidfRequest *self)
     return self->explanation;
 }   // end function: SidfRequest_getExplanation
 
-static SidfStat
-SidfRequest_setExplanation(SidfRequest *self, const char *domain, const char *exp_macro)
-{
-    const char *nextp;
-    XBuffer_reset(self->xbuf);
-    SidfStat parse_stat =
-        SidfMacro_parseExplainString(self, exp_macro, STRTAIL(exp_macro), &nextp, self->xbuf);
-    if (SIDF_STAT_OK == parse_stat && STRTAIL(exp_macro) == nextp) {
-        SidfLogDebug(self->policy, "explanation record: domain=%s, exp=%s", domain,
-                     XBuffer_getString(self->xbuf));
-        if (NULL != self->explanation) {
-            // "exp=" の評価条件が重複している証拠なのでバグ
-            SidfLogImplError(self->policy, "clean up existing explanation: exp=%s",
-                             self->explanation);
-            free(self->explanation);
-            self->explanation = NULL;
-        }   // end if
-        // ignoring memory allocation error
-        self->explanation = XBuffer_dupString(self->xbuf);
-    } else {
-        SidfLogInfo(self->policy, "explanation expansion failed: domain=%s, exp=%s", domain,
-                    exp_macro);
-    }   // end if
-    return parse_stat;
-}   // end function: SidfRequest_setExplanation
-
 /**
  * スコープに一致する唯一つのレコードを選択する.
  * @return スコープに一致するレコードが唯一つ見つかった場合, または見つからなかった場合は SIDF_SCORE_NULL,
@@ -177,80 +301,13 @@ SidfRequest_uniqueByScope(const SidfRawRecord *rawrecords, unsigned int recordnu
     return SIDF_SCORE_NULL;
 }   // end function: SidfRequest_uniqueByScope
 
-/**
- * @return 成功した場合は SIDF_SCORE_NULL, SPFレコード取得の際にエラーが発生した場合は SIDF_SCORE_NULL 以外.
+/*
+ * SPF RR, TXT RR のルックアップがレコードを返さなかった場合に, check_host() の結果にマップする.
  */
 static SidfScore
-SidfRequest_fetch(const SidfRequest *self, const char *domain, DnsTxtResponse **txtresp)
+SidfRequest_mapFetchDnsResponseToSidfScore(const SidfRequest *self, dns_stat_t resolv_stat)
 {
-    if (self->policy->lookup_spf_rr) {
-        dns_stat_t spfquery_stat = DnsResolver_lookupSpf(self->resolver, domain, txtresp);
-        switch (spfquery_stat) {
-        case DNS_STAT_NOERROR:
-            /*
-             * RFC4406, 4408 とも SPF RR が存在した場合は全ての TXT RR を破棄するので,
-             * SPF RR が見つかった場合は TXT RR をルックアップせずにこのまま戻せばよい.
-             * [RFC4406] 4.4.
-             * 1. If any records of type SPF are in the set, then all records of
-             *    type TXT are discarded.
-             * [RFC4408] 4.5.
-             * 2. If any records of type SPF are in the set, then all records of
-             *    type TXT are discarded.
-             */
-            return SIDF_SCORE_NULL;
-        case DNS_STAT_NODATA:  // NOERROR
-            // SPF RR がないので TXT RR にフォールバック
-            break;
-        case DNS_STAT_NXDOMAIN:
-            /*
-             * [RFC4406] 4.3.
-             * When performing the PRA version of the test, if the DNS query returns
-             * "non-existent domain" (RCODE 3), then check_host() exits immediately
-             * with the result "Fail".
-             * [RFC4408] 4.3.
-             * If the <domain> is malformed (label longer than 63 characters, zero-
-             * length label not at the end, etc.) or is not a fully qualified domain
-             * name, or if the DNS lookup returns "domain does not exist" (RCODE 3),
-             * check_host() immediately returns the result "None".
-             */
-            return (self->scope & SIDF_RECORD_SCOPE_SPF2_PRA)
-                ? SIDF_SCORE_HARDFAIL : SIDF_SCORE_NONE;
-        case DNS_STAT_FORMERR:
-        case DNS_STAT_SERVFAIL:
-        case DNS_STAT_NOTIMPL:
-        case DNS_STAT_REFUSED:
-        case DNS_STAT_YXDOMAIN:
-        case DNS_STAT_YXRRSET:
-        case DNS_STAT_NXRRSET:
-        case DNS_STAT_NOTAUTH:
-        case DNS_STAT_NOTZONE:
-        case DNS_STAT_RESERVED11:
-        case DNS_STAT_RESERVED12:
-        case DNS_STAT_RESERVED13:
-        case DNS_STAT_RESERVED14:
-        case DNS_STAT_RESERVED15:
-            /*
-             * [RFC4408] 4.4.
-             * If all DNS lookups that are made return a server failure (RCODE 2),
-             * or other error (RCODE other than 0 or 3), or time out, then
-             * check_host() exits immediately with the result "TempError".
-             */
-            return SIDF_SCORE_TEMPERROR;
-        case DNS_STAT_BADREQUEST:
-        case DNS_STAT_SYSTEM:
-        case DNS_STAT_RESOLVER:
-        case DNS_STAT_RESOLVER_INTERNAL:
-        case DNS_STAT_NOMEMORY:
-        default:
-            return SIDF_SCORE_SYSERROR;
-        }   // end switch
-    }   // end if
-
-    // TXT RR を引く
-    dns_stat_t txtquery_stat = DnsResolver_lookupTxt(self->resolver, domain, txtresp);
-    switch (txtquery_stat) {
-    case DNS_STAT_NOERROR:
-        return SIDF_SCORE_NULL;
+    switch (resolv_stat) {
     case DNS_STAT_NODATA:  // NOERROR
         /*
          * [RFC4406] 4.4.
@@ -297,6 +354,7 @@ SidfRequest_fetch(const SidfRequest *self, const char *domain, DnsTxtResponse **
          * check_host() exits immediately with the result "TempError".
          */
         return SIDF_SCORE_TEMPERROR;
+    case DNS_STAT_NOERROR:
     case DNS_STAT_BADREQUEST:
     case DNS_STAT_SYSTEM:
     case DNS_STAT_RESOLVER:
@@ -305,23 +363,25 @@ SidfRequest_fetch(const SidfRequest *self, const char *domain, DnsTxtResponse **
     default:
         return SIDF_SCORE_SYSERROR;
     }   // end switch
-}   // end function: SidfRequest_fetch
+}   // end function: SidfRequest_mapFetchDnsResponseToSidfScore
 
+/*
+ * SPF RR または TXT RR の応答から, スコープに一致するレコードを選択してパースする.
+ * @return 成功した場合は SIDF_SCORE_NULL, それ以外の場合は check_host() の結果.
+ */
 static SidfScore
-SidfRequest_lookupRecord(const SidfRequest *self, const char *domain, SidfRecord **record)
+SidfRequest_selectRecord(SidfRequest *self, const char *domain, const SidfAnswer *answer,
+                         SidfRecord **record)
 {
-    DnsTxtResponse *txtresp = NULL;
-    SidfScore fetch_score = SidfRequest_fetch(self, domain, &txtresp);
-    if (SIDF_SCORE_NULL != fetch_score) {
-        return fetch_score;
+    if (DNS_STAT_NOERROR != answer->stat) {
+        return SidfRequest_mapFetchDnsResponseToSidfScore(self, answer->stat);
     }   // end if
-    assert(NULL != txtresp);
 
     // 各レコードのスコープを調べる
-    SidfRawRecord rawrecords[DnsTxtResponse_size(txtresp)];
-    for (size_t n = 0; n < DnsTxtResponse_size(txtresp); ++n) {
-        rawrecords[n].record_head = DnsTxtResponse_data(txtresp, n);
-        rawrecords[n].record_tail = STRTAIL(DnsTxtResponse_data(txtresp, n));
+    SidfRawRecord rawrecords[MAX(answer->num, 1)];
+    for (size_t n = 0; n < answer->num; ++n) {
+        rawrecords[n].record_head = answer->rr.str[n];
+        rawrecords[n].record_tail = STRTAIL(answer->rr.str[n]);
         (void) SidfRecord_getSidfScope(self, rawrecords[n].record_head, rawrecords[n].record_tail,
                                        &(rawrecords[n].scope), &(rawrecords[n].scope_tail));
     }   // end for
@@ -330,27 +390,23 @@ SidfRequest_lookupRecord(const SidfRequest *self, const char *domain, SidfRecord
     const SidfRawRecord *selected = NULL;
     if (self->scope & (SIDF_RECORD_SCOPE_SPF2_MFROM | SIDF_RECORD_SCOPE_SPF2_PRA)) {
         SidfScore select_score =
-            SidfRequest_uniqueByScope(rawrecords, DnsTxtResponse_size(txtresp), self->scope,
-                                      &selected);
+            SidfRequest_uniqueByScope(rawrecords, answer->num, self->scope, &selected);
         if (SIDF_SCORE_NULL != select_score) {
             SidfLogPermFail
                 (self->policy, "multiple spf2 record found: domain=%s, spf2-mfrom=%s, spf2-pra=%s",
                  domain, self->scope & SIDF_RECORD_SCOPE_SPF2_MFROM ? "true" : "false",
                  self->scope & SIDF_RECORD_SCOPE_SPF2_PRA ? "true" : "false");
-            DnsTxtResponse_free(txtresp);
             return select_score;
         }   // end if
     }   // end if
 
     // SPFv1 なスコープを持つ場合, SIDF なスコープを持つが SIDF レコードが見つからなかった場合は SPF レコードを探す
     if (NULL == selected) {
-        SidfScore select_score = SidfRequest_uniqueByScope(rawrecords, DnsTxtResponse_size(txtresp),
-                                                           SIDF_RECORD_SCOPE_SPF1,
-                                                           &selected);
+        SidfScore select_score = SidfRequest_uniqueByScope(rawrecords, answer->num,
+                                                           SIDF_RECORD_SCOPE_SPF1, &selected);
         if (SIDF_SCORE_NULL != select_score) {
             SidfLogPermFail(self->policy, "multiple spf1 record found: domain=%s, spf1=%s", domain,
                             self->scope & SIDF_RECORD_SCOPE_SPF1 ? "true" : "false");
-            DnsTxtResponse_free(txtresp);
             return select_score;
         }   // end if
     }   // end if
@@ -362,30 +418,51 @@ SidfRequest_lookupRecord(const SidfRequest *self, const char *domain, SidfRecord
                      self->scope & SIDF_RECORD_SCOPE_SPF1 ? "true" : "false",
                      self->scope & SIDF_RECORD_SCOPE_SPF2_MFROM ? "true" : "false",
                      self->scope & SIDF_RECORD_SCOPE_SPF2_PRA ? "true" : "false");
-        DnsTxtResponse_free(txtresp);
         return SIDF_SCORE_NONE;
     }   // end if
 
     // スコープに一致する SPF/SIDF レコードが唯一つ存在した
-    // レコードのパース
+    // レコードのパース. レコードはアリーナにコピーされるので応答を参照し続けることはない.
     SidfStat build_stat =
         SidfRecord_build(self, selected->scope, selected->scope_tail, selected->record_tail,
                          record);
-    DnsTxtResponse_free(txtresp);
     switch (build_stat) {
     case SIDF_STAT_OK:
+        if (NULL != self->trace_handler) {
+            SidfTrace trace;
+            SidfRequest_initTrace(self, SIDF_TRACE_RECORD, domain, &trace);
+            trace.record = selected->record_head;
+            self->trace_handler(&trace, self->trace_arg);
+        }   // end if
         return SIDF_SCORE_NULL;
     case SIDF_STAT_NO_RESOURCE:
         return SIDF_SCORE_SYSERROR;
     default:
         return SIDF_SCORE_PERMERROR;
     }   // end switch
-}   // end function: SidfRequest_lookupRecord
+}   // end function: SidfRequest_selectRecord
 
-static const char *
-SidfRequest_getTargetName(const SidfRequest *self, const SidfTerm *term)
+/*
+ * @return SIDF_SCORE_NULL if <target-name> is successfully obtained,
+ *         otherwise the score the term should return.
+ */
+static SidfScore
+SidfRequest_getTargetName(SidfRequest *self, const SidfTerm *term, const char **target)
 {
-    return term->querydomain ? term->querydomain : SidfRequest_getDomain(self);
+    SidfStat expand_stat = SidfTerm_getTargetName(term, self, target);
+    // "p" macro is resolved again for another expansion
+    self->validated_domain = NULL;
+    switch (expand_stat) {
+    case SIDF_STAT_OK:
+        if (NULL == *target) {
+            *target = SidfRequest_getDomain(self);
+        }   // end if
+        return SIDF_SCORE_NULL;
+    case SIDF_STAT_NO_RESOURCE:
+        return SIDF_SCORE_SYSERROR;
+    default:
+        return SIDF_SCORE_PERMERROR;
+    }   // end switch
 }   // end function: SidfRequest_getTargetName
 
 /*
@@ -447,6 +524,34 @@ SidfRequest_incrementDnsMechCounter(SidfRequest *self)
     }   // end if
 }   // end function: SidfRequest_incrementDnsMechCounter
 
+/*
+ * メカニズムの評価で発行した DNS クエリの応答が "void lookup" だった場合に数える.
+ * [RFC7208] 4.6.4.
+ * there may be cases where it is useful to limit the number of "terms"
+ * for which DNS queries return either a positive answer (RCODE 0) with
+ * an answer count of 0, or a "Name Error" (RCODE 3) answer.  These are
+ * sometimes collectively referred to as "void lookups".  SPF
+ * implementations SHOULD limit "void lookups" to two.
+ * ...
+ * Exceeding the limit produces a "permerror" result.
+ */
+static SidfScore
+SidfRequest_countVoidLookup(SidfRequest *self, dns_stat_t resolv_stat)
+{
+    if (DNS_STAT_NXDOMAIN != resolv_stat && DNS_STAT_NODATA != resolv_stat) {
+        return SIDF_SCORE_NULL;
+    }   // end if
+    ++(self->void_lookup_count);
+    if (0 == self->policy->max_void_lookup
+        || self->void_lookup_count <= self->policy->max_void_lookup) {
+        return SIDF_SCORE_NULL;
+    }   // end if
+    SidfLogPermFail(self->policy, "over %u void lookups: sender=%s, domain=%s",
+                    self->policy->max_void_lookup, InetMailbox_getDomain(self->sender),
+                    SidfRequest_getDomain(self));
+    return SIDF_SCORE_PERMERROR;
+}   // end function: SidfRequest_countVoidLookup
+
 static SidfScore
 SidfRequest_checkMaliceOfCidrLength(const SidfRequest *self, char ip_version,
                                     unsigned short cidr_length, unsigned char malicious_cidr_length,
@@ -482,7 +587,6 @@ SidfRequest_checkMaliceOfCidrLength(const SidfRequest *self, char ip_version,
 static SidfScore
 SidfRequest_checkMaliceOfIp4CidrLength(const SidfRequest *self, const SidfTerm *term)
 {
-	print_self_term(term);
     return SidfRequest_checkMaliceOfCidrLength(self, '4', term->ip4cidr,
                                                self->policy->malicious_ip4_cidr_length,
                                                self->policy->action_on_malicious_ip4_cidr_length);
@@ -547,13 +651,90 @@ SidfRequest_evalMechAll(const SidfRequest *self, const SidfTerm *term)
         : self->policy->overwrite_all_directive_score;
 }   // end function: SidfRequest_evalMechAll
 
+static const SidfIncludeMemo *
+SidfRequest_lookupIncludeMemo(const SidfRequest *self, const char *domain)
+{
+    for (const SidfIncludeMemo *p = self->include_memo; NULL != p; p = p->next) {
+        if (self->scope == p->scope && InetDomain_equals(domain, p->domain)) {
+            return p;
+        }   // end if
+    }   // end for
+    return NULL;
+}   // end function: SidfRequest_lookupIncludeMemo
+
+static void
+SidfRequest_storeIncludeMemo(SidfRequest *self, const char *domain, SidfScore score,
+                             unsigned int dns_mech_count, unsigned int void_lookup_count)
+{
+    /*
+     * Errors are not memorized. They terminate the evaluation anyway except in local-policy,
+     * where the DNS mechanism counter is cleared and the same target may yield another result.
+     */
+    switch (score) {
+    case SIDF_SCORE_PASS:
+    case SIDF_SCORE_HARDFAIL:
+    case SIDF_SCORE_SOFTFAIL:
+    case SIDF_SCORE_NEUTRAL:
+    case SIDF_SCORE_NONE:
+        break;
+    default:
+        return;
+    }   // end switch
+
+    SidfIncludeMemo *memo =
+        (SidfIncludeMemo *) MemArena_alloc(self->arena, sizeof(SidfIncludeMemo));
+    if (NULL == memo) {
+        // the memo is just an optimization
+        return;
+    }   // end if
+    memo->domain = MemArena_strdup(self->arena, domain);
+    if (NULL == memo->domain) {
+        return;
+    }   // end if
+    memo->scope = self->scope;
+    memo->score = score;
+    memo->dns_mech_count = dns_mech_count;
+    memo->void_lookup_count = void_lookup_count;
+    memo->next = self->include_memo;
+    self->include_memo = memo;
+}   // end function: SidfRequest_storeIncludeMemo
+
+/*
+ * 同じ評価の中で既に評価したことのある "include:" の対象ドメインについて, その結果を再利用する.
+ * @return the reused result of check_host(), or SIDF_SCORE_PERMERROR if the reuse exceeds the limits.
+ */
+static SidfScore
+SidfRequest_reuseIncludeMemo(SidfRequest *self, const SidfIncludeMemo *memo, const char *domain)
+{
+    SidfLogDebug(self->policy,
+                 "include result reused: domain=%s, score=%s, dns_mech=%u, void_lookup=%u",
+                 domain, SidfEnum_lookupScoreByValue(memo->score), memo->dns_mech_count,
+                 memo->void_lookup_count);
+    if (NULL != self->trace_handler) {
+        SidfRequest_trace(self, SIDF_TRACE_INCLUDE_REUSED, domain, NULL, memo->score);
+    }   // end if
+    // charge the mechanisms as if the evaluation were actually performed
+    self->dns_mech_count += memo->dns_mech_count;
+    if (self->policy->max_dns_mech < self->dns_mech_count) {
+        SidfLogPermFail(self->policy,
+                        "over %d mechanisms with dns look up evaluated: sender=%s, domain=%s",
+                        self->policy->max_dns_mech, InetMailbox_getDomain(self->sender), domain);
+        return SIDF_SCORE_PERMERROR;
+    }   // end if
+    self->void_lookup_count += memo->void_lookup_count;
+    if (0 < self->policy->max_void_lookup
+        && self->policy->max_void_lookup < self->void_lookup_count) {
+        SidfLogPermFail(self->policy, "over %u void lookups: sender=%s, domain=%s",
+                        self->policy->max_void_lookup, InetMailbox_getDomain(self->sender),
+                        domain);
+        return SIDF_SCORE_PERMERROR;
+    }   // end if
+    return memo->score;
+}   // end function: SidfRequest_reuseIncludeMemo
+
 static SidfScore
-SidfRequest_evalMechInclude(SidfRequest *self, const SidfTerm *term)
+SidfRequest_mapIncludeScore(const SidfTerm *term, SidfScore eval_score)
 {
-    assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
-    ++(self->include_depth);
-    SidfScore eval_score = SidfRequest_checkHost(self, term->querydomain);
-    --(self->include_depth);
     /*
      * [RFC4408] 5.2.
      * Whether this mechanism matches, does not match, or throws an
@@ -597,252 +778,7 @@ SidfRequest_evalMechInclude(SidfRequest *self, const SidfTerm *term)
     default:
         abort();
     }   // end switch
-}   // end function: SidfRequest_evalMechInclude
-
-/*
- * "a" メカニズムと "mx" メカニズムの共通部分を実装する関数
- */
-static SidfScore
-SidfRequest_evalByALookup(SidfRequest *self, const char *domain, const SidfTerm *term)
-{
-    size_t n;
-    switch (self->sa_family) {
-    case AF_INET:;
-        DnsAResponse *resp4;
-        dns_stat_t query4_stat = DnsResolver_lookupA(self->resolver, domain, &resp4);
-        if (DNS_STAT_NOERROR != query4_stat) {
-            SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=a, domain=%s, err=%s", domain,
-                            DnsResolver_getErrorString(self->resolver));
-            return SidfRequest_mapMechDnsResponseToSidfScore(query4_stat);
-        }   // end if
-
-        for (n = 0; n < DnsAResponse_size(resp4); ++n) {
-			print_self_term(term);
-            if (0 == bitmemcmp(&(self->ipaddr.addr4), DnsAResponse_addr(resp4, n), term->ip4cidr)) {
-                DnsAResponse_free(resp4);
-                return SidfRequest_getScoreByQualifier(term->qualifier);
-            }   // end if
-        }   // end for
-        DnsAResponse_free(resp4);
-        break;
-
-    case AF_INET6:;
-        DnsAaaaResponse *resp6;
-        dns_stat_t query6_stat = DnsResolver_lookupAaaa(self->resolver, domain, &resp6);
-        if (DNS_STAT_NOERROR != query6_stat) {
-            SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=aaaa, domain=%s, err=%s",
-                            domain, DnsResolver_getErrorString(self->resolver));
-            return SidfRequest_mapMechDnsResponseToSidfScore(query6_stat);
-        }   // end if
-
-        for (n = 0; n < DnsAaaaResponse_size(resp6); ++n) {
-            if (0 ==
-                bitmemcmp(&(self->ipaddr.addr6), DnsAaaaResponse_addr(resp6, n), term->ip6cidr)) {
-                DnsAaaaResponse_free(resp6);
-                return SidfRequest_getScoreByQualifier(term->qualifier);
-            }   // end if
-        }   // end for
-        DnsAaaaResponse_free(resp6);
-        break;
-
-    default:
-        abort();
-    }   // end if
-
-    return SIDF_SCORE_NULL;
-}   // end function: SidfRequest_evalByALookup
-
-static SidfScore
-SidfRequest_evalMechA(SidfRequest *self, const SidfTerm *term)
-{
-	assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
-
-	SidfScore score = SidfRequest_checkMaliceOfDualCidrLength(self, term);
-    if (score != SIDF_SCORE_NULL) {
-        return score;
-    }   // end if
-
-	const char *domain = SidfRequest_getTargetName(self, term);
-	score = SidfRequest_evalByALookup(self, domain, term);
-	return score;
-}   // end function: SidfRequest_evalMechA
-
-static SidfScore
-SidfRequest_evalMechMx(SidfRequest *self, const SidfTerm *term)
-{
-    assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
-
-    SidfScore score = SidfRequest_checkMaliceOfDualCidrLength(self, term);
-    if (score != SIDF_SCORE_NULL) {
-        return score;
-    }   // end if
-
-    const char *domain = SidfRequest_getTargetName(self, term);
-    DnsMxResponse *respmx;
-    dns_stat_t mxquery_stat = DnsResolver_lookupMx(self->resolver, domain, &respmx);
-    if (DNS_STAT_NOERROR != mxquery_stat) {
-        SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=mx, domain=%s, err=%s", domain,
-                        DnsResolver_getErrorString(self->resolver));
-        return SidfRequest_mapMechDnsResponseToSidfScore(mxquery_stat);
-    }   // end if
-
-    /*
-     * [RFC4408] 5.4.
-     * check_host() first performs an MX lookup on the <target-name>.  Then
-     * it performs an address lookup on each MX name returned.  The <ip> is
-     * compared to each returned IP address.  To prevent Denial of Service
-     * (DoS) attacks, more than 10 MX names MUST NOT be looked up during the
-     * evaluation of an "mx" mechanism (see Section 10).  If any address
-     * matches, the mechanism matches.
-     */
-    for (size_t n = 0; n < MIN(DnsMxResponse_size(respmx), self->policy->max_mxrr_per_mxmech); ++n) {
-        SidfScore score = SidfRequest_evalByALookup(self, DnsMxResponse_domain(respmx, n), term);
-        if (SIDF_SCORE_NULL != score) {
-            DnsMxResponse_free(respmx);
-            return score;
-        }   // end if
-    }   // end for
-    DnsMxResponse_free(respmx);
-    return SIDF_SCORE_NULL;
-}   // end function: SidfRequest_evalMechMx
-
-/**
- * @param request SidfRequest object.
- * @param revdomain
- * @return 1 if IP addresses match.
- *         0 if IP addresses doesn't match.
- *         -1 if DNS error occurred.
- */
-static int
-SidfRequest_isValidatedDomainName4(const SidfRequest *self, const char *revdomain)
-{
-    DnsAResponse *resp;
-    dns_stat_t query_stat = DnsResolver_lookupA(self->resolver, revdomain, &resp);
-    if (DNS_STAT_NOERROR != query_stat) {
-        SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=a, domain=%s, err=%s",
-                        revdomain, DnsResolver_getErrorString(self->resolver));
-        return -1;
-    }   // end if
-    for (size_t m = 0; m < DnsAResponse_size(resp); ++m) {
-        if (0 == memcmp(DnsAResponse_addr(resp, m), &(self->ipaddr.addr4), NS_INADDRSZ)) {
-            DnsAResponse_free(resp);
-            return 1;
-        }   // end if
-    }   // end for
-    DnsAResponse_free(resp);
-    return 0;
-}   // end function: SidfRequest_isValidatedDomainName4
-
-/**
- * @param request SidfRequest object.
- * @param revdomain
- * @return 1 if IP addresses match.
- *         0 if IP addresses doesn't match.
- *         -1 if DNS error occurred.
- */
-static int
-SidfRequest_isValidatedDomainName6(const SidfRequest *self, const char *revdomain)
-{
-    DnsAaaaResponse *resp;
-    dns_stat_t query_stat = DnsResolver_lookupAaaa(self->resolver, revdomain, &resp);
-    if (DNS_STAT_NOERROR != query_stat) {
-        SidfLogDnsError(self->policy,
-                        "DNS lookup failure (ignored): rrtype=aaaa, domain=%s, err=%s", revdomain,
-                        DnsResolver_getErrorString(self->resolver));
-        return -1;
-    }   // end if
-    for (size_t m = 0; m < DnsAaaaResponse_size(resp); ++m) {
-        if (0 == memcmp(DnsAaaaResponse_addr(resp, m), &(self->ipaddr.addr6), NS_IN6ADDRSZ)) {
-            DnsAaaaResponse_free(resp);
-            return 1;
-        }   // end if
-    }   // end for
-    DnsAaaaResponse_free(resp);
-    return 0;
-}   // end function: SidfMacro_isValidatedDomainName6
-
-/*
- * @param request SidfRequest object.
- * @param revdomain
- * @return 1 if IP addresses match.
- *         0 if IP addresses doesn't match.
- *         -1 if DNS error occurred.
- */
-int
-SidfRequest_isValidatedDomainName(const SidfRequest *self, const char *revdomain)
-{
-    switch (self->sa_family) {
-    case AF_INET:
-        return SidfRequest_isValidatedDomainName4(self, revdomain);
-    case AF_INET6:
-        return SidfRequest_isValidatedDomainName6(self, revdomain);
-    default:
-        abort();
-    }   // end switch
-}   // end function: SidfRequest_isValidatedDomainName
-
-static SidfScore
-SidfRequest_evalMechPtr(SidfRequest *self, const SidfTerm *term)
-{
-    assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
-    const char *domain = SidfRequest_getTargetName(self, term);
-    DnsPtrResponse *respptr;
-    dns_stat_t ptrquery_stat =
-        DnsResolver_lookupPtr(self->resolver, self->sa_family, &(self->ipaddr), &respptr);
-    if (DNS_STAT_NOERROR != ptrquery_stat) {
-        /*
-         * [RFC4408] 5.5.
-         * If a DNS error occurs while doing the PTR RR lookup, then this
-         * mechanism fails to match.
-         */
-        char addrbuf[INET6_ADDRSTRLEN];
-        (void) inet_ntop(self->sa_family, &(self->ipaddr), addrbuf, sizeof(addrbuf));
-        SidfLogDnsError(self->policy, "DNS lookup failure (ignored): rrtype=ptr, ipaddr=%s, err=%s",
-                        addrbuf, DnsResolver_getErrorString(self->resolver));
-        return SIDF_SCORE_NULL;
-    }   // end if
-
-    /*
-     * [RFC4408] 5.5.
-     * First, the <ip>'s name is looked up using this procedure: perform a
-     * DNS reverse-mapping for <ip>, looking up the corresponding PTR record
-     * in "in-addr.arpa." if the address is an IPv4 one and in "ip6.arpa."
-     * if it is an IPv6 address.  For each record returned, validate the
-     * domain name by looking up its IP address.  To prevent DoS attacks,
-     * more than 10 PTR names MUST NOT be looked up during the evaluation of
-     * a "ptr" mechanism (see Section 10).  If <ip> is among the returned IP
-     * addresses, then that domain name is validated.
-     */
-    size_t resp_num_limit = MIN(DnsPtrResponse_size(respptr), self->policy->max_ptrrr_per_ptrmech);
-    for (size_t n = 0; n < resp_num_limit; ++n) {
-        // アルゴリズムをよく読むと validated domain が <target-name> で終わっているかどうかの判断を
-        // 先におこなった方が DNS ルックアップの回数が少なくて済む場合があることがわかる.
-        /*
-         * [RFC4408] 5.5.
-         * Check all validated domain names to see if they end in the
-         * <target-name> domain.  If any do, this mechanism matches.  If no
-         * validated domain name can be found, or if none of the validated
-         * domain names end in the <target-name>, this mechanism fails to match.
-         */
-        if (!InetDomain_isParent(domain, DnsPtrResponse_domain(respptr, n))) {
-            continue;
-        }   // end if
-
-        int validation_stat =
-            SidfRequest_isValidatedDomainName(self, DnsPtrResponse_domain(respptr, n));
-        /*
-         * [RFC4408] 5.5.
-         * If a DNS error occurs while doing an A RR
-         * lookup, then that domain name is skipped and the search continues.
-         */
-        if (1 == validation_stat) {
-            DnsPtrResponse_free(respptr);
-            return SidfRequest_getScoreByQualifier(term->qualifier);
-        }   // end if
-    }   // end for
-    DnsPtrResponse_free(respptr);
-    return SIDF_SCORE_NULL;
-}   // end function: SidfRequest_evalMechPtr
+}   // end function: SidfRequest_mapIncludeScore
 
 static SidfScore
 SidfRequest_evalMechIp4(const SidfRequest *self, const SidfTerm *term)
@@ -852,7 +788,6 @@ SidfRequest_evalMechIp4(const SidfRequest *self, const SidfTerm *term)
     if (score != SIDF_SCORE_NULL) {
         return score;
     }   // end if nnnn
-	print_self_term(term);
     return (AF_INET == self->sa_family
             && 0 == bitmemcmp(&(self->ipaddr.addr4), &(term->param.addr4), term->ip4cidr))
         ? SidfRequest_getScoreByQualifier(term->qualifier) : SIDF_SCORE_NULL;
@@ -872,332 +807,1157 @@ SidfRequest_evalMechIp6(const SidfRequest *self, const SidfTerm *term)
 }   // end function: SidfRequest_evalMechIp6
 
 static SidfScore
-SidfRequest_evalMechExists(SidfRequest *self, const SidfTerm *term)
-{
-    assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
-    DnsAResponse *resp;
-    dns_stat_t aquery_stat = DnsResolver_lookupA(self->resolver, term->querydomain, &resp);
-    if (DNS_STAT_NOERROR != aquery_stat) {
-        SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=a, domain=%s, err=%s",
-                        term->querydomain, DnsResolver_getErrorString(self->resolver));
-        return SidfRequest_mapMechDnsResponseToSidfScore(aquery_stat);
-    }   // end if
-
-    size_t num = DnsAResponse_size(resp);
-    DnsAResponse_free(resp);
-    return (0 < num) ? SidfRequest_getScoreByQualifier(term->qualifier) : SIDF_SCORE_NULL;
-}   // end function: SidfRequest_evalMechExists
-
-static SidfScore
-SidfRequest_evalModRedirect(SidfRequest *self, const SidfTerm *term)
+SidfRequest_checkDomain(const SidfRequest *self, const char *domain)
 {
-    assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
-    SidfScore incr_stat = SidfRequest_incrementDnsMechCounter(self);
-    if (SIDF_SCORE_NULL != incr_stat) {
-        return incr_stat;
-    }   // end if
-    ++(self->redirect_depth);
-    SidfScore eval_score = SidfRequest_checkHost(self, term->querydomain);
-    --(self->redirect_depth);
     /*
-     * [RFC4408] 6.1.
-     * The result of this new evaluation of check_host() is then considered
-     * the result of the current evaluation with the exception that if no
-     * SPF record is found, or if the target-name is malformed, the result
-     * is a "PermError" rather than "None".
-     */
-    return SIDF_SCORE_NONE == eval_score ? SIDF_SCORE_PERMERROR : eval_score;
-}   // end function: SidfRequest_evalModRedirect
+     * 引数 <domain> の検証
+     *
+     * [RFC4408] 4.3.
+     * If the <domain> is malformed (label longer than 63 characters, zero-
+     * length label not at the end, etc.) or is not a fully qualified domain
+     * name, or if the DNS lookup returns "domain does not exist" (RCODE 3),
+     * check_host() immediately returns the result "None".
+     */
+    const char *p = domain;
+    const char *domain_tail = STRTAIL(domain);
+    while (p < domain_tail) {
+        // 同時に文字種のチェック. 2821-Domain だとキツいのでちょっと緩め.
+        int label_len = XSkip_atextBlock(p, domain_tail, &p);
+        if (label_len <= 0) {
+            break;
+        } else if ((int) self->policy->max_label_len < label_len) {
+            SidfLogPermFail(self->policy,
+                            "label length of <domain> argument of check_host exceeds its limit: length=%u, limit=%u, domain(256)=%.256",
+                            (unsigned int) label_len, self->policy->max_label_len, domain);
+            return SIDF_SCORE_NONE;
+        }   // end if
+        if (0 >= XSkip_char(p, domain_tail, '.', &p)) {
+            /*
+             * <domain-spec> may end with '.' (dot, 0x2e)
+             * [RFC4408] 8.1.
+             * domain-spec      = macro-string domain-end
+             * domain-end       = ( "." toplabel [ "." ] ) / macro-expand
+             */
+            break;
+        }   // end if
+    }   // end while
+    if (domain_tail != p) {
+        SidfLogPermFail(self->policy,
+                        "<domain> argument of check_host doesn't match domain-name: domain=%s",
+                        domain);
+        return SIDF_SCORE_NONE;
+    }   // end if
 
-static SidfStat
-SidfRequest_evalModExplanation(SidfRequest *self, const SidfTerm *term)
+    // "include" mechanism や "redirect=" modifier でループを形成していないかチェックする.
+    if (0 <= StrArray_linearSearchIgnoreCase(self->domain, domain)) {
+        SidfLogPermFail(self->policy, "evaluation loop detected: domain=%s", domain);
+        return SIDF_SCORE_PERMERROR;
+    }   // end if
+
+    return SIDF_SCORE_NULL;
+}   // end function: SidfRequest_checkDomain
+
+static SidfFrame *
+SidfRequest_pushFrame(SidfRequest *self, SidfFrameType type, SidfFrameState state,
+                      const char *domain)
+{
+    SidfFrame *frame = self->free_frame;
+    if (NULL != frame) {
+        self->free_frame = frame->caller;
+    } else {
+        frame = (SidfFrame *) MemArena_alloc(self->arena, sizeof(SidfFrame));
+        if (NULL == frame) {
+            SidfLogNoResource(self->policy);
+            return NULL;
+        }   // end if
+    }   // end if
+    memset(frame, 0, sizeof(SidfFrame));
+    frame->caller = self->frame;
+    frame->type = type;
+    frame->state = state;
+    frame->domain = domain;
+    frame->score = SIDF_SCORE_NULL;
+    frame->callee_score = SIDF_SCORE_NULL;
+    self->frame = frame;
+    return frame;
+}   // end function: SidfRequest_pushFrame
+
+static void
+SidfRequest_popFrame(SidfRequest *self)
+{
+    SidfFrame *frame = self->frame;
+    self->frame = frame->caller;
+    frame->caller = self->free_frame;
+    self->free_frame = frame;
+}   // end function: SidfRequest_popFrame
+
+/*
+ * check_host() の結果を呼び出し元のフレームに渡す. 呼び出し元がなければ評価全体の結果とする.
+ */
+static void
+SidfRequest_deliverScore(SidfRequest *self, SidfScore score)
+{
+    if (NULL != self->frame) {
+        self->frame->callee_score = score;
+    } else {
+        self->result = score;
+    }   // end if
+}   // end function: SidfRequest_deliverScore
+
+/**
+ * The check_host() Function as defined in Section 4 of RFC4408.
+ * 呼び出し元のフレームは, check_host() から戻った時の状態に予め遷移しておくこと.
+ * @param self SidfRequest object.
+ * @param domain <domain> parameter of the check_host() function
+ */
+static void
+SidfRequest_callCheckHost(SidfRequest *self, const char *domain)
+{
+    // check <domain> parameter
+    SidfScore precond_score = SidfRequest_checkDomain(self, domain);
+    if (SIDF_SCORE_NULL != precond_score) {
+        SidfRequest_deliverScore(self, precond_score);
+        return;
+    }   // end if
+
+    // register <domain> parameter
+    SidfStat push_stat = SidfRequest_pushDomain(self, domain);
+    if (SIDF_STAT_OK != push_stat) {
+        SidfRequest_deliverScore(self, SIDF_SCORE_SYSERROR);
+        return;
+    }   // end if
+    if (NULL == SidfRequest_pushFrame(self, SIDF_FRAME_CHECK_HOST, SIDF_STATE_FETCH_SPF,
+                                      SidfRequest_getDomain(self))) {
+        SidfRequest_popDomain(self);
+        SidfRequest_deliverScore(self, SIDF_SCORE_SYSERROR);
+        return;
+    }   // end if
+    if (NULL != self->trace_handler) {
+        SidfRequest_trace(self, SIDF_TRACE_CHECK_HOST, domain, NULL, SIDF_SCORE_NULL);
+    }   // end if
+}   // end function: SidfRequest_callCheckHost
+
+static void
+SidfRequest_returnCheckHost(SidfRequest *self, SidfScore score)
+{
+    assert(SIDF_FRAME_CHECK_HOST == self->frame->type);
+    if (NULL != self->trace_handler) {
+        SidfRequest_trace(self, SIDF_TRACE_CHECK_HOST_RESULT, self->frame->domain, NULL, score);
+    }   // end if
+    SidfRequest_popDomain(self);
+    // the record itself stays in the arena until the next evaluation
+    SidfRequest_popFrame(self);
+    SidfRequest_deliverScore(self, score);
+}   // end function: SidfRequest_returnCheckHost
+
+/*
+ * DNS クエリを発行して評価を中断する. 応答は wait_state で受け取る.
+ * @return SIDF_SCORE_NULL if the query is issued,
+ *         otherwise the score the term should return since no more query is allowed.
+ */
+static SidfScore
+SidfRequest_query(SidfRequest *self, SidfQueryType type, const char *domain,
+                  SidfFrameState wait_state)
+{
+    SidfScore charge_score = SidfRequest_chargeDnsQuery(self);
+    if (SIDF_SCORE_NULL != charge_score) {
+        return charge_score;
+    }   // end if
+    self->query.type = type;
+    self->query.domain = domain;
+    self->query.sa_family = self->sa_family;
+    self->query.addr = &(self->ipaddr);
+    self->query_pending = true;
+    self->frame->state = wait_state;
+    if (NULL != self->trace_handler) {
+        SidfRequest_traceQuery(self, NULL);
+    }   // end if
+    return SIDF_SCORE_NULL;
+}   // end function: SidfRequest_query
+
+/*
+ * <ip> と同じアドレスファミリのアドレスをルックアップする.
+ */
+static SidfScore
+SidfRequest_queryAddr(SidfRequest *self, const char *domain, SidfFrameState wait_state)
+{
+    switch (self->sa_family) {
+    case AF_INET:
+        return SidfRequest_query(self, SIDF_QUERY_A, domain, wait_state);
+    case AF_INET6:
+        return SidfRequest_query(self, SIDF_QUERY_AAAA, domain, wait_state);
+    default:
+        abort();
+    }   // end switch
+}   // end function: SidfRequest_queryAddr
+
+static const SidfAnswer *
+SidfRequest_takeAnswer(SidfRequest *self)
+{
+    assert(NULL != self->answer);
+    const SidfAnswer *answer = self->answer;
+    self->answer = NULL;
+    return answer;
+}   // end function: SidfRequest_takeAnswer
+
+/*
+ * MX, PTR の応答に含まれる名前を, 続くクエリの間も参照できるようアリーナにコピーする.
+ * @return true on success, false if memory allocation failed.
+ */
+static bool
+SidfRequest_keepNames(SidfRequest *self, SidfFrame *frame, const SidfAnswer *answer,
+                      size_t limit)
+{
+    frame->name_num = MIN(answer->num, limit);
+    frame->name_index = 0;
+    frame->names =
+        (const char **) MemArena_alloc(self->arena, sizeof(const char *) * frame->name_num);
+    if (NULL == frame->names) {
+        goto cleanup;
+    }   // end if
+    for (size_t n = 0; n < frame->name_num; ++n) {
+        frame->names[n] = MemArena_strdup(self->arena, answer->rr.str[n]);
+        if (NULL == frame->names[n]) {
+            goto cleanup;
+        }   // end if
+    }   // end for
+    return true;
+
+  cleanup:
+    SidfLogNoResource(self->policy);
+    frame->name_num = 0;
+    return false;
+}   // end function: SidfRequest_keepNames
+
+/*
+ * "a" メカニズムと "mx" メカニズムの共通部分を実装する関数
+ * @param is_term_lookup true if the lookup is of the <target-name> of the term itself,
+ *                       which is subject to the limit of void lookups.
+ */
+static SidfScore
+SidfRequest_evalByAddrAnswer(SidfRequest *self, const char *domain, const SidfTerm *term,
+                             const SidfAnswer *answer, bool is_term_lookup)
+{
+    if (DNS_STAT_NOERROR != answer->stat) {
+        SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=%s, domain=%s, err=%s",
+                        AF_INET == self->sa_family ? "a" : "aaaa", domain, NNSTR(answer->error));
+        if (is_term_lookup) {
+            SidfScore void_score = SidfRequest_countVoidLookup(self, answer->stat);
+            if (SIDF_SCORE_NULL != void_score) {
+                return void_score;
+            }   // end if
+        }   // end if
+        return SidfRequest_mapMechDnsResponseToSidfScore(answer->stat);
+    }   // end if
+
+    size_t n;
+    switch (self->sa_family) {
+    case AF_INET:
+        for (n = 0; n < answer->num; ++n) {
+            if (0 == bitmemcmp(&(self->ipaddr.addr4), &(answer->rr.addr4[n]), term->ip4cidr)) {
+                return SidfRequest_getScoreByQualifier(term->qualifier);
+            }   // end if
+        }   // end for
+        break;
+
+    case AF_INET6:
+        for (n = 0; n < answer->num; ++n) {
+            if (0 == bitmemcmp(&(self->ipaddr.addr6), &(answer->rr.addr6[n]), term->ip6cidr)) {
+                return SidfRequest_getScoreByQualifier(term->qualifier);
+            }   // end if
+        }   // end for
+        break;
+
+    default:
+        abort();
+    }   // end switch
+
+    return SIDF_SCORE_NULL;
+}   // end function: SidfRequest_evalByAddrAnswer
+
+/**
+ * @param revdomain the name the address lookup is issued for.
+ * @param answer the answer to the address lookup.
+ * @return 1 if IP addresses match.
+ *         0 if IP addresses doesn't match.
+ *         -1 if DNS error occurred.
+ */
+static int
+SidfRequest_isValidatedDomainName(const SidfRequest *self, const char *revdomain,
+                                  const SidfAnswer *answer)
+{
+    size_t m;
+    switch (self->sa_family) {
+    case AF_INET:
+        if (DNS_STAT_NOERROR != answer->stat) {
+            SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=a, domain=%s, err=%s",
+                            revdomain, NNSTR(answer->error));
+            return -1;
+        }   // end if
+        for (m = 0; m < answer->num; ++m) {
+            if (0 == memcmp(&(answer->rr.addr4[m]), &(self->ipaddr.addr4), NS_INADDRSZ)) {
+                return 1;
+            }   // end if
+        }   // end for
+        return 0;
+
+    case AF_INET6:
+        if (DNS_STAT_NOERROR != answer->stat) {
+            SidfLogDnsError(self->policy,
+                            "DNS lookup failure (ignored): rrtype=aaaa, domain=%s, err=%s",
+                            revdomain, NNSTR(answer->error));
+            return -1;
+        }   // end if
+        for (m = 0; m < answer->num; ++m) {
+            if (0 == memcmp(&(answer->rr.addr6[m]), &(self->ipaddr.addr6), NS_IN6ADDRSZ)) {
+                return 1;
+            }   // end if
+        }   // end for
+        return 0;
+
+    default:
+        abort();
+    }   // end switch
+}   // end function: SidfRequest_isValidatedDomainName
+
+/*
+ * "p" マクロを含むマクロ文字列を展開する前に, <ip> の validated domain name を解決するフレームを積む.
+ * フレームから戻ると self->validated_domain がセットされ, 同じ状態から評価をやり直す.
+ * @return true if the frame is pushed and the expansion should wait for it to return.
+ */
+static bool
+SidfRequest_resolveValidatedDomain(SidfRequest *self, const SidfMacroProgram *program)
 {
+    if (NULL == program || NULL != self->validated_domain
+        || !SidfMacro_needsValidatedDomain(program)) {
+        return false;
+    }   // end if
+    // "p" macro expands to the default value if the frame cannot be allocated
+    return bool_cast(NULL != SidfRequest_pushFrame(self, SIDF_FRAME_VALIDATED_DOMAIN,
+                                                   SIDF_STATE_P_START,
+                                                   SidfRequest_getDomain(self)));
+}   // end function: SidfRequest_resolveValidatedDomain
+
+/*
+ * PTR レコードの名前から, 次に検証する validated domain name の候補を探す.
+ * TODO: stable sort をする代わりにリストを3回なめている. stable sort をする方がエレガント.
+ *
+ * [RFC4408] 8.1.
+ * If the <domain> is present in the list of validated domains, it
+ * SHOULD be used.  Otherwise, if a subdomain of the <domain> is
+ * present, it SHOULD be used.  Otherwise, any name from the list may be
+ * used.
+ * @return true if a candidate is found at frame->name_index, false if no more candidate.
+ */
+static bool
+SidfRequest_nextValidatedDomainCandidate(SidfFrame *frame)
+{
+    for (; frame->pass < 3; ++(frame->pass), frame->name_index = 0) {
+        for (; frame->name_index < frame->name_num; ++(frame->name_index)) {
+            const char *revdomain = frame->names[frame->name_index];
+            bool is_candidate;
+            switch (frame->pass) {
+            case 0:
+                is_candidate = InetDomain_equals(frame->domain, revdomain);
+                break;
+            case 1:
+                is_candidate = InetDomain_isParent(frame->domain, revdomain)
+                    && !InetDomain_equals(frame->domain, revdomain);
+                break;
+            default:
+                is_candidate = !InetDomain_isParent(frame->domain, revdomain);
+                break;
+            }   // end switch
+            if (is_candidate) {
+                return true;
+            }   // end if
+        }   // end for
+    }   // end for
+    return false;
+}   // end function: SidfRequest_nextValidatedDomainCandidate
+
+static void
+SidfRequest_returnValidatedDomain(SidfRequest *self, const char *revdomain)
+{
+    assert(SIDF_FRAME_VALIDATED_DOMAIN == self->frame->type);
     /*
-     * [RFC4408] 6.2.
-     * If <domain-spec> is empty, or there are any DNS processing errors
-     * (any RCODE other than 0), or if no records are returned, or if more
-     * than one record is returned, or if there are syntax errors in the
-     * explanation string, then proceed as if no exp modifier was given.
+     * [RFC4408] 8.1.
+     * If there are no validated domain names or if a DNS error occurs, the string "unknown" is used.
      */
+    self->validated_domain = PTROR(revdomain, SIDF_REQUEST_DEFAULT_P_MACRO_VALUE);
+    SidfRequest_popFrame(self);
+}   // end function: SidfRequest_returnValidatedDomain
 
-    assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
+/*
+ * [RFC4408] 8.1.
+ * The "p" macro expands to the validated domain name of <ip>.  The
+ * procedure for finding the validated domain name is defined in Section
+ * 5.5.
+ */
+static void
+SidfRequest_stepValidatedDomain(SidfRequest *self, SidfFrame *frame)
+{
+    switch (frame->state) {
+    case SIDF_STATE_P_START:
+        if (SIDF_SCORE_NULL != SidfRequest_query(self, SIDF_QUERY_PTR, NULL, SIDF_STATE_P_PTR)) {
+            SidfRequest_returnValidatedDomain(self, NULL);
+        }   // end if
+        break;
 
-    DnsTxtResponse *resp;
-    dns_stat_t txtquery_stat = DnsResolver_lookupTxt(self->resolver, term->querydomain, &resp);
-    if (DNS_STAT_NOERROR != txtquery_stat) {
-        SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=txt, domain=%s, err=%s",
-                        term->querydomain, DnsResolver_getErrorString(self->resolver));
-        return SIDF_STAT_OK;
+    case SIDF_STATE_P_PTR:;
+        const SidfAnswer *ptr_answer = SidfRequest_takeAnswer(self);
+        if (DNS_STAT_NOERROR != ptr_answer->stat
+            || !SidfRequest_keepNames(self, frame, ptr_answer,
+                                      SIDF_REQUEST_DOMAIN_VALIDATION_PTRRR_MAXNUM)) {
+            SidfRequest_returnValidatedDomain(self, NULL);
+            break;
+        }   // end if
+        frame->pass = 0;
+        frame->state = SIDF_STATE_P_NEXT;
+        break;
+
+    case SIDF_STATE_P_NEXT:
+        if (!SidfRequest_nextValidatedDomainCandidate(frame)
+            || SIDF_SCORE_NULL != SidfRequest_queryAddr(self, frame->names[frame->name_index],
+                                                        SIDF_STATE_P_ADDR)) {
+            SidfRequest_returnValidatedDomain(self, NULL);
+        }   // end if
+        break;
+
+    case SIDF_STATE_P_ADDR:
+        switch (SidfRequest_isValidatedDomainName(self, frame->names[frame->name_index],
+                                                  SidfRequest_takeAnswer(self))) {
+        case 1:
+            SidfRequest_returnValidatedDomain(self, frame->names[frame->name_index]);
+            break;
+        case 0:
+            ++(frame->name_index);
+            frame->state = SIDF_STATE_P_NEXT;
+            break;
+        case -1:
+            SidfRequest_returnValidatedDomain(self, NULL);
+            break;
+        default:
+            abort();
+        }   // end switch
+        break;
+
+    default:
+        abort();
+    }   // end switch
+}   // end function: SidfRequest_stepValidatedDomain
+
+/*
+ * frame->exp_text を展開して explanation としてセットする.
+ * @return true if the expansion waits for "p" macro to be resolved, false if done.
+ */
+static bool
+SidfRequest_setExplanation(SidfRequest *self, SidfFrame *frame)
+{
+    if (NULL == frame->exp_program) {
+        const char *nextp;
+        SidfStat parse_stat =
+            SidfMacro_compileExplainString(self, frame->exp_text, STRTAIL(frame->exp_text),
+                                           &nextp, &(frame->exp_program));
+        if (SIDF_STAT_OK != parse_stat || STRTAIL(frame->exp_text) != nextp) {
+            frame->exp_program = NULL;
+            SidfLogInfo(self->policy, "explanation expansion failed: domain=%s, exp=%s",
+                        frame->target, frame->exp_text);
+            return false;
+        }   // end if
+    }   // end if
+    if (SidfRequest_resolveValidatedDomain(self, frame->exp_program)) {
+        return true;
     }   // end if
 
-    if (1 != DnsTxtResponse_size(resp)) {
-        DnsTxtResponse_free(resp);
-        return SIDF_STAT_OK;
+    XBuffer_reset(self->xbuf);
+    SidfStat expand_stat = SidfMacro_expand(self, frame->exp_program, self->xbuf);
+    self->validated_domain = NULL;
+    if (SIDF_STAT_OK == expand_stat) {
+        SidfLogDebug(self->policy, "explanation record: domain=%s, exp=%s", frame->target,
+                     XBuffer_getString(self->xbuf));
+        if (NULL != self->explanation) {
+            // "exp=" の評価条件が重複している証拠なのでバグ
+            SidfLogImplError(self->policy, "clean up existing explanation: exp=%s",
+                             self->explanation);
+            free(self->explanation);
+            self->explanation = NULL;
+        }   // end if
+        // ignoring memory allocation error
+        self->explanation = XBuffer_dupString(self->xbuf);
+    } else {
+        SidfLogInfo(self->policy, "explanation expansion failed: domain=%s, exp=%s",
+                    frame->target, frame->exp_text);
     }   // end if
+    return false;
+}   // end function: SidfRequest_setExplanation
 
-    SidfStat expand_stat =
-        SidfRequest_setExplanation(self, term->querydomain, DnsTxtResponse_data(resp, 0));
-    DnsTxtResponse_free(resp);
-    return expand_stat;
-}   // end function: SidfRequest_evalModExplanation
+static void
+SidfRequest_redirectResult(SidfRequest *self, SidfFrame *frame, SidfScore score)
+{
+    if (NULL != self->trace_handler) {
+        SidfRequest_trace(self, SIDF_TRACE_TERM_RESULT, frame->domain, frame->term, score);
+    }   // end if
+    SidfRequest_returnCheckHost(self, score);
+}   // end function: SidfRequest_redirectResult
 
-static SidfScore
-SidfRequest_evalMechanism(SidfRequest *self, const SidfTerm *term)
+static void
+SidfRequest_returnDefaultScore(SidfRequest *self, SidfFrame *frame)
+{
+    // returns "Neutral" as default socre
+    SidfLogDebug(self->policy, "default score applied: domain=%s", frame->domain);
+    SidfRequest_returnCheckHost(self, SIDF_SCORE_NEUTRAL);
+}   // end function: SidfRequest_returnDefaultScore
+
+/*
+ * ローカルポリシーの directive を評価するよう, フレームを切り替える.
+ * @return true if the local policy is to be evaluated.
+ */
+static bool
+SidfRequest_beginLocalPolicy(SidfRequest *self, SidfFrame *frame)
+{
+    // 再帰評価 (include や redirect) の内側にいない場合のみ, ローカルポリシーの評価をおこなう
+    if (0 < SidfRequest_getDepth(self) || NULL == self->policy->local_policy
+        || self->local_policy_mode) {
+        return false;
+    }   // end if
+
+    SidfLogDebug(self->policy, "evaluating local policy: policy=%s", self->policy->local_policy);
+    // SPF/SIDF 評価過程で遭遇した DNS をひくメカニズムのカウンタをクリア
+    SidfRecord *local_policy_record = NULL;
+    SidfStat build_stat = SidfRecord_build(self, self->scope, self->policy->local_policy,
+                                           STRTAIL(self->policy->local_policy),
+                                           &local_policy_record);
+    if (SIDF_STAT_OK != build_stat) {
+        SidfLogConfigError(self->policy, "failed to build local policy record: policy=%s",
+                           self->policy->local_policy);
+        return false;
+    }   // end if
+    self->dns_mech_count = 0;   // 本物のレコード評価中に遭遇した DNS ルックアップを伴うメカニズムの数は忘れる
+    self->void_lookup_count = 0;    // void lookup の数も同様. クエリ数と評価時間の上限は評価全体に対して適用する.
+    self->local_policy_mode = true; // ローカルポリシー評価中に, さらにローカルポリシーを適用して無限ループに入らないようにフラグを立てる.
+    frame->local_policy = true;
+    frame->record = local_policy_record;
+    frame->term_index = 0;
+    frame->state = SIDF_STATE_NEXT_TERM;
+    return true;
+}   // end function: SidfRequest_beginLocalPolicy
+
+static void
+SidfRequest_endLocalPolicy(SidfRequest *self, SidfFrame *frame, SidfScore local_policy_score)
 {
+    self->local_policy_mode = false;
+    frame->local_policy = false;
+
+    switch (local_policy_score) {
+    case SIDF_SCORE_PERMERROR:
+    case SIDF_SCORE_TEMPERROR:
+        // ローカルポリシー評価中の temperror, permerror は無視する
+        SidfLogDebug(self->policy, "ignoring local policy score: score=%s",
+                     SidfEnum_lookupScoreByValue(local_policy_score));
+        SidfRequest_returnDefaultScore(self, frame);
+        return;
+    default:
+        SidfLogDebug(self->policy, "applying local policy score: score=%s",
+                     SidfEnum_lookupScoreByValue(local_policy_score));
+        break;
+    }   // end switch
+    if (SIDF_SCORE_NULL == local_policy_score) {
+        SidfRequest_returnDefaultScore(self, frame);
+        return;
+    }   // end if
+
+    // exp= を評価する条件は directive によってスコアが決定する場合とほぼ同じ.
+    // 違いは local_policy_explanation を使用する点.
+    frame->score = local_policy_score;
+    if (self->policy->lookup_exp && SIDF_SCORE_HARDFAIL == local_policy_score
+        && 0 == self->include_depth && NULL != self->policy->local_policy_explanation) {
+        // local policy 専用の explanation をセットする.
+        frame->target = frame->domain;
+        frame->exp_text = self->policy->local_policy_explanation;
+        frame->exp_program = NULL;
+        frame->state = SIDF_STATE_EXPLANATION;
+        return;
+    }   // end if
+    SidfRequest_returnCheckHost(self, local_policy_score);
+}   // end function: SidfRequest_endLocalPolicy
+
+/*
+ * レコード中の directive の評価を終えた後の処理.
+ * @param score directive によって決まったスコア, 全ての directive にマッチしなかった場合は SIDF_SCORE_NULL.
+ */
+static void
+SidfRequest_endDirectives(SidfRequest *self, SidfFrame *frame, SidfScore score)
+{
+    if (frame->local_policy) {
+        SidfRequest_endLocalPolicy(self, frame, score);
+        return;
+    }   // end if
+
+    if (SIDF_SCORE_NULL != score) {
+        /*
+         * SidfPolicy で "exp=" を取得するようの指定されている場合に "exp=" を取得する.
+         * ただし, 以下の点に注意する:
+         * - include メカニズム中の exp= は評価しない.
+         * - redirect 評価中に元のドメインの exp= は評価しない.
+         * [RFC4408] 6.2.
+         * Note: During recursion into an "include" mechanism, an exp= modifier
+         * from the <target-name> MUST NOT be used.  In contrast, when executing
+         * a "redirect" modifier, an exp= modifier from the original domain MUST
+         * NOT be used.
+         *
+         * <target-name> は メカニズムの引数で指定されている <domain-spec>,
+         * 指定されていない場合は check_host() 関数の <domain>.
+         * [RFC4408] 4.8.
+         * Several of these mechanisms and modifiers have a <domain-spec>
+         * section.  The <domain-spec> string is macro expanded (see Section 8).
+         * The resulting string is the common presentation form of a fully-
+         * qualified DNS name: a series of labels separated by periods.  This
+         * domain is called the <target-name> in the rest of this document.
+         */
+        frame->score = score;
+        if (self->policy->lookup_exp && SIDF_SCORE_HARDFAIL == score
+            && 0 == self->include_depth && NULL != frame->record->modifiers.exp) {
+            frame->term = frame->record->modifiers.exp;
+            assert(SIDF_TERM_PARAM_DOMAINSPEC == frame->term->attr->param_type);
+            frame->state = SIDF_STATE_MOD_EXP_TARGET;
+            return;
+        }   // end if
+        SidfRequest_returnCheckHost(self, score);
+        return;
+    }   // end if
+
+    /*
+     * レコード中の全てのメカニズムにマッチしなかった場合
+     * [RFC4408] 4.7.
+     * If none of the mechanisms match and there is no "redirect" modifier,
+     * then the check_host() returns a result of "Neutral", just as if
+     * "?all" were specified as the last directive.  If there is a
+     * "redirect" modifier, check_host() proceeds as defined in Section 6.1.
+     */
+
+    // "redirect=" modifier evaluation
+    if (NULL != frame->record->modifiers.rediect) {
+        frame->term = frame->record->modifiers.rediect;
+        assert(SIDF_TERM_PARAM_DOMAINSPEC == frame->term->attr->param_type);
+        SidfScore incr_stat = SidfRequest_incrementDnsMechCounter(self);
+        if (SIDF_SCORE_NULL != incr_stat) {
+            SidfRequest_redirectResult(self, frame, incr_stat);
+            return;
+        }   // end if
+        frame->state = SIDF_STATE_MOD_REDIRECT_TARGET;
+        return;
+    }   // end if
+
+    if (!SidfRequest_beginLocalPolicy(self, frame)) {
+        SidfRequest_returnDefaultScore(self, frame);
+    }   // end if
+}   // end function: SidfRequest_endDirectives
+
+static void
+SidfRequest_termResult(SidfRequest *self, SidfFrame *frame, SidfScore score)
+{
+    const SidfTerm *term = frame->term;
+    if (NULL != self->trace_handler) {
+        SidfRequest_trace(self, SIDF_TRACE_TERM_RESULT, frame->domain, term, score);
+    }   // end if
+    if (SIDF_SCORE_NULL != score) {
+        SidfLogDebug(self->policy, "mechanism match: domain=%s, mech%02u=%s, score=%s",
+                     frame->domain, frame->term_index, term->attr->name,
+                     SidfEnum_lookupScoreByValue(score));
+        SidfRequest_endDirectives(self, frame, score);
+        return;
+    }   // end if
+    SidfLogDebug(self->policy, "mechanism not match: domain=%s, mech_no=%u, mech=%s",
+                 frame->domain, frame->term_index, term->attr->name);
+    ++(frame->term_index);
+    frame->state = SIDF_STATE_NEXT_TERM;
+}   // end function: SidfRequest_termResult
+
+/*
+ * メカニズムの評価を始める. DNS ルックアップを伴わないメカニズムはここで評価を終える.
+ */
+static void
+SidfRequest_evalMechanism(SidfRequest *self, SidfFrame *frame)
+{
+    const SidfTerm *term = frame->term;
     assert(NULL != term);
     assert(NULL != term->attr);
 
     if (term->attr->involve_dnslookup) {
         SidfScore incr_stat = SidfRequest_incrementDnsMechCounter(self);
         if (SIDF_SCORE_NULL != incr_stat) {
-            return incr_stat;
+            SidfRequest_termResult(self, frame, incr_stat);
+            return;
         }   // end if
     }   // end if
 
+    SidfScore score;
     switch (term->attr->type) {
     case SIDF_TERM_MECH_ALL:
-        return SidfRequest_evalMechAll(self, term);
-    case SIDF_TERM_MECH_INCLUDE:
-        return SidfRequest_evalMechInclude(self, term);
+        SidfRequest_termResult(self, frame, SidfRequest_evalMechAll(self, term));
+        return;
+    case SIDF_TERM_MECH_IP4:
+        SidfRequest_termResult(self, frame, SidfRequest_evalMechIp4(self, term));
+        return;
+    case SIDF_TERM_MECH_IP6:
+        SidfRequest_termResult(self, frame, SidfRequest_evalMechIp6(self, term));
+        return;
     case SIDF_TERM_MECH_A:
-        return SidfRequest_evalMechA(self, term);
     case SIDF_TERM_MECH_MX:
-        return SidfRequest_evalMechMx(self, term);
+        assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
+        score = SidfRequest_checkMaliceOfDualCidrLength(self, term);
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_termResult(self, frame, score);
+            return;
+        }   // end if
+        frame->state = SIDF_STATE_TERM_TARGET;
+        return;
+    case SIDF_TERM_MECH_INCLUDE:
     case SIDF_TERM_MECH_PTR:
-        return SidfRequest_evalMechPtr(self, term);
-    case SIDF_TERM_MECH_IP4:
-        return SidfRequest_evalMechIp4(self, term);
-    case SIDF_TERM_MECH_IP6:
-        return SidfRequest_evalMechIp6(self, term);
     case SIDF_TERM_MECH_EXISTS:
-        return SidfRequest_evalMechExists(self, term);
+        assert(SIDF_TERM_PARAM_DOMAINSPEC == term->attr->param_type);
+        frame->state = SIDF_STATE_TERM_TARGET;
+        return;
     default:
         abort();
     }   // end switch
 }   // end function: SidfRequest_evalMechanism
 
-static SidfScore
-SidfRequest_checkDomain(const SidfRequest *self, const char *domain)
+/*
+ * <target-name> を得たメカニズムの評価を続ける.
+ * "include:" 以外は DNS クエリを発行して中断する.
+ */
+static void
+SidfRequest_evalMechTarget(SidfRequest *self, SidfFrame *frame)
 {
-    /*
-     * 引数 <domain> の検証
-     *
-     * [RFC4408] 4.3.
-     * If the <domain> is malformed (label longer than 63 characters, zero-
-     * length label not at the end, etc.) or is not a fully qualified domain
-     * name, or if the DNS lookup returns "domain does not exist" (RCODE 3),
-     * check_host() immediately returns the result "None".
-     */
-    const char *p = domain;
-    const char *domain_tail = STRTAIL(domain);
-    while (p < domain_tail) {
-        // 同時に文字種のチェック. 2821-Domain だとキツいのでちょっと緩め.
-        int label_len = XSkip_atextBlock(p, domain_tail, &p);
-        if (label_len <= 0) {
+    SidfScore score;
+    switch (frame->term->attr->type) {
+    case SIDF_TERM_MECH_A:
+        score = SidfRequest_queryAddr(self, frame->target, SIDF_STATE_MECH_A);
+        break;
+    case SIDF_TERM_MECH_MX:
+        score = SidfRequest_query(self, SIDF_QUERY_MX, frame->target, SIDF_STATE_MECH_MX);
+        break;
+    case SIDF_TERM_MECH_PTR:
+        score = SidfRequest_query(self, SIDF_QUERY_PTR, NULL, SIDF_STATE_MECH_PTR);
+        break;
+    case SIDF_TERM_MECH_EXISTS:
+        score = SidfRequest_query(self, SIDF_QUERY_A, frame->target, SIDF_STATE_MECH_EXISTS);
+        break;
+    case SIDF_TERM_MECH_INCLUDE:;
+        ++(self->include_depth);
+        // ループしている場合は check_host() に検出させるので, メモは参照しない
+        const SidfIncludeMemo *memo = NULL;
+        if (0 > StrArray_linearSearchIgnoreCase(self->domain, frame->target)) {
+            memo = SidfRequest_lookupIncludeMemo(self, frame->target);
+        }   // end if
+        if (NULL != memo) {
+            score = SidfRequest_reuseIncludeMemo(self, memo, frame->target);
+            --(self->include_depth);
+            SidfRequest_termResult(self, frame, SidfRequest_mapIncludeScore(frame->term, score));
+            return;
+        }   // end if
+        frame->dns_mech_base = self->dns_mech_count;
+        frame->void_lookup_base = self->void_lookup_count;
+        frame->state = SIDF_STATE_MECH_INCLUDE;
+        SidfRequest_callCheckHost(self, frame->target);
+        return;
+    default:
+        abort();
+    }   // end switch
+    if (SIDF_SCORE_NULL != score) {
+        // no more query is allowed
+        SidfRequest_termResult(self, frame, score);
+    }   // end if
+}   // end function: SidfRequest_evalMechTarget
+
+/*
+ * 取得したレコードの directive の評価を始める.
+ */
+static void
+SidfRequest_beginDirectives(SidfRequest *self, SidfFrame *frame, const SidfAnswer *answer)
+{
+    SidfScore score = SidfRequest_selectRecord(self, frame->domain, answer, &(frame->record));
+    if (SIDF_SCORE_NULL != score) {
+        SidfRequest_returnCheckHost(self, score);
+        return;
+    }   // end if
+    // mechanism evaluation
+    frame->term_index = 0;
+    frame->state = SIDF_STATE_NEXT_TERM;
+}   // end function: SidfRequest_beginDirectives
+
+static void
+SidfRequest_stepCheckHost(SidfRequest *self, SidfFrame *frame)
+{
+    SidfScore score;
+    const SidfAnswer *answer;
+    switch (frame->state) {
+    case SIDF_STATE_FETCH_SPF:
+        if (!self->policy->lookup_spf_rr) {
+            frame->state = SIDF_STATE_FETCH_TXT;
             break;
-        } else if ((int) self->policy->max_label_len < label_len) {
-            SidfLogPermFail(self->policy,
-                            "label length of <domain> argument of check_host exceeds its limit: length=%u, limit=%u, domain(256)=%.256",
-                            (unsigned int) label_len, self->policy->max_label_len, domain);
-            return SIDF_SCORE_NONE;
         }   // end if
-        if (0 >= XSkip_char(p, domain_tail, '.', &p)) {
+        score = SidfRequest_query(self, SIDF_QUERY_SPF, frame->domain, SIDF_STATE_SPF_ANSWER);
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_returnCheckHost(self, score);
+        }   // end if
+        break;
+
+    case SIDF_STATE_SPF_ANSWER:
+        answer = SidfRequest_takeAnswer(self);
+        if (DNS_STAT_NODATA == answer->stat) {
+            // SPF RR がないので TXT RR にフォールバック
+            frame->state = SIDF_STATE_FETCH_TXT;
+            break;
+        }   // end if
+        /*
+         * RFC4406, 4408 とも SPF RR が存在した場合は全ての TXT RR を破棄するので,
+         * SPF RR が見つかった場合は TXT RR をルックアップせずにこのまま評価すればよい.
+         * [RFC4406] 4.4.
+         * 1. If any records of type SPF are in the set, then all records of
+         *    type TXT are discarded.
+         * [RFC4408] 4.5.
+         * 2. If any records of type SPF are in the set, then all records of
+         *    type TXT are discarded.
+         */
+        SidfRequest_beginDirectives(self, frame, answer);
+        break;
+
+    case SIDF_STATE_TXT_ANSWER:
+        SidfRequest_beginDirectives(self, frame, SidfRequest_takeAnswer(self));
+        break;
+
+    case SIDF_STATE_FETCH_TXT:
+        score = SidfRequest_query(self, SIDF_QUERY_TXT, frame->domain, SIDF_STATE_TXT_ANSWER);
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_returnCheckHost(self, score);
+        }   // end if
+        break;
+
+    case SIDF_STATE_NEXT_TERM:
+        if (frame->record->directive_num <= frame->term_index) {
+            SidfRequest_endDirectives(self, frame, SIDF_SCORE_NULL);
+            break;
+        }   // end if
+        frame->term = frame->record->directives[frame->term_index];
+        SidfRequest_evalMechanism(self, frame);
+        break;
+
+    case SIDF_STATE_TERM_TARGET:
+        if (SidfRequest_resolveValidatedDomain(self, frame->term->macro)) {
+            break;
+        }   // end if
+        score = SidfRequest_getTargetName(self, frame->term, &(frame->target));
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_termResult(self, frame, score);
+            break;
+        }   // end if
+        SidfRequest_evalMechTarget(self, frame);
+        break;
+
+    case SIDF_STATE_MECH_A:
+        score = SidfRequest_evalByAddrAnswer(self, frame->target, frame->term,
+                                             SidfRequest_takeAnswer(self), true);
+        SidfRequest_termResult(self, frame, score);
+        break;
+
+    case SIDF_STATE_MECH_MX:
+        answer = SidfRequest_takeAnswer(self);
+        if (DNS_STAT_NOERROR != answer->stat) {
+            SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=mx, domain=%s, err=%s",
+                            frame->target, NNSTR(answer->error));
+            score = SidfRequest_countVoidLookup(self, answer->stat);
+            if (SIDF_SCORE_NULL == score) {
+                score = SidfRequest_mapMechDnsResponseToSidfScore(answer->stat);
+            }   // end if
+            SidfRequest_termResult(self, frame, score);
+            break;
+        }   // end if
+        /*
+         * [RFC4408] 5.4.
+         * check_host() first performs an MX lookup on the <target-name>.  Then
+         * it performs an address lookup on each MX name returned.  The <ip> is
+         * compared to each returned IP address.  To prevent Denial of Service
+         * (DoS) attacks, more than 10 MX names MUST NOT be looked up during the
+         * evaluation of an "mx" mechanism (see Section 10).  If any address
+         * matches, the mechanism matches.
+         */
+        if (!SidfRequest_keepNames(self, frame, answer, self->policy->max_mxrr_per_mxmech)) {
+            SidfRequest_termResult(self, frame, SIDF_SCORE_SYSERROR);
+            break;
+        }   // end if
+        frame->state = SIDF_STATE_MECH_MX_NEXT;
+        break;
+
+    case SIDF_STATE_MECH_MX_NEXT:
+        if (frame->name_num <= frame->name_index) {
+            SidfRequest_termResult(self, frame, SIDF_SCORE_NULL);
+            break;
+        }   // end if
+        score = SidfRequest_queryAddr(self, frame->names[frame->name_index],
+                                      SIDF_STATE_MECH_MX_ADDR);
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_termResult(self, frame, score);
+        }   // end if
+        break;
+
+    case SIDF_STATE_MECH_MX_ADDR:
+        score = SidfRequest_evalByAddrAnswer(self, frame->names[frame->name_index], frame->term,
+                                             SidfRequest_takeAnswer(self), false);
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_termResult(self, frame, score);
+            break;
+        }   // end if
+        ++(frame->name_index);
+        frame->state = SIDF_STATE_MECH_MX_NEXT;
+        break;
+
+    case SIDF_STATE_MECH_PTR:
+        answer = SidfRequest_takeAnswer(self);
+        if (DNS_STAT_NOERROR != answer->stat) {
             /*
-             * <domain-spec> may end with '.' (dot, 0x2e)
-             * [RFC4408] 8.1.
-             * domain-spec      = macro-string domain-end
-             * domain-end       = ( "." toplabel [ "." ] ) / macro-expand
+             * [RFC4408] 5.5.
+             * If a DNS error occurs while doing the PTR RR lookup, then this
+             * mechanism fails to match.
              */
+            char addrbuf[INET6_ADDRSTRLEN];
+            (void) inet_ntop(self->sa_family, &(self->ipaddr), addrbuf, sizeof(addrbuf));
+            SidfLogDnsError(self->policy,
+                            "DNS lookup failure (ignored): rrtype=ptr, ipaddr=%s, err=%s", addrbuf,
+                            NNSTR(answer->error));
+            SidfRequest_termResult(self, frame, SidfRequest_countVoidLookup(self, answer->stat));
+            break;
+        }   // end if
+        /*
+         * [RFC4408] 5.5.
+         * First, the <ip>'s name is looked up using this procedure: perform a
+         * DNS reverse-mapping for <ip>, looking up the corresponding PTR record
+         * in "in-addr.arpa." if the address is an IPv4 one and in "ip6.arpa."
+         * if it is an IPv6 address.  For each record returned, validate the
+         * domain name by looking up its IP address.  To prevent DoS attacks,
+         * more than 10 PTR names MUST NOT be looked up during the evaluation of
+         * a "ptr" mechanism (see Section 10).  If <ip> is among the returned IP
+         * addresses, then that domain name is validated.
+         */
+        if (!SidfRequest_keepNames(self, frame, answer, self->policy->max_ptrrr_per_ptrmech)) {
+            SidfRequest_termResult(self, frame, SIDF_SCORE_SYSERROR);
+            break;
+        }   // end if
+        frame->state = SIDF_STATE_MECH_PTR_NEXT;
+        break;
+
+    case SIDF_STATE_MECH_PTR_NEXT:
+        // アルゴリズムをよく読むと validated domain が <target-name> で終わっているかどうかの判断を
+        // 先におこなった方が DNS ルックアップの回数が少なくて済む場合があることがわかる.
+        /*
+         * [RFC4408] 5.5.
+         * Check all validated domain names to see if they end in the
+         * <target-name> domain.  If any do, this mechanism matches.  If no
+         * validated domain name can be found, or if none of the validated
+         * domain names end in the <target-name>, this mechanism fails to match.
+         */
+        while (frame->name_index < frame->name_num
+               && !InetDomain_isParent(frame->target, frame->names[frame->name_index])) {
+            ++(frame->name_index);
+        }   // end while
+        if (frame->name_num <= frame->name_index) {
+            SidfRequest_termResult(self, frame, SIDF_SCORE_NULL);
             break;
         }   // end if
-    }   // end while
-    if (domain_tail != p) {
-        SidfLogPermFail(self->policy,
-                        "<domain> argument of check_host doesn't match domain-name: domain=%s",
-                        domain);
-        return SIDF_SCORE_NONE;
-    }   // end if
-
-    // "include" mechanism や "redirect=" modifier でループを形成していないかチェックする.
-    if (0 <= StrArray_linearSearchIgnoreCase(self->domain, domain)) {
-        SidfLogPermFail(self->policy, "evaluation loop detected: domain=%s", domain);
-        return SIDF_SCORE_PERMERROR;
-    }   // end if
-
-    return SIDF_SCORE_NULL;
-}   // end function: SidfRequest_checkDomain
-
-static SidfScore
-SidfRequest_evalDirectives(SidfRequest *self, const PtrArray *directives)
-{
-    const char *domain = SidfRequest_getDomain(self);
-    unsigned int directive_num = PtrArray_getCount(directives);
-    for (unsigned int i = 0; i < directive_num; ++i) {
-        SidfTerm *term = PtrArray_get(directives, i);
-        SidfScore eval_score = SidfRequest_evalMechanism(self, term);
-        if (SIDF_SCORE_NULL != eval_score) {
-            SidfLogDebug(self->policy, "mechanism match: domain=%s, mech%02u=%s, score=%s",
-                         domain, i, term->attr->name, SidfEnum_lookupScoreByValue(eval_score));
-            return eval_score;
+        score = SidfRequest_queryAddr(self, frame->names[frame->name_index],
+                                      SIDF_STATE_MECH_PTR_ADDR);
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_termResult(self, frame, score);
         }   // end if
-        SidfLogDebug(self->policy, "mechanism not match: domain=%s, mech_no=%u, mech=%s",
-                     domain, i, term->attr->name);
-    }   // end if
-    return SIDF_SCORE_NULL;
-}   // end function: SidfRequest_evalDirectives
-
-static SidfScore
-SidfRequest_evalLocalPolicy(SidfRequest *self)
-{
-    // 再帰評価 (include や redirect) の内側にいない場合のみ, ローカルポリシーの評価をおこなう
-    if (0 < SidfRequest_getDepth(self) || NULL == self->policy->local_policy
-        || self->local_policy_mode) {
-        return SIDF_SCORE_NULL;
-    }   // end if
+        break;
 
-    SidfLogDebug(self->policy, "evaluating local policy: policy=%s", self->policy->local_policy);
-    // SPF/SIDF 評価過程で遭遇した DNS をひくメカニズムのカウンタをクリア
-    SidfRecord *local_policy_record = NULL;
-    SidfStat build_stat = SidfRecord_build(self, self->scope, self->policy->local_policy,
-                                           STRTAIL(self->policy->local_policy),
-                                           &local_policy_record);
-    if (SIDF_STAT_OK != build_stat) {
-        SidfLogConfigError(self->policy, "failed to build local policy record: policy=%s",
-                           self->policy->local_policy);
-        return SIDF_SCORE_NULL;
-    }   // end if
-    self->dns_mech_count = 0;   // 本物のレコード評価中に遭遇した DNS ルックアップを伴うメカニズムの数は忘れる
-    self->local_policy_mode = true; // ローカルポリシー評価中に, さらにローカルポリシーを適用して無限ループに入らないようにフラグを立てる.
-    SidfScore local_policy_score =
-        SidfRequest_evalDirectives(self, local_policy_record->directives);
-    self->local_policy_mode = false;
-    SidfRecord_free(local_policy_record);
+    case SIDF_STATE_MECH_PTR_ADDR:
+        /*
+         * [RFC4408] 5.5.
+         * If a DNS error occurs while doing an A RR
+         * lookup, then that domain name is skipped and the search continues.
+         */
+        if (1 == SidfRequest_isValidatedDomainName(self, frame->names[frame->name_index],
+                                                   SidfRequest_takeAnswer(self))) {
+            SidfRequest_termResult(self, frame,
+                                   SidfRequest_getScoreByQualifier(frame->term->qualifier));
+            break;
+        }   // end if
+        ++(frame->name_index);
+        frame->state = SIDF_STATE_MECH_PTR_NEXT;
+        break;
 
-    switch (local_policy_score) {
-    case SIDF_SCORE_PERMERROR:
-    case SIDF_SCORE_TEMPERROR:
-        // ローカルポリシー評価中の temperror, permerror は無視する
-        SidfLogDebug(self->policy, "ignoring local policy score: score=%s",
-                     SidfEnum_lookupScoreByValue(local_policy_score));
-        return SIDF_SCORE_NULL;
-    default:
-        SidfLogDebug(self->policy, "applying local policy score: score=%s",
-                     SidfEnum_lookupScoreByValue(local_policy_score));
-        return local_policy_score;
-    }   // end switch
-}   // end function: SidfRequest_evalLocalPolicy
+    case SIDF_STATE_MECH_EXISTS:
+        answer = SidfRequest_takeAnswer(self);
+        if (DNS_STAT_NOERROR != answer->stat) {
+            SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=a, domain=%s, err=%s",
+                            frame->target, NNSTR(answer->error));
+            score = SidfRequest_countVoidLookup(self, answer->stat);
+            if (SIDF_SCORE_NULL == score) {
+                score = SidfRequest_mapMechDnsResponseToSidfScore(answer->stat);
+            }   // end if
+            SidfRequest_termResult(self, frame, score);
+            break;
+        }   // end if
+        SidfRequest_termResult(self, frame, (0 < answer->num)
+                               ? SidfRequest_getScoreByQualifier(frame->term->qualifier)
+                               : SIDF_SCORE_NULL);
+        break;
 
-/**
- * The check_host() Function as defined in Section 4 of RFC4408
- * @param self SidfRequest object.
- * @param domain <domain> parameter of the check_host() function
- */
-static SidfScore
-SidfRequest_checkHost(SidfRequest *self, const char *domain)
-{
-    // check <domain> parameter
-    SidfScore precond_score = SidfRequest_checkDomain(self, domain);
-    if (SIDF_SCORE_NULL != precond_score) {
-        return precond_score;
-    }   // end if
+    case SIDF_STATE_MECH_INCLUDE:
+        --(self->include_depth);
+        SidfRequest_storeIncludeMemo(self, frame->target, frame->callee_score,
+                                     self->dns_mech_count - frame->dns_mech_base,
+                                     self->void_lookup_count - frame->void_lookup_base);
+        SidfRequest_termResult(self, frame,
+                               SidfRequest_mapIncludeScore(frame->term, frame->callee_score));
+        break;
 
-    // register <domain> parameter
-    SidfStat push_stat = SidfRequest_pushDomain(self, domain);
-    if (SIDF_STAT_OK != push_stat) {
-        return SIDF_SCORE_SYSERROR;
-    }   // end if
+    case SIDF_STATE_MOD_REDIRECT_TARGET:
+        if (SidfRequest_resolveValidatedDomain(self, frame->term->macro)) {
+            break;
+        }   // end if
+        score = SidfRequest_getTargetName(self, frame->term, &(frame->target));
+        if (SIDF_SCORE_NULL != score) {
+            SidfRequest_redirectResult(self, frame, score);
+            break;
+        }   // end if
+        SidfLogDebug(self->policy, "redirect: from=%s, to=%s", frame->domain, frame->target);
+        ++(self->redirect_depth);
+        frame->state = SIDF_STATE_MOD_REDIRECT;
+        SidfRequest_callCheckHost(self, frame->target);
+        break;
 
-    SidfRecord *record = NULL;
-    SidfScore lookup_score = SidfRequest_lookupRecord(self, SidfRequest_getDomain(self), &record);
-    if (SIDF_SCORE_NULL != lookup_score) {
-        SidfRequest_popDomain(self);
-        return lookup_score;
-    }   // end if
+    case SIDF_STATE_MOD_REDIRECT:
+        --(self->redirect_depth);
+        /*
+         * [RFC4408] 6.1.
+         * The result of this new evaluation of check_host() is then considered
+         * the result of the current evaluation with the exception that if no
+         * SPF record is found, or if the target-name is malformed, the result
+         * is a "PermError" rather than "None".
+         */
+        SidfRequest_redirectResult(self, frame, SIDF_SCORE_NONE == frame->callee_score
+                                   ? SIDF_SCORE_PERMERROR : frame->callee_score);
+        break;
 
-    // mechanism evaluation
-    SidfScore eval_score = SidfRequest_evalDirectives(self, record->directives);
-    if (SIDF_SCORE_NULL != eval_score) {
+    case SIDF_STATE_MOD_EXP_TARGET:
         /*
-         * SidfPolicy で "exp=" を取得するようの指定されている場合に "exp=" を取得する.
-         * ただし, 以下の点に注意する:
-         * - include メカニズム中の exp= は評価しない.
-         * - redirect 評価中に元のドメインの exp= は評価しない.
          * [RFC4408] 6.2.
-         * Note: During recursion into an "include" mechanism, an exp= modifier
-         * from the <target-name> MUST NOT be used.  In contrast, when executing
-         * a "redirect" modifier, an exp= modifier from the original domain MUST
-         * NOT be used.
-         *
-         * <target-name> は メカニズムの引数で指定されている <domain-spec>,
-         * 指定されていない場合は check_host() 関数の <domain>.
-         * [RFC4408] 4.8.
-         * Several of these mechanisms and modifiers have a <domain-spec>
-         * section.  The <domain-spec> string is macro expanded (see Section 8).
-         * The resulting string is the common presentation form of a fully-
-         * qualified DNS name: a series of labels separated by periods.  This
-         * domain is called the <target-name> in the rest of this document.
+         * If <domain-spec> is empty, or there are any DNS processing errors
+         * (any RCODE other than 0), or if no records are returned, or if more
+         * than one record is returned, or if there are syntax errors in the
+         * explanation string, then proceed as if no exp modifier was given.
          */
-        if (self->policy->lookup_exp && SIDF_SCORE_HARDFAIL == eval_score
-            && 0 == self->include_depth && NULL != record->modifiers.exp) {
-            (void) SidfRequest_evalModExplanation(self, record->modifiers.exp);
+        if (SidfRequest_resolveValidatedDomain(self, frame->term->macro)) {
+            break;
         }   // end if
-        goto finally;
-    }   // end if
+        if (SIDF_SCORE_NULL != SidfRequest_getTargetName(self, frame->term, &(frame->target))
+            || SIDF_SCORE_NULL != SidfRequest_query(self, SIDF_QUERY_TXT, frame->target,
+                                                    SIDF_STATE_MOD_EXP)) {
+            SidfRequest_returnCheckHost(self, frame->score);
+        }   // end if
+        break;
 
-    /*
-     * レコード中の全てのメカニズムにマッチしなかった場合
-     * [RFC4408] 4.7.
-     * If none of the mechanisms match and there is no "redirect" modifier,
-     * then the check_host() returns a result of "Neutral", just as if
-     * "?all" were specified as the last directive.  If there is a
-     * "redirect" modifier, check_host() proceeds as defined in Section 6.1.
-     */
+    case SIDF_STATE_MOD_EXP:
+        answer = SidfRequest_takeAnswer(self);
+        if (DNS_STAT_NOERROR != answer->stat) {
+            SidfLogDnsError(self->policy, "DNS lookup failure: rrtype=txt, domain=%s, err=%s",
+                            frame->target, NNSTR(answer->error));
+            SidfRequest_returnCheckHost(self, frame->score);
+            break;
+        }   // end if
+        if (1 != answer->num) {
+            SidfRequest_returnCheckHost(self, frame->score);
+            break;
+        }   // end if
+        // the answer is referred to only until the evaluation is suspended again
+        frame->exp_text = MemArena_strdup(self->arena, answer->rr.str[0]);
+        if (NULL == frame->exp_text) {
+            SidfLogNoResource(self->policy);
+            SidfRequest_returnCheckHost(self, frame->score);
+            break;
+        }   // end if
+        frame->exp_program = NULL;
+        frame->state = SIDF_STATE_EXPLANATION;
+        break;
 
-    // "redirect=" modifier evaluation
-    if (NULL != record->modifiers.rediect) {
-        SidfLogDebug(self->policy, "redirect: from=%s, to=%s", domain,
-                     record->modifiers.rediect->param.domain);
-        eval_score = SidfRequest_evalModRedirect(self, record->modifiers.rediect);
-        goto finally;
-    }   // end if
-
-    eval_score = SidfRequest_evalLocalPolicy(self);
-    if (SIDF_SCORE_NULL != eval_score) {
-        // exp= を評価する条件は directive によってスコアが決定する場合とほぼ同じ.
-        // 違いは local_policy_explanation を使用する点.
-        if (self->policy->lookup_exp && SIDF_SCORE_HARDFAIL == eval_score
-            && 0 == self->include_depth && NULL != self->policy->local_policy_explanation) {
-            // local policy 専用の explanation をセットする.
-            (void) SidfRequest_setExplanation(self, domain, self->policy->local_policy_explanation);
+    case SIDF_STATE_EXPLANATION:
+        if (!SidfRequest_setExplanation(self, frame)) {
+            SidfRequest_returnCheckHost(self, frame->score);
         }   // end if
-        goto finally;
-    }   // end if
+        break;
 
-    // returns "Neutral" as default socre
-    eval_score = SIDF_SCORE_NEUTRAL;
-    SidfLogDebug(self->policy, "default score applied: domain=%s", domain);
+    default:
+        abort();
+    }   // end switch
+}   // end function: SidfRequest_stepCheckHost
 
-  finally:
-    SidfRequest_popDomain(self);
-    SidfRecord_free(record);
-    return eval_score;
-}   // end function: SidfRequest_checkHost
+/*
+ * DNS クエリで中断するか, 全てのフレームから戻るまで評価を進める.
+ * @return true if the evaluation finished, false if suspended on a DNS query.
+ */
+static bool
+SidfRequest_run(SidfRequest *self, SidfScore *score)
+{
+    while (NULL != self->frame && !self->query_pending) {
+        switch (self->frame->type) {
+        case SIDF_FRAME_CHECK_HOST:
+            SidfRequest_stepCheckHost(self, self->frame);
+            break;
+        case SIDF_FRAME_VALIDATED_DOMAIN:
+            SidfRequest_stepValidatedDomain(self, self->frame);
+            break;
+        default:
+            abort();
+        }   // end switch
+    }   // end while
+    if (NULL != self->frame) {
+        return false;
+    }   // end if
+    self->eval_time = SidfRequest_getElapsedTime(self);
+    *score = self->result;
+    return true;
+}   // end function: SidfRequest_run
 
 /**
- * HELO は指定必須. sender が指定されていない場合, postmaster@(HELOとして指定したドメイン) を sender として使用する.
- * @return SIDF_SCORE_NULL: 引数がセットされていない.
- *         SIDF_SCORE_SYSERROR: メモリの確保に失敗した.
- *         それ以外の場合は評価結果.
+ * 評価を開始し, 最初の DNS クエリが必要になった時点で中断する.
+ * 中断した評価は SidfRequest_getQuery() で得られるクエリの応答を与えて SidfRequest_resume() で再開する.
+ * 評価の途中で SidfRequest_start() や SidfRequest_reset() を呼び出した場合, 中断中の評価は破棄される.
+ * @param score receives the result of the evaluation when it finished, see SidfRequest_eval().
+ * @return true if the evaluation finished, false if it is suspended on a DNS query.
  */
-SidfScore
-SidfRequest_eval(SidfRequest *self, SidfRecordScope scope)
+bool
+SidfRequest_start(SidfRequest *self, SidfRecordScope scope, SidfScore *score)
 {
     assert(NULL != self);
+    assert(NULL != score);
 
     self->scope = scope;
     self->dns_mech_count = 0;
+    self->void_lookup_count = 0;
+    self->dns_query_count = 0;
+    self->eval_time = 0;
+    self->budget_score = SIDF_SCORE_NULL;
+    self->redirect_depth = 0;
+    self->include_depth = 0;
+    self->local_policy_mode = false;
+    // discard the suspended evaluation, if any, before returning on any path below.
+    // nothing allocated from the arena survives the previous evaluation
+    PtrArray_reset(self->domain);
+    self->include_memo = NULL;
+    self->frame = NULL;
+    self->free_frame = NULL;
+    self->query_pending = false;
+    self->answer = NULL;
+    self->validated_domain = NULL;
+    self->result = SIDF_SCORE_NULL;
+    MemArena_reset(self->arena);
     if (0 == self->sa_family || NULL == self->helo_domain) {
-        return SIDF_SCORE_NULL;
+        *score = SIDF_SCORE_NULL;
+        return true;
     }   // end if
     if (NULL == self->sender) {
         /*
@@ -1208,17 +1968,260 @@ SidfRequest_eval(SidfRequest *self, SidfRecordScope scope)
         self->sender = InetMailbox_build(SIDF_REQUEST_DEFAULT_LOCALPART, self->helo_domain);
         if (NULL == self->sender) {
             SidfLogNoResource(self->policy);
-            return SIDF_SCORE_SYSERROR;
+            *score = SIDF_SCORE_SYSERROR;
+            return true;
         }   // end if
         self->is_sender_context = false;
     } else {
         self->is_sender_context = true;
     }   // end if
-    self->redirect_depth = 0;
-    self->include_depth = 0;
-    return SidfRequest_checkHost(self, InetMailbox_getDomain(self->sender));
+    (void) gettimeofday(&(self->eval_start), NULL);
+    SidfRequest_callCheckHost(self, InetMailbox_getDomain(self->sender));
+    return SidfRequest_run(self, score);
+}   // end function: SidfRequest_start
+
+/**
+ * @return the DNS query the evaluation is suspended on, NULL if not suspended.
+ *         The returned object is valid until the evaluation is resumed.
+ */
+const SidfQuery *
+SidfRequest_getQuery(const SidfRequest *self)
+{
+    assert(NULL != self);
+    return self->query_pending ? &(self->query) : NULL;
+}   // end function: SidfRequest_getQuery
+
+/**
+ * 中断中の評価を DNS クエリの応答で再開し, 次の DNS クエリが必要になるか評価を終えるまで進める.
+ * @param answer the answer to the query obtained with SidfRequest_getQuery().
+ *               it is not referred to after this function returns.
+ * @param score receives the result of the evaluation when it finished, see SidfRequest_eval().
+ * @return true if the evaluation finished, false if it is suspended on another DNS query.
+ */
+bool
+SidfRequest_resume(SidfRequest *self, const SidfAnswer *answer, SidfScore *score)
+{
+    assert(NULL != self);
+    assert(NULL != answer);
+    assert(NULL != score);
+    assert(self->query_pending);
+
+    self->query_pending = false;
+    self->answer = answer;
+    if (NULL != self->trace_handler) {
+        SidfRequest_traceQuery(self, answer);
+    }   // end if
+    bool finished = SidfRequest_run(self, score);
+    assert(NULL == self->answer);
+    self->answer = NULL;
+    return finished;
+}   // end function: SidfRequest_resume
+
+static bool
+SidfRequest_resolveAddr4(SidfRequest *self, SidfScore *score)
+{
+    SidfAnswer answer;
+    memset(&answer, 0, sizeof(SidfAnswer));
+    DnsAResponse *resp;
+    answer.stat = DnsResolver_lookupA(self->resolver, self->query.domain, &resp);
+    if (DNS_STAT_NOERROR != answer.stat) {
+        answer.error = DnsResolver_getErrorString(self->resolver);
+        return SidfRequest_resume(self, &answer, score);
+    }   // end if
+    answer.num = DnsAResponse_size(resp);
+    struct in_addr addr[MAX(answer.num, 1)];
+    for (size_t n = 0; n < answer.num; ++n) {
+        addr[n] = *DnsAResponse_addr(resp, n);
+    }   // end for
+    answer.rr.addr4 = addr;
+    bool finished = SidfRequest_resume(self, &answer, score);
+    DnsAResponse_free(resp);
+    return finished;
+}   // end function: SidfRequest_resolveAddr4
+
+static bool
+SidfRequest_resolveAddr6(SidfRequest *self, SidfScore *score)
+{
+    SidfAnswer answer;
+    memset(&answer, 0, sizeof(SidfAnswer));
+    DnsAaaaResponse *resp;
+    answer.stat = DnsResolver_lookupAaaa(self->resolver, self->query.domain, &resp);
+    if (DNS_STAT_NOERROR != answer.stat) {
+        answer.error = DnsResolver_getErrorString(self->resolver);
+        return SidfRequest_resume(self, &answer, score);
+    }   // end if
+    answer.num = DnsAaaaResponse_size(resp);
+    struct in6_addr addr[MAX(answer.num, 1)];
+    for (size_t n = 0; n < answer.num; ++n) {
+        addr[n] = *DnsAaaaResponse_addr(resp, n);
+    }   // end for
+    answer.rr.addr6 = addr;
+    bool finished = SidfRequest_resume(self, &answer, score);
+    DnsAaaaResponse_free(resp);
+    return finished;
+}   // end function: SidfRequest_resolveAddr6
+
+static bool
+SidfRequest_resolveTxt(SidfRequest *self, SidfScore *score)
+{
+    SidfAnswer answer;
+    memset(&answer, 0, sizeof(SidfAnswer));
+    DnsTxtResponse *resp;
+    answer.stat = (SIDF_QUERY_SPF == self->query.type)
+        ? DnsResolver_lookupSpf(self->resolver, self->query.domain, &resp)
+        : DnsResolver_lookupTxt(self->resolver, self->query.domain, &resp);
+    if (DNS_STAT_NOERROR != answer.stat) {
+        answer.error = DnsResolver_getErrorString(self->resolver);
+        return SidfRequest_resume(self, &answer, score);
+    }   // end if
+    answer.num = DnsTxtResponse_size(resp);
+    const char *data[MAX(answer.num, 1)];
+    for (size_t n = 0; n < answer.num; ++n) {
+        data[n] = DnsTxtResponse_data(resp, n);
+    }   // end for
+    answer.rr.str = data;
+    bool finished = SidfRequest_resume(self, &answer, score);
+    DnsTxtResponse_free(resp);
+    return finished;
+}   // end function: SidfRequest_resolveTxt
+
+static bool
+SidfRequest_resolveMx(SidfRequest *self, SidfScore *score)
+{
+    SidfAnswer answer;
+    memset(&answer, 0, sizeof(SidfAnswer));
+    DnsMxResponse *resp;
+    answer.stat = DnsResolver_lookupMx(self->resolver, self->query.domain, &resp);
+    if (DNS_STAT_NOERROR != answer.stat) {
+        answer.error = DnsResolver_getErrorString(self->resolver);
+        return SidfRequest_resume(self, &answer, score);
+    }   // end if
+    answer.num = DnsMxResponse_size(resp);
+    const char *domain[MAX(answer.num, 1)];
+    for (size_t n = 0; n < answer.num; ++n) {
+        domain[n] = DnsMxResponse_domain(resp, n);
+    }   // end for
+    answer.rr.str = domain;
+    bool finished = SidfRequest_resume(self, &answer, score);
+    DnsMxResponse_free(resp);
+    return finished;
+}   // end function: SidfRequest_resolveMx
+
+static bool
+SidfRequest_resolvePtr(SidfRequest *self, SidfScore *score)
+{
+    SidfAnswer answer;
+    memset(&answer, 0, sizeof(SidfAnswer));
+    DnsPtrResponse *resp;
+    answer.stat =
+        DnsResolver_lookupPtr(self->resolver, self->query.sa_family, self->query.addr, &resp);
+    if (DNS_STAT_NOERROR != answer.stat) {
+        answer.error = DnsResolver_getErrorString(self->resolver);
+        return SidfRequest_resume(self, &answer, score);
+    }   // end if
+    answer.num = DnsPtrResponse_size(resp);
+    const char *domain[MAX(answer.num, 1)];
+    for (size_t n = 0; n < answer.num; ++n) {
+        domain[n] = DnsPtrResponse_domain(resp, n);
+    }   // end for
+    answer.rr.str = domain;
+    bool finished = SidfRequest_resume(self, &answer, score);
+    DnsPtrResponse_free(resp);
+    return finished;
+}   // end function: SidfRequest_resolvePtr
+
+/*
+ * 中断中のクエリを DnsResolver で解決し, その応答で評価を再開する.
+ */
+static bool
+SidfRequest_resolveQuery(SidfRequest *self, SidfScore *score)
+{
+    switch (self->query.type) {
+    case SIDF_QUERY_A:
+        return SidfRequest_resolveAddr4(self, score);
+    case SIDF_QUERY_AAAA:
+        return SidfRequest_resolveAddr6(self, score);
+    case SIDF_QUERY_MX:
+        return SidfRequest_resolveMx(self, score);
+    case SIDF_QUERY_TXT:
+    case SIDF_QUERY_SPF:
+        return SidfRequest_resolveTxt(self, score);
+    case SIDF_QUERY_PTR:
+        return SidfRequest_resolvePtr(self, score);
+    default:
+        abort();
+    }   // end switch
+}   // end function: SidfRequest_resolveQuery
+
+/**
+ * HELO は指定必須. sender が指定されていない場合, postmaster@(HELOとして指定したドメイン) を sender として使用する.
+ * DNS クエリは SidfRequest_new() で指定した DnsResolver で同期的に解決する.
+ * @return SIDF_SCORE_NULL: 引数がセットされていない.
+ *         SIDF_SCORE_SYSERROR: メモリの確保に失敗した.
+ *         それ以外の場合は評価結果.
+ */
+SidfScore
+SidfRequest_eval(SidfRequest *self, SidfRecordScope scope)
+{
+    SidfScore score;
+    bool finished = SidfRequest_start(self, scope, &score);
+    while (!finished) {
+        finished = SidfRequest_resolveQuery(self, &score);
+    }   // end while
+    return score;
 }   // end function: SidfRequest_eval
 
+/**
+ * @return the number of mechanisms and modifiers which involve DNS lookups,
+ *         encountered during the last evaluation (RFC4408 10.1.).
+ */
+unsigned int
+SidfRequest_getDnsMechCount(const SidfRequest *self)
+{
+    return self->dns_mech_count;
+}   // end function: SidfRequest_getDnsMechCount
+
+/**
+ * @return the number of "void lookups" (RFC7208 4.6.4.) during the last evaluation.
+ */
+unsigned int
+SidfRequest_getVoidLookupCount(const SidfRequest *self)
+{
+    return self->void_lookup_count;
+}   // end function: SidfRequest_getVoidLookupCount
+
+/**
+ * @return the number of DNS queries issued during the last evaluation.
+ */
+unsigned int
+SidfRequest_getDnsQueryCount(const SidfRequest *self)
+{
+    return self->dns_query_count;
+}   // end function: SidfRequest_getDnsQueryCount
+
+/**
+ * @return wall-clock time the last evaluation took in milliseconds.
+ */
+unsigned int
+SidfRequest_getEvalTime(const SidfRequest *self)
+{
+    return self->eval_time;
+}   // end function: SidfRequest_getEvalTime
+
+/**
+ * set the handler called on each step of evaluation, to trace how the result is reached.
+ * evaluation costs nothing extra while no handler is set.
+ * @param handler trace handler, NULL to disable tracing.
+ * @param arg an arbitrary pointer passed to the handler.
+ */
+void
+SidfRequest_setTraceHandler(SidfRequest *self, SidfTraceHandler handler, void *arg)
+{
+    assert(NULL != self);
+    self->trace_handler = handler;
+    self->trace_arg = arg;
+}   // end function: SidfRequest_setTraceHandler
+
 /**
  * This function sets an IP address to the SidfRequest object via sockaddr structure.
  * The IP address is used as <ip> parameter of check_host function.
@@ -1322,6 +2325,18 @@ SidfRequest_setHeloDomain(SidfRequest *self, const char *domain)
     return true;
 }   // end function: SidfRequest_setHeloDomain
 
+/**
+ * SidfRequest_eval() が DNS クエリの解決に使用する DnsResolver を差し替える.
+ * SidfRequest を作成したスレッドとは別のスレッドで評価する場合に,
+ * そのスレッドが所有する DnsResolver を指定するために用いる.
+ */
+void
+SidfRequest_setResolver(SidfRequest *self, DnsResolver *resolver)
+{
+    assert(NULL != self);
+    self->resolver = resolver;
+}   // end function: SidfRequest_setResolver
+
 void
 SidfRequest_reset(SidfRequest *self)
 {
@@ -1333,11 +2348,28 @@ SidfRequest_reset(SidfRequest *self)
         StrArray_reset(self->domain);
     }   // end if
     self->dns_mech_count = 0;
+    self->void_lookup_count = 0;
+    self->dns_query_count = 0;
+    self->eval_time = 0;
+    self->budget_score = SIDF_SCORE_NULL;
     self->is_sender_context = false;
+    self->redirect_depth = 0;
+    self->include_depth = 0;
     self->local_policy_mode = false;
+    // discard the evaluation suspended if any
+    self->frame = NULL;
+    self->free_frame = NULL;
+    self->query_pending = false;
+    self->answer = NULL;
+    self->validated_domain = NULL;
+    self->result = SIDF_SCORE_NULL;
     if (NULL != self->xbuf) {
         XBuffer_reset(self->xbuf);
     }   // end if
+    self->include_memo = NULL;
+    if (NULL != self->arena) {
+        MemArena_reset(self->arena);
+    }   // end if
     if (NULL != self->sender) {
         InetMailbox_free(self->sender);
         self->sender = NULL;
@@ -1366,6 +2398,9 @@ SidfRequest_free(SidfRequest *self)
     if (NULL != self->xbuf) {
         XBuffer_free(self->xbuf);
     }   // end if
+    if (NULL != self->arena) {
+        MemArena_free(self->arena);
+    }   // end if
     if (NULL != self->sender) {
         InetMailbox_free(self->sender);
     }   // end if
@@ -1390,7 +2425,8 @@ SidfRequest_new(const SidfPolicy *policy, DnsResolver *resolver)
         return NULL;
     }   // end if
     memset(self, 0, sizeof(SidfRequest));
-    self->domain = StrArray_new(0);
+    // the elements are allocated from the arena, so no destructor is set
+    self->domain = PtrArray_new(0, NULL);
     if (NULL == self->domain) {
         goto cleanup;
     }   // end if
@@ -1398,6 +2434,10 @@ SidfRequest_new(const SidfPolicy *policy, DnsResolver *resolver)
     if (NULL == self->xbuf) {
         goto cleanup;
     }   // end if
+    self->arena = MemArena_new(0);
+    if (NULL == self->arena) {
+        goto cleanup;
+    }   // end if
     self->policy = policy;
     self->resolver = resolver;
     self->is_sender_context = false;
@@ -294,6 +294,26 @@ XBuffer_appendBytes(XBuffer *self, const void *b, size_t size)
     return 0;
 }   // end function: XBuffer_appendBytes
 
+/**
+ * 末尾に size バイトの未初期化領域を追加し, 呼び出し側が直接書き込めるようにする.
+ * 書き込んだ量が size に満たない場合は XBuffer_rollback() で切り詰める.
+ * @return 追加した領域の先頭へのポインタ, メモリの確保に失敗した場合は NULL.
+ *         次に XBuffer を変更するまで有効.
+ */
+void *
+XBuffer_appendSpace(XBuffer *self, size_t size)
+{
+    assert(NULL != self);
+
+    if (0 > XBuffer_reserve(self, self->size + size)) {
+        return NULL;
+    }   // end if
+
+    unsigned char *space = self->buf + self->size;
+    self->size += size;
+    return space;
+}   // end function: XBuffer_appendSpace
+
 int
 XBuffer_appendXBuffer(XBuffer *self, const XBuffer *xbuf)
 {